@@ -5,7 +5,7 @@ Release: %autorelease
 License: GPL-2.0-or-later
 URL: http://sourceforge.net/projects/evolvotron
 Source: https://github.com/WickedSmoke/evolvotron/archive/refs/tags/v%{version}.tar.gz
-BuildRequires: gcc-c++ boost-devel qt6-qtbase-devel
+BuildRequires: gcc-c++ boost-devel qt6-qtbase-devel zlib-devel
 
 %global debug_package %{nil}
 
@@ -24,9 +24,13 @@ mkdir -p $RPM_BUILD_ROOT/usr/bin $RPM_BUILD_ROOT/usr/share/man/man1
 install -m 755 evolvotron/evolvotron $RPM_BUILD_ROOT/usr/bin
 install -m 755 evolvotron_mutate/evolvotron_mutate $RPM_BUILD_ROOT/usr/bin
 install -m 755 evolvotron_render/evolvotron_render $RPM_BUILD_ROOT/usr/bin
+install -m 755 evolvotron_evolve/evolvotron_evolve $RPM_BUILD_ROOT/usr/bin
+install -m 755 evolvotron_serve/evolvotron_serve $RPM_BUILD_ROOT/usr/bin
 install -m 644 man/man1/evolvotron.1 $RPM_BUILD_ROOT/usr/share/man/man1
 install -m 644 man/man1/evolvotron_mutate.1 $RPM_BUILD_ROOT/usr/share/man/man1
 install -m 644 man/man1/evolvotron_render.1 $RPM_BUILD_ROOT/usr/share/man/man1
+install -m 644 man/man1/evolvotron_evolve.1 $RPM_BUILD_ROOT/usr/share/man/man1
+install -m 644 man/man1/evolvotron_serve.1 $RPM_BUILD_ROOT/usr/share/man/man1
 install -D -m 644 dist/icon-48.png $RPM_BUILD_ROOT/usr/share/icons/hicolor/48x48/apps/evolvotron.png
 install -D -m 644 dist/icon-128.png $RPM_BUILD_ROOT/usr/share/icons/hicolor/128x128/apps/evolvotron.png
 install -D -m 644 dist/evolvotron.desktop $RPM_BUILD_ROOT/usr/share/applications/evolvotron.desktop
@@ -39,9 +43,13 @@ rm -rf $RPM_BUILD_ROOT
 %{_bindir}/evolvotron
 %{_bindir}/evolvotron_mutate
 %{_bindir}/evolvotron_render
+%{_bindir}/evolvotron_evolve
+%{_bindir}/evolvotron_serve
 %{_mandir}/man1/evolvotron.1*
 %{_mandir}/man1/evolvotron_mutate.1*
 %{_mandir}/man1/evolvotron_render.1*
+%{_mandir}/man1/evolvotron_evolve.1*
+%{_mandir}/man1/evolvotron_serve.1*
 %{_datadir}/icons/hicolor/48x48/apps/evolvotron.png
 %{_datadir}/icons/hicolor/128x128/apps/evolvotron.png
 %{_datadir}/applications/evolvotron.desktop
@@ -34,6 +34,7 @@
 
 #include "evolvotron_main.h"
 #include "platform_specific.h"
+#include "trace.h"
 
 #include <boost/program_options.hpp>
 
@@ -88,9 +89,13 @@ int main(int argc,char* argv[])
   bool debug;
   bool enlargement_threadpool;
   std::string favourite;
+  std::string metrics_file;
+  uint metrics_interval;
   int niceness_enlargement;
   int niceness_grid;
+  bool profile;
   uint threads;
+  std::string trace;
   bool unwrapped;
   bool verbose;
 
@@ -100,12 +105,17 @@ int main(int argc,char* argv[])
     advanced_options_desc.add_options()
       ("debug,D"                 ,bool_switch(&debug)                    ,"Enable function debug mode")
       ("enlargement-threadpool,E",bool_switch(&enlargement_threadpool)   ,"Enlargements computed using a separate threadpool")
+      ("metrics-file"            ,value<std::string>(&metrics_file)      ,"Periodically write compute farm metrics (JSON) to this file")
+      ("metrics-interval"        ,value<uint>(&metrics_interval)->default_value(5)
+       ,"Seconds between writes of the metrics file")
       ("nice,n"                  ,value<int>(&niceness_grid)->default_value(4)
        ,"Niceness of compute threads for image grid")
       ("Nice,N"                  ,value<int>(&niceness_enlargement)->default_value(8)
        ,"Niceness of compute threads for enlargements (if separate pool)")
+      ("profile"                 ,bool_switch(&profile)                  ,"Count and time evaluations of each function type from the start, and write a table of them to stderr on exit")
       ("threads,t"               ,value<uint>(&threads)->default_value(get_number_of_processors())
        ,"Number of threads in a thread pool")
+      ("trace"                   ,value<std::string>(&trace)             ,"Record a timeline of compute farm and display activity, and write it to this file (Chrome trace JSON) on exit")
       ("unwrapped,u"             ,bool_switch(&unwrapped)                ,"Don't wrap favourite function")
       ("verbose,v"               ,bool_switch(&verbose)                  ,"Log some details to stderr")
       ("favourite,x"             ,value<std::string>(&favourite)         ,"Favourite function")
@@ -197,6 +207,9 @@ int main(int argc,char* argv[])
     std::clog << "\n";
   }
 
+  // Started before the compute threads are, so the timeline covers everything.
+  if (!trace.empty()) Trace::start();
+
   app.setOrganizationName("Evolvotron");
   app.setApplicationName("Evolvotron");
 
@@ -231,6 +244,12 @@ int main(int argc,char* argv[])
 
   main_widget->mutation_parameters().function_registry().status(std::clog);
 
+  FunctionProfile::enabled(profile);
+  main_widget->profile_on_close(profile);
+
+  if (!metrics_file.empty())
+    main_widget->metrics_file(metrics_file,std::max(1u,metrics_interval));
+
   if (!favourite.empty())
     {
       std::clog
@@ -257,8 +276,19 @@ int main(int argc,char* argv[])
   
   // NB No need to worry about deleting EvolvotronMain... QApplication seems to do it for us.
   std::clog << "Commencing main loop...\n";
-  return app.exec();
+  const int status=app.exec();
   std::clog << "...returned from main loop\n";
+
+  if (!trace.empty())
+    {
+      Trace::stop();
+      std::string error;
+      if (!Trace::write(trace,error))
+	{
+	  std::cerr << "evolvotron: Error: " << error << "\n";
+	  return 1;
+	}
+    }
   
-  return 0;
+  return status;
 }
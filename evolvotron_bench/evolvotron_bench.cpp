@@ -0,0 +1,1198 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+
+/*! \file
+  \brief Throughput and latency benchmark over a fixed corpus of functions, and of each function type on its own,
+  and a differential test of the optimised rendering paths against the reference.
+*/
+
+#include "function_node_info.h"
+#include "function_registry.h"
+#include "function_top.h"
+#include "mutatable_image.h"
+#include "mutatable_image_computer_farm.h"
+#include "mutatable_image_computer_task.h"
+#include "mutation_parameters.h"
+#include "platform_specific.h"
+#include "render_checkpoint.h"
+#include "tiled_renderer.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+
+#include <boost/program_options.hpp>
+
+//! A function benchmarked.
+struct BenchFunction
+{
+  //! Name reported.
+  std::string name;
+
+  //! Where it came from (a file, or the seed of a genesis function).
+  std::string source;
+
+  //! The function.
+  boost::shared_ptr<const MutatableImage> imagefn;
+};
+
+//! What's rendered, and how often.
+struct BenchOptions
+{
+  //! Image size.
+  QSize size;
+
+  //! Frames rendered.
+  uint frames;
+
+  //! Multisampling grid.
+  uint multisample;
+
+  //! Times each measurement is repeated (the fastest is reported).
+  uint repeat;
+
+  //! Samples in a render.
+  double samples() const
+    {
+      return static_cast<double>(size.width())*size.height()*frames*multisample*multisample;
+    }
+};
+
+//! Timings of one function.
+struct BenchResult
+{
+  //! Full render time with each number of threads.
+  std::vector<double> render_ms;
+
+  //! Time until the coarsest level of a display-style progressive render is complete.
+  double first_level_ms;
+
+  //! Time until the whole progressive render is complete.
+  double full_ms;
+};
+
+//! Discards tiles: only computing them is timed.
+class NullOutput : public TiledRenderer::Output
+{
+public:
+  //! Nothing to assemble.
+  virtual Assembly assembly() const
+    {
+      return AssembleNothing;
+    }
+
+  //! Discard the frame.
+  virtual bool frame(uint,const QImage&)
+    {
+      return true;
+    }
+};
+
+//! Fastest of repeated full renders, in milliseconds.
+static double time_render(TiledRenderer& renderer,const boost::shared_ptr<const MutatableImage>& imagefn,const BenchOptions& options)
+{
+  double best=0.0;
+  for (uint r=0;r<options.repeat;r++)
+    {
+      NullOutput output;
+      QElapsedTimer timer;
+      timer.start();
+      renderer.render(imagefn,options.size,options.frames,false,options.multisample,output);
+      const double ms=timer.nsecsElapsed()*1e-6;
+      if (r==0 || ms<best) best=ms;
+    }
+  return best;
+}
+
+//! Time a render scheduled the way an image display schedules it.
+/*! Levels from the coarsest at least 4x4 down to full resolution are queued at once, each split into fragments of rows,
+  with any multisampling as a final extra level; the farm computes them smallest first.
+  Reports (the fastest over repeats of) the time for the coarsest level to complete and for everything to.
+ */
+static void time_progressive(uint threads,const boost::shared_ptr<const MutatableImage>& imagefn,const BenchOptions& options,double& first_level_ms,double& full_ms)
+{
+  for (uint r=0;r<options.repeat;r++)
+    {
+      // A fresh farm each time, so nothing is left over from the last repeat.
+      MutatableImageComputerFarm farm(threads,0);
+
+      QElapsedTimer timer;
+      timer.start();
+
+      uint tasks=0;
+      int first_level=-1;
+      uint first_level_tasks=0;
+      for (int level=12;level>=0;level--)
+	{
+	  const QSize render_size(options.size/(1<<level));
+	  if (!((render_size.width()>=4 && render_size.height()>=4) || level==0)) continue;
+	  if (first_level<0) first_level=level;
+
+	  const uint fragments=std::min(2*farm.num_threads(),static_cast<uint>(render_size.height()));
+	  std::vector<uint> multisample_grid(1,1);
+	  if (level==0 && options.multisample>1) multisample_grid.push_back(options.multisample);
+	  for (uint m=0;m<multisample_grid.size();m++)
+	    {
+	      int fragment_start_row=0;
+	      for (uint f=0;f<fragments;f++)
+		{
+		  const int fragment_end_row=(render_size.height()*(f+1))/fragments;
+		  farm.push_todo
+		    (
+		     boost::shared_ptr<MutatableImageComputerTask>
+		     (
+		      new MutatableImageComputerTask
+		      (
+		       0,
+		       imagefn,
+		       render_size.width()*render_size.height()*multisample_grid[m]*multisample_grid[m],
+		       QSize(0,fragment_start_row),
+		       QSize(render_size.width(),fragment_end_row-fragment_start_row),
+		       render_size,
+		       0,
+		       options.frames,
+		       options.frames,
+		       level,
+		       f,
+		       fragments,
+		       false,
+		       multisample_grid[m],
+		       false,
+		       false,
+		       0
+		       )
+		      )
+		     );
+		  fragment_start_row=fragment_end_row;
+		  tasks++;
+		  if (level==first_level) first_level_tasks++;
+		}
+	    }
+	}
+
+      while (tasks)
+	{
+	  const boost::shared_ptr<const MutatableImageComputerTask> task(farm.wait_done());
+	  if (!task) continue;
+	  tasks--;
+	  if (static_cast<int>(task->level())==first_level && --first_level_tasks==0)
+	    {
+	      const double ms=timer.nsecsElapsed()*1e-6;
+	      if (r==0 || ms<first_level_ms) first_level_ms=ms;
+	    }
+	}
+      const double ms=timer.nsecsElapsed()*1e-6;
+      if (r==0 || ms<full_ms) full_ms=ms;
+    }
+}
+
+//! Load the functions in a file, or (in name order) the .xml files in a directory.  Returns false on failure.
+static bool load_corpus(const FunctionRegistry& function_registry,const std::string& path,std::vector<BenchFunction>& functions)
+{
+  const QDir dir(QString::fromLocal8Bit(path.c_str()));
+  if (dir.exists())
+    {
+      const QStringList entries(dir.entryList(QStringList() << "*.xml",QDir::Files,QDir::Name));
+      for (int i=0;i<entries.size();i++)
+	if (!load_corpus(function_registry,path+"/"+entries[i].toStdString(),functions)) return false;
+      return true;
+    }
+
+  std::ifstream file(path.c_str());
+  std::string report;
+  BenchFunction function;
+  function.imagefn=(file ? MutatableImage::load_function(function_registry,file,report) : boost::shared_ptr<const MutatableImage>());
+  if (!function.imagefn)
+    {
+      std::cerr << "evolvotron_bench: Error: Function " << path << " not loaded:\n" << report;
+      return false;
+    }
+  const std::string::size_type slash=path.find_last_of("/\\");
+  const std::string filename(slash==std::string::npos ? path : path.substr(slash+1));
+  function.name=filename.substr(0,filename.rfind(".xml"));
+  function.source=path;
+  functions.push_back(function);
+  return true;
+}
+
+//! Quote a string for JSON.
+static const std::string json_string(const std::string& s)
+{
+  std::ostringstream out;
+  out << '"';
+  for (std::string::const_iterator it=s.begin();it!=s.end();it++)
+    {
+      if (*it=='"' || *it=='\\') out << '\\' << *it;
+      else if (static_cast<unsigned char>(*it)<0x20) out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(*it) << std::dec;
+      else out << *it;
+    }
+  out << '"';
+  return out.str();
+}
+
+//! Write the results as JSON.
+static void write_json
+(
+ std::ostream& out,
+ const std::string& label,
+ const BenchOptions& options,
+ const std::vector<uint>& thread_counts,
+ const std::vector<BenchFunction>& functions,
+ const std::vector<BenchResult>& results
+ )
+{
+  out << std::fixed << std::setprecision(3);
+  out << "{\n";
+  out << "  \"label\": " << json_string(label) << ",\n";
+  out << "  \"version\": " << json_string(APP_VERSION) << ",\n";
+  out << "  \"processors\": " << get_number_of_processors() << ",\n";
+  out << "  \"size\": [" << options.size.width() << ", " << options.size.height() << "],\n";
+  out << "  \"frames\": " << options.frames << ",\n";
+  out << "  \"multisample\": " << options.multisample << ",\n";
+  out << "  \"repeat\": " << options.repeat << ",\n";
+  out << "  \"threads\": [";
+  for (uint t=0;t<thread_counts.size();t++)
+    out << (t ? ", " : "") << thread_counts[t];
+  out << "],\n";
+
+  out << "  \"functions\": [\n";
+  for (uint i=0;i<functions.size();i++)
+    {
+      uint nodes;
+      uint parameters;
+      uint depth;
+      uint width;
+      real proportion_constant;
+      functions[i].imagefn->get_stats(nodes,parameters,depth,width,proportion_constant);
+
+      const BenchResult& result=results[i];
+      out << "    {\n";
+      out << "      \"name\": " << json_string(functions[i].name) << ",\n";
+      out << "      \"source\": " << json_string(functions[i].source) << ",\n";
+      out << "      \"nodes\": " << nodes << ",\n";
+      out << "      \"depth\": " << depth << ",\n";
+      out << "      \"renders\": [\n";
+      for (uint t=0;t<thread_counts.size();t++)
+	{
+	  out
+	    << "        {\"threads\": " << thread_counts[t]
+	    << ", \"ms\": " << result.render_ms[t]
+	    << ", \"msamples_per_s\": " << options.samples()/(1e3*result.render_ms[t])
+	    << ", \"speedup\": " << result.render_ms[0]/result.render_ms[t]
+	    << "}" << (t+1<thread_counts.size() ? "," : "") << "\n";
+	}
+      out << "      ],\n";
+      out << "      \"latency\": {\"threads\": " << thread_counts.back() << ", \"first_level_ms\": " << result.first_level_ms << ", \"full_ms\": " << result.full_ms << "}\n";
+      out << "    }" << (i+1<functions.size() ? "," : "") << "\n";
+    }
+  out << "  ],\n";
+
+  out << "  \"totals\": [\n";
+  for (uint t=0;t<thread_counts.size();t++)
+    {
+      double ms=0.0;
+      double ms_one=0.0;
+      for (uint i=0;i<results.size();i++)
+	{
+	  ms+=results[i].render_ms[t];
+	  ms_one+=results[i].render_ms[0];
+	}
+      out
+	<< "    {\"threads\": " << thread_counts[t]
+	<< ", \"ms\": " << ms
+	<< ", \"msamples_per_s\": " << (ms>0.0 ? results.size()*options.samples()/(1e3*ms) : 0.0)
+	<< ", \"speedup\": " << (ms>0.0 ? ms_one/ms : 0.0)
+	<< "}" << (t+1<thread_counts.size() ? "," : "") << "\n";
+    }
+  out << "  ]\n";
+  out << "}\n";
+}
+
+//! Cost of one function type.
+struct NodeCost
+{
+  //! The function type.
+  const FunctionRegistration* registration;
+
+  //! Evaluation time per sample, in nanoseconds.
+  double ns;
+};
+
+//! Build a function of the given type with fixed parameters, fixed iterations and FunctionIdentity leaves for its arguments.
+static std::unique_ptr<FunctionNode> node_with_leaves(const FunctionRegistry& function_registry,const FunctionRegistration& registration,uint iterations,std::string& report)
+{
+  FunctionNodeInfo info;
+  info.type(registration.name);
+  // Fixed values of either sign and modest size, much like stubparams makes.
+  for (uint i=0;i<registration.params;i++)
+    info.params().push_back((i%2 ? -1.0 : 1.0)*(0.25+0.125*(i%5)));
+  for (uint i=0;i<registration.args;i++)
+    {
+      std::unique_ptr<FunctionNodeInfo> leaf(new FunctionNodeInfo());
+      leaf->type("FunctionIdentity");
+      info.args().push_back(leaf.release());
+    }
+  if (registration.iterative) info.iterations(iterations);
+  return FunctionNode::create(function_registry,info,report);
+}
+
+//! Fastest of repeated evaluations of a function at every pixel of an image (at z=0), in nanoseconds per sample.
+static double time_node(const FunctionNode& fn,const QSize& size,uint repeat)
+{
+  double best=0.0;
+  XYZ total(0.0,0.0,0.0);
+  for (uint r=0;r<repeat;r++)
+    {
+      QElapsedTimer timer;
+      timer.start();
+      for (int row=0;row<size.height();row++)
+	{
+	  const real y=1.0-(2.0*(row+0.5))/size.height();
+	  for (int col=0;col<size.width();col++)
+	    total+=fn(XYZ(-1.0+(2.0*(col+0.5))/size.width(),y,0.0));
+	}
+      const double ns=static_cast<double>(timer.nsecsElapsed())/(static_cast<double>(size.width())*size.height());
+      if (r==0 || ns<best) best=ns;
+    }
+  // Keep the evaluations from being optimised away.
+  if (total.x()!=total.x()) std::clog << "(NaN)\n";
+  return best;
+}
+
+//! Names of the classification bits set.
+static const std::string classification_names(uint classification)
+{
+  std::string names;
+  for (uint c=0;c<FnClassifications;c++)
+    if (classification&(1<<c))
+      names+=std::string(names.empty() ? "" : ",")+function_classification_name[c];
+  return names;
+}
+
+//! Write the per-type costs as JSON.
+static void write_node_costs_json
+(
+ std::ostream& out,
+ const std::string& label,
+ const QSize& size,
+ uint iterations,
+ uint repeat,
+ double leaf_ns,
+ const std::vector<NodeCost>& costs
+ )
+{
+  out << std::fixed << std::setprecision(3);
+  out << "{\n";
+  out << "  \"label\": " << json_string(label) << ",\n";
+  out << "  \"version\": " << json_string(APP_VERSION) << ",\n";
+  out << "  \"samples\": [" << size.width() << ", " << size.height() << "],\n";
+  out << "  \"iterations\": " << iterations << ",\n";
+  out << "  \"repeat\": " << repeat << ",\n";
+  out << "  \"path\": \"scalar\",\n";
+  out << "  \"leaf\": {\"name\": \"FunctionIdentity\", \"ns_per_sample\": " << leaf_ns << "},\n";
+  out << "  \"nodes\": [\n";
+  for (uint i=0;i<costs.size();i++)
+    {
+      const FunctionRegistration& reg=*costs[i].registration;
+      out
+	<< "    {\"name\": " << json_string(reg.name)
+	<< ", \"classification\": " << json_string(classification_names(reg.classification))
+	<< ", \"params\": " << reg.params
+	<< ", \"args\": " << reg.args
+	<< ", \"iterative\": " << (reg.iterative ? "true" : "false")
+	<< ", \"ns_per_sample\": " << costs[i].ns
+	<< "}" << (i+1<costs.size() ? "," : "") << "\n";
+    }
+  out << "  ]\n";
+  out << "}\n";
+}
+
+//! Order costs most expensive first.
+static bool costlier(const NodeCost& a,const NodeCost& b)
+{
+  return a.ns>b.ns;
+}
+
+//! Benchmark every registered function type (or those whose names contain filter) in isolation.
+/*! Each is built with FunctionIdentity leaves as its arguments, fixed parameters and (if iterative) a fixed iteration count,
+  and evaluated on this thread by the scalar path, which is the only one functions have.
+  Returns the exit status.
+ */
+static int bench_node_costs(const std::string& filter,const std::string& label,const QSize& size,uint iterations,uint repeat,const std::string& output_filename)
+{
+  FunctionRegistry function_registry;
+
+  std::string report;
+  const FunctionRegistration*const leaf_registration=function_registry.lookup("FunctionIdentity");
+  const std::unique_ptr<FunctionNode> leaf(leaf_registration ? node_with_leaves(function_registry,*leaf_registration,iterations,report) : std::unique_ptr<FunctionNode>());
+  if (!leaf.get())
+    {
+      std::cerr << "evolvotron_bench: Error: Couldn't create FunctionIdentity:\n" << report;
+      return 1;
+    }
+  const double leaf_ns=time_node(*leaf,size,repeat);
+  std::clog << "FunctionIdentity (leaf): " << leaf_ns << "ns\n";
+
+  std::vector<NodeCost> costs;
+  for (FunctionRegistry::const_iterator it=function_registry.begin();it!=function_registry.end();it++)
+    {
+      if (it->first.find(filter)==std::string::npos) continue;
+      const std::unique_ptr<FunctionNode> fn(node_with_leaves(function_registry,*it->second,iterations,report));
+      if (!fn.get())
+	{
+	  std::cerr << "evolvotron_bench: Error: Couldn't create " << it->first << ":\n" << report;
+	  return 1;
+	}
+      NodeCost cost;
+      cost.registration=it->second;
+      cost.ns=time_node(*fn,size,repeat);
+      costs.push_back(cost);
+      std::clog << it->first << ": " << cost.ns << "ns\n";
+    }
+  if (costs.empty())
+    {
+      std::cerr << "evolvotron_bench: Error: No function names contain \"" << filter << "\"\n";
+      return 1;
+    }
+
+  if (output_filename=="-")
+    {
+      write_node_costs_json(std::cout,label,size,iterations,repeat,leaf_ns,costs);
+    }
+  else
+    {
+      std::ofstream file(output_filename.c_str());
+      write_node_costs_json(file,label,size,iterations,repeat,leaf_ns,costs);
+      file.flush();
+      if (!file)
+	{
+	  std::cerr << "evolvotron_bench: Error: Couldn't write " << output_filename << "\n";
+	  return 1;
+	}
+
+      std::vector<NodeCost> sorted(costs);
+      std::stable_sort(sorted.begin(),sorted.end(),costlier);
+      std::cout << std::left << std::setw(40) << "function" << std::setw(28) << "classification" << std::right << std::setw(12) << "ns/sample" << "\n";
+      std::cout << std::fixed << std::setprecision(1);
+      for (uint i=0;i<sorted.size();i++)
+	std::cout
+	  << std::left << std::setw(40) << sorted[i].registration->name
+	  << std::setw(28) << classification_names(sorted[i].registration->classification)
+	  << std::right << std::setw(12) << sorted[i].ns << "\n";
+      std::cout << "(FunctionIdentity leaves at " << leaf_ns << "ns/sample each included)\n";
+    }
+  return 0;
+}
+
+//! A way of rendering images which must give the same results as a plain tree walk.
+struct DiffPath
+{
+  //! Name reported.
+  std::string name;
+
+  //! Precision functions are evaluated in (which determines the tolerance).
+  std::string precision;
+};
+
+//! Largest difference (in 8-bit levels, per channel) allowed between a path evaluating at the given precision and the reference.
+/*! Paths evaluating in the reference's own precision must match it exactly;
+  reduced-precision ones may be out by a couple of levels.
+ */
+static uint tolerance(const std::string& precision)
+{
+  return (precision=="double" ? 0 : 2);
+}
+
+//! Collects whole frames.
+class FramesOutput : public TiledRenderer::Output
+{
+public:
+  //! The frames rendered.
+  std::vector<QImage> frames;
+
+  //! Keep the frame.
+  virtual bool frame(uint,const QImage& image)
+    {
+      frames.push_back(image);
+      return true;
+    }
+};
+
+//! Abandons a render as soon as a tile completes, as a failing batch job does.
+class AbandonOutput : public TiledRenderer::Output
+{
+public:
+  //! Nothing needs assembling.
+  virtual Assembly assembly() const
+    {
+      return AssembleNothing;
+    }
+
+  //! Abandon the render.
+  virtual bool tile(uint,uint,const QImage&,const QPoint&)
+    {
+      return false;
+    }
+
+  //! Never reached.
+  virtual bool frame(uint,const QImage&)
+    {
+      return true;
+    }
+};
+
+//! Writes tiles straight into frames (as outputs writing files do), abandoning the render once it has written as many as it's allowed.
+class StagedOutput : public TiledRenderer::Output
+{
+public:
+  //! Constructor.
+  StagedOutput(const QSize& size,uint frames,uint tiles)
+    :written(frames,std::vector<bool>(tiles,false))
+    ,_allowance(0)
+    {
+      for (uint f=0;f<frames;f++)
+	{
+	  images.push_back(QImage(size,QImage::Format_RGB32));
+	  images.back().fill(0);
+	}
+    }
+
+  //! The frames written so far.
+  std::vector<QImage> images;
+
+  //! Which tiles of each frame have been written.
+  std::vector<std::vector<bool> > written;
+
+  //! Set how many more tiles may be written.
+  void allow(uint n)
+    {
+      _allowance=n;
+    }
+
+  //! Tiles are written as they come.
+  virtual Assembly assembly() const
+    {
+      return AssembleNothing;
+    }
+
+  //! Write the tile, or abandon the render if no more are allowed.
+  virtual bool tile(uint frame,uint n,const QImage& tile,const QPoint& origin)
+    {
+      if (_allowance==0) return false;
+      _allowance--;
+      for (int row=0;row<tile.height();row++)
+	memcpy(images[frame].scanLine(origin.y()+row)+4*origin.x(),tile.constScanLine(row),4*tile.width());
+      written[frame][n]=true;
+      return true;
+    }
+
+  //! Nothing more to do.
+  virtual bool frame(uint,const QImage&)
+    {
+      return true;
+    }
+
+private:
+  //! Tiles which may still be written.
+  uint _allowance;
+};
+
+//! Render a function in stages, each interrupted part way and resumed from a checkpoint, as evolvotron_render --checkpoint does.
+/*! After each interruption the checkpoint file is left with a cut-short last line naming a tile which wasn't written
+  (as a record of another tile cut short can), which resuming mustn't take as done.
+ */
+static const std::vector<QImage> render_resumed(TiledRenderer& renderer,const boost::shared_ptr<const MutatableImage>& fn,const QSize& size,uint frames,uint multisample)
+{
+  std::ostringstream name;
+  name << QDir::tempPath().toLocal8Bit().constData() << "/evolvotron_bench_" << QCoreApplication::applicationPid() << ".checkpoint";
+  const std::string filename(name.str());
+  remove(filename.c_str());
+  const uint tiles=renderer.tiles(size);
+  StagedOutput output(size,frames,tiles);
+  for (uint stage=0;;stage++)
+    {
+      if (stage>0)
+	{
+	  for (uint t=0;t<frames*tiles;t++)
+	    if (!output.written[t/tiles][t%tiles])
+	      {
+		std::ofstream(filename.c_str(),std::ios::app) << "tile " << t/tiles << " " << t%tiles;
+		break;
+	      }
+	}
+
+      output.allow(stage<3 ? std::max(1u,frames*tiles/4) : UINT_MAX);
+      RenderCheckpoint checkpoint(output,filename,"evolvotron_bench",0);
+      std::string report;
+      if (!checkpoint.resume(report) || !checkpoint.begin(report))
+	{
+	  std::cerr << "evolvotron_bench: Error: " << report;
+	  break;
+	}
+      if (renderer.render(fn,size,frames,false,multisample,checkpoint))
+	{
+	  checkpoint.finish();
+	  break;
+	}
+    }
+  return output.images;
+}
+
+//! Render a member of a family with a renderer.
+/*! On the "abandoned" path, a render of the previous member is started and abandoned first,
+  so any of its tiles still being computed would turn up in this render.
+  On the "resumed" path, the render is interrupted and resumed a few times.
+ */
+static void render_member(const DiffPath& path,TiledRenderer& renderer,const std::vector<boost::shared_ptr<const MutatableImage> >& family,uint i,const QSize& size,uint frames,uint multisample,FramesOutput& output)
+{
+  if (path.name=="resumed")
+    {
+      output.frames=render_resumed(renderer,family[i],size,frames,multisample);
+      return;
+    }
+  if (path.name=="abandoned" && i>0)
+    {
+      AbandonOutput abandon;
+      renderer.render(family[i-1],size,frames,false,multisample,abandon);
+    }
+  renderer.render(family[i],size,frames,false,multisample,output);
+}
+
+//! Render each frame of a function by evaluating the tree at each pixel in turn on this thread.
+static const std::vector<QImage> render_reference(const MutatableImage& imagefn,const QSize& size,uint frames,uint multisample)
+{
+  std::vector<QImage> images;
+  for (uint f=0;f<frames;f++)
+    {
+      QImage image(size,QImage::Format_RGB32);
+      for (int row=0;row<size.height();row++)
+	for (int col=0;col<size.width();col++)
+	  {
+	    const XYZ colour(imagefn.get_rgb_from_precolour(imagefn.get_precolour(col,row,f,size.width(),size.height(),frames,0,multisample)));
+	    const uint col0=lrint(colour.x());
+	    const uint col1=lrint(colour.y());
+	    const uint col2=lrint(colour.z());
+	    image.setPixel(col,row,((col0<<16)|(col1<<8)|(col2)));
+	  }
+      images.push_back(image);
+    }
+  return images;
+}
+
+//! Render a family of functions in turn on a fresh renderer, returning the frames of the last.
+static const std::vector<QImage> render_path(const DiffPath& path,uint threads,const std::vector<boost::shared_ptr<const MutatableImage> >& family,const QSize& size,uint frames,uint multisample)
+{
+  TiledRenderer renderer(threads);
+  FramesOutput output;
+  for (uint i=0;i<family.size();i++)
+    {
+      output.frames.clear();
+      render_member(path,renderer,family,i,size,frames,multisample,output);
+    }
+  return output.frames;
+}
+
+//! Largest difference in any channel of any pixel of any frame.
+static uint max_deviation(const std::vector<QImage>& a,const std::vector<QImage>& b)
+{
+  if (a.size()!=b.size()) return 255;
+  uint deviation=0;
+  for (uint f=0;f<a.size();f++)
+    {
+      if (a[f].size()!=b[f].size()) return 255;
+      for (int row=0;row<a[f].height();row++)
+	for (int col=0;col<a[f].width();col++)
+	  {
+	    const QRgb pa=a[f].pixel(col,row);
+	    const QRgb pb=b[f].pixel(col,row);
+	    deviation=std::max(deviation,static_cast<uint>(abs(qRed(pa)-qRed(pb))));
+	    deviation=std::max(deviation,static_cast<uint>(abs(qGreen(pa)-qGreen(pb))));
+	    deviation=std::max(deviation,static_cast<uint>(abs(qBlue(pa)-qBlue(pb))));
+	  }
+    }
+  return deviation;
+}
+
+//! Deviation of a path from the reference for the last of a family of functions.
+static uint path_deviation(const DiffPath& path,uint threads,const std::vector<boost::shared_ptr<const MutatableImage> >& family,const QSize& size,uint frames,uint multisample)
+{
+  return max_deviation(render_reference(*family.back(),size,frames,multisample),render_path(path,threads,family,size,frames,multisample));
+}
+
+//! Positions (as argument indices from the root) of every node below the root, parents before children.
+static void node_positions(const FunctionNode& node,std::vector<uint>& position,std::vector<std::vector<uint> >& positions)
+{
+  for (uint i=0;i<node.args().size();i++)
+    {
+      position.push_back(i);
+      positions.push_back(position);
+      node_positions(node.arg(i),position,positions);
+      position.pop_back();
+    }
+}
+
+//! Copy of a tree with the node at a position replaced (sharing everything not on the way to it).
+static std::unique_ptr<FunctionNode> replaced(const FunctionNode& node,const std::vector<uint>& position,uint depth,const boost::shared_ptr<FunctionNode>& replacement)
+{
+  std::unique_ptr<FunctionNode> copy(node.deepclone());
+  FunctionNode::Args args(static_cast<const FunctionNode&>(*copy).args());
+  const uint i=position[depth];
+  if (depth+1==position.size())
+    args[i]=replacement;
+  else
+    args[i]=boost::shared_ptr<FunctionNode>(replaced(*args[i],position,depth+1,replacement).release());
+  copy->args(args);
+  return copy;
+}
+
+//! Number of nodes in a function.
+static uint count_nodes(const MutatableImage& imagefn)
+{
+  uint nodes;
+  uint parameters;
+  uint depth;
+  uint width;
+  real proportion_constant;
+  imagefn.get_stats(nodes,parameters,depth,width,proportion_constant);
+  return nodes;
+}
+
+//! Shrink the last function of a family while it still fails on a path.
+/*! Repeatedly replaces a node by one of its arguments or an identity function,
+  keeping any smaller function which still deviates from the reference by more than the path's tolerance,
+  until no replacement does.
+ */
+static const boost::shared_ptr<const MutatableImage> minimise
+(
+ const FunctionRegistry& function_registry,
+ const DiffPath& path,
+ uint threads,
+ std::vector<boost::shared_ptr<const MutatableImage> > family,
+ const QSize& size,
+ uint frames,
+ uint multisample
+ )
+{
+  FunctionNodeInfo identity_info;
+  identity_info.type("FunctionIdentity");
+  std::string report;
+  const boost::shared_ptr<FunctionNode> identity(FunctionNode::create(function_registry,identity_info,report).release());
+
+  bool shrunk=true;
+  while (shrunk)
+    {
+      shrunk=false;
+      const boost::shared_ptr<const MutatableImage> current(family.back());
+      const uint current_nodes=count_nodes(*current);
+      const std::unique_ptr<FunctionTop> top(current->clone_top());
+
+      std::vector<uint> position;
+      std::vector<std::vector<uint> > positions;
+      node_positions(*top,position,positions);
+      for (uint p=0;p<positions.size() && !shrunk;p++)
+	{
+	  // The node at the position, and what might replace it.
+	  const FunctionNode* node=top.get();
+	  for (uint d=0;d<positions[p].size();d++) node=&node->arg(positions[p][d]);
+	  FunctionNode::Args candidates(node->args());
+	  if (identity) candidates.push_back(identity);
+
+	  for (uint c=0;c<candidates.size() && !shrunk;c++)
+	    {
+	      std::unique_ptr<FunctionNode> root(replaced(*top,positions[p],0,candidates[c]));
+	      std::unique_ptr<FunctionTop> candidate_top(root->is_a_FunctionTop());
+	      root.release();
+	      family.back()=boost::shared_ptr<const MutatableImage>(new MutatableImage(candidate_top,current->sinusoidal_z(),current->spheremap(),false));
+	      if (count_nodes(*family.back())<current_nodes && path_deviation(path,threads,family,size,frames,multisample)>tolerance(path.precision))
+		shrunk=true;
+	      else
+		family.back()=current;
+	    }
+	}
+    }
+  return family.back();
+}
+
+//! A function for which a path deviated from the reference.
+struct DiffFailure
+{
+  //! Seed of the family.
+  uint seed;
+
+  //! Position in the family (0 for the genesis function, then successive mutants).
+  uint member;
+
+  //! The path.
+  std::string path;
+
+  //! Largest deviation of the original function.
+  uint deviation;
+
+  //! Nodes in the original function.
+  uint nodes;
+
+  //! The minimised function.
+  boost::shared_ptr<const MutatableImage> minimised;
+};
+
+//! Render random functions by the reference tree walk and each optimised path, and compare the results.
+/*! Functions come in families: a genesis function from each seed, followed by successive mutants of it,
+  as they would be rendered one after another in the GUI.
+  Writes the results as JSON, and returns the exit status (1 if any path deviated by more than its tolerance).
+ */
+static int bench_differential
+(
+ uint trees,
+ uint family_size,
+ uint threads,
+ const std::string& label,
+ const QSize& size,
+ uint frames,
+ uint multisample,
+ const std::string& output_filename
+ )
+{
+  FunctionRegistry function_registry;
+
+  std::vector<DiffPath> paths;
+  {
+    DiffPath path;
+    path.name="tiled";
+    path.precision="double";
+    paths.push_back(path);
+    path.name="abandoned";
+    paths.push_back(path);
+    path.name="resumed";
+    paths.push_back(path);
+  }
+
+  std::vector<uint> failures(paths.size(),0);
+  std::vector<uint> worst(paths.size(),0);
+  std::vector<DiffFailure> failed;
+  uint rendered=0;
+
+  for (uint seed=1;rendered<trees;seed++)
+    {
+      // Sinusoidal z and spheremapping vary with the seed too.
+      MutationParameters mutation_parameters(seed,false,false);
+      std::unique_ptr<FunctionTop> fn_top(FunctionTop::initial(mutation_parameters));
+      std::vector<boost::shared_ptr<const MutatableImage> > family;
+      family.push_back(boost::shared_ptr<const MutatableImage>(new MutatableImage(fn_top,(seed&1)!=0,(seed&2)!=0,false)));
+      while (family.size()<family_size && rendered+family.size()<trees)
+	family.push_back(family.back()->mutated(mutation_parameters));
+      rendered+=family.size();
+
+      std::vector<std::vector<QImage> > reference;
+      for (uint i=0;i<family.size();i++)
+	reference.push_back(render_reference(*family[i],size,frames,multisample));
+
+      for (uint p=0;p<paths.size();p++)
+	{
+	  TiledRenderer renderer(threads);
+	  for (uint i=0;i<family.size();i++)
+	    {
+	      FramesOutput output;
+	      render_member(paths[p],renderer,family,i,size,frames,multisample,output);
+	      const uint deviation=max_deviation(reference[i],output.frames);
+	      worst[p]=std::max(worst[p],deviation);
+	      if (deviation<=tolerance(paths[p].precision)) continue;
+
+	      failures[p]++;
+	      std::cerr << "evolvotron_bench: Seed " << seed << " function " << i << " deviates by " << deviation << " on the " << paths[p].name << " path; minimising\n";
+	      DiffFailure failure;
+	      failure.seed=seed;
+	      failure.member=i;
+	      failure.path=paths[p].name;
+	      failure.deviation=deviation;
+	      failure.nodes=count_nodes(*family[i]);
+	      failure.minimised=minimise(function_registry,paths[p],threads,std::vector<boost::shared_ptr<const MutatableImage> >(family.begin(),family.begin()+i+1),size,frames,multisample);
+	      failed.push_back(failure);
+	    }
+	}
+      std::clog << rendered << " functions compared\n";
+    }
+
+  std::ofstream file;
+  if (output_filename!="-") file.open(output_filename.c_str());
+  std::ostream& out=(output_filename=="-" ? std::cout : file);
+  out << "{\n";
+  out << "  \"label\": " << json_string(label) << ",\n";
+  out << "  \"version\": " << json_string(APP_VERSION) << ",\n";
+  out << "  \"functions\": " << rendered << ",\n";
+  out << "  \"family\": " << family_size << ",\n";
+  out << "  \"size\": [" << size.width() << ", " << size.height() << "],\n";
+  out << "  \"frames\": " << frames << ",\n";
+  out << "  \"multisample\": " << multisample << ",\n";
+  out << "  \"paths\": [\n";
+  for (uint p=0;p<paths.size();p++)
+    out
+      << "    {\"name\": " << json_string(paths[p].name)
+      << ", \"precision\": " << json_string(paths[p].precision)
+      << ", \"tolerance\": " << tolerance(paths[p].precision)
+      << ", \"max_deviation\": " << worst[p]
+      << ", \"failures\": " << failures[p]
+      << "}" << (p+1<paths.size() ? "," : "") << "\n";
+  out << "  ],\n";
+  out << "  \"failures\": [\n";
+  for (uint i=0;i<failed.size();i++)
+    {
+      std::ostringstream function;
+      failed[i].minimised->save_function(function);
+      out
+	<< "    {\"seed\": " << failed[i].seed
+	<< ", \"function\": " << failed[i].member
+	<< ", \"path\": " << json_string(failed[i].path)
+	<< ", \"deviation\": " << failed[i].deviation
+	<< ", \"nodes\": " << failed[i].nodes
+	<< ", \"minimised_nodes\": " << count_nodes(*failed[i].minimised)
+	<< ", \"minimised\": " << json_string(function.str())
+	<< "}" << (i+1<failed.size() ? "," : "") << "\n";
+    }
+  out << "  ]\n";
+  out << "}\n";
+  out.flush();
+  if (!out)
+    {
+      std::cerr << "evolvotron_bench: Error: Couldn't write " << output_filename << "\n";
+      return 1;
+    }
+
+  if (output_filename!="-")
+    {
+      std::cout << std::left << std::setw(16) << "path" << std::setw(12) << "precision" << std::right << std::setw(12) << "tolerance" << std::setw(16) << "max deviation" << std::setw(12) << "failures" << "\n";
+      for (uint p=0;p<paths.size();p++)
+	std::cout
+	  << std::left << std::setw(16) << paths[p].name << std::setw(12) << paths[p].precision
+	  << std::right << std::setw(12) << tolerance(paths[p].precision) << std::setw(16) << worst[p] << std::setw(12) << failures[p] << "\n";
+      std::cout << "(" << rendered << " functions)\n";
+    }
+
+  return (failed.empty() ? 0 : 1);
+}
+
+//! Application code
+int main(int argc,char* argv[])
+{
+  // Only for finding the corpus alongside the executable.
+  QCoreApplication app(argc,argv);
+
+  {
+    std::vector<std::string> corpus;
+    uint differential;
+    uint family;
+    uint frames;
+    uint genesis;
+    bool help;
+    uint iterations;
+    std::string label;
+    int multisample;
+    std::string node_costs;
+    std::string output_filename;
+    bool quick;
+    uint repeat;
+    std::string size;
+    uint threads;
+    bool verbose;
+
+    boost::program_options::options_description options_desc("Options");
+    boost::program_options::positional_options_description pos_options_desc;
+    {
+      using namespace boost::program_options;
+      options_desc.add_options()
+	("corpus"       ,value<std::vector<std::string> >(&corpus) ,"Function files or directories of them (default: the corpus directory alongside the executable).  (Or use positional arguments.)")
+	("differential,d",value<uint>(&differential)->implicit_value(1000),"Rather than timing anything, check this many random functions render the same by each optimised path as by the reference tree walk (default size 64x64)")
+	("family"       ,value<uint>(&family)->default_value(4)    ,"Functions in each family (a genesis function and its successive mutants) with --differential")
+	("frames,f"     ,value<uint>(&frames)->default_value(1)    ,"Frames rendered")
+	("genesis,g"    ,value<uint>(&genesis)->default_value(8)   ,"Also benchmark this many genesis functions, from seeds 1 to n")
+	("help,h"       ,bool_switch(&help)                        ,"Print command-line options help message and exit")
+	("iterations,i" ,value<uint>(&iterations)->default_value(16),"Iterations of iterative function types (with --node-costs)")
+	("label,l"      ,value<std::string>(&label)                ,"Label recorded in the results (e.g a commit id)")
+	("multisample,m",value<int>(&multisample)->default_value(1),"Multisampling grid (NxN)")
+	("node-costs,n" ,value<std::string>(&node_costs)->implicit_value(""),"Rather than the corpus, time each function type (or those whose names contain the argument) on its own, at each pixel of an image of --size")
+	("output,o"     ,value<std::string>(&output_filename)->default_value("-"),"File to write JSON results to (\"-\" for stdout)")
+	("quick,q"      ,bool_switch(&quick)                       ,"Only render with the full number of threads, rather than 1, 2, 4... up to it")
+	("repeat,r"     ,value<uint>(&repeat)->default_value(3)    ,"Times each measurement is repeated (the fastest is reported)")
+	("size,s"       ,value<std::string>(&size)->default_value("256x256"),"Image size")
+	("threads,t"    ,value<uint>(&threads)->default_value(get_number_of_processors()),"Most compute threads")
+	("verbose,v"    ,bool_switch(&verbose)                     ,"Log progress to stderr")
+	;
+      pos_options_desc.add("corpus",-1);
+    }
+
+    boost::program_options::variables_map options;
+    boost::program_options::store
+      (
+       boost::program_options::command_line_parser(argc,argv)
+       .options(options_desc).positional(pos_options_desc).run()
+       ,options
+       );
+    boost::program_options::notify(options);
+
+    if (help)
+      {
+	std::cerr << options_desc;
+	return 0;
+      }
+
+    if (verbose)
+      std::clog.rdbuf(std::cerr.rdbuf());
+    else
+      std::clog.rdbuf(sink_ostream.rdbuf());
+
+    BenchOptions bench_options;
+    {
+      int width=0;
+      int height=0;
+      std::istringstream size_in(size);
+      char separator;
+      if (!(size_in >> width >> separator >> height) || separator!='x' || width<1 || height<1)
+	{
+	  std::cerr << "--size option argument must be of form <width>x<height>\n";
+	  return 1;
+	}
+      bench_options.size=QSize(width,height);
+    }
+    if (frames<1 || multisample<1 || repeat<1 || threads<1)
+      {
+	std::cerr << "--frames, --multisample, --repeat and --threads must be at least 1\n";
+	return 1;
+      }
+    bench_options.frames=frames;
+    bench_options.multisample=multisample;
+    bench_options.repeat=repeat;
+
+    if (options.count("node-costs"))
+      {
+	if (iterations<1)
+	  {
+	    std::cerr << "--iterations must be at least 1\n";
+	    return 1;
+	  }
+	return bench_node_costs(node_costs,label,bench_options.size,iterations,repeat,output_filename);
+      }
+
+    if (options.count("differential"))
+      {
+	if (family<1)
+	  {
+	    std::cerr << "--family must be at least 1\n";
+	    return 1;
+	  }
+	return bench_differential(differential,family,threads,label,(options["size"].defaulted() ? QSize(64,64) : bench_options.size),frames,multisample,output_filename);
+      }
+
+    std::vector<uint> thread_counts;
+    if (!quick)
+      for (uint t=1;t<threads;t*=2)
+	thread_counts.push_back(t);
+    thread_counts.push_back(threads);
+
+    FunctionRegistry function_registry;
+    std::vector<BenchFunction> functions;
+
+    if (corpus.empty())
+      {
+	const std::string default_corpus(QCoreApplication::applicationDirPath().toStdString()+"/corpus");
+	if (QDir(QString::fromLocal8Bit(default_corpus.c_str())).exists())
+	  corpus.push_back(default_corpus);
+	else
+	  std::cerr << "evolvotron_bench: Warning: No corpus directory " << default_corpus << "; only benchmarking genesis functions\n";
+      }
+    for (uint i=0;i<corpus.size();i++)
+      if (!load_corpus(function_registry,corpus[i],functions)) return 1;
+
+    // Genesis functions depend only on the seed (as in evolvotron_mutate -g -s).
+    for (uint seed=1;seed<=genesis;seed++)
+      {
+	MutationParameters mutation_parameters(seed,false,false);
+	std::unique_ptr<FunctionTop> fn_top(FunctionTop::initial(mutation_parameters));
+	std::ostringstream name;
+	name << "genesis-" << seed;
+	BenchFunction function;
+	function.name=name.str();
+	function.source="seed "+name.str().substr(8);
+	function.imagefn=boost::shared_ptr<const MutatableImage>(new MutatableImage(fn_top,true,false,false));
+	functions.push_back(function);
+      }
+
+    if (functions.empty())
+      {
+	std::cerr << "evolvotron_bench: Error: Nothing to benchmark\n";
+	return 1;
+      }
+
+    std::vector<BenchResult> results(functions.size());
+    for (uint i=0;i<functions.size();i++)
+      results[i].render_ms.resize(thread_counts.size());
+
+    // Renderers (and their threads) are only started once for each thread count.
+    for (uint t=0;t<thread_counts.size();t++)
+      {
+	TiledRenderer renderer(thread_counts[t]);
+	for (uint i=0;i<functions.size();i++)
+	  {
+	    results[i].render_ms[t]=time_render(renderer,functions[i].imagefn,bench_options);
+	    std::clog
+	      << functions[i].name << " " << thread_counts[t] << " threads: "
+	      << results[i].render_ms[t] << "ms, "
+	      << bench_options.samples()/(1e3*results[i].render_ms[t]) << " Msamples/s\n";
+	  }
+      }
+
+    for (uint i=0;i<functions.size();i++)
+      {
+	time_progressive(thread_counts.back(),functions[i].imagefn,bench_options,results[i].first_level_ms,results[i].full_ms);
+	std::clog << functions[i].name << " progressive: first level " << results[i].first_level_ms << "ms, full " << results[i].full_ms << "ms\n";
+      }
+
+    if (output_filename=="-")
+      {
+	write_json(std::cout,label,bench_options,thread_counts,functions,results);
+      }
+    else
+      {
+	std::ofstream file(output_filename.c_str());
+	write_json(file,label,bench_options,thread_counts,functions,results);
+	file.flush();
+	if (!file)
+	  {
+	    std::cerr << "evolvotron_bench: Error: Couldn't write " << output_filename << "\n";
+	    return 1;
+	  }
+
+	// With the JSON out of the way, a table for people.
+	std::cout << std::left << std::setw(24) << "function";
+	for (uint t=0;t<thread_counts.size();t++)
+	  std::cout << std::right << std::setw(10) << thread_counts[t];
+	std::cout << std::right << std::setw(12) << "first ms" << std::setw(12) << "full ms" << "\n";
+	std::cout << std::fixed << std::setprecision(2);
+	for (uint i=0;i<functions.size();i++)
+	  {
+	    std::cout << std::left << std::setw(24) << functions[i].name;
+	    for (uint t=0;t<thread_counts.size();t++)
+	      std::cout << std::right << std::setw(10) << bench_options.samples()/(1e3*results[i].render_ms[t]);
+	    std::cout << std::right << std::setw(12) << results[i].first_level_ms << std::setw(12) << results[i].full_ms << "\n";
+	  }
+	std::cout << "(Msamples/s by threads)\n";
+      }
+  }
+
+  return 0;
+}
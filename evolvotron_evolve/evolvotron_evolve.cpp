@@ -0,0 +1,407 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Headless evolution driver, selecting by a built-in complexity measure.
+*/
+
+#include "function_top.h"
+#include "image_fitness.h"
+#include "mutatable_image.h"
+#include "mutation_parameters.h"
+#include "platform_specific.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+
+#include <boost/program_options.hpp>
+
+//! A member of the population.
+struct Candidate
+{
+  //! The function.
+  boost::shared_ptr<const MutatableImage> imagefn;
+
+  //! Its fitness.
+  real score;
+
+  //! Generation it was born in.
+  uint generation;
+};
+
+//! Orders candidates best first (and, of equals, oldest first so the population doesn't drift on ties).
+static bool better(const Candidate& a,const Candidate& b)
+{
+  return (a.score>b.score || (a.score==b.score && a.generation<b.generation));
+}
+
+//! What a worker is asked to do for one candidate.
+struct Job
+{
+  //! Function to mutate (null for a new one).
+  boost::shared_ptr<const MutatableImage> parent;
+
+  //! Function to score as it is (when there's no parent); null to create one.
+  boost::shared_ptr<const MutatableImage> imagefn;
+
+  //! Random seed for the mutation.
+  uint seed;
+
+  //! The result.
+  Candidate result;
+};
+
+//! Things every worker needs to know.
+struct EvolveOptions
+{
+  //! Size of the renders scored.
+  QSize size;
+
+  //! What's scored.
+  ImageFitness::Metric metric;
+
+  //! New functions sweep z linearly.
+  bool linear;
+
+  //! New functions are spheremaps.
+  bool spheremap;
+};
+
+//! Mutates (or creates), renders and scores every n-th job, on a thread of its own.
+/*! Each worker has its own MutationParameters, reseeded per job, so results depend only on the seeds and not on the number of workers.
+ */
+class EvolveWorker : public QThread
+{
+public:
+  //! Constructor.
+  EvolveWorker(const EvolveOptions& options,std::vector<Job>& jobs,uint generation,uint first,uint stride)
+    :_options(options)
+    ,_jobs(jobs)
+    ,_generation(generation)
+    ,_first(first)
+    ,_stride(stride)
+    {}
+
+  //! Do the jobs (in the calling thread).
+  void work();
+
+protected:
+  //! Do the jobs.
+  virtual void run()
+    {
+      work();
+    }
+
+private:
+  //! Render a function at the scoring size.
+  const QImage render(const MutatableImage& imagefn) const;
+
+  //! Common options.
+  const EvolveOptions& _options;
+
+  //! All the jobs.
+  std::vector<Job>& _jobs;
+
+  //! Generation being produced.
+  const uint _generation;
+
+  //! First job to do.
+  const uint _first;
+
+  //! Step between jobs to do.
+  const uint _stride;
+};
+
+const QImage EvolveWorker::render(const MutatableImage& imagefn) const
+{
+  const uint w=_options.size.width();
+  const uint h=_options.size.height();
+  QImage image(w,h,QImage::Format_RGB32);
+  for (uint y=0;y<h;y++)
+    {
+      uint*const row=reinterpret_cast<uint*>(image.scanLine(y));
+      for (uint x=0;x<w;x++)
+	{
+	  const XYZ c(imagefn.get_rgb(x,y,0,w,h,1,0,1));
+	  row[x]=0xff000000|(lrint(c.x())<<16)|(lrint(c.y())<<8)|lrint(c.z());
+	}
+    }
+  return image;
+}
+
+void EvolveWorker::work()
+{
+  MutationParameters mutation_parameters(0,false,false);
+  for (uint i=_first;i<_jobs.size();i+=_stride)
+    {
+      Job& job=_jobs[i];
+      mutation_parameters.seed(job.seed);
+      if (job.parent)
+	{
+	  job.imagefn=job.parent->mutated(mutation_parameters);
+	}
+      else if (!job.imagefn)
+	{
+	  std::unique_ptr<FunctionTop> fn_top(FunctionTop::initial(mutation_parameters));
+	  job.imagefn=boost::shared_ptr<const MutatableImage>(new MutatableImage(fn_top,!_options.linear,_options.spheremap,false));
+	}
+
+      job.result.imagefn=job.imagefn;
+      job.result.generation=_generation;
+      // Constant functions can't be complex, and needn't be rendered to find that out.
+      job.result.score=(job.imagefn->is_constant() ? 0.0 : ImageFitness(render(*job.imagefn)).score(_options.metric));
+    }
+}
+
+//! Do the jobs on a number of threads.
+static void run_jobs(const EvolveOptions& options,std::vector<Job>& jobs,uint generation,uint threads)
+{
+  const uint n_workers=clamped(threads,1u,maximum(static_cast<uint>(jobs.size()),1u));
+  boost::ptr_vector<EvolveWorker> workers;
+  for (uint i=0;i<n_workers;i++)
+    workers.push_back(new EvolveWorker(options,jobs,generation,i,n_workers));
+  for (uint i=1;i<n_workers;i++)
+    workers[i].start();
+  workers[0].work();
+  for (uint i=1;i<n_workers;i++)
+    workers[i].wait();
+}
+
+//! Write a function to a file, via a temporary file so an interrupted write never replaces a good file.  Returns false on failure.
+static bool save_function(const MutatableImage& imagefn,const std::string& filename)
+{
+  const std::string temporary(filename+".tmp");
+  {
+    std::ofstream file(temporary.c_str());
+    imagefn.save_function(file);
+    file.flush();
+    if (!file) return false;
+  }
+  return (rename(temporary.c_str(),filename.c_str())==0);
+}
+
+//! Name of a numbered file in the output directory.
+static const std::string numbered_filename(const std::string& dir,const char* prefix,uint n)
+{
+  std::ostringstream filename;
+  filename << dir << "/" << prefix << std::setfill('0') << std::setw(6) << n << ".xml";
+  return filename.str();
+}
+
+//! Application code
+int main(int argc,char* argv[])
+{
+  {
+    uint children;
+    std::string fitness;
+    uint generations;
+    bool help;
+    std::string input;
+    std::string output_dir;
+    uint population_size;
+    bool resume;
+    uint seed;
+    std::string size;
+    uint threads;
+    bool verbose;
+    EvolveOptions evolve_options;
+
+    boost::program_options::options_description options_desc("Options");
+    {
+      using namespace boost::program_options;
+      options_desc.add_options()
+	("children,c"   ,value<uint>(&children)->default_value(32)        ,"Mutants produced per generation (shared equally between the population)")
+	("fitness,f"    ,value<std::string>(&fitness)->default_value("compression"),"What's selected for: compression, edges, entropy or combined")
+	("generations,n",value<uint>(&generations)->default_value(0)      ,"Number of generations (0 to run until killed)")
+	("help,h"       ,bool_switch(&help)                               ,"Print command-line options help message and exit")
+	("input,i"      ,value<std::string>(&input)                       ,"Function to start from (- for stdin); without this the population starts with new functions")
+	("linear,l"     ,bool_switch(&evolve_options.linear)              ,"Sweep z linearly in new functions' animations")
+	("output-dir,o" ,value<std::string>(&output_dir)->default_value("."),"Directory for the best functions and the population")
+	("population,p" ,value<uint>(&population_size)->default_value(8)  ,"Number of functions kept each generation")
+	("resume,r"     ,bool_switch(&resume)                             ,"Continue from the population saved in the output directory")
+	("seed"         ,value<uint>(&seed)->default_value(1)             ,"Random seed")
+	("size,s"       ,value<std::string>(&size)->default_value("128x128"),"Size of the renders scored")
+	("spheremap"    ,bool_switch(&evolve_options.spheremap)           ,"Make new functions spheremaps")
+	("threads,t"    ,value<uint>(&threads)->default_value(get_number_of_processors()),"Number of threads")
+	("verbose,v"    ,bool_switch(&verbose)                            ,"Log some details to stderr")
+	;
+    }
+
+    boost::program_options::variables_map options;
+    boost::program_options::store(boost::program_options::parse_command_line(argc,argv,options_desc),options);
+    boost::program_options::notify(options);
+
+    if (help)
+      {
+	std::cerr << options_desc;
+	return 0;
+      }
+
+    if (verbose) 
+      std::clog.rdbuf(std::cerr.rdbuf());
+    else
+      std::clog.rdbuf(sink_ostream.rdbuf());
+
+    int width=0;
+    int height=0;
+    {
+      std::string s(size);
+      const std::string::size_type p=s.find("x");
+      if (p!=std::string::npos) s[p]=' ';
+      std::stringstream(s) >> width >> height;
+    }
+    if (width<1 || height<1)
+      {
+	std::cerr << "--size option argument must be in <width>x<height> format\n";
+	return 1;
+      }
+    evolve_options.size=QSize(width,height);
+
+    if (!ImageFitness::metric(fitness,evolve_options.metric))
+      {
+	std::cerr << "--fitness option argument must be one of compression, edges, entropy or combined\n";
+	return 1;
+      }
+    if (population_size<1 || children<1)
+      {
+	std::cerr << "--population and --children option arguments must be at least 1\n";
+	return 1;
+      }
+    if (!QDir().mkpath(QString::fromLocal8Bit(output_dir.c_str())))
+      {
+	std::cerr << "evolvotron_evolve: Error: Couldn't create directory " << output_dir << "\n";
+	return 1;
+      }
+
+    // Functions are only loaded here; each worker mutates with its own MutationParameters.
+    MutationParameters mutation_parameters(seed,false,false);
+    std::vector<Job> jobs;
+    uint generation=0;
+    if (resume)
+      {
+	std::ifstream state((output_dir+"/generation").c_str());
+	if (!(state >> generation))
+	  {
+	    std::cerr << "evolvotron_evolve: Error: Nothing to resume in " << output_dir << "\n";
+	    return 1;
+	  }
+	for (uint i=0;i<population_size;i++)
+	  {
+	    const std::string filename(numbered_filename(output_dir,"population_",i));
+	    std::ifstream file(filename.c_str());
+	    if (!file) break;
+	    std::string report;
+	    Job job;
+	    job.imagefn=MutatableImage::load_function(mutation_parameters.function_registry(),file,report);
+	    if (!job.imagefn)
+	      {
+		std::cerr << "evolvotron_evolve: Error: Couldn't load " << filename << ":\n" << report;
+		return 1;
+	      }
+	    jobs.push_back(job);
+	  }
+	std::cout << "Resuming at generation " << generation << " with " << jobs.size() << " functions\n";
+      }
+    else if (!input.empty())
+      {
+	std::ifstream file;
+	if (input!="-") file.open(input.c_str());
+	std::string report;
+	Job job;
+	job.imagefn=MutatableImage::load_function(mutation_parameters.function_registry(),(input=="-" ? std::cin : file),report);
+	if (!job.imagefn)
+	  {
+	    std::cerr << "evolvotron_evolve: Error: Function not loaded due to errors:\n" << report;
+	    return 1;
+	  }
+	else if (!report.empty())
+	  {
+	    std::cerr << "evolvotron_evolve: Warning: Function loaded with warnings:\n" << report;
+	  }
+	jobs.push_back(job);
+      }
+    else
+      {
+	jobs.resize(population_size);
+      }
+    for (uint i=0;i<jobs.size();i++)
+      jobs[i].seed=seed+i;
+
+    // Score the starting population.
+    std::vector<Candidate> population;
+    run_jobs(evolve_options,jobs,generation,threads);
+    for (uint i=0;i<jobs.size();i++)
+      population.push_back(jobs[i].result);
+    std::stable_sort(population.begin(),population.end(),better);
+    real best=population.front().score;
+    std::cout << "Generation " << generation << ": best " << best << "\n";
+
+    QElapsedTimer timer;
+    timer.start();
+    for (uint g=0;generations==0 || g<generations;g++)
+      {
+	generation++;
+
+	// Each member of the population gets an equal share of the children; seeds depend only on the generation and child.
+	jobs.assign(children,Job());
+	for (uint c=0;c<children;c++)
+	  {
+	    jobs[c].parent=population[c%population.size()].imagefn;
+	    jobs[c].seed=seed+generation*children+c;
+	  }
+	run_jobs(evolve_options,jobs,generation,threads);
+
+	// Survivors are the best of parents and children together.
+	for (uint c=0;c<children;c++)
+	  population.push_back(jobs[c].result);
+	std::stable_sort(population.begin(),population.end(),better);
+	if (population.size()>population_size)
+	  population.resize(population_size);
+
+	for (uint i=0;i<population.size();i++)
+	  {
+	    if (!save_function(*population[i].imagefn,numbered_filename(output_dir,"population_",i)))
+	      {
+		std::cerr << "evolvotron_evolve: Error: Couldn't write population to " << output_dir << "\n";
+		return 1;
+	      }
+	  }
+	std::ofstream state((output_dir+"/generation").c_str());
+	state << generation << "\n";
+	state.close();
+
+	if (population.front().score>best)
+	  {
+	    best=population.front().score;
+	    if (!save_function(*population.front().imagefn,numbered_filename(output_dir,"best_",generation)))
+	      {
+		std::cerr << "evolvotron_evolve: Error: Couldn't write to " << output_dir << "\n";
+		return 1;
+	      }
+	    std::cout
+	      << "Generation " << generation << ": best " << best
+	      << " (" << (3600000.0*(g+1))/maximum(static_cast<qint64>(1),timer.elapsed()) << " generations/hour)\n";
+	    std::cout.flush();
+	  }
+	std::clog << "Generation " << generation << " done\n";
+      }
+  }
+
+  return 0;
+}
@@ -24,28 +24,167 @@
 #include "mutatable_image.h"
 #include "mutation_parameters.h"
 #include "function_top.h"
+#include "platform_specific.h"
+
+#include <QDir>
 
 #include <boost/program_options.hpp>
 
+//! How functions are produced.
+struct MutateOptions
+{
+  //! Create new functions rather than mutating the input.
+  bool genesis;
+
+  //! Created functions sweep z linearly.
+  bool linear;
+
+  //! Created functions are spheremaps.
+  bool spheremap;
+
+  //! Seed of the first function; function n uses seed+n.
+  uint seed;
+
+  //! Reject results whose probe render is (nearly) uniform.
+  bool probe;
+};
+
+//! Attempts at a function before giving up on the probe.
+static const uint probe_attempts=100;
+
+//! Whether a function is worth keeping: not constant, and with some colour variation in a small render.
+static bool probe(const MutatableImage& imagefn)
+{
+  if (imagefn.is_constant()) return false;
+
+  const uint size=16;
+  XYZ lo(255.0,255.0,255.0);
+  XYZ hi(0.0,0.0,0.0);
+  for (uint y=0;y<size;y++)
+    for (uint x=0;x<size;x++)
+      {
+	const XYZ c(imagefn.get_rgb(x,y,0,size,size,1,0,1));
+	lo=XYZ(minimum(lo.x(),c.x()),minimum(lo.y(),c.y()),minimum(lo.z(),c.z()));
+	hi=XYZ(maximum(hi.x(),c.x()),maximum(hi.y(),c.y()),maximum(hi.z(),c.z()));
+      }
+  const XYZ range(hi-lo);
+  return maximum(range.x(),range.y(),range.z())>=16.0;
+}
+
+//! Produces every n-th function of a batch, on a thread of its own.
+/*! Each worker has its own MutationParameters (and so its own function registry),
+  reseeded for each function, so results depend only on the seed and not on the number of workers.
+ */
+class MutateWorker : public QThread
+{
+public:
+  //! Constructor.  The input is the text of the function to mutate (unused for genesis).
+  MutateWorker(const MutateOptions& options,const std::string& input,std::vector<std::string>& results,std::vector<uint>& rejects,uint first,uint stride)
+    :_options(options)
+    ,_input(input)
+    ,_results(results)
+    ,_rejects(rejects)
+    ,_first(first)
+    ,_stride(stride)
+    {}
+
+  //! Produce the functions (in the calling thread).
+  void produce();
+
+protected:
+  //! Produce the functions.
+  virtual void run()
+    {
+      produce();
+    }
+
+private:
+  //! How functions are produced.
+  const MutateOptions& _options;
+
+  //! Function to mutate.
+  const std::string& _input;
+
+  //! Saved functions, by number (left empty if none passed the probe).
+  std::vector<std::string>& _results;
+
+  //! Number of results rejected by the probe, by number.
+  std::vector<uint>& _rejects;
+
+  //! First function to produce.
+  const uint _first;
+
+  //! Step between functions to produce.
+  const uint _stride;
+};
+
+void MutateWorker::produce()
+{
+  MutationParameters mutation_parameters(_options.seed,false,false);
+
+  boost::shared_ptr<const MutatableImage> imagefn_in;
+  if (!_options.genesis)
+    {
+      std::istringstream in(_input);
+      std::string report;
+      imagefn_in=MutatableImage::load_function(mutation_parameters.function_registry(),in,report);
+    }
+
+  for (uint n=_first;n<_results.size();n+=_stride)
+    {
+      mutation_parameters.seed(_options.seed+n);
+      _rejects[n]=0;
+      for (uint attempt=0;attempt<(_options.probe ? probe_attempts : 1);attempt++)
+	{
+	  boost::shared_ptr<const MutatableImage> imagefn_out;
+	  if (_options.genesis)
+	    {
+	      std::unique_ptr<FunctionTop> fn_top(FunctionTop::initial(mutation_parameters));
+	      imagefn_out=boost::shared_ptr<const MutatableImage>(new MutatableImage(fn_top,!_options.linear,_options.spheremap,false));
+	    }
+	  else
+	    {
+	      imagefn_out=imagefn_in->mutated(mutation_parameters);
+	    }
+
+	  if (!_options.probe || probe(*imagefn_out))
+	    {
+	      std::ostringstream out;
+	      imagefn_out->save_function(out);
+	      _results[n]=out.str();
+	      break;
+	    }
+	  _rejects[n]++;
+	}
+    }
+}
+
 //! Application code
 int main(int argc,char* argv[])
 {
   {
-    bool genesis;
+    uint count;
     bool help;
-    bool linear;
-    bool spheremap;
+    std::string output_dir;
     bool verbose;
+    uint seed;
+    uint threads;
+    MutateOptions mutate_options;
 
     boost::program_options::options_description options_desc("Options");
     {
       using namespace boost::program_options;
       options_desc.add_options()
-	("genesis,g"  ,bool_switch(&genesis)  ,"Create a new function to stdout (without this option, a function will be read from stdin)")
-	("help,h"     ,bool_switch(&help)     ,"Print command-line options help message and exit")
-	("linear,l"   ,bool_switch(&linear)   ,"Sweep z linearly in animations")
-	("spheremap,p",bool_switch(&spheremap),"Generate spheremap")
-	("verbose,v"  ,bool_switch(&verbose)  ,"Log some details to stderr")
+	("count,n"     ,value<uint>(&count)->default_value(1),"Number of functions to produce")
+	("genesis,g"   ,bool_switch(&mutate_options.genesis)  ,"Create new functions (without this option, a function will be read from stdin and mutated)")
+	("help,h"      ,bool_switch(&help)                    ,"Print command-line options help message and exit")
+	("linear,l"    ,bool_switch(&mutate_options.linear)   ,"Sweep z linearly in animations")
+	("output-dir,o",value<std::string>(&output_dir)       ,"Write functions to numbered files in this directory rather than to stdout")
+	("probe,P"     ,bool_switch(&mutate_options.probe)    ,"Reject (and retry) functions which are constant or nearly uniform in a small test render")
+	("seed,s"      ,value<uint>(&seed)                    ,"Random seed of the first function (function n uses seed+n); defaults to one from the process id and time")
+	("spheremap,p" ,bool_switch(&mutate_options.spheremap),"Generate spheremap")
+	("threads,t"   ,value<uint>(&threads)->default_value(get_number_of_processors()),"Number of threads")
+	("verbose,v"   ,bool_switch(&verbose)                 ,"Log some details to stderr")
 	;
     }
     
@@ -64,32 +203,36 @@ int main(int argc,char* argv[])
     else
       std::clog.rdbuf(sink_ostream.rdbuf());
     
-    // Normally would use time(0) to seed random number generator
-    // but can imagine several of these starting up virtually simultaneously
-    // so need something with higher resolution.
-    // Adding the process id too to keep things unique.
-    
-    QTime t(QTime::currentTime());
-    uint seed=getpid()+t.msec()+1000*t.second()+60000*t.minute()+3600000*t.hour();
-    
-    std::clog << "Random seed is " << seed << "\n";
-    
-    MutationParameters mutation_parameters(seed,false,false);
-    
-    std::string report;
-    boost::shared_ptr<const MutatableImage> imagefn_out;
-    
-    if (genesis)
+    if (options.count("seed"))
       {
-	std::unique_ptr<FunctionTop> fn_top(FunctionTop::initial(mutation_parameters));
-	
-	imagefn_out=boost::shared_ptr<const MutatableImage>(new MutatableImage(fn_top,!linear,spheremap,false));
+	mutate_options.seed=seed;
       }
     else
       {
+	// Normally would use time(0) to seed random number generator
+	// but can imagine several of these starting up virtually simultaneously
+	// so need something with higher resolution.
+	// Adding the process id too to keep things unique.
+	QTime t(QTime::currentTime());
+	mutate_options.seed=getpid()+t.msec()+1000*t.second()+60000*t.minute()+3600000*t.hour();
+      }
+    
+    std::clog << "Random seed is " << mutate_options.seed << "\n";
+    
+    // The input is checked here, but each worker parses its own copy with its own function registry.
+    std::string input;
+    if (!mutate_options.genesis)
+      {
+	std::ostringstream text;
+	text << std::cin.rdbuf();
+	input=text.str();
+
+	MutationParameters mutation_parameters(mutate_options.seed,false,false);
+	std::istringstream in(input);
+	std::string report;
 	const boost::shared_ptr<const MutatableImage> imagefn_in
 	  (
-	   MutatableImage::load_function(mutation_parameters.function_registry(),std::cin,report)
+	   MutatableImage::load_function(mutation_parameters.function_registry(),in,report)
 	   );
 	
 	if (imagefn_in.get()==0)
@@ -101,11 +244,59 @@ int main(int argc,char* argv[])
 	  {
 	    std::cerr << "evolvotron_mutate: Warning: Function loaded with warnings:\n" << report;
 	  }
-	
-	imagefn_out=imagefn_in->mutated(mutation_parameters);
       }
-    
-    imagefn_out->save_function(std::cout);
+
+    if (!output_dir.empty() && !QDir().mkpath(QString::fromLocal8Bit(output_dir.c_str())))
+      {
+	std::cerr << "evolvotron_mutate: Error: Couldn't create directory " << output_dir << "\n";
+	return 1;
+      }
+
+    std::vector<std::string> results(count);
+    std::vector<uint> rejects(count);
+    {
+      const uint n_workers=clamped(threads,1u,maximum(count,1u));
+      boost::ptr_vector<MutateWorker> workers;
+      for (uint i=0;i<n_workers;i++)
+	workers.push_back(new MutateWorker(mutate_options,input,results,rejects,i,n_workers));
+      for (uint i=1;i<n_workers;i++)
+	workers[i].start();
+      workers[0].produce();
+      for (uint i=1;i<n_workers;i++)
+	workers[i].wait();
+    }
+
+    // Functions are written in order once they're all done, so the output doesn't depend on the number of threads either.
+    uint failures=0;
+    for (uint n=0;n<count;n++)
+      {
+	std::clog << "Function " << n << ": seed " << mutate_options.seed+n << ", " << rejects[n] << " rejected by probe\n";
+	if (results[n].empty())
+	  {
+	    std::cerr << "evolvotron_mutate: Error: No function with seed " << mutate_options.seed+n << " passed the probe in " << probe_attempts << " attempts\n";
+	    failures++;
+	  }
+	else if (output_dir.empty())
+	  {
+	    std::cout << results[n];
+	  }
+	else
+	  {
+	    std::ostringstream filename;
+	    filename << output_dir << "/function" << std::setfill('0') << std::setw(6) << n << ".xml";
+	    std::ofstream file(filename.str().c_str());
+	    file << results[n];
+	    file.flush();
+	    if (!file)
+	      {
+		std::cerr << "evolvotron_mutate: Error: Couldn't write " << filename.str() << "\n";
+		failures++;
+	      }
+	  }
+      }
+    std::cout.flush();
+
+    if (failures) return 1;
   }
     
   return 0;
@@ -21,36 +21,750 @@
   \brief Standalone renderer for evolvotron function files.
 */
 
+#include "band_image_writer.h"
+#include "cost_map.h"
+#include "frame_stream.h"
 #include "function_registry.h"
+#include "image_encoder.h"
+#include "mapped_image_writer.h"
 #include "mutatable_image.h"
-#include "random.h"
+#include "platform_specific.h"
+#include "render_checkpoint.h"
+#include "render_coordinator.h"
+#include "tiled_renderer.h"
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
 
 #include <boost/program_options.hpp>
 
+//! Passes everything on to another output, logging percentage completion of each frame as it's rendered.
+class LoggedOutput : public TiledRenderer::Output
+{
+public:
+  //! Constructor.
+  LoggedOutput(TiledRenderer::Output& output)
+    :_output(output)
+    ,_frame(0)
+    ,_report(1)
+    {}
+
+  //! Whatever the output needs.
+  virtual Assembly assembly() const
+    {
+      return _output.assembly();
+    }
+
+  //! Pass on the question, noting frames which won't be reported.
+  virtual bool skip_frame(uint frame)
+    {
+      const bool skip=_output.skip_frame(frame);
+      if (skip && frame==_frame)
+	{
+	  std::clog << "Skipping frame " << frame << "\n";
+	  _frame=frame+1;
+	}
+      return skip;
+    }
+
+  //! Pass on the question.
+  virtual bool skip_tile(uint frame,uint tile)
+    {
+      return _output.skip_tile(frame,tile);
+    }
+
+  //! Pass on the request.
+  virtual bool sync()
+    {
+      return _output.sync();
+    }
+
+  //! Log a percentage completion every 5% of the frame next to be output.
+  virtual void progress(uint frame,uint tiles_done,uint tiles)
+    {
+      _output.progress(frame,tiles_done,tiles);
+
+      if (frame!=_frame) return;
+      const uint reports=20;
+      while (_report<=reports && tiles_done>=(_report*tiles)/reports)
+	{
+	  std::clog << "[" << (100*_report)/reports << "%]";
+	  _report++;
+	}
+    }
+
+  //! Pass on the tile.
+  virtual bool tile(uint frame,uint n,const QImage& tile,const QPoint& origin)
+    {
+      return _output.tile(frame,n,tile,origin);
+    }
+
+  //! Pass on the rows.
+  virtual bool rows(uint frame,const QImage& band,int begin)
+    {
+      return _output.rows(frame,band,begin);
+    }
+
+  //! Pass on the frame.
+  virtual bool frame(uint frame,const QImage& image)
+    {
+      std::clog << "\n";
+      _frame=frame+1;
+      _report=1;
+      return _output.frame(frame,image);
+    }
+
+private:
+  //! Where everything goes.
+  TiledRenderer::Output& _output;
+
+  //! Frame progress is being reported for.
+  uint _frame;
+
+  //! Next progress report.
+  uint _report;
+};
+
+//! Saves each (whole) frame to its own file, encoding on another thread while the next frame computes.
+class RenderOutput : public TiledRenderer::Output
+{
+public:
+  //! Constructor.
+  RenderOutput(const std::string& filename,uint frames,ImageEncoder& encoder)
+    :_filename(filename)
+    ,_frames(frames)
+    ,_encoder(encoder)
+    {}
+
+  //! Queue the frame for saving.
+  virtual bool frame(uint frame,const QImage& image);
+
+  //! Wait for queued frames to be saved.
+  virtual bool sync();
+
+  //! Description of the last failure.
+  const std::string& error() const
+    {
+      return _error;
+    }
+
+private:
+  //! Log saved files and note any failures.  Returns false if something failed.
+  bool report();
+
+  //! Output filename (before frame numbering).
+  const std::string _filename;
+
+  //! Number of frames.
+  const uint _frames;
+
+  //! Does the saving.
+  ImageEncoder& _encoder;
+
+  //! Description of the last failure.
+  std::string _error;
+};
+
+bool RenderOutput::report()
+{
+  const std::vector<std::string> saved(_encoder.take_saved());
+  for (uint i=0;i<saved.size();i++)
+    std::clog << "Wrote file " << saved[i] << "\n";
+
+  const std::vector<std::string> errors(_encoder.take_errors());
+  if (errors.empty()) return true;
+  _error=errors.front();
+  return false;
+}
+
+/*! Failures saving earlier frames are reported here, as the encoder can't report them itself.
+ */
+bool RenderOutput::frame(uint frame,const QImage& image)
+{
+  if (!report()) return false;
+
+  const std::string filename(frame_filename(_filename,frame,_frames));
+  const QString save_filename(QString::fromLocal8Bit(filename.c_str()));
+
+  const char* save_format="PPM";
+  if (save_filename.toUpper().endsWith(".PPM"))
+    {
+      save_format="PPM";
+    }
+  else if (save_filename.toUpper().endsWith(".PNG"))
+    {
+      save_format="PNG";
+    }
+  else
+    {
+      std::cerr 
+	<< "evolvotron_render: Warning: Unrecognised file suffix.  File will be written in "
+	<< save_format
+	<< " format.\n";
+    }
+
+  _encoder.encode(image,filename,save_format);
+  return true;
+}
+
+bool RenderOutput::sync()
+{
+  _encoder.wait_idle();
+  return report();
+}
+
+//! Saves false-coloured maps of what each pixel of each frame cost to compute, rather than the frames themselves.
+/*! The costs come from the local source computing the tiles, through costs().
+ */
+class CostMapOutput : public TiledRenderer::Output
+{
+public:
+  //! Constructor.  Units are what the costs are counted in, for reporting.
+  CostMapOutput(RenderOutput& output,const std::string& units)
+    :_output(output)
+    ,_units(units)
+    {}
+
+  //! Queue the frame's cost map for saving.
+  virtual bool frame(uint frame,const QImage& image);
+
+  //! Wait for queued frames to be saved.
+  virtual bool sync()
+    {
+      return _output.sync();
+    }
+
+  //! Description of the last failure.
+  const std::string& error() const
+    {
+      return _output.error();
+    }
+
+  //! Where the source should record costs.
+  TiledRenderer::LocalSource::Costs& costs()
+    {
+      return _costs;
+    }
+
+private:
+  //! Saves the maps.
+  RenderOutput& _output;
+
+  //! What costs are counted in.
+  const std::string _units;
+
+  //! Costs of frames not yet output.
+  TiledRenderer::LocalSource::Costs _costs;
+};
+
+/*! The cost shown as white is logged, as the maps are each scaled to their own frame
+  (not written to stdout, which may be carrying a stream or timings).
+ */
+bool CostMapOutput::frame(uint frame,const QImage& image)
+{
+  const TiledRenderer::LocalSource::Costs::iterator it=_costs.find(frame);
+  assert(it!=_costs.end());
+  const std::vector<float>& cost=(*it).second;
+  const float scale=cost_map_scale(cost);
+  std::clog << "Frame " << frame << ": white is " << scale << " " << _units << " per sample\n";
+  const bool ok=_output.frame(frame,cost_map_image(&cost[0],image.size(),scale));
+  _costs.erase(it);
+  return ok;
+}
+
+//! Parse a <width>x<height> size.  Returns false (with a message on cerr) if it's not valid.
+static bool parse_size(std::string size,int& width,int& height)
+{
+  //! \todo Could be done better maybe (set 'x' as input separator)
+  const std::string::size_type p=size.find("x");
+  if (p==std::string::npos || p==0 || p==size.size()-1)
+    {
+      std::cerr << "Size \"" << size << "\" isn't in <width>x<height> format\n";
+      return false;
+    }
+  else
+    {
+      size[p]=' ';
+    }
+  std::stringstream(size) >> width >> height;
+  if (width<1 || height<1)
+    {
+      std::cerr << "Size must give a positive width and height\n";
+      return false;
+    }
+  return true;
+}
+
+//! How rendered frames are written.
+struct OutputOptions
+{
+  //! Stream format name (empty if not streaming).
+  std::string stream;
+
+  //! Stream format.
+  FrameStream::Format stream_format;
+
+  //! Frame rate for streams.
+  uint fps;
+
+  //! Whether to write files without holding whole frames in memory.
+  bool out_of_core;
+
+  //! zlib compression level for PNG files (-1 for zlib's default).
+  int compression;
+
+  //! Seconds between checkpoints (0 for none).
+  uint checkpoint;
+
+  //! Whether to resume from any existing checkpoint.
+  bool resume;
+
+  //! What to write cost maps of instead of the image ("ns" or "evaluations"; empty for the image).
+  std::string cost_map;
+};
+
+//! How tiles are farmed out to worker processes, if they are.
+struct DistributeOptions
+{
+  //! Local worker processes.
+  uint workers;
+
+  //! Commands starting further workers (e.g on other machines).
+  std::vector<std::string> worker_commands;
+
+  //! Spool directory to farm tiles out through instead of pipes (empty for pipes).
+  std::string spool;
+
+  //! Threads expected to serve the spool.
+  uint spool_threads;
+
+  //! Compute threads in each worker.
+  uint threads;
+
+  //! Milliseconds a worker with tiles may go quiet before they're requeued.
+  uint heartbeat_ms;
+
+  //! Times a tile may be lost before the render fails.
+  uint max_retries;
+
+  //! Whether tiles are farmed out at all.
+  bool enabled() const
+    {
+      return (workers || !worker_commands.empty() || !spool.empty());
+    }
+};
+
+//! Render the frames of an image function, locally or on workers.
+/*! Returns false if the output abandoned the render, or (reporting the problem) the workers failed.
+  Tiles come out the same wherever they're computed.
+  Costs can only be recorded when computing locally.
+ */
+static bool render_frames
+(
+ TiledRenderer& renderer,
+ const boost::shared_ptr<const MutatableImage>& imagefn,
+ const QSize& size,
+ uint frames,
+ bool jitter,
+ uint multisample,
+ const DistributeOptions& distribute,
+ TiledRenderer::Output& output,
+ TiledRenderer::LocalSource::Costs* costs=0
+ )
+{
+  if (!distribute.enabled())
+    {
+      TiledRenderer::LocalSource source(renderer,imagefn,size,frames,jitter,multisample);
+      source.record_costs(costs);
+      return renderer.render(source,size,frames,output);
+    }
+  assert(!costs);
+
+  RenderJob job;
+  job.id=RenderJob::new_id();
+  std::ostringstream function;
+  imagefn->save_function(function);
+  job.function=function.str();
+  job.size=size;
+  job.frames=frames;
+  job.jitter=jitter;
+  job.multisample=multisample;
+  job.tile_size=renderer.tile_size();
+
+  boost::shared_ptr<TiledRenderer::Source> source;
+  bool started;
+  if (distribute.spool.empty())
+    {
+      std::vector<QStringList> commands(distribute.workers,QStringList() << QCoreApplication::applicationFilePath());
+      for (uint i=0;i<distribute.worker_commands.size();i++)
+	{
+	  std::istringstream words(distribute.worker_commands[i]);
+	  QStringList command;
+	  std::string word;
+	  while (words >> word) command << QString::fromLocal8Bit(word.c_str());
+	  commands.push_back(command);
+	}
+      PipeCoordinator*const coordinator=new PipeCoordinator(job,commands,distribute.threads,distribute.heartbeat_ms,distribute.max_retries);
+      source.reset(coordinator);
+      started=coordinator->start();
+    }
+  else
+    {
+      SpoolCoordinator*const coordinator=new SpoolCoordinator(job,distribute.spool,distribute.workers,distribute.threads,distribute.spool_threads,distribute.heartbeat_ms,distribute.max_retries);
+      source.reset(coordinator);
+      started=coordinator->start();
+    }
+
+  if (!started || !renderer.render(*source,size,frames,output))
+    {
+      if (!source->error().empty())
+	std::cerr << "evolvotron_render: Error: " << source->error() << "\n";
+      return false;
+    }
+  return true;
+}
+
+//! Identifies a render, so a checkpoint is only resumed by the same render.
+static const std::string render_signature
+(
+ const MutatableImage& imagefn,
+ const std::string& output_filename,
+ const QSize& size,
+ uint frames,
+ bool jitter,
+ uint multisample,
+ const OutputOptions& options,
+ uint tile_size
+ )
+{
+  std::ostringstream function;
+  imagefn.save_function(function);
+  const std::string text(function.str());
+  unsigned long long hash=14695981039346656037ULL;
+  for (std::string::const_iterator it=text.begin();it!=text.end();it++)
+    {
+      hash^=static_cast<unsigned char>(*it);
+      hash*=1099511628211ULL;
+    }
+
+  std::ostringstream signature;
+  signature
+    << "function " << std::hex << hash << std::dec
+    << " size " << size.width() << "x" << size.height()
+    << " frames " << frames
+    << " multisample " << multisample
+    << " jitter " << jitter
+    << " tile " << tile_size
+    << " out-of-core " << options.out_of_core
+    << " output " << output_filename;
+  if (!options.cost_map.empty())
+    signature << " cost-map " << options.cost_map;
+  return signature.str();
+}
+
+//! Render an image function to a file writer, with progress logging and any checkpointing.  Returns false on failure.
+template <typename WRITER> static bool render_to
+(
+ TiledRenderer& renderer,
+ const boost::shared_ptr<const MutatableImage>& imagefn,
+ const std::string& output_filename,
+ const QSize& size,
+ uint frames,
+ bool jitter,
+ uint multisample,
+ const OutputOptions& options,
+ const DistributeOptions& distribute,
+ WRITER& writer,
+ TiledRenderer::LocalSource::Costs* costs=0
+ )
+{
+  if (!options.checkpoint && !options.resume)
+    {
+      LoggedOutput output(writer);
+      if (!render_frames(renderer,imagefn,size,frames,jitter,multisample,distribute,output,costs) || !writer.sync())
+	{
+	  if (!writer.error().empty())
+	    std::cerr << "evolvotron_render: Error: " << writer.error() << "\n";
+	  return false;
+	}
+      return true;
+    }
+
+  RenderCheckpoint checkpoint
+    (
+     writer,
+     output_filename+".checkpoint",
+     render_signature(*imagefn,output_filename,size,frames,jitter,multisample,options,renderer.tile_size()),
+     1000*(options.checkpoint ? options.checkpoint : 60)
+     );
+
+  std::string report;
+  if ((options.resume && !checkpoint.resume(report)) || !checkpoint.begin(report))
+    {
+      std::cerr << "evolvotron_render: Error: " << report;
+      return false;
+    }
+  if (checkpoint.done())
+    std::clog << "Resuming with " << checkpoint.done() << " frames and tiles already done\n";
+
+  LoggedOutput output(checkpoint);
+  if (!render_frames(renderer,imagefn,size,frames,jitter,multisample,distribute,output,costs) || !writer.sync())
+    {
+      if (!writer.error().empty())
+	std::cerr << "evolvotron_render: Error: " << writer.error() << "\n";
+      return false;
+    }
+  checkpoint.finish();
+  return true;
+}
+
+//! Render an image function to files, or a stream if a stream format is specified.  Returns false on failure.
+static bool render
+(
+ TiledRenderer& renderer,
+ const boost::shared_ptr<const MutatableImage>& imagefn,
+ const std::string& output_filename,
+ const QSize& size,
+ uint frames,
+ bool jitter,
+ uint multisample,
+ const OutputOptions& options,
+ const DistributeOptions& distribute
+ )
+{
+  if (!options.stream.empty())
+    {
+      // Opening a FIFO blocks until there's a reader, so do it once everything else has been checked.
+      std::ofstream file;
+      if (output_filename!="-")
+	{
+	  file.open(output_filename.c_str(),std::ios::out|std::ios::binary);
+	  if (!file)
+	    {
+	      std::cerr << "evolvotron_render: Error: Couldn't open " << output_filename << "\n";
+	      return false;
+	    }
+	}
+
+      FrameStream stream((output_filename=="-" ? std::cout : file),options.stream_format,size,options.fps);
+      LoggedOutput output(stream);
+      if (!render_frames(renderer,imagefn,size,frames,jitter,multisample,distribute,output))
+	{
+	  std::cerr << "evolvotron_render: Error: Couldn't write stream to " << output_filename << "\n";
+	  return false;
+	}
+      return true;
+    }
+
+  if (options.out_of_core)
+    {
+      BandImageWriter::Format band_format;
+      MappedImageWriter::Format mapped_format;
+      if (BandImageWriter::format(output_filename,band_format))
+	{
+	  BandImageWriter writer(output_filename,band_format,size,frames,options.compression);
+	  return render_to(renderer,imagefn,output_filename,size,frames,jitter,multisample,options,distribute,writer);
+	}
+      else if (MappedImageWriter::format(output_filename,mapped_format))
+	{
+	  MappedImageWriter writer(output_filename,mapped_format,size,frames);
+	  return render_to(renderer,imagefn,output_filename,size,frames,jitter,multisample,options,distribute,writer);
+	}
+      std::cerr << "evolvotron_render: Error: Out-of-core rendering needs a .png, .tif, .tiff, .ppm or .pam output file\n";
+      return false;
+    }
+
+  // Chunks of a single PNG are deflated on all the compute threads; they're idle once the last frame is done.
+  ImageEncoder encoder(options.compression,renderer.num_threads());
+  RenderOutput writer(output_filename,frames,encoder);
+  if (!options.cost_map.empty())
+    {
+      CostMapOutput cost_map(writer,options.cost_map);
+      return render_to(renderer,imagefn,output_filename,size,frames,jitter,multisample,options,distribute,cost_map,&cost_map.costs());
+    }
+  return render_to(renderer,imagefn,output_filename,size,frames,jitter,multisample,options,distribute,writer);
+}
+
+//! Run the jobs in a manifest, sharing the registry and compute threads.
+/*! Each line is "function size frames multisample output", with - for any of size, frames or multisample
+  taking the value given on the command line.  Blank lines and lines starting with # are ignored.
+  Writes the time taken for each job to stdout, and returns the number of failed jobs.
+ */
+static uint render_batch
+(
+ std::istream& manifest,
+ const FunctionRegistry& function_registry,
+ TiledRenderer& renderer,
+ const QSize& default_size,
+ uint default_frames,
+ bool jitter,
+ uint default_multisample,
+ const OutputOptions& options,
+ const DistributeOptions& distribute
+ )
+{
+  uint jobs=0;
+  uint failures=0;
+  QElapsedTimer batch_timer;
+  batch_timer.start();
+
+  std::string line;
+  for (uint line_number=1;std::getline(manifest,line);line_number++)
+    {
+      std::istringstream fields(line);
+      std::string function_filename;
+      if (!(fields >> function_filename) || function_filename[0]=='#') continue;
+
+      std::string size_field;
+      std::string frames_field;
+      std::string multisample_field;
+      std::string output_filename;
+      std::string extra;
+      if (!(fields >> size_field >> frames_field >> multisample_field >> output_filename) || (fields >> extra))
+	{
+	  std::cerr << "evolvotron_render: Error: Manifest line " << line_number << " isn't \"function size frames multisample output\"\n";
+	  failures++;
+	  continue;
+	}
+
+      jobs++;
+
+      int width=default_size.width();
+      int height=default_size.height();
+      uint frames=default_frames;
+      uint multisample=default_multisample;
+      if (
+	  (size_field!="-" && !parse_size(size_field,width,height))
+	  || (frames_field!="-" && !(std::istringstream(frames_field) >> frames && frames>=1))
+	  || (multisample_field!="-" && !(std::istringstream(multisample_field) >> multisample && multisample>=1))
+	  || output_filename=="-"
+	  )
+	{
+	  std::cerr << "evolvotron_render: Error: Manifest line " << line_number << " has an invalid size, frames, multisample or output\n";
+	  failures++;
+	  continue;
+	}
+
+      QElapsedTimer timer;
+      timer.start();
+
+      std::ifstream function_file(function_filename.c_str());
+      std::string report;
+      const boost::shared_ptr<const MutatableImage> imagefn
+	(
+	 function_file ? MutatableImage::load_function(function_registry,function_file,report) : boost::shared_ptr<const MutatableImage>()
+	 );
+      if (!imagefn)
+	{
+	  std::cerr << "evolvotron_render: Error: Function " << function_filename << " not loaded:\n" << report;
+	  failures++;
+	  continue;
+	}
+      else if (!report.empty())
+	{
+	  std::cerr << "evolvotron_render: Warning: Function " << function_filename << " loaded with warnings:\n" << report;
+	}
+
+      const qint64 load_ms=timer.elapsed();
+      const bool ok=render(renderer,imagefn,output_filename,QSize(width,height),frames,jitter,multisample,options,distribute);
+      if (!ok) failures++;
+
+      std::cout
+	<< output_filename
+	<< "\t" << (ok ? "ok" : "failed")
+	<< "\t" << load_ms << "ms load"
+	<< "\t" << timer.elapsed()-load_ms << "ms render"
+	<< std::endl;
+    }
+
+  std::cout << jobs << " jobs, " << failures << " failed, " << batch_timer.elapsed() << "ms" << std::endl;
+  return failures;
+}
+
+//! Write the renderer's function profile to stderr.
+static void report_profile(const TiledRenderer& renderer)
+{
+  std::vector<FunctionProfile::Totals> totals;
+  renderer.profile(totals);
+  std::cerr << "Function profile (" << renderer.num_threads() << " threads):\n";
+  FunctionProfile::report(std::cerr,totals);
+}
+
+//! Write the trace recorded to a file.  Returns false (reporting the problem) on failure.
+static bool write_trace(const std::string& filename)
+{
+  Trace::stop();
+  std::string error;
+  if (!Trace::write(filename,error))
+    {
+      std::cerr << "evolvotron_render: Error: " << error << "\n";
+      return false;
+    }
+  return true;
+}
+
 //! Application code
 int main(int argc,char* argv[])
 {
+  // Workers are started as copies of this program, and name themselves by its process id.
+  QCoreApplication app(argc,argv);
+
   {
+    std::string batch;
+    uint checkpoint;
+    int compression;
+    std::string cost_map;
+    uint fps;
     uint frames;
+    uint heartbeat;
     bool help;
     bool jitter;
     int multisample;
+    bool out_of_core;
     std::string output_filename;
+    bool profile;
+    bool resume;
     std::string size;
+    std::string spool;
+    uint spool_threads;
+    std::string stream;
+    uint threads;
+    std::string trace;
     bool verbose;
+    bool worker;
+    std::vector<std::string> worker_commands;
+    uint workers;
     
     boost::program_options::options_description options_desc("Options");
     boost::program_options::positional_options_description pos_options_desc;
     {
       using namespace boost::program_options;
       options_desc.add_options()
+	("batch,b"      ,value<std::string>(&batch)                ,"Render the jobs listed in a manifest file (- for stdin), one per line: function size frames multisample output")
+	("checkpoint,c" ,value<uint>(&checkpoint)->default_value(0),"Record progress in a .checkpoint file alongside the output every so many seconds (0: only with --resume, every 60)")
+	("compression,z",value<int>(&compression)->default_value(-1),"PNG compression level (0-9, -1 for zlib's default)")
+	("cost-map"     ,value<std::string>(&cost_map)             ,"Write a false-coloured map of what each pixel cost to compute instead of the image: ns (time) or evaluations (of function nodes) per sample")
+	("fps"          ,value<uint>(&fps)->default_value(25)      ,"Frame rate recorded in y4m streams")
 	("frames,f"     ,value<uint>(&frames)->default_value(1)    ,"Frames in an animation")
+	("heartbeat"    ,value<uint>(&heartbeat)->default_value(30),"Seconds a worker may go quiet before its tiles are given to another")
 	("help,h"       ,bool_switch(&help)                        ,"Print command-line options help message and exit")
 	("jitter,j"     ,bool_switch(&jitter)                      ,"Enable rendering jitter")
 	("multisample,m",value<int>(&multisample)->default_value(1),"Multisampling grid (NxN)")
-	("output,o"     ,value<std::string>(&output_filename)      ,"Output filename (.png or .ppm suffix).  (Or use first positional argument.)")
-	("size,s"       ,value<std::string>(&size)->default_value("512x515"),"Generated image size")
+	("out-of-core,O",bool_switch(&out_of_core)                 ,"Write frames a tile or band at a time, never holding a whole frame (.png, .tif, .tiff, .ppm or .pam output)")
+	("output,o"     ,value<std::string>(&output_filename)      ,"Output filename (.png or .ppm suffix), or stream destination (\"-\" for stdout).  (Or use first positional argument.)")
+	("profile"      ,bool_switch(&profile)                     ,"Count and time evaluations of each function type, and write a table of them to stderr when done")
+	("resume,r"     ,bool_switch(&resume)                      ,"Continue from the output's .checkpoint file, if there is one for the same function and parameters")
+	("size,s"       ,value<std::string>(&size)->default_value("512x512"),"Generated image size")
+	("spool"        ,value<std::string>(&spool)                ,"Farm tiles out through a spool directory (which workers on other machines may share) rather than pipes")
+	("spool-threads",value<uint>(&spool_threads)->default_value(0),"Threads expected to serve the spool (0: threads times local workers)")
+	("stream,S"     ,value<std::string>(&stream)               ,"Write all frames to the output as one stream: rgb, ppm or y4m (implied ppm if output is \"-\")")
+	("threads,t"    ,value<uint>(&threads)->default_value(get_number_of_processors()),"Number of compute threads")
+	("trace"        ,value<std::string>(&trace)                ,"Record a timeline of the compute threads' activity, and write it to this file (Chrome trace JSON) when done")
 	("verbose,v"    ,bool_switch(&verbose)                     ,"Log some details to stderr")
+	("worker"       ,bool_switch(&worker)                      ,"Run as a worker, computing tiles for a coordinator on stdin and stdout (or from --spool)")
+	("worker-command",value<std::vector<std::string> >(&worker_commands),"Command starting a further worker (e.g \"ssh host evolvotron_render\"); may be repeated")
+	("workers,W"    ,value<uint>(&workers)->default_value(0)   ,"Farm tiles out to this many local worker processes")
 	;
       pos_options_desc.add("output",1);
     }
@@ -75,20 +789,19 @@ int main(int argc,char* argv[])
     else
       std::clog.rdbuf(sink_ostream.rdbuf());
 
-    //! \todo Could be done better maybe (set 'x' as input separator)
-    const std::string::size_type p=size.find("x");
-    if (p==std::string::npos || p==0 || p==size.size()-1)
+    if (worker)
       {
-	std::cerr << "--size option argument isn't in <width>x<height> format\n";
-	return 1;
-      }
-    else
-      {
-	size[p]=' ';
+	FunctionRegistry function_registry;
+	if (spool.empty())
+	  return run_pipe_worker(function_registry,threads,std::cin,std::cout);
+	else
+	  return run_spool_worker(function_registry,threads,spool);
       }
+
     int width=512;
     int height=512;
-    std::stringstream(size) >> width >> height;
+    if (!parse_size(size,width,height))
+      return 1;
     
     if (frames<1)
       {
@@ -96,13 +809,132 @@ int main(int argc,char* argv[])
 	return 1;
       }
 
-    if (output_filename.empty())
+    if (output_filename.empty() && batch.empty())
       {
 	std::cerr << "Must specify an output filename\n";
 	return 1;
       }
+
+    if (multisample<1)
+      {
+	std::cerr << "Multisampling grid must be at least 1 (option: -m <n>)\n";
+	return 1;
+      }
+
+    OutputOptions output_options;
+    output_options.stream=stream;
+    output_options.stream_format=FrameStream::FormatPPM;
+    output_options.fps=fps;
+    output_options.out_of_core=out_of_core;
+    output_options.compression=compression;
+    output_options.checkpoint=checkpoint;
+    output_options.resume=resume;
+    output_options.cost_map=cost_map;
+    if (output_options.stream.empty() && output_filename=="-") output_options.stream="ppm";
+    if (!output_options.stream.empty() && !FrameStream::format(output_options.stream,output_options.stream_format))
+      {
+	std::cerr << "--stream option argument must be one of rgb, ppm or y4m\n";
+	return 1;
+      }
+    if (compression<-1 || compression>9)
+      {
+	std::cerr << "--compression option argument must be between -1 and 9\n";
+	return 1;
+      }
+    if (!output_options.stream.empty() && (checkpoint || resume))
+      {
+	std::cerr << "Streams can't be checkpointed or resumed\n";
+	return 1;
+      }
     
+    if (!spool.empty() && !worker_commands.empty())
+      {
+	std::cerr << "--worker-command starts pipe workers, so can't be used with --spool\n";
+	return 1;
+      }
+
+    if (profile && (workers || !worker_commands.empty() || !spool.empty()))
+      {
+	std::cerr << "--profile only profiles this process's threads, so can't be used with workers\n";
+	return 1;
+      }
+
+    if (!cost_map.empty())
+      {
+	if (cost_map!="ns" && cost_map!="evaluations")
+	  {
+	    std::cerr << "--cost-map option argument must be ns or evaluations\n";
+	    return 1;
+	  }
+	if (!stream.empty() || output_filename=="-" || out_of_core || workers || !worker_commands.empty() || !spool.empty())
+	  {
+	    std::cerr << "--cost-map needs whole frames computed by this process, so can't be used with streams, --out-of-core or workers\n";
+	    return 1;
+	  }
+	if (cost_map=="ns" && profile)
+	  {
+	    std::cerr << "--profile counts evaluations, so can only be used with --cost-map evaluations\n";
+	    return 1;
+	  }
+      }
+
+    // Evaluations are counted by the compute threads' function profiles.
+    FunctionProfile::enabled(profile || cost_map=="evaluations");
+
+    DistributeOptions distribute;
+    distribute.workers=workers;
+    distribute.worker_commands=worker_commands;
+    distribute.spool=spool;
+    distribute.spool_threads=(spool_threads ? spool_threads : threads*std::max(1u,workers));
+    distribute.threads=threads;
+    distribute.heartbeat_ms=1000*heartbeat;
+    distribute.max_retries=3;
+
     FunctionRegistry function_registry;
+
+    if (!trace.empty())
+      {
+	Trace::start();
+	Trace::thread_name("main");
+      }
+
+    // With workers computing the tiles, this process only assembles them.
+    TiledRenderer renderer(distribute.enabled() ? 1 : threads);
+    if (!distribute.enabled())
+      std::clog << "Rendering with " << renderer.num_threads() << " threads\n";
+    else if (spool.empty())
+      std::clog << "Rendering on " << workers+worker_commands.size() << " workers of " << threads << " threads\n";
+    else
+      std::clog << "Rendering through spool " << spool << " with " << workers << " local workers\n";
+
+    if (!batch.empty())
+      {
+	std::ifstream manifest_file;
+	if (batch!="-")
+	  {
+	    manifest_file.open(batch.c_str());
+	    if (!manifest_file)
+	      {
+		std::cerr << "evolvotron_render: Error: Couldn't open manifest " << batch << "\n";
+		return 1;
+	      }
+	  }
+	const uint failures=render_batch
+	  (
+	   (batch=="-" ? std::cin : manifest_file),
+	   function_registry,
+	   renderer,
+	   QSize(width,height),
+	   frames,
+	   jitter,
+	   multisample,
+	   output_options,
+	   distribute
+	   );
+	if (profile) report_profile(renderer);
+	if (!trace.empty() && !write_trace(trace)) return 1;
+	return (failures==0 ? 0 : 1);
+      }
     
     std::string report;
     const boost::shared_ptr<const MutatableImage> imagefn(MutatableImage::load_function(function_registry,std::cin,report));
@@ -117,97 +949,11 @@ int main(int argc,char* argv[])
 	std::cerr << "evolvotron_render: Warning: Function loaded with warnings:\n" << report;
       }
 
-    // Seed value pretty unimportant; only used for sample jitter.
-    Random01 r01(23);
-
-    for (uint frame=0;frame<frames;frame++)
-      {
-	std::vector<uint> image_data;
-	image_data.reserve(width*height);
-  
-	uint pixels=0;
-	uint report=1;
-	const uint reports=20;
-	for (int row=0;row<height;row++)
-	  for (int col=0;col<width;col++)
-	    {
-	      const XYZ v(imagefn->sampling_coordinate(col,row,frame,width,height,frames));
-	    
-	      const XYZ colour(imagefn->get_rgb(col,row,frame,width,height,frames,(jitter ? &r01 : 0),multisample));
-	    
-	      const uint col0=lrint(clamped(colour.x(),0.0,255.0));
-	      const uint col1=lrint(clamped(colour.y(),0.0,255.0));
-	      const uint col2=lrint(clamped(colour.z(),0.0,255.0));
-
-	      image_data.push_back(((col0<<16)|(col1<<8)|(col2)));
-
-	      pixels++;
-	      if (pixels>=(report*width*height)/reports)
-		{
-		  std::clog << "[" << (100*report)/reports << "%]";
-		  report++;
-		}
-	    }
-	std::clog << "\n";
-
-	{
-	  //! \todo If filename is "-", write PPM to stdout (QImage save only supports write-to-a-filenames though)
-	  QString save_filename(QString::fromLocal8Bit(output_filename.c_str()));
-
-	  const char* save_format="PPM";
-	  if (save_filename.toUpper().endsWith(".PPM"))
-	    {
-	      save_format="PPM";
-	    }
-	  else if (save_filename.toUpper().endsWith(".PNG"))
-	    {
-	      save_format="PNG";
-	    }
-	  else
-	    {
-	      std::cerr 
-		<< "evolvotron_render: Warning: Unrecognised file suffix.  File will be written in "
-		<< save_format
-		<< " format.\n";
-	    }
-
-	  if (frames>1)
-	    {
-	      QString frame_component = QString::asprintf(".f%06d",frame);
-	      int insert_point=save_filename.lastIndexOf(QString("."));
-	      if (insert_point==-1)
-		{
-		  save_filename.append(frame_component);
-		}
-	      else
-		{
-		  save_filename.insert(insert_point,frame_component);
-		}
-	    }
-    
-	  QImage image
-	    (
-	     reinterpret_cast<uchar*>(&(image_data[0])),
-	     width,
-	     height,
-	     QImage::Format_RGB32
-	     );
-
-	  if (!image.save(save_filename,save_format))
-	    {
-	      std::cerr 
-		<< "evolvotron_render: Error: Couldn't save file "
-		<< save_filename.toLocal8Bit().data()
-		<< "\n";
-	      return 1;
-	    }
-	
-	  std::clog
-	    << "Wrote file " 
-	    << save_filename.toLocal8Bit().data()
-	    << "\n";
-	}
-      }
+    const bool ok=render(renderer,imagefn,output_filename,QSize(width,height),frames,jitter,multisample,output_options,distribute);
+    if (profile) report_profile(renderer);
+    if (!trace.empty() && !write_trace(trace)) return 1;
+    if (!ok)
+      return 1;
   }
   
   return 0;
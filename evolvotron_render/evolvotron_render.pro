@@ -12,4 +12,4 @@ DEPENDPATH += ../libevolvotron ../libfunction
 INCLUDEPATH += ../libevolvotron ../libfunction
 
 TARGETDEPS += ../libevolvotron/libevolvotron.a ../libfunction/libfunction.a
-LIBS       += ../libevolvotron/libevolvotron.a ../libfunction/libfunction.a -lboost_program_options
+LIBS       += ../libevolvotron/libevolvotron.a ../libfunction/libfunction.a -lboost_program_options -lz
@@ -0,0 +1,648 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Long-lived render service, and a client for it.
+
+  Requests and responses are exchanged over a local socket (a Unix-domain socket, or a named pipe on Windows).
+  A connection may carry any number of requests, each a header line followed by the function XML:
+  \verbatim
+  render <width>x<height> <frames> <multisample> <png|rgb> <xml length>
+  \endverbatim
+  The response is either an error line, or an ok line followed by each frame's length and data:
+  \verbatim
+  error <message>
+  ok <frames> <hit|miss>
+  <length>
+  <data>...
+  \endverbatim
+  A "stats" request is answered with a line of request, cache hit and cache size counts,
+  and a "metrics" request with a line of compute thread metrics (as JSON, with rates since the last metrics request).
+  A malformed render request, or one with more than max_xml_length bytes of XML, is answered with an error and the connection closed
+  (as there's no telling where the next request would start).
+  A render request bigger than the limits below (on pixels, frames, multisampling and samples) is answered with an error.
+*/
+
+#include "farm_metrics.h"
+#include "function_registry.h"
+#include "image_encoder.h"
+#include "mutatable_image.h"
+#include "platform_specific.h"
+#include "tiled_renderer.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include <boost/program_options.hpp>
+
+//! How long to wait for a client to send or accept data before giving up on it.
+static const int client_timeout_ms=30000;
+
+//! Longest function XML accepted in a render request (functions are rarely more than a few hundred kilobytes).
+static const size_t max_xml_length=16<<20;
+
+//! Longest request header line accepted.
+static const size_t max_line_length=4096;
+
+//! Most pixels in a frame of a render request.
+static const unsigned long long max_frame_pixels=1ull<<24;
+
+//! Most pixels in all the frames of a render request (which are held in memory, and cached, together).
+static const unsigned long long max_pixels=1ull<<26;
+
+//! Most frames in a render request.
+static const unsigned long long max_frames=1024;
+
+//! Largest multisampling grid in a render request.
+static const unsigned long long max_multisample=16;
+
+//! Most samples computed for a render request (as a render holds up every other request while it runs).
+static const unsigned long long max_samples=1ull<<30;
+
+//! Parse a whole word as an unsigned number, with no sign or anything else around it.
+/*! Returns false if it doesn't parse, or is more than max.
+ */
+static bool parse_unsigned(const std::string& word,unsigned long long max,unsigned long long& n)
+{
+  // Any more digits might not fit.
+  if (word.empty() || word.size()>19 || word.find_first_not_of("0123456789")!=std::string::npos) return false;
+  std::istringstream(word) >> n;
+  return (n<=max);
+}
+
+//! Collects the frames of a render.
+class CollectedOutput : public TiledRenderer::Output
+{
+public:
+  //! Keep the frame.
+  virtual bool frame(uint /*frame*/,const QImage& image)
+    {
+      _frames.push_back(image);
+      return true;
+    }
+
+  //! Accessor.
+  const std::vector<QImage>& frames() const
+    {
+      return _frames;
+    }
+
+private:
+  //! Frames so far.
+  std::vector<QImage> _frames;
+};
+
+//! Encoded results of recent renders, keyed by a hash of the function and render parameters, least recently used discarded first.
+class ResultCache
+{
+public:
+  //! Encoded frames.
+  typedef std::vector<std::string> Frames;
+
+  //! Constructor.
+  ResultCache(size_t max_bytes)
+    :_max_bytes(max_bytes)
+    ,_bytes(0)
+    {}
+
+  //! Look up a result, returning null if it's not cached.
+  const Frames* find(const std::string& key);
+
+  //! Add a result, discarding old ones to make room.
+  void insert(const std::string& key,const Frames& frames);
+
+  //! Number of results cached.
+  uint entries() const
+    {
+      return _entries.size();
+    }
+
+  //! Size of results cached.
+  size_t bytes() const
+    {
+      return _bytes;
+    }
+
+private:
+  //! A cached result.
+  struct Entry
+  {
+    //! The result.
+    Frames frames;
+
+    //! Its size.
+    size_t bytes;
+
+    //! Its place in the use order.
+    std::list<std::string>::iterator use;
+  };
+
+  //! Limit on the size of results cached.
+  const size_t _max_bytes;
+
+  //! Size of results cached.
+  size_t _bytes;
+
+  //! Keys, most recently used first.
+  std::list<std::string> _use;
+
+  //! The results.
+  std::map<std::string,Entry> _entries;
+};
+
+const ResultCache::Frames* ResultCache::find(const std::string& key)
+{
+  std::map<std::string,Entry>::iterator it=_entries.find(key);
+  if (it==_entries.end()) return 0;
+  _use.splice(_use.begin(),_use,(*it).second.use);
+  return &(*it).second.frames;
+}
+
+void ResultCache::insert(const std::string& key,const Frames& frames)
+{
+  size_t bytes=0;
+  for (uint i=0;i<frames.size();i++) bytes+=frames[i].size();
+  if (bytes>_max_bytes || _entries.find(key)!=_entries.end()) return;
+
+  while (_bytes+bytes>_max_bytes)
+    {
+      std::map<std::string,Entry>::iterator oldest=_entries.find(_use.back());
+      _bytes-=(*oldest).second.bytes;
+      _entries.erase(oldest);
+      _use.pop_back();
+    }
+
+  _use.push_front(key);
+  Entry& entry=_entries[key];
+  entry.frames=frames;
+  entry.bytes=bytes;
+  entry.use=_use.begin();
+  _bytes+=bytes;
+}
+
+//! Read a line (without its newline) from a socket.  Returns false if the client went away or took too long.
+static bool read_line(QLocalSocket& socket,std::string& line)
+{
+  while (!socket.canReadLine())
+    {
+      if (socket.bytesAvailable()>static_cast<qint64>(max_line_length) || !socket.waitForReadyRead(client_timeout_ms)) return false;
+    }
+  const QByteArray data(socket.readLine());
+  line.assign(data.constData(),data.size());
+  if (!line.empty() && line[line.size()-1]=='\n') line.erase(line.size()-1);
+  return true;
+}
+
+//! Read a number of bytes from a socket.  Returns false if the client went away or took too long.
+static bool read_bytes(QLocalSocket& socket,size_t length,std::string& data)
+{
+  data.clear();
+  while (data.size()<length)
+    {
+      if (socket.bytesAvailable()==0 && !socket.waitForReadyRead(client_timeout_ms)) return false;
+      const QByteArray part(socket.read(length-data.size()));
+      data.append(part.constData(),part.size());
+    }
+  return true;
+}
+
+//! Write to a socket, waiting until it's all gone.  Returns false if the client went away or took too long.
+static bool write_bytes(QLocalSocket& socket,const std::string& data)
+{
+  if (socket.write(data.data(),data.size())!=static_cast<qint64>(data.size())) return false;
+  while (socket.bytesToWrite()>0)
+    {
+      if (!socket.waitForBytesWritten(client_timeout_ms)) return false;
+    }
+  return true;
+}
+
+//! Encode a frame as PNG or packed 8-bit RGB.  Returns false if PNG encoding failed.
+static bool encode_frame(const QImage& image,bool png,uint threads,std::string& data)
+{
+  std::ostringstream out;
+  if (png)
+    {
+      if (!encode_png(image,out,-1,threads)) return false;
+    }
+  else
+    {
+      std::vector<char> row(3*image.width());
+      for (int y=0;y<image.height();y++)
+	{
+	  const uint*const src=reinterpret_cast<const uint*>(image.constScanLine(y));
+	  for (int x=0;x<image.width();x++)
+	    {
+	      row[3*x  ]=(src[x]>>16)&0xff;
+	      row[3*x+1]=(src[x]>>8)&0xff;
+	      row[3*x+2]=src[x]&0xff;
+	    }
+	  out.write(&row[0],row.size());
+	}
+    }
+  data=out.str();
+  return true;
+}
+
+//! Everything kept warm between requests.
+class RenderService
+{
+public:
+  //! Constructor.
+  RenderService(uint threads,size_t result_cache_bytes)
+    :_renderer(threads)
+    ,_cache(result_cache_bytes)
+    ,_requests(0)
+    ,_hits(0)
+    {}
+
+  //! Answer requests on a new connection (which is deleted once the client closes it) as they arrive.
+  void accept(QLocalSocket* socket);
+
+private:
+  //! Answer whatever requests have arrived in full on a connection.
+  void receive(QLocalSocket* socket);
+
+  //! Send a last response on a connection and close it.
+  void hang_up(QLocalSocket* socket,const std::string& response);
+
+  //! Answer a request (given the words of its header line, and any XML), returning the response.
+  const std::string respond(const std::vector<std::string>& words,const std::string& xml);
+
+  //! Answer a render request (given the words of its header line), returning the response.
+  const std::string render(const std::vector<std::string>& words,const std::string& xml);
+
+  //! The thread pool.
+  TiledRenderer _renderer;
+
+  //! Functions are loaded with this.
+  FunctionRegistry _function_registry;
+
+  //! Recent results.
+  ResultCache _cache;
+
+  //! Count of render requests.
+  uint _requests;
+
+  //! Count of render requests answered from the cache.
+  uint _hits;
+
+  //! Metrics as of the last metrics request (or startup).
+  FarmMetrics _metrics;
+
+  //! What's been received on each open connection but not yet answered.
+  std::map<QLocalSocket*,std::string> _input;
+};
+
+const std::string RenderService::render(const std::vector<std::string>& words,const std::string& xml)
+{
+  const std::string& size(words[1]);
+  const std::string& format(words[4]);
+  const std::string::size_type p=size.find('x');
+  unsigned long long w=0;
+  unsigned long long h=0;
+  unsigned long long f=0;
+  unsigned long long m=0;
+  if (
+      p==std::string::npos
+      || !parse_unsigned(size.substr(0,p),max_frame_pixels,w)
+      || !parse_unsigned(size.substr(p+1),max_frame_pixels,h)
+      || !parse_unsigned(words[2],max_frames,f)
+      || !parse_unsigned(words[3],max_multisample,m)
+      || w<1 || h<1 || f<1 || m<1
+      || (format!="png" && format!="rgb")
+      )
+    return "error Bad request\n";
+
+  // Each product is checked before it's multiplied further, so none can overflow.
+  if (w*h>max_frame_pixels || w*h*f>max_pixels || w*h*f*m*m>max_samples)
+    return "error Request too large\n";
+
+  const int width=w;
+  const int height=h;
+  const uint frames=f;
+  const uint multisample=m;
+
+  std::string report;
+  std::istringstream in(xml);
+  const boost::shared_ptr<const MutatableImage> imagefn(MutatableImage::load_function(_function_registry,in,report));
+  if (!imagefn)
+    {
+      std::replace(report.begin(),report.end(),'\n',' ');
+      return "error Function not loaded: "+report+"\n";
+    }
+
+  // The function is saved again for the key, so differences in layout or formatting of the XML don't matter.
+  std::ostringstream key_text;
+  imagefn->save_function(key_text);
+  key_text << width << "x" << height << " " << frames << " " << multisample << " " << format;
+  const std::string key(QCryptographicHash::hash(QByteArray(key_text.str().c_str()),QCryptographicHash::Sha1).toHex().constData());
+
+  _requests++;
+  const ResultCache::Frames* cached=_cache.find(key);
+  ResultCache::Frames encoded;
+  if (cached)
+    {
+      _hits++;
+      encoded=*cached;
+    }
+  else
+    {
+      CollectedOutput output;
+      if (!_renderer.render(imagefn,QSize(width,height),frames,false,multisample,output))
+	return "error Couldn't render\n";
+      for (uint f=0;f<output.frames().size();f++)
+	{
+	  std::string data;
+	  if (!encode_frame(output.frames()[f],format=="png",_renderer.num_threads(),data))
+	    return "error Couldn't encode frame\n";
+	  encoded.push_back(data);
+	}
+      _cache.insert(key,encoded);
+    }
+  std::clog << "Request " << _requests << ": " << width << "x" << height << " " << frames << " frames, " << (cached ? "hit" : "miss") << "\n";
+
+  std::ostringstream response;
+  response << "ok " << encoded.size() << " " << (cached ? "hit" : "miss") << "\n";
+  for (uint f=0;f<encoded.size();f++)
+    response << encoded[f].size() << "\n" << encoded[f];
+  return response.str();
+}
+
+const std::string RenderService::respond(const std::vector<std::string>& words,const std::string& xml)
+{
+  const std::string command(words.empty() ? "" : words[0]);
+  if (command=="render")
+    {
+      return render(words,xml);
+    }
+  else if (command=="stats")
+    {
+      std::ostringstream stats;
+      stats << "ok " << _requests << " requests " << _hits << " hits " << _cache.entries() << " cached " << _cache.bytes() << " bytes\n";
+      return stats.str();
+    }
+  else if (command=="metrics")
+    {
+      FarmMetrics metrics;
+      _renderer.metrics(metrics);
+      std::ostringstream json;
+      metrics_json(json << "ok ",metrics,_metrics) << "\n";
+      _metrics=metrics;
+      return json.str();
+    }
+  else
+    {
+      return "error Unknown request\n";
+    }
+}
+
+void RenderService::accept(QLocalSocket* socket)
+{
+  _input[socket];
+  QObject::connect(socket,&QLocalSocket::readyRead,[this,socket](){receive(socket);});
+  QObject::connect
+    (
+     socket,&QLocalSocket::disconnected,
+     [this,socket]()
+     {
+       _input.erase(socket);
+       socket->deleteLater();
+     }
+     );
+  receive(socket);
+}
+
+/*! Requests are answered as they complete, whichever connection they arrive on,
+  so an idle or slow client holds up nobody else (though a render holds up everything until it's done).
+  Responses are queued on the socket and sent from the event loop.
+ */
+void RenderService::receive(QLocalSocket* socket)
+{
+  if (_input.find(socket)==_input.end()) return;
+  const QByteArray data(socket->readAll());
+  _input[socket].append(data.constData(),data.size());
+
+  while (true)
+    {
+      // Look the connection up afresh each time, in case answering the last request found it had gone.
+      const std::map<QLocalSocket*,std::string>::iterator it=_input.find(socket);
+      if (it==_input.end()) return;
+      std::string& input=(*it).second;
+
+      const std::string::size_type eol=input.find('\n');
+      if (eol==std::string::npos)
+	{
+	  if (input.size()>max_line_length) hang_up(socket,"error Bad request\n");
+	  return;
+	}
+
+      std::istringstream fields(input.substr(0,eol));
+      std::vector<std::string> words;
+      std::string word;
+      while (fields >> word) words.push_back(word);
+
+      size_t consumed=eol+1;
+      std::string xml;
+      if (!words.empty() && words[0]=="render")
+	{
+	  // Without a length there's no telling where the XML ends, so the connection can't continue.
+	  unsigned long long length=0;
+	  if (words.size()!=6 || !parse_unsigned(words[5],ULLONG_MAX,length))
+	    {
+	      hang_up(socket,"error Bad request\n");
+	      return;
+	    }
+	  if (length>max_xml_length)
+	    {
+	      hang_up(socket,"error Function too long\n");
+	      return;
+	    }
+	  if (input.size()<consumed+length) return;
+	  xml.assign(input,consumed,length);
+	  consumed+=length;
+	}
+      input.erase(0,consumed);
+
+      const std::string response(respond(words,xml));
+      socket->write(response.data(),response.size());
+    }
+}
+
+void RenderService::hang_up(QLocalSocket* socket,const std::string& response)
+{
+  _input.erase(socket);
+  socket->write(response.data(),response.size());
+  // Pending data is written before the connection closes.
+  socket->disconnectFromServer();
+}
+
+//! Send one render request and write the frames it returns.  Returns an exit status.
+static int client(const std::string& socket_name,const std::string& size,uint frames,uint multisample,const std::string& format,const std::string& output_filename)
+{
+  QLocalSocket socket;
+  socket.connectToServer(QString::fromLocal8Bit(socket_name.c_str()));
+  if (!socket.waitForConnected(client_timeout_ms))
+    {
+      std::cerr << "evolvotron_serve: Error: Couldn't connect to " << socket_name << "\n";
+      return 1;
+    }
+
+  std::ostringstream xml;
+  xml << std::cin.rdbuf();
+  std::ostringstream request;
+  request << "render " << size << " " << frames << " " << multisample << " " << format << " " << xml.str().size() << "\n" << xml.str();
+
+  std::string line;
+  if (!write_bytes(socket,request.str()) || !read_line(socket,line))
+    {
+      std::cerr << "evolvotron_serve: Error: No response from " << socket_name << "\n";
+      return 1;
+    }
+  std::istringstream fields(line);
+  std::string status;
+  uint n=0;
+  std::string cached;
+  fields >> status >> n >> cached;
+  if (status!="ok")
+    {
+      std::cerr << "evolvotron_serve: Error: " << line << "\n";
+      return 1;
+    }
+  std::clog << "Result was a cache " << cached << "\n";
+
+  for (uint f=0;f<n;f++)
+    {
+      size_t length=0;
+      std::string data;
+      if (!read_line(socket,line) || !(std::istringstream(line) >> length) || !read_bytes(socket,length,data))
+	{
+	  std::cerr << "evolvotron_serve: Error: Incomplete response from " << socket_name << "\n";
+	  return 1;
+	}
+      if (output_filename=="-")
+	{
+	  std::cout.write(data.data(),data.size());
+	}
+      else
+	{
+	  const std::string filename(frame_filename(output_filename,f,n));
+	  std::ofstream file(filename.c_str(),std::ios::out|std::ios::binary);
+	  file.write(data.data(),data.size());
+	  file.flush();
+	  if (!file)
+	    {
+	      std::cerr << "evolvotron_serve: Error: Couldn't write " << filename << "\n";
+	      return 1;
+	    }
+	}
+    }
+  std::cout.flush();
+  return 0;
+}
+
+//! Application code
+int main(int argc,char* argv[])
+{
+  QCoreApplication app(argc,argv);
+  {
+    uint cache_mb;
+    bool client_mode;
+    std::string format;
+    uint frames;
+    bool help;
+    uint multisample;
+    std::string output_filename;
+    std::string size;
+    std::string socket_name;
+    uint threads;
+    bool verbose;
+
+    boost::program_options::options_description options_desc("Options");
+    {
+      using namespace boost::program_options;
+      options_desc.add_options()
+	("cache"        ,value<uint>(&cache_mb)->default_value(256)        ,"Megabytes of rendered results to cache")
+	("client,c"     ,bool_switch(&client_mode)                         ,"Send a function from stdin to a running server, and write what it returns")
+	("format,F"     ,value<std::string>(&format)->default_value("png") ,"Client: format requested (png or rgb)")
+	("frames,f"     ,value<uint>(&frames)->default_value(1)            ,"Client: frames to render")
+	("help,h"       ,bool_switch(&help)                                ,"Print command-line options help message and exit")
+	("multisample,m",value<uint>(&multisample)->default_value(1)       ,"Client: multisample grid")
+	("output,o"     ,value<std::string>(&output_filename)->default_value("-"),"Client: output file (- for stdout)")
+	("size,s"       ,value<std::string>(&size)->default_value("64x64") ,"Client: size to render")
+	("socket,S"     ,value<std::string>(&socket_name)->default_value("evolvotron"),"Local socket name or path")
+	("threads,t"    ,value<uint>(&threads)->default_value(get_number_of_processors()),"Number of compute threads")
+	("verbose,v"    ,bool_switch(&verbose)                             ,"Log requests to stderr")
+	;
+    }
+
+    boost::program_options::variables_map options;
+    boost::program_options::store(boost::program_options::parse_command_line(argc,argv,options_desc),options);
+    boost::program_options::notify(options);
+
+    if (help)
+      {
+	std::cerr << options_desc;
+	return 0;
+      }
+
+    if (verbose) 
+      std::clog.rdbuf(std::cerr.rdbuf());
+    else
+      std::clog.rdbuf(sink_ostream.rdbuf());
+
+    if (client_mode)
+      return client(socket_name,size,frames,multisample,format,output_filename);
+
+    // A socket left by a server which was killed would stop a new one listening,
+    // but one still being answered belongs to a running server.
+    {
+      QLocalSocket probe;
+      probe.connectToServer(QString::fromLocal8Bit(socket_name.c_str()));
+      if (probe.waitForConnected(1000))
+	{
+	  std::cerr << "evolvotron_serve: Error: A server is already listening on " << socket_name << "\n";
+	  return 1;
+	}
+    }
+    QLocalServer::removeServer(QString::fromLocal8Bit(socket_name.c_str()));
+    QLocalServer server;
+    if (!server.listen(QString::fromLocal8Bit(socket_name.c_str())))
+      {
+	std::cerr << "evolvotron_serve: Error: Couldn't listen on " << socket_name << ": " << server.errorString().toLocal8Bit().constData() << "\n";
+	return 1;
+      }
+    std::cerr << "Listening on " << server.fullServerName().toLocal8Bit().constData() << "\n";
+
+    // Renders use every thread, so requests are answered one at a time, but from any number of connections.
+    RenderService service(threads,static_cast<size_t>(cache_mb)<<20);
+    QObject::connect
+      (
+       &server,&QLocalServer::newConnection,
+       [&server,&service]()
+       {
+	 while (QLocalSocket*const socket=server.nextPendingConnection())
+	   service.accept(socket);
+       }
+       );
+    return app.exec();
+  }
+}
@@ -0,0 +1,243 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class BandImageWriter.
+*/
+
+#include "band_image_writer.h"
+
+#include "image_encoder.h"
+
+#include <zlib.h>
+
+//! Append a little-endian 16-bit value.
+static void put_le16(std::vector<unsigned char>& v,unsigned long x)
+{
+  v.push_back(x&0xff);
+  v.push_back((x>>8)&0xff);
+}
+
+//! Append a little-endian 32-bit value.
+static void put_le32(std::vector<unsigned char>& v,unsigned long x)
+{
+  put_le16(v,x&0xffff);
+  put_le16(v,(x>>16)&0xffff);
+}
+
+//! Append a TIFF directory entry.  Values of SHORT type fit in the (little-endian) value field the same way as LONGs.
+static void put_tiff_entry(std::vector<unsigned char>& v,uint tag,uint type,unsigned long count,unsigned long value)
+{
+  put_le16(v,tag);
+  put_le16(v,type);
+  put_le32(v,count);
+  put_le32(v,value);
+}
+
+//! Convert RGB32 pixels to packed RGB.
+static void unpack_rgb(const uchar* src,uint pixels,unsigned char* dst)
+{
+  const uint*const p=reinterpret_cast<const uint*>(src);
+  for (uint x=0;x<pixels;x++)
+    {
+      dst[3*x  ]=(p[x]>>16)&0xff;
+      dst[3*x+1]=(p[x]>>8)&0xff;
+      dst[3*x+2]=p[x]&0xff;
+    }
+}
+
+bool BandImageWriter::format(const std::string& filename,Format& f)
+{
+  const QString name(QString::fromLocal8Bit(filename.c_str()).toUpper());
+  if (name.endsWith(".PNG")) f=FormatPNG;
+  else if (name.endsWith(".TIF") || name.endsWith(".TIFF")) f=FormatTIFF;
+  else return false;
+  return true;
+}
+
+BandImageWriter::BandImageWriter(const std::string& filename,Format format,const QSize& size,uint frames,int level)
+  :_filename(filename)
+  ,_format(format)
+  ,_size(size)
+  ,_frames(frames)
+  ,_level(level)
+{}
+
+BandImageWriter::~BandImageWriter()
+{
+  if (_zstream) deflateEnd(_zstream.get());
+}
+
+bool BandImageWriter::fail(const std::string& what)
+{
+  _error=what+" "+_current_filename;
+  if (_zstream)
+    {
+      deflateEnd(_zstream.get());
+      _zstream.reset();
+    }
+  return false;
+}
+
+bool BandImageWriter::png_chunk(const char* type,const unsigned char* data,uint length)
+{
+  return write_png_chunk(_out,type,data,length);
+}
+
+/*! The row buffer is consumed.  Output accumulates until it's worth writing an IDAT chunk.
+ */
+bool BandImageWriter::png_deflate(bool finish)
+{
+  const size_t chunk_size=1<<16;
+
+  _zstream->next_in=(_row.empty() ? Z_NULL : &_row[0]);
+  _zstream->avail_in=(finish ? 0 : _row.size());
+  int status;
+  do
+    {
+      const size_t used=_compressed.size();
+      _compressed.resize(used+chunk_size);
+      _zstream->next_out=&_compressed[used];
+      _zstream->avail_out=chunk_size;
+      status=deflate(_zstream.get(),(finish ? Z_FINISH : Z_NO_FLUSH));
+      if (status==Z_STREAM_ERROR) return fail("Compression failed for");
+      _compressed.resize(used+chunk_size-_zstream->avail_out);
+
+      if (_compressed.size()>=chunk_size || (finish && status==Z_STREAM_END))
+	{
+	  if (!png_chunk("IDAT",&_compressed[0],_compressed.size())) return fail("Couldn't write");
+	  _compressed.clear();
+	}
+    }
+  while (finish ? status!=Z_STREAM_END : _zstream->avail_in>0);
+  return true;
+}
+
+/*! Strips are one row each, so readers needn't hold more than a row either.
+  Classic TIFF offsets are 32-bit, which limits files to 4GB.
+ */
+bool BandImageWriter::begin_tiff()
+{
+  const unsigned long w=_size.width();
+  const unsigned long h=_size.height();
+  const uint entries=10;
+  const unsigned long bits_offset=8+2+12*entries+4;
+  const unsigned long strip_offsets_offset=bits_offset+8;
+  const unsigned long strip_counts_offset=strip_offsets_offset+4*h;
+  const unsigned long data_offset=strip_counts_offset+4*h;
+  if (static_cast<unsigned long long>(data_offset)+3ULL*w*h>0xffffffffULL)
+    return fail("Image too large for TIFF:");
+
+  std::vector<unsigned char> header;
+  header.push_back('I');
+  header.push_back('I');
+  put_le16(header,42);
+  put_le32(header,8);
+
+  put_le16(header,entries);
+  put_tiff_entry(header,256,4,1,w);                                          // ImageWidth
+  put_tiff_entry(header,257,4,1,h);                                          // ImageLength
+  put_tiff_entry(header,258,3,3,bits_offset);                                // BitsPerSample
+  put_tiff_entry(header,259,3,1,1);                                          // Compression: none
+  put_tiff_entry(header,262,3,1,2);                                          // PhotometricInterpretation: RGB
+  put_tiff_entry(header,273,4,h,(h==1 ? data_offset : strip_offsets_offset)); // StripOffsets
+  put_tiff_entry(header,277,3,1,3);                                          // SamplesPerPixel
+  put_tiff_entry(header,278,4,1,1);                                          // RowsPerStrip
+  put_tiff_entry(header,279,4,h,(h==1 ? 3*w : strip_counts_offset));        // StripByteCounts
+  put_tiff_entry(header,284,3,1,1);                                          // PlanarConfiguration: chunky
+  put_le32(header,0);
+
+  for (uint i=0;i<3;i++) put_le16(header,8);
+  put_le16(header,0);
+
+  for (unsigned long y=0;y<h;y++) put_le32(header,data_offset+3*w*y);
+  for (unsigned long y=0;y<h;y++) put_le32(header,3*w);
+  assert(header.size()==data_offset);
+
+  _out.write(reinterpret_cast<const char*>(&header[0]),header.size());
+  return (_out.good() || fail("Couldn't write"));
+}
+
+bool BandImageWriter::begin_frame(uint frame)
+{
+  _current_filename=frame_filename(_filename,frame,_frames);
+  _out.open(_current_filename.c_str(),std::ios::out|std::ios::binary|std::ios::trunc);
+  if (!_out) return fail("Couldn't open");
+
+  if (_format==FormatTIFF) return begin_tiff();
+
+  if (!write_png_header(_out,_size)) return fail("Couldn't write");
+
+  _zstream.reset(new z_stream);
+  memset(_zstream.get(),0,sizeof(z_stream));
+  if (deflateInit(_zstream.get(),_level)!=Z_OK)
+    {
+      _zstream.reset();
+      return fail("Couldn't initialise compression for");
+    }
+  _previous_row.assign(3*_size.width(),0);
+  _compressed.clear();
+  return true;
+}
+
+/*! PNG rows all use the "up" filter, which is cheap and suits the smooth gradients typical of evolvotron images.
+ */
+bool BandImageWriter::rows(uint frame,const QImage& band,int begin)
+{
+  if (begin==0 && !begin_frame(frame)) return false;
+
+  const uint w=_size.width();
+  for (int row=0;row<band.height();row++)
+    {
+      if (_format==FormatTIFF)
+	{
+	  _row.resize(3*w);
+	  unpack_rgb(band.constScanLine(row),w,&_row[0]);
+	  _out.write(reinterpret_cast<const char*>(&_row[0]),_row.size());
+	  if (!_out.good()) return fail("Couldn't write");
+	}
+      else
+	{
+	  _row.resize(1+3*w);
+	  _row[0]=2;
+	  unpack_rgb(band.constScanLine(row),w,&_row[1]);
+	  for (uint i=0;i<3*w;i++)
+	    {
+	      const unsigned char v=_row[1+i];
+	      _row[1+i]=v-_previous_row[i];
+	      _previous_row[i]=v;
+	    }
+	  if (!png_deflate(false)) return false;
+	}
+    }
+  return true;
+}
+
+bool BandImageWriter::frame(uint /*frame*/,const QImage& /*image*/)
+{
+  if (_format==FormatPNG)
+    {
+      if (!png_deflate(true)) return false;
+      deflateEnd(_zstream.get());
+      _zstream.reset();
+      if (!png_chunk("IEND",0,0)) return fail("Couldn't write");
+    }
+  _out.close();
+  return (!_out.fail() || fail("Couldn't write"));
+}
@@ -0,0 +1,130 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class BandImageWriter.
+*/
+
+#ifndef _band_image_writer_h_
+#define _band_image_writer_h_
+
+#include "common.h"
+
+#include "tiled_renderer.h"
+
+struct z_stream_s;
+
+//! Writes PNG or (uncompressed) TIFF files a band of rows at a time, so whole frames are never held in memory.
+/*! One file is written per frame, numbered as by frame_filename.
+ */
+class BandImageWriter : public TiledRenderer::Output
+{
+ public:
+
+  //! File formats.
+  enum Format
+    {
+      FormatPNG,
+      FormatTIFF
+    };
+
+  //! Choose a format from a filename suffix (.png, .tif or .tiff).  Returns false if unsupported.
+  static bool format(const std::string& filename,Format& f);
+
+  //! Constructor.
+  /*! level is the zlib compression level for PNG (0-9, or -1 for zlib's default).
+   */
+  BandImageWriter(const std::string& filename,Format format,const QSize& size,uint frames,int level=-1);
+
+  //! Destructor.
+  virtual ~BandImageWriter();
+
+  //! Only bands of rows are needed.
+  virtual Assembly assembly() const
+    {
+      return AssembleBands;
+    }
+
+  //! Encode the rows.
+  virtual bool rows(uint frame,const QImage& band,int begin);
+
+  //! Finish the frame's file.
+  virtual bool frame(uint frame,const QImage& image);
+
+  //! Description of the last failure.
+  const std::string& error() const
+    {
+      return _error;
+    }
+
+ private:
+
+  //! Open the frame's file and write headers.
+  bool begin_frame(uint frame);
+
+  //! Write the TIFF header, directory and strip tables.
+  bool begin_tiff();
+
+  //! Write a PNG chunk.
+  bool png_chunk(const char* type,const unsigned char* data,uint length);
+
+  //! Compress the filtered row buffer into IDAT chunks (or finish the stream if finish is set).
+  bool png_deflate(bool finish);
+
+  //! Record a failure.
+  bool fail(const std::string& what);
+
+  //! Filename (before frame numbering).
+  const std::string _filename;
+
+  //! Format written.
+  const Format _format;
+
+  //! Frame size.
+  const QSize _size;
+
+  //! Number of frames.
+  const uint _frames;
+
+  //! PNG compression level.
+  const int _level;
+
+  //! The file being written.
+  std::ofstream _out;
+
+  //! Name of the file being written.
+  std::string _current_filename;
+
+  //! Row buffer.
+  std::vector<unsigned char> _row;
+
+  //! Previous row (unfiltered), for PNG's "up" filter.
+  std::vector<unsigned char> _previous_row;
+
+  //! Compressor state for PNG.
+  std::unique_ptr<z_stream_s> _zstream;
+
+  //! Compressed data awaiting output as an IDAT chunk.
+  std::vector<unsigned char> _compressed;
+
+  //! Description of the last failure.
+  std::string _error;
+};
+
+#endif
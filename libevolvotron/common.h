@@ -34,7 +34,9 @@
 #include <QCursor>
 #include <QDateTime>
 #include <QDialog>
+#include <QDockWidget>
 #include <QFileDialog>
+#include <QFontDatabase>
 #include <QGroupBox>
 #include <QImage>
 #include <QKeyEvent>
@@ -61,6 +63,7 @@
 #include <QTextEdit>
 #include <QThread>
 #include <QTimer>
+#include <QToolButton>
 #include <QToolTip>
 #include <QWaitCondition>
 #include <QWidget>
@@ -0,0 +1,67 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of false-colouring per-pixel compute costs.
+*/
+
+#include "cost_map.h"
+
+float cost_map_scale(const std::vector<float>& cost)
+{
+  if (cost.empty()) return 1.0f;
+  std::vector<float> sorted(cost);
+  const std::vector<float>::iterator percentile=sorted.begin()+(99*(sorted.size()-1))/100;
+  std::nth_element(sorted.begin(),percentile,sorted.end());
+  return (*percentile>0.0f ? *percentile : 1.0f);
+}
+
+/*! Colours are interpolated linearly between evenly spaced stops.
+ */
+const QImage cost_map_image(const float* cost,const QSize& size,float scale)
+{
+  static const uint stops[6][3]=
+    {
+      {  0,  0,  0},
+      {  0,  0,192},
+      {192,  0,192},
+      {255,  0,  0},
+      {255,255,  0},
+      {255,255,255}
+    };
+
+  QImage image(size,QImage::Format_RGB32);
+  for (int row=0;row<size.height();row++)
+    {
+      QRgb*const line=reinterpret_cast<QRgb*>(image.scanLine(row));
+      for (int col=0;col<size.width();col++)
+	{
+	  const float v=5.0f*std::min(1.0f,std::max(0.0f,cost[row*size.width()+col]/scale));
+	  const uint i=std::min(4u,static_cast<uint>(v));
+	  const float t=v-i;
+	  line[col]=qRgb
+	    (
+	     lrint(stops[i][0]+t*(static_cast<float>(stops[i+1][0])-stops[i][0])),
+	     lrint(stops[i][1]+t*(static_cast<float>(stops[i+1][1])-stops[i][1])),
+	     lrint(stops[i][2]+t*(static_cast<float>(stops[i+1][2])-stops[i][2]))
+	     );
+	}
+    }
+  return image;
+}
@@ -0,0 +1,40 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for false-colouring per-pixel compute costs.
+*/
+
+#ifndef _cost_map_h_
+#define _cost_map_h_
+
+#include "common.h"
+#include "useful.h"
+
+//! Cost which cost_map_image shows at full brightness: the 99th percentile of the costs (or 1 if that's zero).
+/*! A percentile rather than the maximum, so a few pixels slowed by something else (e.g the thread being preempted) don't darken the rest.
+ */
+extern float cost_map_scale(const std::vector<float>& cost);
+
+//! False-colour image of the costs of an image's pixels (row major), scaled so scale is white.
+/*! Costs run from black through blue, magenta, red and yellow; anything beyond scale saturates.
+ */
+extern const QImage cost_map_image(const float* cost,const QSize& size,float scale);
+
+#endif
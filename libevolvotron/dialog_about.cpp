@@ -26,9 +26,11 @@
 #include "dialog_about.h"
 
 #include "license.h"
+#include "memory_account.h"
 
 DialogAbout::DialogAbout(QWidget* parent,int n_threads,bool separate_farm_for_enlargements)
   :QDialog(parent)
+  ,_memory(0)
 {
   assert(parent!=0);
 
@@ -45,6 +47,10 @@ DialogAbout::DialogAbout(QWidget* parent,int n_threads,bool separate_farm_for_en
   tab_info->setLayout(new QVBoxLayout);
   tabs->addTab(tab_info,"Info");
 
+  QWidget*const tab_memory=new QWidget;
+  tab_memory->setLayout(new QVBoxLayout);
+  tabs->addTab(tab_memory,"Memory");
+
   QWidget*const tab_license=new QWidget;
   tab_license->setLayout(new QVBoxLayout);
   tabs->addTab(tab_license,"License");
@@ -73,6 +79,13 @@ DialogAbout::DialogAbout(QWidget* parent,int n_threads,bool separate_farm_for_en
   label->setAlignment(Qt::AlignTop);
   label->setOpenExternalLinks(true);
   
+  _memory=new QLabel;
+  tab_memory->layout()->addWidget(_memory);
+  _memory->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  _memory->setAlignment(Qt::AlignTop);
+  _memory->setTextInteractionFlags(Qt::TextSelectableByMouse);
+  update_memory();
+
   QTextEdit*const license=new QTextEdit;
   tab_license->layout()->addWidget(license);
   license->setReadOnly(true);
@@ -91,3 +104,10 @@ DialogAbout::DialogAbout(QWidget* parent,int n_threads,bool separate_farm_for_en
 
 DialogAbout::~DialogAbout()
 {}
+
+void DialogAbout::update_memory()
+{
+  std::ostringstream table;
+  MemoryAccount::report(table);
+  _memory->setText(table.str().c_str());
+}
@@ -27,13 +27,16 @@
 #include "common.h"
 
 //! Provides an "About" dialog box.
-/*! About dialog displays author info, web addresses and license info.
+/*! About dialog displays author info, web addresses, license info and where memory is going.
  */
 class DialogAbout : public QDialog
 {
  private:
   Q_OBJECT
 
+  //! Table of memory accounts.
+  QLabel* _memory;
+
  public:
 
   //! Constructor.
@@ -41,6 +44,9 @@ class DialogAbout : public QDialog
 
   //! Destructor.
   ~DialogAbout();
+
+  //! Show the current memory accounts.
+  void update_memory();
 };
 
 #endif
@@ -25,6 +25,37 @@
 
 #include "dialog_mutatable_image_display.h"
 
+#include "function_top.h"
+#include "mutatable_image.h"
+
+namespace
+{
+  //! Side of the (square) profiling render.
+  const int profile_size=64;
+
+  //! Write a line for a node and (indented) each of its arguments with its share of the total time and its evaluations per sample.
+  void annotate
+  (
+   std::ostream& out,
+   const FunctionNode& node,
+   uint depth,
+   const std::map<const void*,FunctionProfile::Totals>& node_totals,
+   double total_ns,
+   double samples
+   )
+  {
+    const std::map<const void*,FunctionProfile::Totals>::const_iterator it=node_totals.find(static_cast<const Function*>(&node));
+    const FunctionProfile::Totals totals(it==node_totals.end() ? FunctionProfile::Totals() : it->second);
+    out
+      << std::setw(8) << 100.0*totals.inclusive_ns/total_ns << "%"
+      << std::setw(8) << 100.0*totals.exclusive_ns/total_ns << "%"
+      << std::setw(10) << totals.calls/samples
+      << "  " << std::string(2*depth,' ') << node.thisname() << "\n";
+    for (uint i=0;i<node.args().size();i++)
+      annotate(out,node.arg(i),depth+1,node_totals,total_ns,samples);
+  }
+}
+
 DialogMutatableImageDisplay::DialogMutatableImageDisplay(QWidget* parent)
   :QDialog(parent)
 {
@@ -43,6 +74,21 @@ DialogMutatableImageDisplay::DialogMutatableImageDisplay(QWidget* parent)
   _textedit_xml->setReadOnly(true);
   _tabs->addTab(_textedit_xml,"Detail");
 
+  QWidget*const tab_profile=new QWidget;
+  tab_profile->setLayout(new QVBoxLayout);
+  _tabs->addTab(tab_profile,"Profile");
+
+  std::ostringstream button_text;
+  button_text << "Time each node over a " << profile_size << "x" << profile_size << " render";
+  _button_profile=new QPushButton(button_text.str().c_str());
+  tab_profile->layout()->addWidget(_button_profile);
+
+  _textedit_profile=new QTextEdit;
+  _textedit_profile->setReadOnly(true);
+  _textedit_profile->setLineWrapMode(QTextEdit::NoWrap);
+  _textedit_profile->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  tab_profile->layout()->addWidget(_textedit_profile);
+
   _ok=new QPushButton("OK");
   _ok->setDefault(true);
   layout()->addWidget(_ok);
@@ -51,13 +97,21 @@ DialogMutatableImageDisplay::DialogMutatableImageDisplay(QWidget* parent)
 	  _ok,SIGNAL(clicked()),
 	  this,SLOT(hide())
 	  );
+
+  connect(
+	  _button_profile,SIGNAL(clicked()),
+	  this,SLOT(profile())
+	  );
 }
 
 DialogMutatableImageDisplay::~DialogMutatableImageDisplay()
 {}
 
-void DialogMutatableImageDisplay::set_content(const std::string& m,const std::string& x)
+void DialogMutatableImageDisplay::set_content(const std::string& m,const std::string& x,const boost::shared_ptr<const MutatableImage>& image_function)
 {
+  _image_function=image_function;
+  _textedit_profile->clear();
+
   _label_info->setText(QString(m.c_str()));
   _label_info->adjustSize();
 
@@ -66,3 +120,34 @@ void DialogMutatableImageDisplay::set_content(const std::string& m,const std::st
   adjustSize();
   updateGeometry();
 }
+
+/*! The render is on this thread (so every node is evaluated for every sample),
+  and the time in each node includes that of its arguments (a node's own share excludes them).
+ */
+void DialogMutatableImageDisplay::profile()
+{
+  if (!_image_function) return;
+
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  FunctionProfile profile;
+  const unsigned long long total_ns=_image_function->profile_nodes(QSize(profile_size,profile_size),profile);
+  QApplication::restoreOverrideCursor();
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << "Total " << total_ns*1e-6 << "ms for " << profile_size*profile_size << " samples\n\n";
+  out << std::setw(9) << "subtree" << std::setw(9) << "own" << std::setw(10) << "calls" << "  node\n";
+
+  // The top node's own transforms aren't evaluated as a node, so its share is whatever its argument doesn't account for.
+  const FunctionTop& top=_image_function->top();
+  const std::map<const void*,FunctionProfile::Totals>::const_iterator it=profile.node_totals().find(static_cast<const Function*>(&top.arg(0)));
+  const unsigned long long arg_ns=(it==profile.node_totals().end() ? 0 : it->second.inclusive_ns);
+  out
+    << std::setw(8) << 100.0 << "%"
+    << std::setw(8) << (total_ns ? 100.0*(total_ns-std::min(total_ns,arg_ns))/total_ns : 0.0) << "%"
+    << std::setw(10) << 1.0
+    << "  " << top.thisname() << "\n";
+  annotate(out,top.arg(0),1,profile.node_totals(),std::max(1ull,total_ns),profile_size*profile_size);
+
+  _textedit_profile->setPlainText(out.str().c_str());
+}
@@ -25,6 +25,9 @@
 #define _dialog_mutatable_image_display_h_
 
 #include "common.h"
+#include "useful.h"
+
+class MutatableImage;
 
 //! Provides a "Properties" style dialog box for manipulating 
 /*! Make this modal for simplicity: 
@@ -47,6 +50,15 @@ class DialogMutatableImageDisplay : public QDialog
   //! Scrolling text area for XML description.
   QTextEdit* _textedit_xml;
 
+  //! Starts a profiling render.
+  QPushButton* _button_profile;
+
+  //! Scrolling text area for the function tree annotated with the time spent in each node.
+  QTextEdit* _textedit_profile;
+
+  //! The image described.
+  boost::shared_ptr<const MutatableImage> _image_function;
+
   //! Button to close dialog.
   QPushButton* _ok;
 
@@ -57,8 +69,13 @@ class DialogMutatableImageDisplay : public QDialog
   //! Destructor.
   ~DialogMutatableImageDisplay();
 
-  //! Set content of main text and scrolling area.
-  void set_content(const std::string& m,const std::string& x);
+  //! Set content of main text and scrolling area, and the image which can be profiled.
+  void set_content(const std::string& m,const std::string& x,const boost::shared_ptr<const MutatableImage>& image_function);
+
+ protected slots:
+
+  //! Time each node over a small render of the image, and show the results.
+  void profile();
 };
 
 #endif
@@ -0,0 +1,105 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+/*! \file
+  \brief Implementation of class DialogProfile.
+*/
+
+#include "dialog_profile.h"
+
+#include "evolvotron_main.h"
+#include "function_profile.h"
+
+DialogProfile::DialogProfile(EvolvotronMain* parent)
+  :QDialog(parent)
+  ,_parent(parent)
+{
+  setWindowTitle("Function profile");
+  setMinimumSize(720,480);
+  setSizeGripEnabled(true);
+
+  QBoxLayout* lo = new QVBoxLayout(this);
+
+  _enabled=new QCheckBox("Count and time evaluations (slows computation)");
+  lo->addWidget(_enabled);
+
+  _table=new QTextEdit;
+  _table->setReadOnly(true);
+  _table->setLineWrapMode(QTextEdit::NoWrap);
+  _table->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  lo->addWidget(_table);
+
+  QBoxLayout*const buttons=new QHBoxLayout;
+  lo->addLayout(buttons);
+
+  QPushButton*const reset=new QPushButton("Reset");
+  buttons->addWidget(reset);
+
+  QPushButton*const ok=new QPushButton("OK");
+  buttons->addWidget(ok);
+  ok->setDefault(true);
+
+  _timer=new QTimer(this);
+
+  connect(_enabled,SIGNAL(toggled(bool)),this,SLOT(changed_enabled(bool)));
+
+  connect(reset,SIGNAL(clicked()),this,SLOT(reset()));
+
+  connect(ok,SIGNAL(clicked()),this,SLOT(hide()));
+
+  connect(_timer,SIGNAL(timeout()),this,SLOT(refresh()));
+}
+
+DialogProfile::~DialogProfile()
+{}
+
+void DialogProfile::showEvent(QShowEvent* e)
+{
+  // Profiling may have been enabled from the command line.
+  _enabled->setChecked(FunctionProfile::enabled());
+  refresh();
+  _timer->start(1000);
+  QDialog::showEvent(e);
+}
+
+void DialogProfile::hideEvent(QHideEvent* e)
+{
+  _timer->stop();
+  QDialog::hideEvent(e);
+}
+
+void DialogProfile::changed_enabled(bool b)
+{
+  FunctionProfile::enabled(b);
+}
+
+void DialogProfile::reset()
+{
+  _parent->reset_profile();
+  refresh();
+}
+
+void DialogProfile::refresh()
+{
+  std::vector<FunctionProfile::Totals> totals;
+  _parent->profile(totals);
+
+  std::ostringstream table;
+  FunctionProfile::report(table,totals);
+  _table->setPlainText(table.str().c_str());
+}
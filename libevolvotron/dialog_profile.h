@@ -0,0 +1,77 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+/*! \file 
+  \brief Interface for class DialogProfile.
+*/
+
+#ifndef _dialog_profile_h_
+#define _dialog_profile_h_
+
+#include "common.h"
+
+class EvolvotronMain;
+
+//! Provides a dialog showing how much time is spent evaluating each type of function.
+/*! Profiling (see FunctionProfile) slows computation, so it's only enabled while the checkbox is set.
+  The table covers both compute farms and is refreshed every second while the dialog is shown.
+ */
+class DialogProfile : public QDialog
+{
+ private:
+  Q_OBJECT
+
+ protected:
+  //! Owner.
+  EvolvotronMain* _parent;
+
+  //! Controls whether profiling is enabled.
+  QCheckBox* _enabled;
+
+  //! Shows the table.
+  QTextEdit* _table;
+
+  //! Triggers refreshes.
+  QTimer* _timer;
+
+  //! Start refreshing when shown.
+  virtual void showEvent(QShowEvent* e);
+
+  //! Stop refreshing when hidden.
+  virtual void hideEvent(QHideEvent* e);
+
+ protected slots:
+
+  //! Invoked on checkbox toggle.
+  void changed_enabled(bool b);
+
+  //! Clear the totals.
+  void reset();
+
+  //! Update the table.
+  void refresh();
+
+ public:
+  //! Constructor.
+  DialogProfile(EvolvotronMain* parent);
+
+  //! Destructor.
+  ~DialogProfile();
+};
+
+#endif
@@ -33,10 +33,30 @@
 #include "dialog_render_parameters.h"
 #include "dialog_functions.h"
 #include "dialog_favourite.h"
+#include "dialog_profile.h"
 #include "function_node.h"
 #include "function_post_transform.h"
 #include "function_pre_transform.h"
 #include "function_top.h"
+#include "memory_account.h"
+#include "trace.h"
+
+namespace
+{
+  //! Function nodes held only by the undo history.
+  MemoryAccount undo_history("undo history","function nodes");
+
+  //! Footprint of the nodes of a tree not already seen (which they then are).
+  long long unseen_footprint(const FunctionNode& node,std::set<const FunctionNode*>& seen)
+  {
+    if (!seen.insert(&node).second) return 0;
+
+    long long bytes=node.footprint();
+    for (FunctionNode::Args::const_iterator it=node.args().begin();it!=node.args().end();it++)
+      bytes+=unseen_footprint(**it,seen);
+    return bytes;
+  }
+}
 
 void EvolvotronMain::History::purge()
 {
@@ -118,6 +138,7 @@ void EvolvotronMain::History::begin_action(const std::string& action_name)
     }
   
   _archive.front().first=action_name;
+  if (!action_name.empty()) _main->_spawn_latency.action(action_name);
 
   while (_archive.size()>max_slots)
     {
@@ -164,6 +185,7 @@ void EvolvotronMain::History::undo()
     }
   else
     {
+      _main->_spawn_latency.action("undo");
       for (ArchiveRecordEntries::iterator it=_archive.front().second.begin();
 	   it!=_archive.front().second.end();
 	   it++
@@ -178,6 +200,26 @@ void EvolvotronMain::History::undo()
   _main->set_undoable(undoable(),action_name);
 }
 
+/*! Archived images are clones sharing most of their nodes with what's displayed, so only the rest are counted.
+ */
+void EvolvotronMain::History::account_memory() const
+{
+  std::set<const FunctionNode*> seen;
+  for (std::set<MutatableImageDisplay*>::const_iterator it=_main->_known_displays.begin();it!=_main->_known_displays.end();it++)
+    if ((*it)->image_function())
+      unseen_footprint((*it)->image_function()->top(),seen);
+
+  long long images=0;
+  long long bytes=0;
+  for (Archive::const_iterator it=_archive.begin();it!=_archive.end();it++)
+    for (ArchiveRecordEntries::const_iterator entry=(*it).second.begin();entry!=(*it).second.end();entry++)
+      {
+	images++;
+	bytes+=unseen_footprint((*entry).second->top(),seen);
+      }
+  undo_history.set(images,bytes);
+}
+
 void EvolvotronMain::last_spawned_image(const boost::shared_ptr<const MutatableImage>& image,SpawnMemberFn method)
 {
   _last_spawned_image=image;
@@ -214,14 +256,19 @@ EvolvotronMain::EvolvotronMain
   ,_spheremap(spheremap)
   ,_startup_filenames(startup_filenames)
   ,_startup_shuffle(startup_shuffle)
+  ,_profile_on_close(false)
+  ,_cost_map(false)
   ,_mutation_parameters(time(0),autocool,function_debug_mode,this)
   ,_render_parameters(jitter,multisample_level,this)
   ,_statusbar_tasks_main(0)
   ,_statusbar_tasks_enlargement(0)
+  ,_statusbar_saving(0)
   ,_last_spawn_method(&EvolvotronMain::spawn_normal)
 {
   lockPix = QPixmap(":/icons/lock.png");
 
+  Trace::thread_name("gui");
+
   setMinimumSize(640,480);
 
   // Need to create this first or DialogMutationParameters might cause one to be created too.
@@ -243,6 +290,8 @@ EvolvotronMain::EvolvotronMain
 
   _dialog_favourite=new DialogFavourite(this);
 
+  _dialog_profile=new DialogProfile(this);
+
 #if QT_VERSION >= 0x060400
 #define KEY_ACTION(menu, L, M, K)   menu->addAction(L, K, this, M)
 #else
@@ -267,6 +316,9 @@ EvolvotronMain::EvolvotronMain
   _popupmenu_settings->addAction("Mutation parameters...",_dialog_mutation_parameters,SLOT(show()));
   _popupmenu_settings->addAction("Function weightings...",_dialog_functions,SLOT(show()));
   _popupmenu_settings->addAction("Favourite function...",_dialog_favourite,SLOT(show()));
+  _popupmenu_settings->addAction("Function profile...",_dialog_profile,SLOT(show()));
+  _menu_action_cost_map=_popupmenu_settings->addAction("Cost map overlay",this,SLOT(toggle_cost_map()));
+  _menu_action_cost_map->setCheckable(true);
 
   _popupmenu_settings->addSeparator();
 
@@ -292,7 +344,7 @@ EvolvotronMain::EvolvotronMain
       _popupmenu_help->addAction("User &Manual",_dialog_help_long,SLOT(show()));
   act->setShortcut(QKeySequence::HelpContents);
   _popupmenu_help->addSeparator();
-  _popupmenu_help->addAction("&About",_dialog_about,SLOT(show()));
+  _popupmenu_help->addAction("&About",this,SLOT(about()));
 
   _checkbox_autocool_enable=new QCheckBox("Autocool");
   _checkbox_autocool_enable->setToolTip("Autocooling gradually reduces the chance and magnitude of mutations with time.");
@@ -307,6 +359,21 @@ EvolvotronMain::EvolvotronMain
   _statusbar->addPermanentWidget(_label_autocool_enable);
   _statusbar->addPermanentWidget(_button_autocool_reheat);
 
+  _metrics_label=new QLabel;
+  _metrics_label->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  _metrics_label->setTextInteractionFlags(Qt::TextSelectableByMouse);
+  _metrics_dock=new QDockWidget("Compute metrics",this);
+  _metrics_dock->setObjectName("metrics");
+  _metrics_dock->setWidget(_metrics_label);
+  addDockWidget(Qt::BottomDockWidgetArea,_metrics_dock);
+  _metrics_dock->hide();
+
+  // The dock's own action shows and hides it.
+  QToolButton*const metrics_button=new QToolButton;
+  metrics_button->setDefaultAction(_metrics_dock->toggleViewAction());
+  metrics_button->setToolTip("Show samples computed per second, thread utilisation, queued tasks, task latency and aborted work.");
+  _statusbar->addPermanentWidget(metrics_button);
+
   connect(
 	  &_render_parameters,SIGNAL(changed()),
 	  this,SLOT(render_parameters_changed())
@@ -324,6 +391,9 @@ EvolvotronMain::EvolvotronMain
       _farm[1]=std::unique_ptr<MutatableImageComputerFarm>(new MutatableImageComputerFarm(n_threads,niceness_enlargements));
     }
 
+  // Queued images share their data with the displays, so there's no need to hold up an animation's save by bounding the queue tightly.
+  _encoder=std::unique_ptr<ImageEncoder>(new ImageEncoder(-1,n_threads,1024));
+
   _grid=new QWidget;
   QGridLayout*const grid_layout=new QGridLayout;
   _grid->setLayout(grid_layout);
@@ -346,6 +416,13 @@ EvolvotronMain::EvolvotronMain
   // Run tick() at 100Hz
   _timer->start(10);
 
+  _metrics_timer=new QTimer(this);
+  connect(
+	  _metrics_timer,SIGNAL(timeout()),
+	  this, SLOT(metrics_tick())
+	  );
+  _metrics_timer->start(1000);
+
   if (start_fullscreen)
     {
       showFullScreen();
@@ -380,7 +457,12 @@ EvolvotronMain::~EvolvotronMain()
       (*it)->main(0);
     }
 
-  std::clog << "...cleared displays, deleting farm...\n";
+  std::clog << "...cleared displays, finishing saves...\n";
+
+  // Anything still queued is saved before the encoder stops
+  _encoder.reset();
+
+  std::clog << "...finished saves, deleting farm...\n";
 
   // Shut down the compute farms
   _farm[0].reset();
@@ -407,6 +489,67 @@ void EvolvotronMain::favourite_function_unwrapped(bool v)
   _dialog_favourite->favourite_function_unwrapped(v);
 }
 
+void EvolvotronMain::profile(std::vector<FunctionProfile::Totals>& totals) const
+{
+  for (uint i=0;i<2;i++)
+    if (_farm[i].get()) _farm[i]->profile(totals);
+}
+
+void EvolvotronMain::metrics(FarmMetrics& m) const
+{
+  for (int i=0;i<2;i++)
+    if (_farm[i].get()) _farm[i]->metrics(m);
+}
+
+void EvolvotronMain::metrics_file(const std::string& filename,uint interval_s)
+{
+  _metrics_file=std::unique_ptr<MetricsFile>(new MetricsFile(filename,1000*interval_s));
+}
+
+/*! A metrics file which can't be written is given up on, rather than complained about every second.
+ */
+void EvolvotronMain::metrics_tick()
+{
+  FarmMetrics now;
+  metrics(now);
+
+  if (_metrics_dock->isVisible())
+    {
+      const std::string& latency=_spawn_latency.last_summary();
+      _metrics_label->setText(QString::fromLocal8Bit((metrics_text(now,_metrics_last)+(latency.empty() ? "" : "\nLatency: "+latency)).c_str()));
+    }
+  _metrics_last=now;
+
+  const bool metrics_due=(_metrics_file && _metrics_file->due());
+  if (metrics_due || _dialog_about->isVisible())
+    _history->account_memory();
+  if (_dialog_about->isVisible())
+    _dialog_about->update_memory();
+
+  if (metrics_due)
+    {
+      std::string error;
+      if (!_metrics_file->write(now,error))
+	{
+	  std::cerr << "evolvotron: Error: " << error << "\n";
+	  _metrics_file.reset();
+	}
+    }
+}
+
+void EvolvotronMain::about()
+{
+  _history->account_memory();
+  _dialog_about->update_memory();
+  _dialog_about->show();
+}
+
+void EvolvotronMain::reset_profile()
+{
+  for (uint i=0;i<2;i++)
+    if (_farm[i].get()) _farm[i]->reset_profile();
+}
+
 void EvolvotronMain::spawn_normal(const boost::shared_ptr<const MutatableImage>& image_function,MutatableImageDisplay* display,bool one_of_many)
 {
   boost::shared_ptr<const MutatableImage> new_image_function;
@@ -423,17 +566,24 @@ void EvolvotronMain::spawn_normal(const boost::shared_ptr<const MutatableImage>&
 
 void EvolvotronMain::spawn_recoloured(const boost::shared_ptr<const MutatableImage>& image_function,MutatableImageDisplay* display,bool one_of_many)
 {  
-  std::unique_ptr<FunctionTop> new_root(image_function->top().typed_deepclone());
+  std::unique_ptr<FunctionTop> new_root(image_function->clone_top());
   
   new_root->reset_posttransform_parameters(mutation_parameters());
   history().replacing(display);
   boost::shared_ptr<const MutatableImage> it(new MutatableImage(new_root,image_function->sinusoidal_z(),image_function->spheremap(),false));
+
+  // If the original is on display, its pre-colour values can be recoloured directly without recomputing anything.
+  for (std::vector<MutatableImageDisplay*>::const_iterator d=displays().begin();d!=displays().end();d++)
+    {
+      if ((*d)!=display && (*d)->image_function()==image_function && display->image_function_recoloured(it,**d))
+	return;
+    }
   display->image_function(it,one_of_many);
 }
 
 void EvolvotronMain::spawn_warped(const boost::shared_ptr<const MutatableImage>& image_function,MutatableImageDisplay* display,bool one_of_many)
 {
-  std::unique_ptr<FunctionTop> new_root=std::unique_ptr<FunctionTop>(image_function->top().typed_deepclone());
+  std::unique_ptr<FunctionTop> new_root(image_function->clone_top());
 
   // Get the transform from whatever factory is currently set
   const Transform transform(transform_factory()(mutation_parameters().rng01()));
@@ -574,7 +724,8 @@ void EvolvotronMain::tick()
 {
   const uint tasks_main=_farm[0]->tasks();
   const uint tasks_enlargement=(_farm[1].get() ? _farm[1]->tasks() : 0);
-  if (tasks_main!=_statusbar_tasks_main || tasks_enlargement!=_statusbar_tasks_enlargement)
+  const uint saving=_encoder->pending();
+  if (tasks_main!=_statusbar_tasks_main || tasks_enlargement!=_statusbar_tasks_enlargement || saving!=_statusbar_saving)
     {
       std::ostringstream msg;
       msg << "";
@@ -592,10 +743,32 @@ void EvolvotronMain::tick()
 	    }
 	  msg << " tasks remaining";
 	}
+      if (saving)
+	{
+	  msg << ", saving " << saving << (saving==1 ? " image" : " images");
+	}
 
       _statusbar_tasks_label->setText(msg.str().c_str());
       _statusbar_tasks_main=tasks_main;
       _statusbar_tasks_enlargement=tasks_enlargement;
+      _statusbar_saving=saving;
+    }
+
+  // Saves finish in the background; this is the first chance to report on them.
+  const std::vector<std::string> saved(_encoder->take_saved());
+  for (uint i=0;i<saved.size();i++)
+    {
+      std::clog << "Saved " << saved[i] << "\n";
+    }
+  const std::vector<std::pair<std::string,bool> > saved_batches(_encoder->take_batches());
+  for (uint i=0;i<saved_batches.size();i++)
+    {
+      if (saved_batches[i].second) imagePath=QString::fromLocal8Bit(saved_batches[i].first.c_str());
+    }
+  const std::vector<std::string> save_errors(_encoder->take_errors());
+  for (uint i=0;i<save_errors.size();i++)
+    {
+      QMessageBox::critical(this,"Evolvotron",QString::fromLocal8Bit(save_errors[i].c_str()));
     }
 
   boost::shared_ptr<MutatableImageComputerTask> task;
@@ -608,6 +781,9 @@ void EvolvotronMain::tick()
   QElapsedTimer watchdog;
   watchdog.start();
 
+  const long long trace_begin=(Trace::enabled() ? Trace::now() : 0);
+  uint delivered=0;
+
   for (int which_farm=0;which_farm<(_farm[1].get() ? 2 : 1);which_farm++)
     {
       while ((task=_farm[which_farm]->pop_done())!=0)
@@ -615,6 +791,7 @@ void EvolvotronMain::tick()
 	  if (is_known(task->display()))
 	    {
 	      task->display()->deliver(task);
+	      delivered++;
 	    }
 	  else
 	    {
@@ -628,6 +805,9 @@ void EvolvotronMain::tick()
 	    break;
 	}
     }
+
+  if (delivered && Trace::enabled())
+    Trace::complete("gui","deliver tasks",trace_begin,Trace::Args()("tasks",delivered));
 }    
 
 void EvolvotronMain::closeEvent(QCloseEvent* e)
@@ -637,6 +817,14 @@ void EvolvotronMain::closeEvent(QCloseEvent* e)
   settings.setValue("func-path", functionPath);
   settings.setValue("image-path", imagePath);
 
+  if (_profile_on_close)
+    {
+      std::vector<FunctionProfile::Totals> totals;
+      profile(totals);
+      std::cerr << "Function profile:\n";
+      FunctionProfile::report(std::cerr,totals);
+    }
+
   QMainWindow::closeEvent(e);
 }
 
@@ -679,6 +867,16 @@ void EvolvotronMain::toggle_fullscreen()
     }
 }
 
+/*! Enlargements are known displays too, so they switch as well.
+ */
+void EvolvotronMain::toggle_cost_map()
+{
+  _cost_map=!_cost_map;
+  _menu_action_cost_map->setChecked(_cost_map);
+  for (std::set<MutatableImageDisplay*>::const_iterator it=_known_displays.begin();it!=_known_displays.end();it++)
+    (*it)->cost_map_changed();
+}
+
 void EvolvotronMain::toggle_hide_menu()
 {
   if (menuBar()->isHidden())
@@ -31,9 +31,12 @@
 
 #include "mutatable_image.h"
 #include "mutatable_image_display.h"
+#include "farm_metrics.h"
+#include "image_encoder.h"
 #include "mutatable_image_computer_farm.h"
 #include "mutation_parameters_qobject.h"
 #include "render_parameters.h"
+#include "spawn_latency.h"
 
 class DialogAbout;
 class DialogHelp;
@@ -41,6 +44,7 @@ class DialogMutationParameters;
 class DialogRenderParameters;
 class DialogFunctions;
 class DialogFavourite;
+class DialogProfile;
 
 //! Utility class to expand "restart with" menu picks
 /*! A boost::bind kind of thing
@@ -128,6 +132,9 @@ class EvolvotronMain : public QMainWindow
 
       //! Implements an undo.
       void undo();
+
+      //! Count the function nodes only the archive holds (not shared with any displayed image) in the undo history's MemoryAccount.
+      void account_memory() const;
     };
 
  protected:
@@ -137,6 +144,9 @@ class EvolvotronMain : public QMainWindow
   //! Instance of History object to track activity.
   std::unique_ptr<History> _history;
 
+  //! How long displays take to show what they're given, by the History action responsible.
+  SpawnLatency _spawn_latency;
+
   //! Sweep z linearly through animations
   /*! \todo Move to mutation or render paraemeters ?
    */
@@ -152,6 +162,12 @@ class EvolvotronMain : public QMainWindow
 
   //! Whether to shuffle startup files (if any).
   const bool _startup_shuffle;
+
+  //! Whether to write the function profile to stderr on closing.
+  bool _profile_on_close;
+
+  //! Whether displays show what each pixel cost to compute rather than its colour.
+  bool _cost_map;
   
   //! Instance of mutation parameters for the app
   /*! This used to be held by DialogMutationParameters, but now we want to share it around a bit
@@ -178,6 +194,11 @@ class EvolvotronMain : public QMainWindow
    */
   uint _statusbar_tasks_enlargement;
 
+  //! Number of images the statusbar is currently reporting as being saved
+  /*! Cached to avoid unnecessarily regenerating message
+   */
+  uint _statusbar_saving;
+
   //! The "About" dialog widget.
   DialogAbout* _dialog_about;
 
@@ -199,6 +220,9 @@ class EvolvotronMain : public QMainWindow
   //! Dialog for selecting a favourite function (also holds the state for favourite stuff)
   DialogFavourite* _dialog_favourite;
 
+  //! Dialog showing the function profile.
+  DialogProfile* _dialog_profile;
+
   //! The file menu.
   QMenu* _popupmenu_file;
 
@@ -217,6 +241,9 @@ class EvolvotronMain : public QMainWindow
   //! Action for hiding menubar
   QAction* _menu_action_hide_menu;
 
+  //! Action for the cost map overlay
+  QAction* _menu_action_cost_map;
+
   //! The help menu.
   QMenu* _popupmenu_help;
 
@@ -229,6 +256,21 @@ class EvolvotronMain : public QMainWindow
   //! Button to reheat
   QPushButton* _button_autocool_reheat;
 
+  //! Expandable panel showing the compute farms' metrics.
+  QDockWidget* _metrics_dock;
+
+  //! The metrics shown in the panel.
+  QLabel* _metrics_label;
+
+  //! Timer to drive metrics_tick() slot
+  QTimer* _metrics_timer;
+
+  //! Metrics as of the last metrics_tick().
+  FarmMetrics _metrics_last;
+
+  //! Where metrics are written for monitoring, if anywhere.
+  std::unique_ptr<MetricsFile> _metrics_file;
+
   //! Grid for image display areas
   QWidget* _grid;
 
@@ -238,6 +280,9 @@ class EvolvotronMain : public QMainWindow
   //! Two farms of compute threads.  One for the main display, one for enlargements.
   std::unique_ptr<MutatableImageComputerFarm> _farm[2];
 
+  //! Saves images in the background, so large saves don't freeze the app.
+  std::unique_ptr<ImageEncoder> _encoder;
+
   //! All the displays in the grid.
   std::vector<MutatableImageDisplay*> _displays;
 
@@ -336,6 +381,24 @@ class EvolvotronMain : public QMainWindow
   //! Accessor.  Forwards to DialogFavourite.
   void favourite_function_unwrapped(bool v);
 
+  //! Accessor.
+  void profile_on_close(bool v)
+    {
+      _profile_on_close=v;
+    }
+
+  //! Accessor.
+  bool cost_map() const
+    {
+      return _cost_map;
+    }
+
+  //! Add the function profiles of both farms' compute threads to totals.
+  void profile(std::vector<FunctionProfile::Totals>& totals) const;
+
+  //! Clear the function profiles of both farms' compute threads.
+  void reset_profile();
+
   //! Accessor.  
   std::vector<MutatableImageDisplay*>& displays()
     {
@@ -364,12 +427,30 @@ class EvolvotronMain : public QMainWindow
       return *_farm[enlargement && _farm[1].get()];
     }
 
+  //! Add what both farms have done, and are doing, to a metrics snapshot.
+  void metrics(FarmMetrics& m) const;
+
+  //! Write metrics (as JSON) to a file every so many seconds.
+  void metrics_file(const std::string& filename,uint interval_s);
+
+  //! Accessor.
+  ImageEncoder& encoder()
+    {
+      return *_encoder;
+    }
+
   //! Accessor.
   History& history()
     {
       return *_history;
     }
 
+  //! Accessor.
+  SpawnLatency& spawn_latency()
+    {
+      return _spawn_latency;
+    }
+
   //! Called by History when performing undo.
   void restore(MutatableImageDisplay* display,const boost::shared_ptr<const MutatableImage>&,bool one_of_many);
 
@@ -413,6 +494,12 @@ class EvolvotronMain : public QMainWindow
   //! Signalled by timer.
   void tick();
 
+  //! Signalled by timer every second.  Updates the metrics panel and file.
+  void metrics_tick();
+
+  //! Show the About dialog, with the memory accounts up to date.
+  void about();
+
   //! Signalled by menu item.  Forwards to History object.
   void undo();
 
@@ -425,6 +512,9 @@ class EvolvotronMain : public QMainWindow
 
   //! Signalled by menu item
   void toggle_fullscreen();
+
+  //! Signalled by menu item.  Switches every display between colour and cost map.
+  void toggle_cost_map();
   
   //! Signalled by menu item.  Public because called from evolvotron app wrapper.
   void reset(bool reset_mutation_parameters,bool reset_locks);
@@ -0,0 +1,192 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of classes ComputerMetrics, FarmMetrics and MetricsFile.
+*/
+
+#include "farm_metrics.h"
+
+#include "memory_account.h"
+
+FarmMetrics::FarmMetrics()
+  :time_ns(now_ns())
+  ,samples(0)
+  ,wasted_samples(0)
+  ,tasks_completed(0)
+  ,tasks_deferred(0)
+  ,tasks_aborted(0)
+  ,latency_ns(0)
+  ,running(0)
+{}
+
+namespace
+{
+  //! Rates between two snapshots.
+  struct Rates
+  {
+    //! Constructor.
+    Rates(const FarmMetrics& now,const FarmMetrics& before)
+      :seconds(std::max(1e-9,1e-9*(now.time_ns-before.time_ns)))
+      ,samples_per_second((now.samples-before.samples)/seconds)
+      ,wasted_samples(now.wasted_samples-before.wasted_samples)
+      ,tasks_completed(now.tasks_completed-before.tasks_completed)
+      ,mean_latency_ms(tasks_completed ? 1e-6*(now.latency_ns-before.latency_ns)/tasks_completed : 0.0)
+    {
+      for (uint i=0;i<now.busy_ns.size();i++)
+	{
+	  const unsigned long long busy=now.busy_ns[i]-(i<before.busy_ns.size() ? before.busy_ns[i] : 0);
+	  utilisation.push_back(std::min(1.0,1e-9*busy/seconds));
+	}
+    }
+
+    //! Time between the snapshots.
+    const double seconds;
+
+    //! Samples computed per second.
+    const double samples_per_second;
+
+    //! Samples wasted on aborted tasks.
+    const unsigned long long wasted_samples;
+
+    //! Tasks completed.
+    const unsigned long long tasks_completed;
+
+    //! Mean latency of the tasks completed.
+    const double mean_latency_ms;
+
+    //! Fraction of the time each thread was busy.
+    std::vector<double> utilisation;
+  };
+}
+
+std::ostream& metrics_json(std::ostream& out,const FarmMetrics& now,const FarmMetrics& before)
+{
+  const Rates rates(now,before);
+
+  out
+    << "{\"interval_s\":" << rates.seconds
+    << ",\"samples_per_s\":" << rates.samples_per_second
+    << ",\"utilisation\":[";
+  for (uint i=0;i<rates.utilisation.size();i++)
+    out << (i ? "," : "") << rates.utilisation[i];
+  out
+    << "],\"running\":" << now.running
+    << ",\"queued_by_level\":{";
+  for (std::map<uint,uint>::const_iterator it=now.queued.begin();it!=now.queued.end();it++)
+    out << (it==now.queued.begin() ? "" : ",") << "\"" << (*it).first << "\":" << (*it).second;
+  out
+    << "},\"tasks_completed\":" << rates.tasks_completed
+    << ",\"mean_task_latency_ms\":" << rates.mean_latency_ms
+    << ",\"wasted_samples\":" << rates.wasted_samples
+    << ",\"totals\":{\"samples\":" << now.samples
+    << ",\"wasted_samples\":" << now.wasted_samples
+    << ",\"tasks_completed\":" << now.tasks_completed
+    << ",\"tasks_deferred\":" << now.tasks_deferred
+    << ",\"tasks_aborted\":" << now.tasks_aborted
+    << "},\"memory\":";
+  return MemoryAccount::json(out) << "}";
+}
+
+const std::string metrics_text(const FarmMetrics& now,const FarmMetrics& before)
+{
+  const Rates rates(now,before);
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2)
+      << "Samples/s: " << 1e-6*rates.samples_per_second << "M"
+      << "   Tasks completed: " << rates.tasks_completed
+      << " (mean latency " << std::setprecision(1) << rates.mean_latency_ms << "ms)"
+      << "   Aborted work: " << std::setprecision(2) << 1e-6*rates.wasted_samples << "M samples\n";
+
+  out << "Thread utilisation:";
+  for (uint i=0;i<rates.utilisation.size();i++)
+    out << " " << lrint(100.0*rates.utilisation[i]) << "%";
+
+  out << "\nRunning: " << now.running << "   Queued by level:";
+  if (now.queued.empty()) out << " none";
+  for (std::map<uint,uint>::const_iterator it=now.queued.begin();it!=now.queued.end();it++)
+    out << " " << (*it).first << ":" << (*it).second;
+
+  out << "\nTotals: " << now.tasks_completed << " completed, "
+      << now.tasks_deferred << " deferred, "
+      << now.tasks_aborted << " aborted, "
+      << std::setprecision(2) << 1e-6*now.wasted_samples << "M of " << 1e-6*now.samples << "M samples wasted";
+  return out.str();
+}
+
+ComputerMetrics::ComputerMetrics()
+  :_busy_ns(0)
+  ,_busy_since_ns(0)
+  ,_samples(0)
+  ,_wasted_samples(0)
+  ,_tasks_completed(0)
+  ,_tasks_deferred(0)
+  ,_tasks_aborted(0)
+  ,_latency_ns(0)
+{}
+
+void ComputerMetrics::accumulate(FarmMetrics& metrics) const
+{
+  const unsigned long long since=_busy_since_ns.load(std::memory_order_relaxed);
+  metrics.busy_ns.push_back(_busy_ns.load(std::memory_order_relaxed)+(since && since<metrics.time_ns ? metrics.time_ns-since : 0));
+  metrics.samples+=_samples.load(std::memory_order_relaxed);
+  metrics.wasted_samples+=_wasted_samples.load(std::memory_order_relaxed);
+  metrics.tasks_completed+=_tasks_completed.load(std::memory_order_relaxed);
+  metrics.tasks_deferred+=_tasks_deferred.load(std::memory_order_relaxed);
+  metrics.tasks_aborted+=_tasks_aborted.load(std::memory_order_relaxed);
+  metrics.latency_ns+=_latency_ns.load(std::memory_order_relaxed);
+}
+
+MetricsFile::MetricsFile(const std::string& filename,uint interval_ms)
+  :_filename(filename)
+  ,_interval_ms(interval_ms)
+{}
+
+bool MetricsFile::due() const
+{
+  return (FarmMetrics::now_ns()-_last.time_ns>=1000000ULL*_interval_ms);
+}
+
+bool MetricsFile::write(const FarmMetrics& metrics,std::string& error)
+{
+  const std::string temporary(_filename+".tmp");
+  {
+    std::ofstream out(temporary.c_str());
+    metrics_json(out,metrics,_last) << "\n";
+    out.flush();
+    if (!out)
+      {
+	error="Couldn't write "+temporary;
+	return false;
+      }
+  }
+  if (std::rename(temporary.c_str(),_filename.c_str())!=0)
+    {
+      // Windows won't rename over an existing file.
+      std::remove(_filename.c_str());
+      if (std::rename(temporary.c_str(),_filename.c_str())!=0)
+	{
+	  error="Couldn't replace "+_filename;
+	  return false;
+	}
+    }
+  _last=metrics;
+  return true;
+}
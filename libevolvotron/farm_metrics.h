@@ -0,0 +1,190 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for classes ComputerMetrics, FarmMetrics and MetricsFile.
+*/
+
+#ifndef _farm_metrics_h_
+#define _farm_metrics_h_
+
+#include "common.h"
+#include "useful.h"
+
+//! A snapshot of what a compute farm (or several) has done so far.
+/*! Rates (samples per second, utilisation, mean latency) come from the difference between two snapshots.
+ */
+struct FarmMetrics
+{
+  //! Constructor.  Takes the time; everything else is zero.
+  FarmMetrics();
+
+  //! Nanoseconds on a steady clock, as used for all metrics' times.
+  static unsigned long long now_ns()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+  //! When the snapshot was taken.
+  unsigned long long time_ns;
+
+  //! Time each compute thread has spent computing.
+  std::vector<unsigned long long> busy_ns;
+
+  //! Samples computed.
+  unsigned long long samples;
+
+  //! Samples computed for tasks which were then aborted.
+  unsigned long long wasted_samples;
+
+  //! Tasks completed.
+  unsigned long long tasks_completed;
+
+  //! Times tasks were deferred for more important ones.
+  unsigned long long tasks_deferred;
+
+  //! Tasks aborted while being computed.
+  unsigned long long tasks_aborted;
+
+  //! Total time completed tasks took from being queued to completing.
+  unsigned long long latency_ns;
+
+  //! Tasks waiting to be computed, by resolution level (0 being full resolution, and so least urgent).
+  std::map<uint,uint> queued;
+
+  //! Tasks being computed.
+  uint running;
+};
+
+//! Write the rates since before, and totals, as a JSON object.  The process's MemoryAccounts are included too.
+extern std::ostream& metrics_json(std::ostream& out,const FarmMetrics& now,const FarmMetrics& before);
+
+//! Describe the rates since before, and totals, in a few lines of text.
+extern const std::string metrics_text(const FarmMetrics& now,const FarmMetrics& before);
+
+//! Counts what a compute thread does.
+/*! Only the thread itself writes the counters (with relaxed loads and stores, so without locks or read-modify-write),
+  and any other thread can read them.
+ */
+class ComputerMetrics : boost::noncopyable
+{
+ public:
+
+  //! Constructor.
+  ComputerMetrics();
+
+  //! Note the start of a run of a task.
+  void begin(unsigned long long now_ns)
+    {
+      _busy_since_ns.store(now_ns,std::memory_order_relaxed);
+    }
+
+  //! Note the end of a run of a task, which computed some samples.
+  void end(unsigned long long now_ns,unsigned long long samples)
+    {
+      add(_busy_ns,now_ns-_busy_since_ns.load(std::memory_order_relaxed));
+      _busy_since_ns.store(0,std::memory_order_relaxed);
+      add(_samples,samples);
+    }
+
+  //! Note a task completed, having taken latency_ns since it was queued.
+  void completed(unsigned long long latency_ns)
+    {
+      add(_tasks_completed,1);
+      add(_latency_ns,latency_ns);
+    }
+
+  //! Note a task deferred.
+  void deferred()
+    {
+      add(_tasks_deferred,1);
+    }
+
+  //! Note a task aborted, after computing some samples for it.
+  void aborted(unsigned long long wasted_samples)
+    {
+      add(_tasks_aborted,1);
+      add(_wasted_samples,wasted_samples);
+    }
+
+  //! Add the counters to a snapshot (as another thread), counting any run in progress as busy until its time.
+  void accumulate(FarmMetrics& metrics) const;
+
+ private:
+
+  //! Add to a counter only ever written by this thread.
+  static void add(std::atomic<unsigned long long>& counter,unsigned long long n)
+    {
+      counter.store(counter.load(std::memory_order_relaxed)+n,std::memory_order_relaxed);
+    }
+
+  //! Time spent in completed runs of tasks.
+  std::atomic<unsigned long long> _busy_ns;
+
+  //! When the run in progress started (0 if none).
+  std::atomic<unsigned long long> _busy_since_ns;
+
+  //! Samples computed.
+  std::atomic<unsigned long long> _samples;
+
+  //! Samples computed for aborted tasks.
+  std::atomic<unsigned long long> _wasted_samples;
+
+  //! Tasks completed.
+  std::atomic<unsigned long long> _tasks_completed;
+
+  //! Tasks deferred.
+  std::atomic<unsigned long long> _tasks_deferred;
+
+  //! Tasks aborted.
+  std::atomic<unsigned long long> _tasks_aborted;
+
+  //! Total latency of completed tasks.
+  std::atomic<unsigned long long> _latency_ns;
+};
+
+//! Writes metrics as JSON to a file every so often, for monitoring.
+/*! The file is replaced (by renaming a temporary file over it) so readers always see a whole snapshot.
+ */
+class MetricsFile
+{
+ public:
+
+  //! Constructor.
+  MetricsFile(const std::string& filename,uint interval_ms);
+
+  //! Whether it's time for the next write.
+  bool due() const;
+
+  //! Write the rates since the last write (or construction).  Returns false (with a description in error) on failure.
+  bool write(const FarmMetrics& metrics,std::string& error);
+
+ private:
+
+  //! The file.
+  const std::string _filename;
+
+  //! Time between writes.
+  const uint _interval_ms;
+
+  //! The metrics last written (or empty ones from construction).
+  FarmMetrics _last;
+};
+
+#endif
@@ -0,0 +1,113 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class FrameStream.
+*/
+
+#include "frame_stream.h"
+
+bool FrameStream::format(const std::string& name,Format& f)
+{
+  if (name=="rgb") f=FormatRGB;
+  else if (name=="ppm") f=FormatPPM;
+  else if (name=="y4m") f=FormatY4M;
+  else return false;
+  return true;
+}
+
+FrameStream::FrameStream(std::ostream& out,Format format,const QSize& size,uint fps)
+  :_out(out)
+  ,_format(format)
+  ,_size(size)
+  ,_fps(fps)
+  ,_started(false)
+  ,_row(_format==FormatY4M ? _size.width() : 3*_size.width())
+  ,_chroma(_format==FormatY4M ? 2*_size.width()*_size.height() : 0)
+{}
+
+FrameStream::~FrameStream()
+{
+  _out.flush();
+}
+
+//! Clamp a rounded value to a byte.
+static unsigned char byte(real v)
+{
+  return static_cast<unsigned char>(clamped(lrint(v),0L,255L));
+}
+
+bool FrameStream::rows(uint /*frame*/,const QImage& band,int begin)
+{
+  if (!_started)
+    {
+      if (_format==FormatY4M)
+	{
+	  _out << "YUV4MPEG2 W" << _size.width() << " H" << _size.height() << " F" << _fps << ":1 Ip A1:1 C444\n";
+	}
+      _started=true;
+    }
+
+  if (begin==0)
+    {
+      if (_format==FormatPPM) _out << "P6\n" << _size.width() << " " << _size.height() << "\n255\n";
+      else if (_format==FormatY4M) _out << "FRAME\n";
+    }
+
+  const int w=_size.width();
+  for (int row=0;row<band.height();row++)
+    {
+      const int y=begin+row;
+      const uint*const src=reinterpret_cast<const uint*>(band.constScanLine(row));
+      if (_format==FormatY4M)
+	{
+	  unsigned char*const u=&_chroma[y*w];
+	  unsigned char*const v=&_chroma[(_size.height()+y)*w];
+	  for (int x=0;x<w;x++)
+	    {
+	      const real r=(src[x]>>16)&0xff;
+	      const real g=(src[x]>>8)&0xff;
+	      const real b=src[x]&0xff;
+	      _row[x]=byte( 16.0+( 65.481*r+128.553*g+ 24.966*b)/255.0);
+	      u[x]   =byte(128.0+(-37.797*r- 74.203*g+112.000*b)/255.0);
+	      v[x]   =byte(128.0+(112.000*r- 93.786*g- 18.214*b)/255.0);
+	    }
+	}
+      else
+	{
+	  for (int x=0;x<w;x++)
+	    {
+	      _row[3*x  ]=(src[x]>>16)&0xff;
+	      _row[3*x+1]=(src[x]>>8)&0xff;
+	      _row[3*x+2]=src[x]&0xff;
+	    }
+	}
+      _out.write(reinterpret_cast<const char*>(&_row[0]),_row.size());
+    }
+  return _out.good();
+}
+
+bool FrameStream::frame(uint /*frame*/,const QImage& /*image*/)
+{
+  if (_format==FormatY4M) _out.write(reinterpret_cast<const char*>(&_chroma[0]),_chroma.size());
+
+  // Let a downstream reader have the frame now rather than when a buffer fills.
+  _out.flush();
+  return _out.good();
+}
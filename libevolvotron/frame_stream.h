@@ -0,0 +1,92 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class FrameStream.
+*/
+
+#ifndef _frame_stream_h_
+#define _frame_stream_h_
+
+#include "common.h"
+
+#include "tiled_renderer.h"
+
+//! Writes rendered frames as a single continuous stream (e.g to stdout or a FIFO) for piping into an encoder.
+/*! Rows are written as soon as the renderer completes them, except for the chroma planes of YUV4MPEG2
+  which necessarily follow the whole luma plane.
+ */
+class FrameStream : public TiledRenderer::Output
+{
+ public:
+
+  //! Stream formats.
+  enum Format
+    {
+      FormatRGB,  //!< Raw 8-bit RGB, no headers.
+      FormatPPM,  //!< Concatenated binary PPM images.
+      FormatY4M   //!< YUV4MPEG2, 4:4:4 with BT.601 video-range coefficients.
+    };
+
+  //! Look up a format by name (rgb, ppm or y4m).  Returns false if unrecognised.
+  static bool format(const std::string& name,Format& f);
+
+  //! Constructor.  Frames per second is only used for the YUV4MPEG2 header.
+  FrameStream(std::ostream& out,Format format,const QSize& size,uint fps);
+
+  //! Destructor.
+  virtual ~FrameStream();
+
+  //! Rows are written as they're completed, so whole frames aren't needed.
+  virtual Assembly assembly() const
+    {
+      return AssembleBands;
+    }
+
+  //! Write the rows.
+  virtual bool rows(uint frame,const QImage& band,int begin);
+
+  //! Finish the frame.
+  virtual bool frame(uint frame,const QImage& image);
+
+ private:
+
+  //! Stream written to.
+  std::ostream& _out;
+
+  //! Format written.
+  const Format _format;
+
+  //! Frame size.
+  const QSize _size;
+
+  //! Frame rate.
+  const uint _fps;
+
+  //! Whether the stream header has been written.
+  bool _started;
+
+  //! Row conversion buffer.
+  std::vector<unsigned char> _row;
+
+  //! Chroma planes held back until the end of the frame (YUV4MPEG2 only).
+  std::vector<unsigned char> _chroma;
+};
+
+#endif
@@ -0,0 +1,438 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class ImageEncoder and PNG encoding helpers.
+*/
+
+#include "image_encoder.h"
+
+#include <zlib.h>
+
+//! Append a big-endian 32-bit value.
+static void put_be32(std::vector<unsigned char>& v,unsigned long x)
+{
+  v.push_back((x>>24)&0xff);
+  v.push_back((x>>16)&0xff);
+  v.push_back((x>>8)&0xff);
+  v.push_back(x&0xff);
+}
+
+bool write_png_chunk(std::ostream& out,const char* type,const unsigned char* data,size_t length)
+{
+  std::vector<unsigned char> header;
+  put_be32(header,length);
+  header.insert(header.end(),type,type+4);
+
+  unsigned long crc=crc32(0L,Z_NULL,0);
+  crc=crc32(crc,reinterpret_cast<const Bytef*>(type),4);
+  if (length) crc=crc32(crc,data,length);
+  std::vector<unsigned char> trailer;
+  put_be32(trailer,crc);
+
+  out.write(reinterpret_cast<const char*>(&header[0]),header.size());
+  if (length) out.write(reinterpret_cast<const char*>(data),length);
+  out.write(reinterpret_cast<const char*>(&trailer[0]),trailer.size());
+  return out.good();
+}
+
+bool write_png_header(std::ostream& out,const QSize& size)
+{
+  static const unsigned char signature[8]={137,'P','N','G','\r','\n',26,'\n'};
+  out.write(reinterpret_cast<const char*>(signature),8);
+
+  std::vector<unsigned char> ihdr;
+  put_be32(ihdr,size.width());
+  put_be32(ihdr,size.height());
+  ihdr.push_back(8);  // Bit depth
+  ihdr.push_back(2);  // Colour type: RGB
+  ihdr.push_back(0);  // Compression method: deflate
+  ihdr.push_back(0);  // Filter method: adaptive
+  ihdr.push_back(0);  // Interlace: none
+  return write_png_chunk(out,"IHDR",&ihdr[0],ihdr.size());
+}
+
+//! A run of rows of filtered image data, and its compressed form.
+struct DeflateChunk
+{
+  //! Offset of the chunk in the filtered data.
+  size_t begin;
+
+  //! Length of the chunk.
+  size_t length;
+
+  //! Adler-32 checksum of the chunk.
+  unsigned long adler;
+
+  //! Compressed data (a headerless deflate stream, ending on a byte boundary).
+  std::vector<unsigned char> compressed;
+
+  //! Whether compression succeeded.
+  bool ok;
+};
+
+//! Compresses every n-th chunk of some filtered image data.
+class DeflateWorker : public QThread
+{
+ public:
+
+  //! Constructor.
+  DeflateWorker(const std::vector<unsigned char>& data,std::vector<DeflateChunk>& chunks,int level,uint first,uint stride)
+    :_data(data)
+    ,_chunks(chunks)
+    ,_level(level)
+    ,_first(first)
+    ,_stride(stride)
+    {}
+
+  //! Compress the chunks (in the calling thread).
+  void deflate_chunks();
+
+ protected:
+
+  //! Compress the chunks.
+  virtual void run()
+    {
+      deflate_chunks();
+    }
+
+ private:
+
+  //! Compress one chunk.
+  bool deflate_chunk(DeflateChunk& chunk,bool last) const;
+
+  //! All the filtered data.
+  const std::vector<unsigned char>& _data;
+
+  //! All the chunks.
+  std::vector<DeflateChunk>& _chunks;
+
+  //! Compression level.
+  const int _level;
+
+  //! First chunk to compress.
+  const uint _first;
+
+  //! Step between chunks to compress.
+  const uint _stride;
+};
+
+void DeflateWorker::deflate_chunks()
+{
+  for (uint i=_first;i<_chunks.size();i+=_stride)
+    _chunks[i].ok=deflate_chunk(_chunks[i],i+1==_chunks.size());
+}
+
+/*! All but the last chunk end with a sync flush, which byte-aligns the output without ending the deflate stream,
+  so the compressed chunks can simply be concatenated.
+ */
+bool DeflateWorker::deflate_chunk(DeflateChunk& chunk,bool last) const
+{
+  z_stream zs;
+  memset(&zs,0,sizeof(zs));
+  if (deflateInit2(&zs,_level,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY)!=Z_OK) return false;
+
+  // Back-references can still reach into the previous chunk.
+  const size_t window=32768;
+  if (chunk.begin>0 && _level!=0)
+    {
+      const size_t dictionary=minimum(chunk.begin,window);
+      deflateSetDictionary(&zs,&_data[chunk.begin-dictionary],dictionary);
+    }
+
+  chunk.adler=adler32(adler32(0L,Z_NULL,0),&_data[chunk.begin],chunk.length);
+
+  zs.next_in=const_cast<Bytef*>(&_data[chunk.begin]);
+  zs.avail_in=chunk.length;
+  chunk.compressed.resize(deflateBound(&zs,chunk.length)+16);
+  const int flush=(last ? Z_FINISH : Z_SYNC_FLUSH);
+  size_t used=0;
+  int status;
+  do
+    {
+      if (used==chunk.compressed.size()) chunk.compressed.resize(2*used);
+      zs.next_out=&chunk.compressed[used];
+      zs.avail_out=chunk.compressed.size()-used;
+      status=deflate(&zs,flush);
+      used=chunk.compressed.size()-zs.avail_out;
+    }
+  while (status==Z_OK && (last || zs.avail_out==0));
+  deflateEnd(&zs);
+  chunk.compressed.resize(used);
+  return (status==(last ? Z_STREAM_END : Z_OK));
+}
+
+/*! Rows all use the "up" filter, like BandImageWriter.
+ */
+bool encode_png(const QImage& source,std::ostream& out,int level,uint threads)
+{
+  if (source.isNull()) return false;
+  const QImage image(source.format()==QImage::Format_RGB32 ? source : source.convertToFormat(QImage::Format_RGB32));
+  const uint w=image.width();
+  const uint h=image.height();
+  const size_t row_bytes=1+3*w;
+
+  std::vector<unsigned char> data(row_bytes*h);
+  for (uint y=0;y<h;y++)
+    {
+      const uint*const src=reinterpret_cast<const uint*>(image.constScanLine(y));
+      const uint*const above=(y ? reinterpret_cast<const uint*>(image.constScanLine(y-1)) : 0);
+      unsigned char*const dst=&data[row_bytes*y];
+      dst[0]=2;
+      for (uint x=0;x<w;x++)
+	{
+	  const uint a=(above ? above[x] : 0);
+	  dst[1+3*x  ]=((src[x]>>16)&0xff)-((a>>16)&0xff);
+	  dst[1+3*x+1]=((src[x]>>8)&0xff)-((a>>8)&0xff);
+	  dst[1+3*x+2]=(src[x]&0xff)-(a&0xff);
+	}
+    }
+
+  // Chunks of a few hundred KB are enough to keep threads busy without costing much compression.
+  const size_t rows_per_chunk=maximum(static_cast<size_t>(1),(static_cast<size_t>(256)<<10)/row_bytes);
+  std::vector<DeflateChunk> chunks((h+rows_per_chunk-1)/rows_per_chunk);
+  for (uint i=0;i<chunks.size();i++)
+    {
+      chunks[i].begin=i*rows_per_chunk*row_bytes;
+      chunks[i].length=minimum(rows_per_chunk*row_bytes,data.size()-chunks[i].begin);
+      chunks[i].ok=false;
+    }
+
+  const uint n_workers=clamped(threads,1u,static_cast<uint>(chunks.size()));
+  boost::ptr_vector<DeflateWorker> workers;
+  for (uint i=0;i<n_workers;i++)
+    workers.push_back(new DeflateWorker(data,chunks,level,i,n_workers));
+  for (uint i=1;i<n_workers;i++)
+    workers[i].start();
+  workers[0].deflate_chunks();
+  for (uint i=1;i<n_workers;i++)
+    workers[i].wait();
+
+  // zlib stream header (with the compression level hint) and Adler-32 trailer go around the concatenated chunks.
+  const int l=(level<0 ? 6 : level);
+  const uint cmf=0x78;
+  uint flg=(l<2 ? 0 : (l<6 ? 1 : (l==6 ? 2 : 3)))<<6;
+  flg+=31-(cmf*256+flg)%31;
+  const unsigned char zlib_header[2]={static_cast<unsigned char>(cmf),static_cast<unsigned char>(flg)};
+
+  unsigned long adler=adler32(0L,Z_NULL,0);
+  for (uint i=0;i<chunks.size();i++)
+    {
+      if (!chunks[i].ok) return false;
+      adler=adler32_combine(adler,chunks[i].adler,chunks[i].length);
+    }
+  chunks[0].compressed.insert(chunks[0].compressed.begin(),zlib_header,zlib_header+2);
+  put_be32(chunks.back().compressed,adler);
+
+  bool ok=write_png_header(out,QSize(w,h));
+  for (uint i=0;ok && i<chunks.size();i++)
+    ok=write_png_chunk(out,"IDAT",&chunks[i].compressed[0],chunks[i].compressed.size());
+  return (ok && write_png_chunk(out,"IEND",0,0));
+}
+
+bool encode_png(const QImage& image,const std::string& filename,int level,uint threads,std::string& error)
+{
+  if (image.isNull())
+    {
+      error="Can't save an empty image to "+filename;
+      return false;
+    }
+
+  std::ofstream out(filename.c_str(),std::ios::out|std::ios::binary|std::ios::trunc);
+  const bool ok=(out && encode_png(image,out,level,threads));
+  out.close();
+  if (!ok || out.fail())
+    {
+      error="Couldn't write "+filename;
+      return false;
+    }
+  return true;
+}
+
+ImageEncoder::ImageEncoder(int level,uint deflate_threads,uint max_queued)
+  :_level(level)
+  ,_deflate_threads(deflate_threads)
+  ,_max_queued(maximum(max_queued,1u))
+  ,_busy(false)
+  ,_stop(false)
+  ,_failed(false)
+  ,_next_batch(1)
+{
+  start();
+}
+
+ImageEncoder::~ImageEncoder()
+{
+  {
+    QMutexLocker lock(&_mutex);
+    _stop=true;
+  }
+  _queued.wakeAll();
+  wait();
+}
+
+void ImageEncoder::encode(const QImage& image,const std::string& filename,const char* format)
+{
+  Job job;
+  job.image=image;
+  job.filename=filename;
+  job.format=format;
+  job.batch=0;
+
+  QMutexLocker lock(&_mutex);
+  while (_queue.size()>=_max_queued)
+    _finished.wait(&_mutex);
+  _queue.push_back(job);
+  _queued.wakeOne();
+}
+
+bool ImageEncoder::try_encode(const std::vector<QImage>& images,const std::vector<std::string>& filenames,const char* format,const std::string& name)
+{
+  assert(images.size()==filenames.size());
+  if (images.empty()) return true;
+
+  QMutexLocker lock(&_mutex);
+  if (!_queue.empty() && _queue.size()+images.size()>_max_queued) return false;
+
+  const uint number=_next_batch++;
+  Batch& batch=_batches[number];
+  batch.name=name;
+  batch.remaining=images.size();
+  batch.failed=false;
+
+  for (uint i=0;i<images.size();i++)
+    {
+      Job job;
+      job.image=images[i];
+      job.filename=filenames[i];
+      job.format=format;
+      job.batch=number;
+      _queue.push_back(job);
+    }
+  _queued.wakeOne();
+  return true;
+}
+
+bool ImageEncoder::wait_idle()
+{
+  QMutexLocker lock(&_mutex);
+  while (!_queue.empty() || _busy)
+    _finished.wait(&_mutex);
+  const bool ok=!_failed;
+  _failed=false;
+  return ok;
+}
+
+uint ImageEncoder::pending() const
+{
+  QMutexLocker lock(&_mutex);
+  return _queue.size()+(_busy ? 1 : 0);
+}
+
+const std::vector<std::string> ImageEncoder::take_errors()
+{
+  QMutexLocker lock(&_mutex);
+  std::vector<std::string> errors;
+  errors.swap(_errors);
+  return errors;
+}
+
+const std::vector<std::string> ImageEncoder::take_saved()
+{
+  QMutexLocker lock(&_mutex);
+  std::vector<std::string> saved;
+  saved.swap(_saved);
+  return saved;
+}
+
+const std::vector<std::pair<std::string,bool> > ImageEncoder::take_batches()
+{
+  QMutexLocker lock(&_mutex);
+  std::vector<std::pair<std::string,bool> > batches;
+  batches.swap(_batches_done);
+  return batches;
+}
+
+bool ImageEncoder::save(const Job& job,std::string& error) const
+{
+  if (job.format=="PNG")
+    return encode_png(job.image,job.filename,_level,_deflate_threads,error);
+
+  if (!job.image.save(QString::fromLocal8Bit(job.filename.c_str()),job.format.c_str()))
+    {
+      error="Couldn't write "+job.filename;
+      return false;
+    }
+  return true;
+}
+
+/*! The thread only stops once the queue is empty, so nothing queued is lost.
+ */
+void ImageEncoder::run()
+{
+  while (true)
+    {
+      Job job;
+      bool attempt=true;
+      {
+	QMutexLocker lock(&_mutex);
+	while (_queue.empty() && !_stop)
+	  _queued.wait(&_mutex);
+	if (_queue.empty()) return;
+	job=_queue.front();
+	_queue.pop_front();
+	_busy=true;
+	// Once an image of a batch has failed, the rest of it isn't attempted.
+	if (job.batch) attempt=!_batches[job.batch].failed;
+      }
+      _finished.wakeAll();
+
+      std::string error;
+      const bool ok=(attempt && save(job,error));
+      job.image=QImage();
+
+      {
+	QMutexLocker lock(&_mutex);
+	_busy=false;
+	if (ok)
+	  {
+	    _saved.push_back(job.filename);
+	  }
+	else if (attempt)
+	  {
+	    _failed=true;
+	    _errors.push_back(error);
+	  }
+
+	if (job.batch)
+	  {
+	    Batch& batch=_batches[job.batch];
+	    if (attempt && !ok && batch.remaining>1)
+	      _errors.push_back("Not attempting to save remaining images in animation");
+	    if (!ok) batch.failed=true;
+	    if (--batch.remaining==0)
+	      {
+		_batches_done.push_back(std::make_pair(batch.name,!batch.failed));
+		_batches.erase(job.batch);
+	      }
+	  }
+      }
+      _finished.wakeAll();
+    }
+}
@@ -0,0 +1,171 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class ImageEncoder and PNG encoding helpers.
+*/
+
+#ifndef _image_encoder_h_
+#define _image_encoder_h_
+
+#include "common.h"
+#include "useful.h"
+
+//! Write the PNG signature and an IHDR chunk for an 8-bit RGB image.
+extern bool write_png_header(std::ostream& out,const QSize& size);
+
+//! Write a PNG chunk (length, type, data and CRC).
+extern bool write_png_chunk(std::ostream& out,const char* type,const unsigned char* data,size_t length);
+
+//! Write an image to a PNG file, deflating chunks of rows on separate threads.
+/*! Chunks are compressed independently (each primed with the end of the previous chunk as its dictionary)
+  and concatenated into a single zlib stream, so the file is an ordinary PNG only slightly larger than a serially compressed one.
+  level is a zlib compression level (0-9, or -1 for zlib's default).
+  Returns false (with a description in error) on failure.
+ */
+extern bool encode_png(const QImage& image,const std::string& filename,int level,uint threads,std::string& error);
+
+//! Write an image as PNG to a stream, as encode_png does to a file.  Returns false on failure.
+extern bool encode_png(const QImage& image,std::ostream& out,int level,uint threads);
+
+//! Saves images on a thread of its own, so encoding overlaps whatever the caller does next.
+/*! PNG files are written by encode_png; other formats (PPM) by QImage::save.
+  Queueing an image is cheap (QImage is implicitly shared) but the queue is bounded,
+  so a caller producing images faster than they can be saved is held up rather than accumulating them
+  (or, with try_encode, turned away).
+ */
+class ImageEncoder : public QThread
+{
+ public:
+
+  //! Constructor.  Starts the encoding thread.
+  /*! level is passed to encode_png, as are deflate_threads.
+   */
+  ImageEncoder(int level,uint deflate_threads,uint max_queued=2);
+
+  //! Destructor.  Saves anything still queued before stopping.
+  virtual ~ImageEncoder();
+
+  //! Queue an image to be saved in the given format ("PNG" or "PPM").  Blocks while the queue is full.
+  void encode(const QImage& image,const std::string& filename,const char* format);
+
+  //! Queue images (e.g an animation's frames) to be saved as a batch, without blocking.
+  /*! Returns false, queueing none of them, if the queue hasn't room for them all
+    (unless it's empty, so a batch bigger than the queue can still be saved).
+    Once an image of a batch fails to save, the rest of it isn't attempted.
+    The batch's outcome is reported by take_batches under the given name.
+   */
+  bool try_encode(const std::vector<QImage>& images,const std::vector<std::string>& filenames,const char* format,const std::string& name);
+
+  //! Block until everything queued has been saved.  Returns false if anything failed since the last call.
+  bool wait_idle();
+
+  //! Number of images queued or being saved.
+  uint pending() const;
+
+  //! Descriptions of failures (and clears them).
+  const std::vector<std::string> take_errors();
+
+  //! Filenames saved successfully (and clears them).
+  const std::vector<std::string> take_saved();
+
+  //! Names of finished batches, with whether every image of each was saved (and clears them).
+  const std::vector<std::pair<std::string,bool> > take_batches();
+
+ protected:
+
+  //! Save queued images until told to stop.
+  virtual void run();
+
+ private:
+
+  //! An image waiting to be saved.
+  struct Job
+  {
+    QImage image;
+    std::string filename;
+    std::string format;
+
+    //! Number of the batch the image is part of (0 if none).
+    uint batch;
+  };
+
+  //! Images queued by try_encode together.
+  struct Batch
+  {
+    //! Name the outcome is reported under.
+    std::string name;
+
+    //! Images not yet saved (or skipped).
+    uint remaining;
+
+    //! Whether any image failed to save.
+    bool failed;
+  };
+
+  //! Save an image, returning false (with a description in error) on failure.
+  bool save(const Job& job,std::string& error) const;
+
+  //! Compression level for PNG.
+  const int _level;
+
+  //! Threads for deflating PNG.
+  const uint _deflate_threads;
+
+  //! Limit on queued images.
+  const uint _max_queued;
+
+  //! Guards everything below.
+  mutable QMutex _mutex;
+
+  //! Signalled when a job is queued (or the thread should stop).
+  QWaitCondition _queued;
+
+  //! Signalled when a job is finished.
+  QWaitCondition _finished;
+
+  //! Images waiting to be saved.
+  std::deque<Job> _queue;
+
+  //! Whether a job is being saved now.
+  bool _busy;
+
+  //! Set to stop the thread once the queue is empty.
+  bool _stop;
+
+  //! Whether anything failed since the last wait_idle.
+  bool _failed;
+
+  //! Failure descriptions not yet taken.
+  std::vector<std::string> _errors;
+
+  //! Saved filenames not yet taken.
+  std::vector<std::string> _saved;
+
+  //! Batches with images queued or being saved, by number.
+  std::map<uint,Batch> _batches;
+
+  //! Number for the next batch.
+  uint _next_batch;
+
+  //! Finished batches not yet taken.
+  std::vector<std::pair<std::string,bool> > _batches_done;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class ImageFitness.
+*/
+
+#include "image_fitness.h"
+
+#include <zlib.h>
+
+//! Sum over channels of absolute differences between two rows of RGB32 pixels, written to d.
+static void channel_differences(const uint* a,const uint* b,uint n,uint* d)
+{
+  for (uint i=0;i<n;i++)
+    {
+      const int dr=static_cast<int>((a[i]>>16)&0xff)-static_cast<int>((b[i]>>16)&0xff);
+      const int dg=static_cast<int>((a[i]>>8)&0xff)-static_cast<int>((b[i]>>8)&0xff);
+      const int db=static_cast<int>(a[i]&0xff)-static_cast<int>(b[i]&0xff);
+      d[i]=(dr<0 ? -dr : dr)+(dg<0 ? -dg : dg)+(db<0 ? -db : db);
+    }
+}
+
+bool ImageFitness::metric(const std::string& name,Metric& m)
+{
+  if (name=="compression") m=MetricCompression;
+  else if (name=="edges") m=MetricEdges;
+  else if (name=="entropy") m=MetricEntropy;
+  else if (name=="combined") m=MetricCombined;
+  else return false;
+  return true;
+}
+
+ImageFitness::ImageFitness(const QImage& image)
+  :_compression(0.0)
+  ,_edges(0.0)
+  ,_entropy(0.0)
+{
+  const uint w=image.width();
+  const uint h=image.height();
+  if (w==0 || h==0) return;
+
+  // Rows filtered as for PNG's "up" filter, so smooth gradients compress as they would in a saved image.
+  std::vector<unsigned char> filtered(3*w*h);
+  std::vector<uint> histogram(4096,0);
+  std::vector<uint> right(w);
+  std::vector<uint> below(w);
+  uint edge_pixels=0;
+  const uint edge_threshold=48;
+  for (uint y=0;y<h;y++)
+    {
+      const uint*const row=reinterpret_cast<const uint*>(image.constScanLine(y));
+      const uint*const above=(y ? reinterpret_cast<const uint*>(image.constScanLine(y-1)) : row);
+      unsigned char*const f=&filtered[3*w*y];
+      for (uint x=0;x<w;x++)
+	{
+	  const uint a=(y ? above[x] : 0);
+	  f[3*x  ]=((row[x]>>16)&0xff)-((a>>16)&0xff);
+	  f[3*x+1]=((row[x]>>8)&0xff)-((a>>8)&0xff);
+	  f[3*x+2]=(row[x]&0xff)-(a&0xff);
+	}
+
+      for (uint x=0;x<w;x++)
+	histogram[((row[x]>>12)&0xf00)|((row[x]>>8)&0xf0)|((row[x]>>4)&0xf)]++;
+
+      // Edges against the pixel to the right and (except on the first row) the one above.
+      if (w>1) channel_differences(row,row+1,w-1,&right[0]);
+      right[w-1]=0;
+      channel_differences(row,above,w,&below[0]);
+      for (uint x=0;x<w;x++)
+	edge_pixels+=(right[x]+below[x]>edge_threshold);
+    }
+
+  uLongf compressed_size=compressBound(filtered.size());
+  std::vector<unsigned char> compressed(compressed_size);
+  if (compress2(&compressed[0],&compressed_size,&filtered[0],filtered.size(),1)==Z_OK)
+    _compression=minimum(1.0,static_cast<real>(compressed_size)/filtered.size());
+
+  _edges=static_cast<real>(edge_pixels)/(w*h);
+
+  const real pixels=w*h;
+  for (uint i=0;i<histogram.size();i++)
+    if (histogram[i])
+      {
+	const real p=histogram[i]/pixels;
+	_entropy-=p*log2(p);
+      }
+  _entropy/=12.0;
+}
+
+real ImageFitness::score(Metric m) const
+{
+  switch (m)
+    {
+    case MetricCompression: return _compression;
+    case MetricEdges: return _edges;
+    case MetricEntropy: return _entropy;
+    default: return (_compression+_edges+_entropy)/3.0;
+    }
+}
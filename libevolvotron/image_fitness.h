@@ -0,0 +1,88 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class ImageFitness.
+*/
+
+#ifndef _image_fitness_h_
+#define _image_fitness_h_
+
+#include "common.h"
+#include "useful.h"
+
+//! Measures of an image's visual complexity, for driving evolution without a human in the loop.
+/*! Each measure is in [0,1], higher being more complex.
+  The inner loops work on whole rows of packed pixels with no branches, so compilers can vectorise them.
+ */
+class ImageFitness
+{
+ public:
+
+  //! The measures.
+  enum Metric
+    {
+      MetricCompression,  //!< Compressed size over raw size.
+      MetricEdges,        //!< Fraction of pixels on an edge.
+      MetricEntropy,      //!< Entropy of the colour histogram.
+      MetricCombined      //!< Mean of the others.
+    };
+
+  //! Choose a metric by name (compression, edges, entropy or combined).  Returns false if unknown.
+  static bool metric(const std::string& name,Metric& m);
+
+  //! Measure an (RGB32) image.
+  ImageFitness(const QImage& image);
+
+  //! Deflated size of the image (filtered as for PNG) over its raw size.
+  /*! This is the measure the extras/evolvotron_complexity script makes by rendering and running an external compressor.
+   */
+  real compression() const
+    {
+      return _compression;
+    }
+
+  //! Fraction of pixels differing noticeably from their right and lower neighbours.
+  real edges() const
+    {
+      return _edges;
+    }
+
+  //! Shannon entropy of the colour histogram (4 bits per channel) over its 12 bit maximum.
+  real entropy() const
+    {
+      return _entropy;
+    }
+
+  //! The chosen measure.
+  real score(Metric m) const;
+
+ private:
+
+  //! Compression ratio.
+  real _compression;
+
+  //! Edge density.
+  real _edges;
+
+  //! Colour entropy.
+  real _entropy;
+};
+
+#endif
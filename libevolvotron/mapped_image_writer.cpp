@@ -0,0 +1,132 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class MappedImageWriter.
+*/
+
+#include "mapped_image_writer.h"
+
+#include "platform_specific.h"
+
+bool MappedImageWriter::format(const std::string& filename,Format& f)
+{
+  const QString name(QString::fromLocal8Bit(filename.c_str()).toUpper());
+  if (name.endsWith(".PPM")) f=FormatPPM;
+  else if (name.endsWith(".PAM")) f=FormatPAM;
+  else return false;
+  return true;
+}
+
+MappedImageWriter::MappedImageWriter(const std::string& filename,Format format,const QSize& size,uint frames)
+  :_filename(filename)
+  ,_format(format)
+  ,_size(size)
+  ,_frames(frames)
+{}
+
+/*! Any files left (from an abandoned render) are unmapped and closed by the QFile destructors.
+ */
+MappedImageWriter::~MappedImageWriter()
+{}
+
+bool MappedImageWriter::fail(const std::string& what,const std::string& filename)
+{
+  _error=what+" "+filename;
+  return false;
+}
+
+/*! Returns null on failure.
+ */
+MappedImageWriter::Mapping* MappedImageWriter::mapping(uint frame)
+{
+  boost::ptr_map<uint,Mapping>::iterator it=_mappings.find(frame);
+  if (it!=_mappings.end()) return (*it).second;
+
+  const std::string filename(frame_filename(_filename,frame,_frames));
+  std::ostringstream header;
+  if (_format==FormatPPM)
+    header << "P6\n" << _size.width() << " " << _size.height() << "\n255\n";
+  else
+    header << "P7\nWIDTH " << _size.width() << "\nHEIGHT " << _size.height() << "\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n";
+  const std::string h(header.str());
+  const qint64 bytes=h.size()+3LL*_size.width()*_size.height();
+
+  std::unique_ptr<Mapping> m(new Mapping(QString::fromLocal8Bit(filename.c_str())));
+  if (!m->file.open(QFile::ReadWrite) || !m->file.resize(bytes))
+    {
+      fail("Couldn't create",filename);
+      return 0;
+    }
+  m->mapped=m->file.map(0,bytes);
+  if (!m->mapped)
+    {
+      fail("Couldn't map",filename);
+      return 0;
+    }
+  m->bytes=bytes;
+  memcpy(m->mapped,h.data(),h.size());
+  m->pixels=m->mapped+h.size();
+
+  uint key=frame;
+  Mapping*const ret=m.get();
+  _mappings.insert(key,m.release());
+  return ret;
+}
+
+bool MappedImageWriter::tile(uint frame,uint /*n*/,const QImage& tile,const QPoint& origin)
+{
+  Mapping*const m=mapping(frame);
+  if (!m) return false;
+
+  for (int row=0;row<tile.height();row++)
+    {
+      const uint*const src=reinterpret_cast<const uint*>(tile.constScanLine(row));
+      uchar*const dst=m->pixels+3*(static_cast<qint64>(origin.y()+row)*_size.width()+origin.x());
+      for (int x=0;x<tile.width();x++)
+	{
+	  dst[3*x  ]=(src[x]>>16)&0xff;
+	  dst[3*x+1]=(src[x]>>8)&0xff;
+	  dst[3*x+2]=src[x]&0xff;
+	}
+    }
+  return true;
+}
+
+bool MappedImageWriter::frame(uint frame,const QImage& /*image*/)
+{
+  boost::ptr_map<uint,Mapping>::iterator it=_mappings.find(frame);
+  if (it==_mappings.end()) return true;
+
+  Mapping& m=*(*it).second;
+  const bool ok=m.file.unmap(m.mapped);
+  m.file.close();
+  _mappings.erase(it);
+  return (ok || fail("Couldn't write",frame_filename(_filename,frame,_frames)));
+}
+
+bool MappedImageWriter::sync()
+{
+  for (boost::ptr_map<uint,Mapping>::iterator it=_mappings.begin();it!=_mappings.end();it++)
+    {
+      if (!sync_mapped_memory((*it).second->mapped,(*it).second->bytes))
+	return fail("Couldn't write",frame_filename(_filename,(*it).first,_frames));
+    }
+  return true;
+}
@@ -0,0 +1,131 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class MappedImageWriter.
+*/
+
+#ifndef _mapped_image_writer_h_
+#define _mapped_image_writer_h_
+
+#include "common.h"
+
+#include <QFile>
+
+#include "tiled_renderer.h"
+
+//! Writes PPM or PAM files through a memory mapping, copying each tile into place as it completes.
+/*! Nothing is assembled in memory, so image size is limited only by the filesystem.
+  One file is written per frame, numbered as by frame_filename.
+  Existing files are reused rather than truncated, so tiles written before an interrupted render survive to be resumed.
+ */
+class MappedImageWriter : public TiledRenderer::Output
+{
+ public:
+
+  //! File formats.
+  enum Format
+    {
+      FormatPPM,
+      FormatPAM
+    };
+
+  //! Choose a format from a filename suffix (.ppm or .pam).  Returns false if unsupported.
+  static bool format(const std::string& filename,Format& f);
+
+  //! Constructor.
+  MappedImageWriter(const std::string& filename,Format format,const QSize& size,uint frames);
+
+  //! Destructor.
+  virtual ~MappedImageWriter();
+
+  //! Tiles are written straight into the file.
+  virtual Assembly assembly() const
+    {
+      return AssembleNothing;
+    }
+
+  //! Copy the tile into the frame's file.
+  virtual bool tile(uint frame,uint n,const QImage& tile,const QPoint& origin);
+
+  //! Finish the frame's file.
+  virtual bool frame(uint frame,const QImage& image);
+
+  //! Write back the tiles copied into files so far.
+  virtual bool sync();
+
+  //! Description of the last failure.
+  const std::string& error() const
+    {
+      return _error;
+    }
+
+ private:
+
+  //! A mapped file.
+  class Mapping
+  {
+  public:
+    //! Constructor.
+    Mapping(const QString& filename)
+      :file(filename)
+      ,mapped(0)
+      ,bytes(0)
+      ,pixels(0)
+      {}
+
+    //! The file.
+    QFile file;
+
+    //! Start of the mapping.
+    uchar* mapped;
+
+    //! Size of the mapping.
+    qint64 bytes;
+
+    //! Start of the pixel data in the mapping.
+    uchar* pixels;
+  };
+
+  //! Find the mapping for a frame, creating the file if necessary.
+  Mapping* mapping(uint frame);
+
+  //! Record a failure.
+  bool fail(const std::string& what,const std::string& filename);
+
+  //! Filename (before frame numbering).
+  const std::string _filename;
+
+  //! Format written.
+  const Format _format;
+
+  //! Frame size.
+  const QSize _size;
+
+  //! Number of frames.
+  const uint _frames;
+
+  //! Files for frames in progress.
+  boost::ptr_map<uint,Mapping> _mappings;
+
+  //! Description of the last failure.
+  std::string _error;
+};
+
+#endif
@@ -26,15 +26,17 @@
 #include "mutatable_image.h"
 
 #include "function_node_info.h"
+#include "function_profiled.h"
 #include "function_top.h"
 #include "mutatable_image_display_big.h"
 #include "random.h"
 #include "transform.h"
 
-unsigned long long MutatableImage::_count=0;
+std::atomic<unsigned long long> MutatableImage::_count(0);
 
 MutatableImage::MutatableImage(std::unique_ptr<FunctionTop>& r,bool sinz,bool sm,bool lock)
   :_top(r.release())
+  ,_pretransform(_top->params(),0)
   ,_sinusoidal_z(sinz)
   ,_spheremap(sm)
   ,_locked(lock)
@@ -43,6 +45,28 @@ MutatableImage::MutatableImage(std::unique_ptr<FunctionTop>& r,bool sinz,bool sm
   assert(_top.get()!=0);
 }
 
+MutatableImage::MutatableImage(const boost::shared_ptr<const FunctionTop>& top,const Transform& pretransform,bool sinz,bool sm,bool lock)
+  :_top(top)
+  ,_pretransform(pretransform)
+  ,_sinusoidal_z(sinz)
+  ,_spheremap(sm)
+  ,_locked(lock)
+  ,_serial(_count++)
+{
+  assert(_top.get()!=0);
+}
+
+MutatableImage::MutatableImage(const boost::shared_ptr<const FunctionTop>& top,const MutatableImage& image)
+  :_top(top)
+  ,_pretransform(image._pretransform)
+  ,_sinusoidal_z(image._sinusoidal_z)
+  ,_spheremap(image._spheremap)
+  ,_locked(image._locked)
+  ,_serial(image._serial)
+{
+  assert(_top.get()!=0);
+}
+
 MutatableImage::MutatableImage(const MutationParameters& parameters,bool exciting,bool sinz,bool sm)
   :_sinusoidal_z(sinz)
   ,_spheremap(sm)
@@ -51,9 +75,10 @@ MutatableImage::MutatableImage(const MutationParameters& parameters,bool excitin
 {
   std::vector<real> pv;
   FunctionNode::stubparams(pv,parameters,12);
-  boost::ptr_vector<FunctionNode> av;
-  av.push_back(FunctionNode::stub(parameters,exciting).release());
-  _top=std::unique_ptr<FunctionTop>(new FunctionTop(pv,av,0));
+  FunctionNode::Args av;
+  av.push_back(boost::shared_ptr<FunctionNode>(FunctionNode::stub(parameters,exciting).release()));
+  _top=boost::shared_ptr<const FunctionTop>(new FunctionTop(pv,av,0));
+  _pretransform=Transform(_top->params(),0);
   //! \todo _sinusoidal_z should be obtained from AnimationParameters when it exists
 }
 
@@ -66,6 +91,33 @@ const FunctionTop& MutatableImage::top() const
   return *_top;
 }
 
+std::unique_ptr<FunctionTop> MutatableImage::clone_top() const
+{
+  std::unique_ptr<FunctionTop> root(top().typed_deepclone());
+  root->pretransform(_pretransform);
+  return root;
+}
+
+boost::shared_ptr<const MutatableImage> MutatableImage::pretransformed(const Transform& tf) const
+{
+  Transform t(_pretransform);
+  t.concatenate_on_right(tf);
+  return boost::shared_ptr<const MutatableImage>(new MutatableImage(_top,t,sinusoidal_z(),spheremap(),false));
+}
+
+/*! The top node's own evaluation isn't counted (as it never was through precolour), only its arguments'.
+  The copy keeps this image's serial number, so it stands in for it wherever serial numbers are compared.
+ */
+boost::shared_ptr<const MutatableImage> MutatableImage::profiled(FunctionProfile& profile) const
+{
+  std::unique_ptr<FunctionTop> root(top().typed_deepclone());
+  FunctionNode::Args args;
+  for (FunctionNode::Args::const_iterator it=top().args().begin();it!=top().args().end();it++)
+    args.push_back(FunctionProfiled::tree(*it,profile));
+  root->args(args);
+  return boost::shared_ptr<const MutatableImage>(new MutatableImage(boost::shared_ptr<const FunctionTop>(root.release()),*this));
+}
+
 boost::shared_ptr<const MutatableImage> MutatableImage::deepclone() const
 {
   return deepclone(false);
@@ -73,7 +125,7 @@ boost::shared_ptr<const MutatableImage> MutatableImage::deepclone() const
 
 boost::shared_ptr<const MutatableImage> MutatableImage::deepclone(bool lock) const
 {
-  std::unique_ptr<FunctionTop> root(top().typed_deepclone());
+  std::unique_ptr<FunctionTop> root(clone_top());
   return boost::shared_ptr<const MutatableImage>(new MutatableImage(root,sinusoidal_z(),spheremap(),lock)); 
 }
 
@@ -127,14 +179,14 @@ const XYZ MutatableImage::sampling_coordinate(real x,real y,uint z,uint sx,uint
 
 boost::shared_ptr<const MutatableImage> MutatableImage::mutated(const MutationParameters& p) const
 {
-  std::unique_ptr<FunctionTop> c(top().typed_deepclone());  
+  std::unique_ptr<FunctionTop> c(clone_top());
   c->mutate(p);
   return boost::shared_ptr<const MutatableImage>(new MutatableImage(c,sinusoidal_z(),spheremap(),false));
 }
 
 boost::shared_ptr<const MutatableImage> MutatableImage::simplified() const
 {
-  std::unique_ptr<FunctionTop> c(top().typed_deepclone());  
+  std::unique_ptr<FunctionTop> c(clone_top());
   c->simplify_constants();
   return boost::shared_ptr<const MutatableImage>(new MutatableImage(c,sinusoidal_z(),spheremap(),false));
 }
@@ -143,7 +195,7 @@ const XYZ MutatableImage::get_rgb(const XYZ& p) const
 {
   // Actually calculate a pixel value from the image.
   // negexp distribution on colour-space parameters probably means the nominal range is something like -4.0 to 4.0
-  const XYZ pv(top()(p));
+  const XYZ pv(top().colour(top().precolour(p,_pretransform)));
 
   // Scale a nominal -2.0 to 2.0 range to 0-255
   return 127.5*(0.5*pv+XYZ(1.0,1.0,1.0));
@@ -151,7 +203,12 @@ const XYZ MutatableImage::get_rgb(const XYZ& p) const
 
 const XYZ MutatableImage::get_rgb(uint x,uint y,uint f,uint width,uint height,uint frames,Random01* r01,uint multisample) const
 {
-  XYZ accumulated_colour(0.0,0.0,0.0);
+  return get_rgb_from_precolour(get_precolour(x,y,f,width,height,frames,r01,multisample));
+}
+
+const XYZ MutatableImage::get_precolour(uint x,uint y,uint f,uint width,uint height,uint frames,Random01* r01,uint multisample) const
+{
+  XYZ accumulated(0.0,0.0,0.0);
   for (uint sy=0;sy<multisample;sy++)
     for (uint sx=0;sx<multisample;sx++)
       {
@@ -173,17 +230,39 @@ const XYZ MutatableImage::get_rgb(uint x,uint y,uint f,uint width,uint height,ui
 	    )
 	   );
 	
-	accumulated_colour+=get_rgb(p);
+	accumulated+=top().precolour(p,_pretransform);
       }
 
-  accumulated_colour/=(multisample*multisample);
+  return accumulated/(multisample*multisample);
+}
+
+const XYZ MutatableImage::get_rgb_from_precolour(const XYZ& tv) const
+{
+  // Scale a nominal -2.0 to 2.0 range to 0-255
+  XYZ colour(127.5*(0.5*top().colour(tv)+XYZ(1.0,1.0,1.0)));
 		  
   // Clamp out of range values
-  accumulated_colour.x(clamped(accumulated_colour.x(),0.0,255.0));
-  accumulated_colour.y(clamped(accumulated_colour.y(),0.0,255.0));
-  accumulated_colour.z(clamped(accumulated_colour.z(),0.0,255.0));
+  colour.x(clamped(colour.x(),0.0,255.0));
+  colour.y(clamped(colour.y(),0.0,255.0));
+  colour.z(clamped(colour.z(),0.0,255.0));
 
-  return accumulated_colour;
+  return colour;
+}
+
+unsigned long long MutatableImage::profile_nodes(const QSize& size,FunctionProfile& profile) const
+{
+  const boost::shared_ptr<const MutatableImage> image(profiled(profile));
+  const bool record_nodes=profile.record_nodes();
+  profile.record_nodes(true);
+
+  const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+  for (int row=0;row<size.height();row++)
+    for (int col=0;col<size.width();col++)
+      image->get_rgb(col,row,0,size.width(),size.height(),1,0,1);
+  const unsigned long long ns=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+
+  profile.record_nodes(record_nodes);
+  return ns;
 }
 
 void MutatableImage::get_stats(uint& total_nodes,uint& total_parameters,uint& depth,uint& width,real& proportion_constant) const
@@ -205,7 +284,10 @@ std::ostream& MutatableImage::save_function(std::ostream& out) const
     << "\""
     << ">\n";
   
-  top().save_function(out,1);
+  if (top().pretransform().get_columns()==_pretransform.get_columns())
+    top().save_function(out,1);
+  else
+    clone_top()->save_function(out,1);
 
   out << "</evolvotron-image-function>\n";
 
@@ -559,8 +641,8 @@ boost::shared_ptr<const MutatableImage> MutatableImage::load_function(const Func
         {
           // Build a FunctionTop wrapper for compataibility with old .xml files
 
-          boost::ptr_vector<FunctionNode> a;
-          a.push_back(root.release());
+          FunctionNode::Args a;
+          a.push_back(boost::shared_ptr<FunctionNode>(root.release()));
 
           const TransformIdentity ti;
           std::vector<real> tiv=ti.get_columns();
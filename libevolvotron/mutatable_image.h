@@ -26,16 +26,18 @@
 
 #include "common.h"
 
+#include "transform.h"
 #include "xyz.h"
 
 class FunctionNull;
+class FunctionProfile;
 class FunctionRegistry;
 class FunctionTop;
 class MutationParameters;
 
 //! Class to hold the base FunctionNode of an image.
 /*! Once it owns a root FunctionNode* the whole structure should be fixed (mutate isn't available, only mutated).
-  \todo Do reference counting on this object ?  Maybe not: have to worry about stateful nodes,
+  Function nodes are reference counted and copied on write, so clones share all unmodified subtrees.
   \todo Generally tighten up const-ness of interfaces.
  */
 class MutatableImage
@@ -46,8 +48,15 @@ class MutatableImage
   /*! This is partly here because FunctionNode::mutate can't change the type of
     the node it is invoked on (only child nodes can be zapped), partly so we
     can keep colour and space transforms under control.
+    Never modified once owned, so it can be shared by images differing only in pre-transform.
    */
-  std::unique_ptr<FunctionTop> _top;
+  boost::shared_ptr<const FunctionTop> _top;
+
+  //! The space transform applied to sample positions.
+  /*! Normally the same as the top node's own pre-transform parameters, but supersedes them
+    in images obtained from pretransformed (which share the top node of the original).
+   */
+  Transform _pretransform;
 
   //! Whether to sweep z sinusoidally (vs linearly)
   bool _sinusoidal_z;
@@ -61,8 +70,14 @@ class MutatableImage
   //! Serial number for identity tracking (used by display to discover whether a recompute is needed)
   unsigned long long _serial;
 
-  //! Object count to generate serial numbers
-  static unsigned long long _count;
+  //! Object count to generate serial numbers (atomic, as images are created on several threads by evolvotron_mutate and evolvotron_evolve).
+  static std::atomic<unsigned long long> _count;
+
+  //! Share the image tree of another image, but with a different pre-transform.
+  MutatableImage(const boost::shared_ptr<const FunctionTop>& top,const Transform& pretransform,bool sinz,bool sm,bool lock);
+
+  //! Stand in for another image (with the given serial number), evaluating a different tree.
+  MutatableImage(const boost::shared_ptr<const FunctionTop>& top,const MutatableImage& image);
 
  public:
   
@@ -81,8 +96,20 @@ class MutatableImage
   const XYZ sampling_coordinate(real x,real y,uint z,uint sx,uint sy,uint sz) const;
 
   //! Accessor.
+  /*! NB The top node's pre-transform parameters may be superseded by pretransform().
+    Use clone_top to obtain a self-contained copy.
+   */
   const FunctionTop& top() const;
 
+  //! Accessor.
+  const Transform& pretransform() const
+    {
+      return _pretransform;
+    }
+
+  //! Return a copy of the top node (and whole tree) with the effective pre-transform.
+  std::unique_ptr<FunctionTop> clone_top() const;
+
   //! Accessor.
   bool sinusoidal_z() const
     {
@@ -119,6 +146,19 @@ class MutatableImage
   //! Clone this image, setting locked state to that specified.
   boost::shared_ptr<const MutatableImage> deepclone(bool lock) const;
 
+  //! Return a version of this image with tf concatenated on the right of the pre-transform.
+  /*! Only the pre-transform is copied; the function tree is shared with this image.
+    This is intended for interactive adjustments, which would otherwise clone the whole tree on every mouse event.
+   */
+  boost::shared_ptr<const MutatableImage> pretransformed(const Transform& tf) const;
+
+  //! Return a version of this image which adds every node's evaluations to profile.
+  /*! Its tree is a copy built by FunctionProfiled::tree, so is only valid while profile is,
+    and the same image as this as far as serial numbers and saving go.
+    Building it is linear in the size of the tree, so it's intended to be done once per compute task.
+   */
+  boost::shared_ptr<const MutatableImage> profiled(FunctionProfile& profile) const;
+
   //! Return a mutated version of this image
   boost::shared_ptr<const MutatableImage> mutated(const MutationParameters& p) const;
 
@@ -131,6 +171,19 @@ class MutatableImage
   //! Return the a 0-255-scaled RGB value at the specified pixel of an image/animation taking jitter (if random number generator provided) and multisampling into account
   const XYZ get_rgb(uint x,uint y,uint f,uint width,uint height,uint frames,Random01* r01,uint multisample) const;
 
+  //! Return the mean pre-colour-transform value (see FunctionTop::precolour) over the samples of the specified pixel, as used by get_rgb.
+  const XYZ get_precolour(uint x,uint y,uint f,uint width,uint height,uint frames,Random01* r01,uint multisample) const;
+
+  //! Return the clamped 0-255-scaled RGB value for a pre-colour-transform value.
+  /*! The colour transform is affine so applying it to the mean of a pixel's samples gives the same result as get_rgb.
+   */
+  const XYZ get_rgb_from_precolour(const XYZ& tv) const;
+
+  //! Evaluate every pixel of a single-frame image of the given size on the calling thread, keeping totals for each node in profile.
+  /*! Returns the time taken in nanoseconds, which (unlike the nodes' totals) includes the top node's own transforms.
+   */
+  unsigned long long profile_nodes(const QSize& size,FunctionProfile& profile) const;
+
   //! Return whether image value is independent of position.
   bool is_constant() const;
 
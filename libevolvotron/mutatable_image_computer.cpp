@@ -28,11 +28,11 @@
 #include "mutatable_image_computer_task.h"
 
 #include "platform_specific.h"
+#include "trace.h"
 
 MutatableImageComputer::MutatableImageComputer(MutatableImageComputerFarm* frm,int niceness)
   :_farm(frm)
   ,_niceness(niceness)
-  ,_r01(23)  // Seed pretty unimportant; only used for sample jitter
 {
   start();
 }
@@ -59,6 +59,8 @@ void MutatableImageComputer::run()
   // is less important than displaying the results we've got so far.
   add_thread_niceness(_niceness);
 
+  Trace::thread_name("compute");
+
   // Run until something sets the kill flag 
   while(!communications().kill())
     {
@@ -73,20 +75,45 @@ void MutatableImageComputer::run()
 	  // Careful, we could be given an already aborted task
 	  if (!task()->aborted())
 	    {
+	      const long long trace_begin=(Trace::enabled() ? Trace::now() : 0);
+	      const uint first_pixel=task()->current_pixel();
+	      const unsigned long long first_samples=task()->samples_computed();
+	      _metrics.begin(FarmMetrics::now_ns());
+
+	      // A deferred task carries on as it started, so its costs are all in the same units.
+	      if (task()->current_pixel()==0) task()->profiled(FunctionProfile::enabled());
+	      // Profiled tasks evaluate a copy of the tree which does the counting, so other tasks pay nothing for it.
+	      const boost::shared_ptr<const MutatableImage> image_function(task()->profiled() ? task()->image_function()->profiled(_profile) : task()->image_function());
+	      const float samples=task()->multisample_grid()*task()->multisample_grid();
+
 	      while (!communications().kill_or_abort_or_defer() && !task()->completed())
 		{
-		  XYZ accumulated_colour=task()->image_function()->get_rgb
+		  // Only pay for reading the clock when someone wants to see what pixels cost.
+		  const bool timed=(task()->record_cost() && !task()->profiled());
+		  const unsigned long long evaluations=_profile.evaluations();
+		  const std::chrono::steady_clock::time_point start(timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point());
+
+		  const XYZ precolour=image_function->get_precolour
 		    (
 		     task()->fragment_origin().width()+task()->current_col(),
 		     task()->fragment_origin().height()+task()->current_row(),
-		     task()->current_frame(),
+		     task()->frame_origin()+task()->current_frame(),
 		     task()->whole_image_size().width(),
 		     task()->whole_image_size().height(),
-		     task()->frames(),
-		     (task()->jittered_samples() ? &_r01 : 0),
+		     task()->whole_frames(),
+		     (task()->jittered_samples() ? &task()->r01() : 0),
 		     task()->multisample_grid()
 		     );
 
+		  if (timed)
+		    task()->cost(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count()/samples);
+		  else if (task()->record_cost())
+		    task()->cost((_profile.evaluations()-evaluations)/samples);
+
+		  if (task()->record_precolour()) task()->precolour(precolour);
+
+		  const XYZ accumulated_colour=task()->image_function()->get_rgb_from_precolour(precolour);
+
 		  const uint col0=lrint(accumulated_colour.x());
 		  const uint col1=lrint(accumulated_colour.y());
 		  const uint col2=lrint(accumulated_colour.z());
@@ -95,6 +122,30 @@ void MutatableImageComputer::run()
 
 		  task()->pixel_advance();
 		}
+
+	      const unsigned long long end_ns=FarmMetrics::now_ns();
+	      _metrics.end(end_ns,task()->samples_computed()-first_samples);
+	      const char*const outcome=(task()->completed() ? "completed" : communications().kill() ? "killed" : communications().abort() ? "aborted" : "deferred");
+	      if (task()->completed())
+		_metrics.completed(end_ns-task()->enqueued_ns());
+	      else if (communications().kill() || communications().abort())
+		_metrics.aborted(task()->samples_computed());
+	      else
+		_metrics.deferred();
+
+	      if (Trace::enabled())
+		Trace::complete
+		  (
+		   "compute",
+		   "task",
+		   trace_begin,
+		   Trace::Args()
+		   ("serial",task()->serial())
+		   ("level",task()->level())
+		   ("fragment",task()->fragment())
+		   ("pixels",task()->current_pixel()-first_pixel)
+		   ("outcome",outcome)
+		   );
 	    }
 	  
 	  // Maybe should capture copies of the flags for use here
@@ -102,7 +153,7 @@ void MutatableImageComputer::run()
 	    {
 	      if (communications().defer() && !communications().abort())
 		{
-		  farm()->push_todo(task());
+		  farm()->requeue(task());
 		  communications().defer(false);
 		  _task.reset();
 		}
@@ -144,6 +195,11 @@ void MutatableImageComputer::abort()
   communications().abort(true);
 }
 
+void MutatableImageComputer::clear_abort()
+{
+  communications().abort(false);
+}
+
 void MutatableImageComputer::abort_for(const MutatableImageDisplay* disp)
 {
   if (task()!=0 && task()->display()==disp)
@@ -26,8 +26,9 @@
 
 #include "common.h"
 
+#include "farm_metrics.h"
+#include "function_profile.h"
 #include "mutatable_image.h"
-#include "random.h"
 
 class MutatableImageDisplay;
 class MutatableImageComputerFarm;
@@ -49,8 +50,11 @@ class MutatableImageComputer : public QThread
   //! The current task.  Can't be a const MutatableImageComputerTask because the task holds the calculated result.
   boost::shared_ptr<MutatableImageComputerTask> _task;
 
-  //! Randomness for sampling jitter
-  Random01 _r01;
+  //! Evaluations by this thread, while profiling is enabled.
+  FunctionProfile _profile;
+
+  //! What this thread has done.
+  ComputerMetrics _metrics;
 
   //! Class encapsulating mutex-protected flags used for communicating between farm and worker.
   /*! The Mutex is of dubious value (could certainly be eliminated for reads).
@@ -178,6 +182,9 @@ class MutatableImageComputer : public QThread
   //! This method called by an external threads to shut down the current task
   void abort();
 
+  //! Clear any abort signalled while the thread was idle, which would otherwise abort its next task.
+  void clear_abort();
+
   //! This method called by an external threads to shut down the current task if it's for a particular display
   void abort_for(const MutatableImageDisplay* disp);
 
@@ -189,6 +196,24 @@ class MutatableImageComputer : public QThread
    */
   bool killed() const;
 
+  //! Accessor.
+  const FunctionProfile& profile() const
+    {
+      return _profile;
+    }
+
+  //! Accessor.
+  FunctionProfile& profile()
+    {
+      return _profile;
+    }
+
+  //! Accessor.
+  const ComputerMetrics& metrics() const
+    {
+      return _metrics;
+    }
+
   //! Indicate whether computation us taking place (only intended for counting outstanding threads).
   bool active() const
     {
@@ -24,10 +24,42 @@
 #include "mutatable_image_computer_farm.h"
 
 #include "mutatable_image_computer.h"
+#include "trace.h"
+
+namespace
+{
+  //! Locks a mutex for its lifetime (as QMutexLocker does), tracing any wait for it.
+  class FarmLock : boost::noncopyable
+  {
+  public:
+    //! Constructor.
+    FarmLock(QMutex& mutex)
+      :_mutex(mutex)
+    {
+      if (!_mutex.tryLock())
+	{
+	  Trace::Span wait("farm","lock wait");
+	  _mutex.lock();
+	}
+    }
+
+    //! Destructor.
+    ~FarmLock()
+    {
+      _mutex.unlock();
+    }
+
+  private:
+    //! The mutex held.
+    QMutex& _mutex;
+  };
+}
 
 /*! Creates the specified number of threads and store pointers to them.
  */
 MutatableImageComputerFarm::MutatableImageComputerFarm(uint n_threads, int niceness)
+  : _in_flight(0)
+  , _wasted_samples(0)
 {
   _done_position = _done.end();
 
@@ -53,7 +85,7 @@ MutatableImageComputerFarm::~MutatableImageComputerFarm()
 
   // Clear all the tasks in queues
   {
-    QMutexLocker lock(&_mutex);
+    FarmLock lock(_mutex);
     _todo.clear();
     _done.clear();
   }
@@ -71,7 +103,7 @@ static bool predicate_aborted(const boost::shared_ptr<const MutatableImageComput
 
 void MutatableImageComputerFarm::fasttrack_aborted()
 {
-  QMutexLocker lock(&_mutex);
+  FarmLock lock(_mutex);
 
   TodoQueue::iterator it = _todo.begin();
   while (it != _todo.end())
@@ -89,7 +121,7 @@ void MutatableImageComputerFarm::fasttrack_aborted()
 void MutatableImageComputerFarm::push_todo(const boost::shared_ptr<MutatableImageComputerTask> &task)
 {
   {
-    QMutexLocker lock(&_mutex);
+    FarmLock lock(_mutex);
 
     // We could be in a situation where there are tasks with lower priority which should be defered in favour of this one.
     // Currently we simply defer everything with a lower priority and let the queue sort them out.
@@ -105,16 +137,20 @@ void MutatableImageComputerFarm::push_todo(const boost::shared_ptr<MutatableImag
       }
     */
 
+    if (!task->enqueued_ns()) task->enqueued_ns(FarmMetrics::now_ns());
     _todo.insert(task);
   }
 
+  if (Trace::enabled())
+    Trace::instant("farm","enqueue",Trace::Args()("serial",task->serial())("level",task->level())("fragment",task->fragment())("priority",task->priority()));
+
   // If there any threads waiting, we should wake one up.
   _wait_condition.wakeOne();
 }
 
 const boost::shared_ptr<MutatableImageComputerTask> MutatableImageComputerFarm::pop_todo(MutatableImageComputer &requester)
 {
-  _mutex.lock();
+  FarmLock lock(_mutex);
   boost::shared_ptr<MutatableImageComputerTask> ret;
   while (!ret)
   {
@@ -123,29 +159,44 @@ const boost::shared_ptr<MutatableImageComputerTask> MutatableImageComputerFarm::
     {
       ret = (*it);
       _todo.erase(it);
+      _in_flight++;
     }
     else
     {
-      std::clog << "Thread waiting\n";
+      Trace::Span idle("farm","idle");
       _wait_condition.wait(&_mutex);
-      std::clog << "Thread woken\n";
       if (requester.killed())
         break;
     }
   }
-  _mutex.unlock();
   return ret;
 }
 
+void MutatableImageComputerFarm::requeue(const boost::shared_ptr<MutatableImageComputerTask> &task)
+{
+  {
+    FarmLock lock(_mutex);
+    assert(_in_flight > 0);
+    _in_flight--;
+    _todo.insert(task);
+  }
+  _wait_condition.wakeOne();
+}
+
 void MutatableImageComputerFarm::push_done(const boost::shared_ptr<MutatableImageComputerTask> &task)
 {
-  QMutexLocker lock(&_mutex);
-  _done[task->display()].insert(task);
+  {
+    FarmLock lock(_mutex);
+    assert(_in_flight > 0);
+    _in_flight--;
+    _done[task->display()].insert(task);
+  }
+  _done_wait_condition.wakeAll();
 }
 
 const boost::shared_ptr<MutatableImageComputerTask> MutatableImageComputerFarm::pop_done()
 {
-  QMutexLocker lock(&_mutex);
+  FarmLock lock(_mutex);
 
   boost::shared_ptr<MutatableImageComputerTask> ret;
   if (_done_position == _done.end())
@@ -179,13 +230,26 @@ const boost::shared_ptr<MutatableImageComputerTask> MutatableImageComputerFarm::
   return ret;
 }
 
+const boost::shared_ptr<MutatableImageComputerTask> MutatableImageComputerFarm::wait_done(unsigned long timeout)
+{
+  {
+    FarmLock lock(_mutex);
+    while (_done.empty())
+      if (!_done_wait_condition.wait(&_mutex,timeout)) break;
+  }
+  return pop_done();
+}
+
 void MutatableImageComputerFarm::abort_all()
 {
-  QMutexLocker lock(&_mutex);
+  Trace::instant("farm","abort all");
+
+  FarmLock lock(_mutex);
 
   for (TodoQueue::iterator it = _todo.begin(); it != _todo.end(); it++)
   {
     (*it)->abort();
+    _wasted_samples += (*it)->samples_computed();
   }
   _todo.clear();
 
@@ -199,21 +263,56 @@ void MutatableImageComputerFarm::abort_all()
     DoneQueue &q = (*it0).second;
     for (DoneQueue::iterator it1 = q.begin(); it1 != q.end(); it1++)
     {
+      if (!(*it1)->aborted())
+        _wasted_samples += (*it1)->samples_computed();
       (*it1)->abort();
     }
   }
   _done.clear();
+  _done_position = _done.end();
+}
+
+void MutatableImageComputerFarm::abort_all_and_wait()
+{
+  abort_all();
+
+  FarmLock lock(_mutex);
+  while (_in_flight > 0)
+    _done_wait_condition.wait(&_mutex);
+
+  // Nothing is being computed now, so threads which were idle can't be aborting anything.
+  for (boost::ptr_vector<MutatableImageComputer>::iterator it = _computers.begin(); it != _computers.end(); it++)
+  {
+    (*it).clear_abort();
+  }
+
+  // A thread can have finished its task just as abort_all signalled it, so not everything given back is marked aborted.
+  for (DoneQueueByDisplay::iterator it0 = _done.begin(); it0 != _done.end(); it0++)
+  {
+    DoneQueue &q = (*it0).second;
+    for (DoneQueue::iterator it1 = q.begin(); it1 != q.end(); it1++)
+    {
+      if (!(*it1)->aborted())
+        _wasted_samples += (*it1)->samples_computed();
+      (*it1)->abort();
+    }
+  }
+  _done.clear();
+  _done_position = _done.end();
 }
 
 void MutatableImageComputerFarm::abort_for(const MutatableImageDisplay *disp)
 {
-  QMutexLocker lock(&_mutex);
+  Trace::instant("farm","abort display");
+
+  FarmLock lock(_mutex);
 
   for (TodoQueue::iterator it = _todo.begin(); it != _todo.end(); it++)
   {
     if ((*it)->display() == disp)
     {
       (*it)->abort();
+      _wasted_samples += (*it)->samples_computed();
 
       it = _todo.erase(it);
       if (it == _todo.end())
@@ -226,23 +325,22 @@ void MutatableImageComputerFarm::abort_for(const MutatableImageDisplay *disp)
     (*it).abort_for(disp);
   }
 
+  // The display's whole done queue goes: an empty one left behind would make wait_done return without waiting.
   DoneQueueByDisplay::iterator it0 = _done.find(disp);
   if (it0 != _done.end())
   {
     DoneQueue &q = (*it0).second;
-
-    //! \todo It would be pretty odd if display didn't match the queue bin: change to assert
     for (DoneQueue::iterator it1 = q.begin(); it1 != q.end(); it1++)
     {
-      if ((*it1)->display() == disp)
-      {
-        (*it1)->abort();
-
-        it1 = q.erase(it1);
-        if (it1 == q.end())
-          break;
-      }
+      assert((*it1)->display() == disp);
+      if (!(*it1)->aborted())
+        _wasted_samples += (*it1)->samples_computed();
+      (*it1)->abort();
     }
+
+    if (_done_position == it0)
+      _done_position++;
+    _done.erase(it0);
   }
 }
 
@@ -258,7 +356,7 @@ uint MutatableImageComputerFarm::tasks() const
     }
   }
 
-  QMutexLocker lock(&_mutex);
+  FarmLock lock(_mutex);
 
   ret += _todo.size();
 
@@ -267,3 +365,33 @@ uint MutatableImageComputerFarm::tasks() const
 
   return ret;
 }
+
+void MutatableImageComputerFarm::profile(std::vector<FunctionProfile::Totals>& totals) const
+{
+  for (boost::ptr_vector<MutatableImageComputer>::const_iterator it = _computers.begin(); it != _computers.end(); it++)
+    (*it).profile().accumulate(totals);
+}
+
+void MutatableImageComputerFarm::reset_profile()
+{
+  for (boost::ptr_vector<MutatableImageComputer>::iterator it = _computers.begin(); it != _computers.end(); it++)
+    (*it).profile().reset();
+}
+
+void MutatableImageComputerFarm::metrics(FarmMetrics& m) const
+{
+  {
+    FarmLock lock(_mutex);
+    for (TodoQueue::const_iterator it = _todo.begin(); it != _todo.end(); it++)
+      m.queued[(*it)->level()]++;
+  }
+
+  for (boost::ptr_vector<MutatableImageComputer>::const_iterator it = _computers.begin(); it != _computers.end(); it++)
+  {
+    (*it).metrics().accumulate(m);
+    if ((*it).active())
+      m.running++;
+  }
+
+  m.wasted_samples += _wasted_samples;
+}
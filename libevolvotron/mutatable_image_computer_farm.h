@@ -68,6 +68,9 @@ class MutatableImageComputerFarm
   //! Wait condition for threads waiting for a new task.
   QWaitCondition _wait_condition;
 
+  //! Wait condition for a client waiting for a completed task.
+  QWaitCondition _done_wait_condition;
+
   //! The compute threads
   boost::ptr_vector<MutatableImageComputer> _computers;
 
@@ -98,6 +101,12 @@ class MutatableImageComputerFarm
   //! Points to the next display queue to be returned (could be .end())
   DoneQueueByDisplay::iterator _done_position;
 
+  //! Tasks taken by compute threads and not yet given back.
+  uint _in_flight;
+
+  //! Samples computed for queued or completed tasks which were then aborted (those aborted mid-computation are counted by their computers).
+  std::atomic<unsigned long long> _wasted_samples;
+
  public:
 
   //! Constructor.
@@ -121,20 +130,44 @@ class MutatableImageComputerFarm
   //! Remove a task from the head of the todo queue (returns null if none).
   const boost::shared_ptr<MutatableImageComputerTask> pop_todo(MutatableImageComputer& requester);
 
+  //! Return a deferred task to the todo queue (for compute threads).
+  void requeue(const boost::shared_ptr<MutatableImageComputerTask>&);
+
   //! Enqueue a task for display.
   void push_done(const boost::shared_ptr<MutatableImageComputerTask>&);
 
   //! Remove a task from the head of the display queue (returns null if none).
   const boost::shared_ptr<MutatableImageComputerTask> pop_done();
 
+  //! Remove a task from the head of the display queue, blocking until there is one.
+  /*! For clients without an event loop polling pop_done.
+    Returns null if there's still none after timeout milliseconds.
+   */
+  const boost::shared_ptr<MutatableImageComputerTask> wait_done(unsigned long timeout=ULONG_MAX);
+
   //! Flags all tasks in all queues as aborted, and signals the compute threads to abort their current task.
   void abort_all();
 
+  //! As abort_all, but also waits for the compute threads to give back what they were computing, and discards it.
+  /*! Nothing queued before then turns up in the done queue afterwards.
+    Only for clients (such as TiledRenderer) which don't queue tasks while it waits.
+   */
+  void abort_all_and_wait();
+
   //! Flags all tasks for a particular display as aborted (including compute threads)
   void abort_for(const MutatableImageDisplay* disp);
 
   //! Number of tasks in queues
   uint tasks() const;
+
+  //! Add the compute threads' profiles to totals (indexed by FunctionProfile::type_index).
+  void profile(std::vector<FunctionProfile::Totals>& totals) const;
+
+  //! Clear the compute threads' profiles.
+  void reset_profile();
+
+  //! Add what the farm has done, and is doing, to a snapshot.
+  void metrics(FarmMetrics& m) const;
 };
 
 #endif
@@ -25,6 +25,14 @@
 
 #include "mutatable_image_computer_task.h"
 
+#include "memory_account.h"
+
+namespace
+{
+  //! Memory held by tasks' image (per frame), pre-colour and cost buffers (images delivered to a display become its own).
+  MemoryAccount task_buffers("task buffers");
+}
+
 MutatableImageComputerTask::MutatableImageComputerTask
 (
  MutatableImageDisplay*const disp,
@@ -33,12 +41,16 @@ MutatableImageComputerTask::MutatableImageComputerTask
  const QSize& fo,
  const QSize& fs,
  const QSize& wis,
+ uint ff,
  uint f,
+ uint wf,
  uint lev,
  uint frag,
  uint nfrag,
  bool j,
  uint ms,
+ bool pc,
+ bool rc,
  unsigned long long int n
  )
   :_aborted(false)
@@ -48,18 +60,26 @@ MutatableImageComputerTask::MutatableImageComputerTask
   ,_fragment_origin(fo)
   ,_fragment_size(fs)
   ,_whole_image_size(wis)
+  ,_frame_origin(ff)
   ,_frames(f)
+  ,_whole_frames(wf)
   ,_level(lev)
   ,_fragment(frag)
   ,_number_of_fragments(nfrag)
   ,_jittered_samples(j)
   ,_multisample_grid(ms)
+  ,_record_precolour(pc)
+  ,_record_cost(rc)
+  ,_r01(23+frag+nfrag*ff)  // Seed pretty unimportant, but must depend only on what's being computed
   ,_current_pixel(0)
   ,_current_col(0)
   ,_current_row(0)
   ,_current_frame(0)
+  ,_enqueued_ns(0)
+  ,_profiled(false)
   ,_completed(false)
   ,_serial(n)
+  ,_memory(task_buffers)
 {
   /*
   std::cerr 
@@ -75,6 +95,7 @@ MutatableImageComputerTask::MutatableImageComputerTask
   assert(_fragment<_number_of_fragments);
   assert(_number_of_fragments>1 || _whole_image_size==_fragment_size);
   assert(1<=_multisample_grid);
+  assert(_frame_origin+_frames<=_whole_frames);
 }
 
 void MutatableImageComputerTask::allocate_images() const
@@ -83,6 +104,13 @@ void MutatableImageComputerTask::allocate_images() const
     {
       _images.push_back(QImage(fragment_size(),QImage::Format_RGB32));
     }
+  _memory.add(_images.size(),static_cast<long long>(_images.size())*_images[0].bytesPerLine()*fragment_size().height());
+}
+
+void MutatableImageComputerTask::allocate(std::vector<float>& v,size_t n)
+{
+  v.resize(n);
+  _memory.add(1,n*sizeof(float));
 }
 
 MutatableImageComputerTask::~MutatableImageComputerTask()
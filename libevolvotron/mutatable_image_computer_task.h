@@ -26,7 +26,9 @@
 
 #include "common.h"
 
+#include "memory_account.h"
 #include "mutatable_image.h"
+#include "random.h"
 #include "mutatable_image_display.h"
 
 //! Class encapsulating all the parameters of, and output from, a single image generation run.
@@ -63,9 +65,15 @@ class MutatableImageComputerTask
   //! The full size of the image of which this is a fragment.
   const QSize _whole_image_size;
 
+  //! The first animation frame to be rendered.
+  const uint _frame_origin;
+
   //! Number of animation frames to be rendered
   const uint _frames;
 
+  //! The full number of frames in the animation of which these are part.
+  const uint _whole_frames;
+
   //! The resolution level of this image (0=1-for-1 pixels, 1=half res etc)
   /*! This is tracked because multiple compute threads could return the completed tasks out of order
     (Unlikely given the huge difference in the amount of compute between levels, but possible).
@@ -84,6 +92,17 @@ class MutatableImageComputerTask
   //! Multisampling grid resolution e.g 4 implies a 4x4 grid
   const uint _multisample_grid;
 
+  //! Whether pre-colour-transform values should be retained as well as the image.
+  const bool _record_precolour;
+
+  //! Whether the cost of computing each pixel should be measured (which takes time of its own).
+  const bool _record_cost;
+
+  //! Randomness for sampling jitter.
+  /*! Held by the task rather than the compute thread, so results don't depend on which thread computes them.
+   */
+  Random01 _r01;
+
   //@{
   //! Track pixels computed, so tasks can be restarted after defer.  Row and column are relative to the fragment origin.
   uint _current_pixel;
@@ -101,6 +120,23 @@ class MutatableImageComputerTask
 
   //! Lazy allocator for _images (which is mutable)
   void allocate_images() const;
+
+  //! Lazy allocator for _precolour and _cost.
+  void allocate(std::vector<float>& v,size_t n);
+
+  //! Pre-colour-transform values of each pixel (3 per pixel, frame major), if recorded.
+  /*! Floats are ample for the 8-bit colour eventually computed from them, and halve the memory.
+   */
+  std::vector<float> _precolour;
+
+  //! Cost of computing each pixel (per sample, frame major).
+  std::vector<float> _cost;
+
+  //! When the task was first queued (as FarmMetrics::now_ns; 0 until it is).
+  unsigned long long _enqueued_ns;
+
+  //! Whether the task is computed from a profiled copy of its image function, and so has its cost counted in node evaluations rather than nanoseconds.
+  bool _profiled;
   
   //! Set true by pixel_advance when it advances off the last frame.
   bool _completed;
@@ -108,6 +144,9 @@ class MutatableImageComputerTask
   //! Serial number, to fix some occasional out-of-order display problems
   unsigned long long int _serial;
 
+  //! The image, pre-colour and cost buffers, in the task buffers' MemoryAccount.
+  mutable MemoryAccount::Holding _memory;
+
  public:
   //! Constructor.
   MutatableImageComputerTask
@@ -118,12 +157,16 @@ class MutatableImageComputerTask
      const QSize& fo,
      const QSize& fs,
      const QSize& wis,
+     uint ff,
      uint f,
+     uint wf,
      uint lev,
      uint frag,
      uint nfrag,
      bool j,
      uint ms,
+     bool pc,
+     bool rc,
      unsigned long long int n
      );
   
@@ -172,12 +215,24 @@ class MutatableImageComputerTask
       return _whole_image_size;
     }
 
+  //! Accessor.
+  uint frame_origin() const
+    {
+      return _frame_origin;
+    }
+
   //! Accessor.
   uint frames() const
     {
       return _frames;
     }
 
+  //! Accessor.
+  uint whole_frames() const
+    {
+      return _whole_frames;
+    }
+
   //! Accessor.
   uint level() const
     {
@@ -208,6 +263,83 @@ class MutatableImageComputerTask
       return _multisample_grid;
     }
 
+  //! Source of sample jitter.
+  Random01& r01()
+    {
+      return _r01;
+    }
+
+  //! Accessor.
+  bool record_precolour() const
+    {
+      return _record_precolour;
+    }
+
+  //! Accessor.
+  bool record_cost() const
+    {
+      return _record_cost;
+    }
+
+  //! Pre-colour-transform values (empty unless recorded).
+  const std::vector<float>& precolour() const
+    {
+      return _precolour;
+    }
+
+  //! Record the pre-colour-transform value for the current pixel.
+  void precolour(const XYZ& tv)
+    {
+      if (_precolour.empty()) allocate(_precolour,3*fragment_size().width()*fragment_size().height()*frames());
+      float*const v=&_precolour[3*_current_pixel];
+      v[0]=tv.x();
+      v[1]=tv.y();
+      v[2]=tv.z();
+    }
+
+  //! Per-sample cost of each pixel computed (in nanoseconds, or node evaluations if profiled; empty unless recorded).
+  const std::vector<float>& cost() const
+    {
+      return _cost;
+    }
+
+  //! Record the per-sample cost of the current pixel.
+  void cost(float c)
+    {
+      if (_cost.empty()) allocate(_cost,fragment_size().width()*fragment_size().height()*frames());
+      _cost[_current_pixel]=c;
+    }
+
+  //! Accessor.
+  unsigned long long enqueued_ns() const
+    {
+      return _enqueued_ns;
+    }
+
+  //! Accessor.
+  void enqueued_ns(unsigned long long t)
+    {
+      _enqueued_ns=t;
+    }
+
+  //! Samples computed so far.
+  unsigned long long samples_computed() const
+    {
+      return static_cast<unsigned long long>(_current_pixel)*_multisample_grid*_multisample_grid;
+    }
+
+  //! Accessor.
+  bool profiled() const
+    {
+      return _profiled;
+    }
+
+  //! Accessor.  Set by the compute thread as it starts the task, so all of it is costed the same way.
+  void profiled(bool p)
+    {
+      _profiled=p;
+    }
+
   //! Serial number
   unsigned long long int serial() const
     {
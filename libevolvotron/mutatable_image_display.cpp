@@ -24,12 +24,23 @@
 #include "mutatable_image_display.h"
 
 #include "mutatable_image_display_big.h"
+#include "cost_map.h"
 #include "evolvotron_main.h"
 #include "mutatable_image_computer_task.h"
+#include "trace.h"
 #include "transform_factory.h"
 #include "function_pre_transform.h"
 #include "function_top.h"
 
+namespace
+{
+  //! Memory held by displays' offscreen images (one per frame, at the resolution last delivered).
+  MemoryAccount display_images("display images");
+
+  //! Memory held by displays' offscreen pixmaps (one per frame, at the display's size).
+  MemoryAccount display_pixmaps("display pixmaps");
+}
+
 /*! The constructor is passed:
     - the owning widget (probably either a QGrid or null if top-level),
     - the EvolvotronMain providing spawn and farm services, 
@@ -52,11 +63,15 @@ MutatableImageDisplay::MutatableImageDisplay(EvolvotronMain* mn,bool full_functi
   ,_current_display_level(0)
   ,_current_display_multisample_grid(0)
   ,_icon_serial(0LL)
+  ,_precolour_multisample_grid(0)
   ,_properties(0)
   ,_menu(0)
   ,_menu_big(0)
   ,_menu_item_action_lock(0)
+  ,_mid_button_adjust_snapshot(false)
   ,_serial(0LL)
+  ,_images_memory(display_images)
+  ,_pixmaps_memory(display_pixmaps)
 {
   setAttribute(Qt::WA_DeleteOnClose,true);
 
@@ -155,6 +170,7 @@ MutatableImageDisplay::~MutatableImageDisplay()
   if (_main)
     {
       farm().abort_for(this);
+      main().spawn_latency().abandon(_spawn);
       main().goodbye(this);
     }
 
@@ -240,6 +256,12 @@ void MutatableImageDisplay::image_function(const boost::shared_ptr<const Mutatab
     {
       _image_function=i;
 
+      // Time how long the new image takes to show (but only in the grid; enlargements take as long as they take).
+      if (_full_functionality && i.get())
+	main().spawn_latency().begin(_spawn);
+      else
+	main().spawn_latency().abandon(_spawn);
+
       // If we're part of a fullscale change then better to display back rather than something misleading
       // but for one-offs (e.g middle mouse drag) is better not to clear.
       if (one_of_many)
@@ -253,6 +275,11 @@ void MutatableImageDisplay::image_function(const boost::shared_ptr<const Mutatab
 	}
     }
 
+  // Any pre-colour values or reprojection are for an old image or size.
+  _precolour.reset();
+  _cost.reset();
+  _offscreen_valid.clear();
+
   // If we start recomputing again we need to accept any delivered images.
   _current_display_level=static_cast<uint>(-1);
   _current_display_multisample_grid=static_cast<uint>(-1);
@@ -321,12 +348,16 @@ void MutatableImageDisplay::image_function(const boost::shared_ptr<const Mutatab
 			  QSize(0,fragment_start_row),
 			  QSize(render_size.width(),fragment_end_row-fragment_start_row),
 			  render_size,
+			  0,
+			  _frames,
 			  _frames,
 			  level,
 			  f,
 			  fragments,
 			  main().render_parameters().jittered_samples(),
 			  (*multisample_it),
+			  (_full_functionality && level==0),
+			  main().cost_map(),
 			  _serial
 			  )
 			 );
@@ -351,6 +382,10 @@ void MutatableImageDisplay::deliver(const boost::shared_ptr<const MutatableImage
       )
     return;
 
+  Trace::Span span("gui","deliver");
+  if (Trace::enabled())
+    span.args(Trace::Args()("serial",task->serial())("level",task->level())("fragment",task->fragment()));
+
   // Record the fragment in the inbox
   const OffscreenImageInbox::key_type inbox_key(task->level(),task->multisample_grid());  
   OffscreenImageInbox::mapped_type& inbox_level=_offscreen_images_inbox[inbox_key];
@@ -372,22 +407,22 @@ void MutatableImageDisplay::deliver(const boost::shared_ptr<const MutatableImage
   
   const QSize render_size(task->whole_image_size());
   
+  std::vector<QImage> images;
   if (task->number_of_fragments()==1)
     {
       // If there's only one fragment in the task, just use it
-      _offscreen_images=task->images();
+      images=task->images();
     }
   else
     {
       // Otherwise we need to assemble the fragments together
-      _offscreen_images.resize(0);
       for (uint f=0;f<_frames;f++)
 	{
-	  _offscreen_images.push_back(QImage(render_size,QImage::Format_RGB32));
+	  images.push_back(QImage(render_size,QImage::Format_RGB32));
 	  
 	  for (OffscreenImageInbox::mapped_type::const_iterator it=inbox_level.begin();it!=inbox_level.end();++it)
 	    {
-	      QPainter painter(&_offscreen_images.back());
+	      QPainter painter(&images.back());
 	      painter.drawImage
 		(
 		 QPoint((*it).second->fragment_origin().width(),(*it).second->fragment_origin().height()),
@@ -396,35 +431,225 @@ void MutatableImageDisplay::deliver(const boost::shared_ptr<const MutatableImage
 	    }
 	}
     }
+
+  if (
+      !_offscreen_valid.empty()
+      && render_size.width()*render_size.height()<_offscreen_images[0].width()*_offscreen_images[0].height()
+      )
+    {
+      // Coarser than the reprojected image: only use it to fill in the pixels reprojection couldn't supply.
+      const QSize size(_offscreen_images[0].size());
+      for (uint f=0;f<_frames;f++)
+	{
+	  const QImage coarse(images[f].scaled(size));
+	  for (int row=0;row<size.height();row++)
+	    for (int col=0;col<size.width();col++)
+	      if (!_offscreen_valid[row*size.width()+col])
+		_offscreen_images[f].setPixel(col,row,coarse.pixel(col,row));
+	}
+    }
+  else
+    {
+      _offscreen_images.swap(images);
+      _offscreen_valid.clear();
+
+      // Keep what each pixel cost, for the cost map overlay (costs are only measured while it's on).
+      _cost.reset();
+      if (task->record_cost())
+	{
+	  boost::shared_ptr<std::vector<float> > cost(new std::vector<float>(render_size.width()*render_size.height()*_frames));
+	  for (OffscreenImageInbox::mapped_type::const_iterator it=inbox_level.begin();it!=inbox_level.end();++it)
+	    {
+	      const MutatableImageComputerTask& fragment=*(*it).second;
+	      const std::vector<float>& values=fragment.cost();
+	      const uint row_floats=fragment.fragment_size().width();
+	      for (uint f=0;f<_frames;f++)
+		for (int r=0;r<fragment.fragment_size().height();r++)
+		  {
+		    const uint src=row_floats*(f*fragment.fragment_size().height()+r);
+		    const uint dst=(f*render_size.height()+fragment.fragment_origin().height()+r)*render_size.width()+fragment.fragment_origin().width();
+		    std::copy(values.begin()+src,values.begin()+src+row_floats,cost->begin()+dst);
+		  }
+	    }
+	  _cost=cost;
+	}
+    }
+
+  if (task->record_precolour())
+    {
+      // Keep the pre-colour-transform values so recolourings of this image needn't be recomputed.
+      boost::shared_ptr<std::vector<float> > precolour(new std::vector<float>(3*render_size.width()*render_size.height()*_frames));
+      for (OffscreenImageInbox::mapped_type::const_iterator it=inbox_level.begin();it!=inbox_level.end();++it)
+	{
+	  const MutatableImageComputerTask& fragment=*(*it).second;
+	  const std::vector<float>& values=fragment.precolour();
+	  const uint row_floats=3*fragment.fragment_size().width();
+	  for (uint f=0;f<_frames;f++)
+	    for (int r=0;r<fragment.fragment_size().height();r++)
+	      {
+		const uint src=row_floats*(f*fragment.fragment_size().height()+r);
+		const uint dst=3*((f*render_size.height()+fragment.fragment_origin().height()+r)*render_size.width()+fragment.fragment_origin().width());
+		std::copy(values.begin()+src,values.begin()+src+row_floats,precolour->begin()+dst);
+	      }
+	}
+      _precolour=precolour;
+      _precolour_multisample_grid=task->multisample_grid();
+    }
+
+  show_offscreen_images(task->level(),task->multisample_grid());
+}
+
+/*! With the cost map overlay on, the pixmaps show what each pixel cost instead (when that's known).
+ */
+void MutatableImageDisplay::update_pixmaps()
+{
+  const bool cost_map=(main().cost_map() && _cost);
+  const float cost_scale=(cost_map ? cost_map_scale(*_cost) : 0.0f);
+  const QSize render_size(_offscreen_images[0].size());
+  Trace::Span span("gui","pixmaps");
   
   for (uint f=0;f<_frames;f++)
     {
+      const QImage image
+	(
+	 cost_map
+	 ? cost_map_image(&(*_cost)[f*render_size.width()*render_size.height()],render_size,cost_scale)
+	 : _offscreen_images[f]
+	 );
+
       //! \todo Pick a scaling mode: Qt::SmoothTransformation vs Qt::FastTransformation (default) (and put it under GUI control). 
       //! \todo Expose dither mode control: Qt::DiffuseDither vs Qt::ThresholdDither
-      _offscreen_pixmaps[f]=QPixmap::fromImage(_offscreen_images[f].scaled(image_size()),(Qt::ColorOnly|Qt::ThresholdDither));
+      _offscreen_pixmaps[f]=QPixmap::fromImage(image.scaled(image_size()),(Qt::ColorOnly|Qt::ThresholdDither));
+    }
+
+  account_memory();
+}
+
+/*! Pixmaps are counted at their depth, though where they're actually held (and in what format) is up to the window system.
+ */
+void MutatableImageDisplay::account_memory()
+{
+  long long bytes=0;
+  for (uint f=0;f<_offscreen_images.size();f++)
+    bytes+=static_cast<long long>(_offscreen_images[f].bytesPerLine())*_offscreen_images[f].height();
+  _images_memory.set(_offscreen_images.size(),bytes);
+
+  uint pixmaps=0;
+  bytes=0;
+  for (uint f=0;f<_offscreen_pixmaps.size();f++)
+    if (!_offscreen_pixmaps[f].isNull())
+      {
+	pixmaps++;
+	bytes+=static_cast<long long>(_offscreen_pixmaps[f].width())*_offscreen_pixmaps[f].height()*_offscreen_pixmaps[f].depth()/8;
+      }
+  _pixmaps_memory.set(pixmaps,bytes);
+}
+
+/*! Costs are only measured while the overlay is on, so turning it on recomputes an image computed without them.
+ */
+void MutatableImageDisplay::cost_map_changed()
+{
+  if (main().cost_map() && !_cost && _image_function)
+    {
+      image_function(_image_function,false);
+      return;
     }
+  if (_offscreen_images.size()!=_frames) return;
+  update_pixmaps();
+  update();
+}
+
+void MutatableImageDisplay::show_offscreen_images(uint level,uint multisample_grid)
+{
+  const QSize render_size(_offscreen_images[0].size());
+
+  update_pixmaps();
+
+  if (_spawn.pending)
+    main().spawn_latency().reached
+      (
+       _spawn,
+       level>0 ? SpawnLatency::FirstPreview
+       : multisample_grid<main().render_parameters().multisample_grid() ? SpawnLatency::FullResolution
+       : SpawnLatency::Final
+       );
   
   //! Note the resolution we've displayed so out-of-order low resolution images are dropped
-  _current_display_level=task->level();
-  _current_display_multisample_grid=task->multisample_grid();
+  _current_display_level=level;
+  _current_display_multisample_grid=multisample_grid;
   
   // For an icon, take the first image big enough to (hopefully) be filtered down nicely.
   // The (Qt3) converter seems to auto-create an alpha mask sometimes (images with const-color areas), which is quite cool.
   const QSize icon_size(32,32);
-  if (task->serial()!=_icon_serial && (task->level()==0 || (render_size.width()>=2*icon_size.width() && render_size.height()>=2*icon_size.height())))
+  if (_serial!=_icon_serial && (level==0 || (render_size.width()>=2*icon_size.width() && render_size.height()>=2*icon_size.height())))
     {
       const QImage icon_image(_offscreen_images[_offscreen_images.size()/2].scaled(icon_size));
       
       if (!_icon.get()) _icon=std::unique_ptr<QPixmap>(new QPixmap(icon_size));
       (*_icon)=QPixmap::fromImage(icon_image,Qt::ColorOnly);
       
-      _icon_serial=task->serial();
+      _icon_serial=_serial;
     }
 
   // Update what's on the screen.
   update();
 }
 
+/*! The source display must be showing the image this one is a recolouring of, at full resolution and multisampling.
+  The colour transform is then applied directly to the source's pre-colour-transform values,
+  which takes milliseconds rather than the full recompute image_function would start.
+ */
+bool MutatableImageDisplay::image_function_recoloured(const boost::shared_ptr<const MutatableImage>& image_fn,const MutatableImageDisplay& source)
+{
+  if (
+      !source._precolour
+      || source.image_size()!=image_size()
+      || source._frames!=_frames
+      || source._precolour_multisample_grid!=main().render_parameters().multisample_grid()
+      )
+    return false;
+
+  assert(image_fn->ok());
+
+  _serial++;
+  farm().abort_for(this);
+
+  _image_function=image_fn;
+  if (_full_functionality) main().spawn_latency().begin(_spawn);
+  _offscreen_images_inbox.clear();
+  _offscreen_valid.clear();
+  _precolour=source._precolour;
+  _precolour_multisample_grid=source._precolour_multisample_grid;
+  // A recolouring of a function costs (or would cost) the same to compute.
+  _cost=source._cost;
+
+  if (_menu_item_action_lock)
+    _menu_item_action_lock->setChecked(_image_function->locked());
+
+  const std::vector<float>& precolour=*_precolour;
+  _offscreen_images.resize(0);
+  for (uint f=0;f<_frames;f++)
+    {
+      _offscreen_images.push_back(QImage(image_size(),QImage::Format_RGB32));
+      QImage& image=_offscreen_images.back();
+      for (int row=0;row<image_size().height();row++)
+	for (int col=0;col<image_size().width();col++)
+	  {
+	    const float*const v=&precolour[3*((f*image_size().height()+row)*image_size().width()+col)];
+	    const XYZ colour(_image_function->get_rgb_from_precolour(XYZ(v[0],v[1],v[2])));
+	    
+	    const uint col0=lrint(colour.x());
+	    const uint col1=lrint(colour.y());
+	    const uint col2=lrint(colour.z());
+	    
+	    image.setPixel(col,row,((col0<<16)|(col1<<8)|(col2)));
+	  }
+    }
+
+  show_offscreen_images(0,_precolour_multisample_grid);
+  return true;
+}
+
 void MutatableImageDisplay::lock(bool l,bool record_in_history)
 {
   // This might be called (with l=false) with null _image during start-up reset.
@@ -486,6 +711,8 @@ void MutatableImageDisplay::resizeEvent(QResizeEvent* event)
       
       // Abort all current tasks because they'll be the wrong size.
       farm().abort_for(this);
+      _precolour.reset();
+      _offscreen_valid.clear();
       
       // Resize and reset our offscreen pixmap (something to do while we wait)
       for (uint f=0;f<_offscreen_pixmaps.size();f++)
@@ -493,6 +720,7 @@ void MutatableImageDisplay::resizeEvent(QResizeEvent* event)
 	  _offscreen_pixmaps[f]=QPixmap(image_size()); 
 	  _offscreen_pixmaps[f].fill(QColor(0,0,0));           
 	}
+      account_memory();
       
       // Flag for the next paintEvent to tell it a recompute can be started now.
       _resize_in_progress=true;
@@ -522,7 +750,8 @@ void MutatableImageDisplay::mousePressEvent(QMouseEvent* event)
     }
   else if (event->button() == Qt::MiddleButton)
     {
-      snapshot("middle-button drag");
+      // Snapshot deferred until the image actually changes.
+      _mid_button_adjust_snapshot=false;
 
       _mid_button_adjust_start_pos=event->pos();
       _mid_button_adjust_last_pos=event->pos();
@@ -542,12 +771,67 @@ void MutatableImageDisplay::mousePressEvent(QMouseEvent* event)
 
 void MutatableImageDisplay::mouseTransform(const Transform& tf)
 {
-  std::unique_ptr<FunctionTop> new_root(image_function()->top().typed_deepclone());
-  new_root->concatenate_pretransform_on_right(tf);
+  // Warp what's already computed into the new view before it's invalidated.
+  std::vector<QImage> images;
+  std::vector<bool> valid;
+  const bool reprojected=reproject(tf,images,valid);
+
+  // Install new image (triggers recompute).  This shares the function tree; only the pre-transform changes.
+  image_function(image_function()->pretransformed(tf),false);
 
-  // Install new image (triggers recompute).
-  const boost::shared_ptr<const MutatableImage> new_image_function(new MutatableImage(new_root,image_function()->sinusoidal_z(),image_function()->spheremap(),false));
-  image_function(new_image_function,false);
+  if (reprojected)
+    {
+      _offscreen_images.swap(images);
+      _offscreen_valid.swap(valid);
+      update_pixmaps();
+      update();
+    }
+}
+
+/*! The new image samples the old one's function at tf of each sample position,
+  so each pixel of the new view can be looked up in the existing (possibly low resolution) images.
+  Pixels with no (valid) source are flagged invalid; they're filled in from coarse levels as they arrive,
+  until a level at least as fine as the reprojected one replaces everything.
+  Only planar projections and transforms preserving z (so each frame maps to itself) are handled.
+ */
+bool MutatableImageDisplay::reproject(const Transform& tf,std::vector<QImage>& images,std::vector<bool>& valid) const
+{
+  if (_offscreen_images.size()!=_frames || _image_function->spheremap()) return false;
+
+  if (
+      tf.basis_x().z()!=0.0 || tf.basis_y().z()!=0.0 || tf.translate().z()!=0.0
+      || tf.basis_z().x()!=0.0 || tf.basis_z().y()!=0.0 || tf.basis_z().z()!=1.0
+      )
+    return false;
+
+  const int w=_offscreen_images[0].width();
+  const int h=_offscreen_images[0].height();
+
+  images.clear();
+  for (uint f=0;f<_frames;f++)
+    {
+      images.push_back(QImage(w,h,QImage::Format_RGB32));
+      images.back().fill(0);
+    }
+  valid.assign(w*h,false);
+
+  for (int row=0;row<h;row++)
+    for (int col=0;col<w;col++)
+      {
+	const XYZ q(tf.transformed(_image_function->sampling_coordinate(col+0.5,row+0.5,0,w,h,_frames)));
+	const int src_col=static_cast<int>(floor(0.5*(q.x()+1.0)*w));
+	const int src_row=static_cast<int>(floor(0.5*(1.0-q.y())*h));
+	if (
+	    0<=src_col && src_col<w && 0<=src_row && src_row<h
+	    && (_offscreen_valid.empty() || _offscreen_valid[src_row*w+src_col])
+	    )
+	  {
+	    valid[row*w+col]=true;
+	    for (uint f=0;f<_frames;f++)
+	      images[f].setPixel(col,row,_offscreen_images[f].pixel(src_col,src_row));
+	  }
+      }
+  return true;
 }
 
 void MutatableImageDisplay::mouseMoveEvent(QMouseEvent* event)
@@ -672,7 +956,12 @@ void MutatableImageDisplay::mouseMoveEvent(QMouseEvent* event)
 	      std::clog << "[Pan]";
 	    }
 	  
-      mouseTransform(transform);
+	  if (!_mid_button_adjust_snapshot)
+	    {
+	      snapshot("middle-button drag");
+	      _mid_button_adjust_snapshot=true;
+	    }
+	  mouseTransform(transform);
 
 	  // Finally, record position of this event as last event
 	  _mid_button_adjust_last_pos=event->pos();
@@ -829,7 +1118,8 @@ void MutatableImageDisplay::menupick_save_image()
 		  );
 	    }
 
-      bool ok = true;
+	  // Images are saved in the background; the main window reports failures, and remembers the path once they're all saved.
+	  std::vector<std::string> filenames;
 	  for (uint f=0;f<_offscreen_images.size();f++)
 	    {
 	      QString actual_save_filename(save_filename);
@@ -844,23 +1134,19 @@ void MutatableImageDisplay::menupick_save_image()
 		      actual_save_filename.insert(insert_point,frame_component);
 		}
 
-	      if (!_offscreen_images[f].save(actual_save_filename,save_format.toLocal8Bit()))
-		{
-		  QMessageBox::critical(this,"Evolvotron","Failed to write file "+actual_save_filename);
-		  if (f<_offscreen_images.size()-1)
-		    {
-		      QMessageBox::critical(this,"Evolvotron","Not attempting to save remaining images in animation");
-		    }
-		  ok = false;
-		  break;
-		}
+	      filenames.push_back(actual_save_filename.toLocal8Bit().constData());
 	    }
 
-      if (ok)
-        _main->imagePath = save_filename;
+	  // Rather than hold up the GUI while earlier saves finish, turn this one away.
+	  if (!_main->encoder().try_encode(_offscreen_images,filenames,save_format.toLatin1().constData(),save_filename.toLocal8Bit().constData()))
+	    {
+	      QMessageBox::critical(this,"Evolvotron","Too many images are waiting to be saved.\nPlease try again later.");
+	      std::clog << "...save refused\n";
+	      return;
+	    }
     }
   }
-  std::clog << "...save done\n";
+  std::clog << "...save queued\n";
 }
 
 void MutatableImageDisplay::menupick_save_function()
@@ -1018,7 +1304,7 @@ void MutatableImageDisplay::menupick_properties()
   std::stringstream xml;
   image_function()->save_function(xml);
 
-  _properties->set_content(msg.str(),xml.str());
+  _properties->set_content(msg.str(),xml.str(),image_function());
   _properties->exec();
 }
 
@@ -29,6 +29,8 @@
 #include "mutatable_image.h"
 #include "mutatable_image_computer.h"
 #include "dialog_mutatable_image_display.h"
+#include "memory_account.h"
+#include "spawn_latency.h"
 
 class EvolvotronMain;
 class MutatableImageComputerTask;
@@ -97,6 +99,11 @@ class MutatableImageDisplay : public QWidget
   //! Offscreen image buffer in sensible image format (used for save, as pixmap is in display format which might be less bits).
   std::vector<QImage> _offscreen_images;
 
+  //! Whether each pixel of _offscreen_images is valid, when they've been reprojected after a middle-button adjustment.
+  /*! Empty when the offscreen images are simply the last level delivered.
+   */
+  std::vector<bool> _offscreen_valid;
+
   //! Type for staging area for incoming fragments.
   /*! Key is level and multisampling, mapped type is also itself a map from fragment number to tasks.
    */
@@ -107,6 +114,17 @@ class MutatableImageDisplay : public QWidget
    */
   OffscreenImageInbox _offscreen_images_inbox;
 
+  //! Pre-colour-transform values (3 per pixel, frame major) of the full resolution image, if available.
+  /*! Shared with displays showing recolourings of the same image.
+   */
+  boost::shared_ptr<const std::vector<float> > _precolour;
+
+  //! Multisample grid used to compute _precolour.
+  uint _precolour_multisample_grid;
+
+  //! Cost of computing each pixel (per sample, frame major) of the offscreen images, if they're simply the last level delivered.
+  boost::shared_ptr<const std::vector<float> > _cost;
+
   //! The image function being displayed (its root node).
   /*! The held image is const because references to it could be held by history archive, compute tasks etc,
     so it should be completely replaced rather than manipulated.
@@ -130,6 +148,9 @@ class MutatableImageDisplay : public QWidget
    */
   QAction* _menu_item_action_lock;
 
+  //! Whether the current mid-button adjustment has been recorded in the history yet.
+  bool _mid_button_adjust_snapshot;
+
   //! Coordinate of mouse event which started mid-button adjustment
   QPoint _mid_button_adjust_start_pos;
 
@@ -139,6 +160,15 @@ class MutatableImageDisplay : public QWidget
   //! Serial number to kill some rare problems with out-of-order tasks being returned
   unsigned long long int _serial;
 
+  //! Timing of how long the current image is taking to show, for grid displays.
+  SpawnLatency::Spawn _spawn;
+
+  //! The offscreen images, in the display images' MemoryAccount.
+  MemoryAccount::Holding _images_memory;
+
+  //! The offscreen pixmaps, in the display pixmaps' MemoryAccount.
+  MemoryAccount::Holding _pixmaps_memory;
+
  public:
   //! Constructor.  
   MutatableImageDisplay(EvolvotronMain* mn,bool full_functionality,bool fixed_size,const QSize& image_size,uint f,uint fr);
@@ -183,22 +213,44 @@ class MutatableImageDisplay : public QWidget
    */
   void image_function(const boost::shared_ptr<const MutatableImage>& image_fn,bool one_of_many);
 
+  //! Load an image which differs from the one displayed by source only in its colour transform.
+  /*! Returns false (having done nothing) if source doesn't have what's needed to skip computing the image.
+   */
+  bool image_function_recoloured(const boost::shared_ptr<const MutatableImage>& image_fn,const MutatableImageDisplay& source);
+
   //! Evolvotron main calls this with completed (but possibly aborted) tasks.
   void deliver(const boost::shared_ptr<const MutatableImageComputerTask>& task);
 
   //! Set the lock state.
   void lock(bool l,bool record_in_history);
 
+  //! Show (or stop showing) the cost map overlay, as the main window now says.
+  void cost_map_changed();
+
  protected:
 
   //! Which farm this display should use.
   MutatableImageComputerFarm& farm() const;
 
+  //! Update pixmaps and icon from the offscreen images, which are of the given level.
+  void show_offscreen_images(uint level,uint multisample_grid);
+
   //! Take a snapshot to undo back to.
   void snapshot(const char* name);
 
   void mouseTransform(const Transform& tf);
 
+  //! Warp the offscreen images to the view after the image pre-transform is concatenated with tf.
+  /*! Returns false if the warp isn't possible.
+   */
+  bool reproject(const Transform& tf,std::vector<QImage>& images,std::vector<bool>& valid) const;
+
+  //! Rebuild the pixmaps from the offscreen images.
+  void update_pixmaps();
+
+  //! Recount the offscreen images and pixmaps in their MemoryAccounts.
+  void account_memory();
+
   //! Usual handler for repaint events.
   virtual void paintEvent(QPaintEvent* event);
 
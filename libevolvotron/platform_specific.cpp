@@ -24,6 +24,7 @@
 #include <QThread>
 
 #ifdef __unix__
+#include <sys/mman.h>        // for msync
 #include <sys/resource.h>    // for getpriority/setprioirty
 #endif
 
@@ -48,3 +49,13 @@ void add_thread_niceness(uint n)
 #warning "No platform-specific implementation of add_thread_niceness available"
 #endif
 }
+
+bool sync_mapped_memory(void* address,size_t bytes)
+{
+#ifdef __unix__
+  return (msync(address,bytes,MS_SYNC)==0);
+#else
+  // Pages still reach the file when unmapped; only a system crash before then loses them.
+  return true;
+#endif
+}
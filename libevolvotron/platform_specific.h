@@ -32,4 +32,7 @@ extern uint get_number_of_processors();
 //! Lower the priority of the calling thread by increasing its "niceness" (unix 0-19 'nice' scale used)
 extern void add_thread_niceness(uint);
 
+//! Write modified pages of a memory-mapped file back to the file, returning false on failure.
+extern bool sync_mapped_memory(void* address,size_t bytes);
+
 #endif
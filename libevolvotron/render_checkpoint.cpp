@@ -0,0 +1,189 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class RenderCheckpoint.
+*/
+
+#include "render_checkpoint.h"
+
+#include <QFile>
+
+//! First line of a checkpoint file.
+static const char*const checkpoint_magic="evolvotron_render checkpoint 1";
+
+RenderCheckpoint::RenderCheckpoint(TiledRenderer::Output& output,const std::string& filename,const std::string& signature,uint interval_ms)
+  :_output(output)
+  ,_filename(filename)
+  ,_signature(signature)
+  ,_interval_ms(interval_ms)
+  ,_resume_length(0)
+{
+  _timer.start();
+}
+
+RenderCheckpoint::~RenderCheckpoint()
+{
+  if (_file.is_open()) checkpoint();
+}
+
+/*! The last line may be incomplete if the render was killed while writing it,
+  and a line cut short can still parse (as a different frame or tile, which may never have been written),
+  so only lines ending with a newline count.
+ */
+bool RenderCheckpoint::resume(std::string& report)
+{
+  std::ifstream in(_filename.c_str());
+  if (!in) return true;
+
+  std::string magic;
+  std::string signature;
+  const bool header=(std::getline(in,magic) && std::getline(in,signature) && !in.eof());
+  if (!header && std::string(checkpoint_magic).compare(0,magic.size(),magic)==0)
+    return true;
+  if (!header || magic!=checkpoint_magic)
+    {
+      report="Unrecognised checkpoint file "+_filename+"\n";
+      return false;
+    }
+  if (signature!=_signature)
+    {
+      report="Checkpoint file "+_filename+" is for a different function or render parameters\n";
+      return false;
+    }
+
+  _resume_length=in.tellg();
+  std::string line;
+  while (std::getline(in,line) && !in.eof())
+    {
+      std::istringstream fields(line);
+      std::string what;
+      uint frame;
+      uint n;
+      fields >> what >> frame;
+      if (what=="frame" && fields) _frames_done.insert(frame);
+      else if (what=="tile" && fields >> n) _tiles_done.insert(std::make_pair(frame,n));
+      _resume_length=in.tellg();
+    }
+  return true;
+}
+
+bool RenderCheckpoint::begin(std::string& report)
+{
+  const bool resuming=(done()>0);
+  // Appending to an incomplete line would run the first new record into it.
+  if (resuming && !QFile::resize(QString::fromLocal8Bit(_filename.c_str()),_resume_length))
+    {
+      report="Couldn't truncate checkpoint file "+_filename+"\n";
+      return false;
+    }
+  _file.open(_filename.c_str(),(resuming ? std::ios::app : std::ios::trunc)|std::ios::out);
+  if (!resuming) _file << checkpoint_magic << "\n" << _signature << "\n";
+  _file.flush();
+  if (!_file)
+    {
+      report="Couldn't write checkpoint file "+_filename+"\n";
+      return false;
+    }
+  _timer.restart();
+  return true;
+}
+
+void RenderCheckpoint::finish()
+{
+  _file.close();
+  _tiles_pending.clear();
+  _frames_pending.clear();
+  remove(_filename.c_str());
+}
+
+bool RenderCheckpoint::checkpoint()
+{
+  if (_tiles_pending.empty() && _frames_pending.empty()) return true;
+  if (!_output.sync()) return false;
+
+  for (uint i=0;i<_tiles_pending.size();i++)
+    _file << "tile " << _tiles_pending[i].first << " " << _tiles_pending[i].second << "\n";
+  for (uint i=0;i<_frames_pending.size();i++)
+    _file << "frame " << _frames_pending[i] << "\n";
+  _file.flush();
+  _tiles_pending.clear();
+  _frames_pending.clear();
+  _timer.restart();
+  return _file.good();
+}
+
+TiledRenderer::Output::Assembly RenderCheckpoint::assembly() const
+{
+  return _output.assembly();
+}
+
+void RenderCheckpoint::progress(uint frame,uint tiles_done,uint tiles)
+{
+  _output.progress(frame,tiles_done,tiles);
+}
+
+bool RenderCheckpoint::rows(uint frame,const QImage& band,int begin)
+{
+  return _output.rows(frame,band,begin);
+}
+
+bool RenderCheckpoint::sync()
+{
+  return _output.sync();
+}
+
+bool RenderCheckpoint::skip_frame(uint frame)
+{
+  return (_frames_done.find(frame)!=_frames_done.end() || _output.skip_frame(frame));
+}
+
+bool RenderCheckpoint::skip_tile(uint frame,uint n)
+{
+  return (_tiles_done.find(std::make_pair(frame,n))!=_tiles_done.end() || _output.skip_tile(frame,n));
+}
+
+bool RenderCheckpoint::tile(uint frame,uint n,const QImage& tile,const QPoint& origin)
+{
+  if (!_output.tile(frame,n,tile,origin)) return false;
+
+  if (_output.assembly()==AssembleNothing)
+    _tiles_pending.push_back(std::make_pair(frame,n));
+  if (static_cast<uint>(_timer.elapsed())>=_interval_ms) return checkpoint();
+  return true;
+}
+
+/*! Outputs may still be saving the frame when this returns, so it's only recorded at the next checkpoint.
+ */
+bool RenderCheckpoint::frame(uint frame,const QImage& image)
+{
+  if (!_output.frame(frame,image)) return false;
+
+  // Any tiles of the frame are now redundant.
+  std::vector<std::pair<uint,uint> >::iterator it=_tiles_pending.begin();
+  while (it!=_tiles_pending.end())
+    {
+      if ((*it).first==frame) it=_tiles_pending.erase(it);
+      else it++;
+    }
+
+  _frames_pending.push_back(frame);
+  if (static_cast<uint>(_timer.elapsed())>=_interval_ms) return checkpoint();
+  return true;
+}
@@ -0,0 +1,127 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class RenderCheckpoint.
+*/
+
+#ifndef _render_checkpoint_h_
+#define _render_checkpoint_h_
+
+#include "common.h"
+
+#include <QElapsedTimer>
+
+#include "tiled_renderer.h"
+
+//! Passes everything on to another output, recording completed frames and tiles in a sidecar file so an interrupted render can be resumed.
+/*! Frames and tiles are recorded in batches, after the output has synced them to file, at most every interval.
+  Tiles are only worth recording for outputs which write them straight to file (those assembling nothing).
+  A resumed render skips the recorded frames and tiles.
+ */
+class RenderCheckpoint : public TiledRenderer::Output
+{
+ public:
+
+  //! Constructor.
+  /*! The signature identifies the render (function and parameters): only a checkpoint with the same signature can be resumed.
+   */
+  RenderCheckpoint(TiledRenderer::Output& output,const std::string& filename,const std::string& signature,uint interval_ms);
+
+  //! Destructor.  Records anything pending, in case the render was interrupted.
+  virtual ~RenderCheckpoint();
+
+  //! Read back any existing checkpoint file.
+  /*! Returns false (with reasons in report) if the file exists but isn't for the same render.
+    A missing file (or one cut short before its header was complete) just means there's nothing to resume.
+   */
+  bool resume(std::string& report);
+
+  //! Start writing the checkpoint file (after any resume), dropping any incomplete last line.  Returns false (with reasons in report) on failure.
+  bool begin(std::string& report);
+
+  //! Remove the checkpoint file once the render has completed.
+  void finish();
+
+  //! Number of frames and tiles already done (after resume).
+  uint done() const
+    {
+      return _frames_done.size()+_tiles_done.size();
+    }
+
+  //@{
+  //! Pass on to the output.
+  virtual Assembly assembly() const;
+  virtual void progress(uint frame,uint tiles_done,uint tiles);
+  virtual bool rows(uint frame,const QImage& band,int begin);
+  virtual bool sync();
+  //@}
+
+  //! Skip recorded frames (and any the output skips).
+  virtual bool skip_frame(uint frame);
+
+  //! Skip recorded tiles (and any the output skips).
+  virtual bool skip_tile(uint frame,uint n);
+
+  //! Pass on the tile, noting it for the next checkpoint.
+  virtual bool tile(uint frame,uint n,const QImage& tile,const QPoint& origin);
+
+  //! Pass on the frame, noting it for the next checkpoint.
+  virtual bool frame(uint frame,const QImage& image);
+
+ private:
+
+  //! Sync the output and record pending frames and tiles.  Returns false on failure.
+  bool checkpoint();
+
+  //! Where everything goes.
+  TiledRenderer::Output& _output;
+
+  //! Checkpoint filename.
+  const std::string _filename;
+
+  //! Identifies the render.
+  const std::string _signature;
+
+  //! Time between recording frames and tiles.
+  const uint _interval_ms;
+
+  //! The checkpoint file, open for appending.
+  std::ofstream _file;
+
+  //! Length of the resumed checkpoint file up to the end of its last complete line.
+  long long _resume_length;
+
+  //! Frames completed (by this render or the one resumed).
+  std::set<uint> _frames_done;
+
+  //! Tiles completed (by this render or the one resumed), by frame and number.
+  std::set<std::pair<uint,uint> > _tiles_done;
+
+  //! Tiles completed but not yet recorded.
+  std::vector<std::pair<uint,uint> > _tiles_pending;
+
+  //! Frames completed but not yet recorded.
+  std::vector<uint> _frames_pending;
+
+  //! Time since last recording frames and tiles.
+  QElapsedTimer _timer;
+};
+
+#endif
@@ -0,0 +1,899 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+
+/*! \file
+  \brief Implementation of classes PipeCoordinator and SpoolCoordinator, and the workers serving them.
+*/
+
+#include "render_coordinator.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QSysInfo>
+
+#include "function_registry.h"
+#include "mutatable_image.h"
+
+void RenderJob::write(std::ostream& out) const
+{
+  out
+    << "job " << id
+    << " " << size.width() << "x" << size.height()
+    << " " << frames
+    << " " << jitter
+    << " " << multisample
+    << " " << tile_size
+    << " " << function.size()
+    << "\n"
+    << function;
+}
+
+bool RenderJob::read(std::istream& in,std::string& error)
+{
+  std::string line;
+  if (!std::getline(in,line))
+    {
+      error="No job";
+      return false;
+    }
+  std::istringstream words(line);
+  std::string word;
+  int width;
+  int height;
+  char x;
+  size_t length;
+  if (!(words >> word >> id >> width >> x >> height >> frames >> jitter >> multisample >> tile_size >> length) || word!="job" || x!='x' || width<1 || height<1 || frames<1 || multisample<1 || tile_size<1)
+    {
+      error="Malformed job: "+line;
+      return false;
+    }
+  size=QSize(width,height);
+  function.resize(length);
+  if (length && !in.read(&function[0],length))
+    {
+      error="Job function truncated";
+      return false;
+    }
+  return true;
+}
+
+const std::string RenderJob::new_id()
+{
+  std::ostringstream id;
+  id << std::hex << QDateTime::currentMSecsSinceEpoch() << "p" << QCoreApplication::applicationPid();
+  return id.str();
+}
+
+//! Write a tile as a header line and packed 8-bit RGB.
+static void write_tile(std::ostream& out,uint frame,uint n,const QImage& tile)
+{
+  out << "tile " << frame << " " << n << " " << tile.width() << " " << tile.height() << "\n";
+  std::string data(3*tile.width()*tile.height(),'\0');
+  std::string::iterator it=data.begin();
+  for (int row=0;row<tile.height();row++)
+    {
+      const QRgb*const pixels=reinterpret_cast<const QRgb*>(tile.constScanLine(row));
+      for (int column=0;column<tile.width();column++)
+	{
+	  *(it++)=qRed(pixels[column]);
+	  *(it++)=qGreen(pixels[column]);
+	  *(it++)=qBlue(pixels[column]);
+	}
+    }
+  out.write(data.data(),data.size());
+}
+
+//! Parse a tile header line.  Returns false if it isn't one.
+static bool parse_tile_header(const std::string& line,uint& frame,uint& n,int& width,int& height)
+{
+  std::istringstream words(line);
+  std::string word;
+  return (words >> word >> frame >> n >> width >> height && word=="tile" && width>0 && height>0);
+}
+
+//! Unpack a tile from packed 8-bit RGB.
+static const QImage read_tile(const char* data,int width,int height)
+{
+  QImage tile(width,height,QImage::Format_RGB32);
+  for (int row=0;row<height;row++)
+    {
+      QRgb*const pixels=reinterpret_cast<QRgb*>(tile.scanLine(row));
+      for (int column=0;column<width;column++,data+=3)
+	pixels[column]=qRgb(static_cast<uchar>(data[0]),static_cast<uchar>(data[1]),static_cast<uchar>(data[2]));
+    }
+  return tile;
+}
+
+//! Load a job's function.  Returns null (with a description on one line in error) on failure.
+static const boost::shared_ptr<const MutatableImage> load_job_function(const FunctionRegistry& function_registry,const RenderJob& job,std::string& error)
+{
+  std::istringstream in(job.function);
+  std::string report;
+  const boost::shared_ptr<const MutatableImage> fn(MutatableImage::load_function(function_registry,in,report));
+  if (!fn)
+    {
+      std::replace(report.begin(),report.end(),'\n',' ');
+      error="Function not loaded: "+report;
+    }
+  return fn;
+}
+
+PipeCoordinator::PipeCoordinator(const RenderJob& job,const std::vector<QStringList>& commands,uint threads_per_worker,uint heartbeat_timeout_ms,uint max_retries)
+  :_job(job)
+  ,_threads_per_worker(std::max(1u,threads_per_worker))
+  ,_heartbeat_timeout_ms(heartbeat_timeout_ms)
+  ,_max_retries(max_retries)
+  ,_workers(commands.size())
+  ,_workers_lost(0)
+{
+  std::ostringstream message;
+  job.write(message);
+  _job_message=QByteArray(message.str().data(),message.str().size());
+  for (uint i=0;i<commands.size();i++)
+    _workers[i].command=commands[i];
+}
+
+/*! Closing a worker's input tells it to finish.
+ */
+PipeCoordinator::~PipeCoordinator()
+{
+  for (uint i=0;i<_workers.size();i++)
+    if (_workers[i].process)
+      {
+	_workers[i].process->closeWriteChannel();
+	if (!_workers[i].process->waitForFinished(5000))
+	  {
+	    _workers[i].process->kill();
+	    _workers[i].process->waitForFinished(1000);
+	  }
+      }
+}
+
+bool PipeCoordinator::launch(Worker& worker)
+{
+  if (worker.process)
+    {
+      worker.process->kill();
+      worker.process->waitForFinished(1000);
+    }
+  worker.process.reset(new QProcess);
+  worker.process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+  worker.buffer.clear();
+  worker.assigned.clear();
+
+  QStringList arguments(worker.command.mid(1));
+  arguments << "--worker" << "--threads" << QString::number(_threads_per_worker);
+  worker.process->start(worker.command.front(),arguments);
+  if (!worker.process->waitForStarted(30000))
+    {
+      _error="Couldn't start worker "+worker.command.join(" ").toStdString()+": "+worker.process->errorString().toStdString();
+      return false;
+    }
+  worker.process->write(_job_message);
+  worker.process->waitForBytesWritten(30000);
+  worker.heard.start();
+  return true;
+}
+
+bool PipeCoordinator::start()
+{
+  if (_workers.empty())
+    {
+      _error="No workers";
+      return false;
+    }
+  for (uint i=0;i<_workers.size();i++)
+    if (!launch(_workers[i])) return false;
+  return true;
+}
+
+uint PipeCoordinator::capacity() const
+{
+  return _workers.size()*_threads_per_worker;
+}
+
+void PipeCoordinator::submit(uint frame,uint tile)
+{
+  _queued.push_back(std::make_pair(frame,tile));
+}
+
+/*! Workers are sent batches of twice their threads, with up to two batches outstanding.
+  Workers read batches as they arrive, so each has the next batch queued behind the one it's computing.
+ */
+void PipeCoordinator::dispatch()
+{
+  const uint batch=2*_threads_per_worker;
+  for (uint i=0;i<_workers.size() && !_queued.empty();i++)
+    {
+      Worker& worker=_workers[i];
+      if (worker.assigned.size()>batch) continue;
+
+      // An idle worker has had nothing to report.
+      if (worker.assigned.empty()) worker.heard.restart();
+
+      const uint n=std::min(batch,static_cast<uint>(_queued.size()));
+      std::ostringstream message;
+      message << "tiles " << n << "\n";
+      for (uint t=0;t<n;t++)
+	{
+	  message << _queued.front().first << " " << _queued.front().second << "\n";
+	  worker.assigned.push_back(_queued.front());
+	  _queued.pop_front();
+	}
+      worker.process->write(message.str().data(),message.str().size());
+      worker.process->waitForBytesWritten(30000);
+    }
+}
+
+bool PipeCoordinator::parse(Worker& worker)
+{
+  int eol;
+  while ((eol=worker.buffer.indexOf('\n'))>=0)
+    {
+      const std::string line(worker.buffer.constData(),eol);
+      if (line=="heartbeat")
+	{
+	  worker.buffer.remove(0,eol+1);
+	}
+      else if (line.compare(0,6,"error ")==0)
+	{
+	  // Workers only report errors which would recur (e.g the function not loading), so retrying is pointless.
+	  _error="Worker "+worker.command.join(" ").toStdString()+" failed: "+line.substr(6);
+	  return false;
+	}
+      else
+	{
+	  uint frame;
+	  uint n;
+	  int width;
+	  int height;
+	  if (!parse_tile_header(line,frame,n,width,height) || width>static_cast<int>(_job.tile_size) || height>static_cast<int>(_job.tile_size))
+	    return lost(worker,"sent \""+line+"\"");
+
+	  const int bytes=3*width*height;
+	  if (worker.buffer.size()<eol+1+bytes) return true;
+	  const QImage tile(read_tile(worker.buffer.constData()+eol+1,width,height));
+	  worker.buffer.remove(0,eol+1+bytes);
+
+	  const std::deque<std::pair<uint,uint> >::iterator it=std::find(worker.assigned.begin(),worker.assigned.end(),std::make_pair(frame,n));
+	  if (it!=worker.assigned.end())
+	    {
+	      worker.assigned.erase(it);
+	      _completed.push_back(boost::make_tuple(frame,n,tile));
+	    }
+	}
+    }
+  return true;
+}
+
+bool PipeCoordinator::poll()
+{
+  // Wait briefly on each worker in turn; a round takes about as long however many there are.
+  const int wait_ms=std::max(1,static_cast<int>(10/_workers.size()));
+  for (uint i=0;i<_workers.size();i++)
+    {
+      Worker& worker=_workers[i];
+      if (worker.process->bytesAvailable() || worker.process->waitForReadyRead(wait_ms))
+	{
+	  worker.buffer.append(worker.process->readAll());
+	  worker.heard.restart();
+	  // Parsing may replace the process.
+	  if (!parse(worker)) return false;
+	}
+      if (worker.process->state()==QProcess::NotRunning)
+	{
+	  if (!lost(worker,"exited")) return false;
+	}
+      else if (!worker.assigned.empty() && worker.heard.elapsed()>_heartbeat_timeout_ms)
+	{
+	  if (!lost(worker,"stopped responding")) return false;
+	}
+    }
+  return true;
+}
+
+bool PipeCoordinator::lost(Worker& worker,const std::string& why)
+{
+  std::clog << "Worker " << worker.command.join(" ").toStdString() << " " << why << "; requeueing its " << worker.assigned.size() << " tiles\n";
+
+  // Back to the front of the queue, in their original order.
+  for (std::deque<std::pair<uint,uint> >::reverse_iterator it=worker.assigned.rbegin();it!=worker.assigned.rend();it++)
+    {
+      if (++_retries[*it]>_max_retries)
+	{
+	  std::ostringstream error;
+	  error << "Tile " << it->second << " of frame " << it->first << " lost " << _retries[*it] << " times";
+	  _error=error.str();
+	  return false;
+	}
+      _queued.push_front(*it);
+    }
+  worker.assigned.clear();
+
+  if (++_workers_lost>_max_retries*_workers.size())
+    {
+      _error="Too many workers lost";
+      return false;
+    }
+  return launch(worker);
+}
+
+bool PipeCoordinator::wait(uint& frame,uint& tile,QImage& image)
+{
+  while (_completed.empty())
+    {
+      if (!_error.empty()) return false;
+      dispatch();
+      if (!poll()) return false;
+    }
+  boost::tie(frame,tile,image)=_completed.front();
+  _completed.pop_front();
+  return true;
+}
+
+void PipeCoordinator::abort()
+{
+  _queued.clear();
+  _completed.clear();
+  for (uint i=0;i<_workers.size();i++)
+    if (_workers[i].process)
+      {
+	_workers[i].process->kill();
+	_workers[i].process->waitForFinished(1000);
+	_workers[i].assigned.clear();
+      }
+}
+
+//! Reads a pipe worker's batches of tiles, submitting each tile as it arrives.
+/*! Reading on a thread of its own means the next batch is queued behind the tiles being computed,
+  rather than only being read once they've all been written.
+ */
+class PipeTileReader : public QThread
+{
+public:
+  //! Constructor.
+  PipeTileReader(std::istream& in,TiledRenderer::LocalSource& source,uint frames,uint tiles)
+    :_in(in)
+    ,_source(source)
+    ,_frames(frames)
+    ,_tiles(tiles)
+    ,_submitted(0)
+    ,_done(false)
+    {}
+
+  //! Number of tiles submitted so far.
+  uint submitted() const
+    {
+      return _submitted;
+    }
+
+  //! Whether the input has ended (in which case submitted won't change).
+  bool done() const
+    {
+      return _done;
+    }
+
+  //! What was wrong with the input (empty if nothing).  Only valid once done.
+  const std::string& error() const
+    {
+      return _error;
+    }
+
+protected:
+  //! Read batches until the input ends.
+  virtual void run();
+
+private:
+  //! Where batches come from.
+  std::istream& _in;
+
+  //! Where tiles go.
+  TiledRenderer::LocalSource& _source;
+
+  //! Frames in the job.
+  const uint _frames;
+
+  //! Tiles in each frame.
+  const uint _tiles;
+
+  //! Number of tiles submitted so far.
+  std::atomic<uint> _submitted;
+
+  //! Whether the input has ended.
+  std::atomic<bool> _done;
+
+  //! What was wrong with the input.
+  std::string _error;
+};
+
+void PipeTileReader::run()
+{
+  std::string line;
+  while (_error.empty() && std::getline(_in,line))
+    {
+      std::istringstream words(line);
+      std::string word;
+      uint n;
+      if (!(words >> word >> n) || word!="tiles")
+	{
+	  _error="Expected a batch of tiles, got \""+line+"\"";
+	  break;
+	}
+      for (uint i=0;i<n;i++)
+	{
+	  uint frame;
+	  uint tile;
+	  if (!std::getline(_in,line) || !(std::istringstream(line) >> frame >> tile) || frame>=_frames || tile>=_tiles)
+	    {
+	      _error="Bad tile \""+line+"\"";
+	      break;
+	    }
+	  _source.submit(frame,tile);
+	  _submitted++;
+	}
+    }
+  _done=true;
+}
+
+/*! Tiles are submitted by a PipeTileReader as they're read, and written here as they're completed.
+ */
+int run_pipe_worker(const FunctionRegistry& function_registry,uint threads,std::istream& in,std::ostream& out)
+{
+  RenderJob job;
+  std::string error;
+  if (!job.read(in,error))
+    {
+      out << "error " << error << std::endl;
+      return 1;
+    }
+  const boost::shared_ptr<const MutatableImage> fn(load_job_function(function_registry,job,error));
+  if (!fn)
+    {
+      out << "error " << error << std::endl;
+      return 1;
+    }
+
+  TiledRenderer renderer(threads,job.tile_size);
+  TiledRenderer::LocalSource source(renderer,fn,job.size,job.frames,job.jitter,job.multisample);
+  PipeTileReader reader(in,source,job.frames,renderer.tiles(job.size));
+  reader.start();
+
+  // Carry on until the input ends and every tile submitted has been written, or the input turns out to be bad.
+  uint written=0;
+  while (!reader.done() || (reader.error().empty() && written<reader.submitted()))
+    {
+      uint frame;
+      uint tile;
+      QImage image;
+      if (source.wait_for(1000,frame,tile,image))
+	{
+	  write_tile(out,frame,tile,image);
+	  written++;
+	}
+      else
+	{
+	  out << "heartbeat\n";
+	}
+      out.flush();
+    }
+  reader.wait();
+
+  if (!reader.error().empty())
+    {
+      out << "error " << reader.error() << std::endl;
+      return 1;
+    }
+  return 0;
+}
+
+SpoolCoordinator::SpoolCoordinator(const RenderJob& job,const std::string& spool,uint local_workers,uint threads_per_worker,uint capacity,uint heartbeat_timeout_ms,uint max_retries)
+  :_job(job)
+  ,_spool(spool)
+  ,_local_worker_count(local_workers)
+  ,_threads_per_worker(std::max(1u,threads_per_worker))
+  ,_capacity(std::max(1u,capacity))
+  ,_heartbeat_timeout_ms(heartbeat_timeout_ms)
+  ,_max_retries(max_retries)
+  ,_workers_lost(0)
+{}
+
+SpoolCoordinator::~SpoolCoordinator()
+{
+  abort();
+  remove((_spool+"/job").c_str());
+  for (uint i=0;i<_local_workers.size();i++)
+    {
+      _local_workers[i]->kill();
+      _local_workers[i]->waitForFinished(1000);
+    }
+}
+
+const std::string SpoolCoordinator::unit_name(uint frame,uint tile) const
+{
+  std::ostringstream name;
+  name << _job.id << "_" << std::setw(6) << std::setfill('0') << frame << "_" << std::setw(6) << std::setfill('0') << tile;
+  return name.str();
+}
+
+//! Parse the frame and tile from a unit name (ignoring anything after them).  Returns false if it isn't one of the job's.
+static bool parse_unit_name(const std::string& name,const std::string& id,uint& frame,uint& tile)
+{
+  if (name.compare(0,id.size()+1,id+"_")!=0) return false;
+  std::istringstream fields(name.substr(id.size()+1));
+  char separator;
+  return (fields >> frame >> separator >> tile && separator=='_');
+}
+
+//! Subdirectories of a spool.
+static const char*const spool_subdirectories[]={"todo","claimed","done","failed","workers"};
+
+//! Create a spool's subdirectories if they don't exist.  Returns false (with a description in error) on failure.
+static bool make_spool_directories(const std::string& spool,std::string& error)
+{
+  for (uint i=0;i<sizeof(spool_subdirectories)/sizeof(spool_subdirectories[0]);i++)
+    if (!QDir().mkpath(QString::fromLocal8Bit((spool+"/"+spool_subdirectories[i]).c_str())))
+      {
+	error="Couldn't create spool directory "+spool+"/"+spool_subdirectories[i];
+	return false;
+      }
+  return true;
+}
+
+//! File names in a directory, sorted, skipping temporary files (starting with ".").
+static const QStringList spool_entries(const std::string& dir)
+{
+  QStringList entries(QDir(QString::fromLocal8Bit(dir.c_str())).entryList(QDir::Files|QDir::Hidden,QDir::Name));
+  for (int i=entries.size()-1;i>=0;i--)
+    if (entries[i].startsWith('.')) entries.removeAt(i);
+  return entries;
+}
+
+//! Write a spool file, via a temporary file so it appears complete or not at all.  Returns false on failure.
+static bool write_spool_file(const std::string& filename,const std::string& temporary,const std::string& content)
+{
+  {
+    std::ofstream file(temporary.c_str(),std::ios::out|std::ios::binary);
+    file.write(content.data(),content.size());
+    file.flush();
+    if (!file) return false;
+  }
+  return (rename(temporary.c_str(),filename.c_str())==0);
+}
+
+bool SpoolCoordinator::launch(boost::shared_ptr<QProcess>& worker)
+{
+  worker.reset(new QProcess);
+  worker->setProcessChannelMode(QProcess::ForwardedChannels);
+  worker->start
+    (
+     QCoreApplication::applicationFilePath(),
+     QStringList() << "--worker" << "--spool" << QString::fromLocal8Bit(_spool.c_str()) << "--threads" << QString::number(_threads_per_worker)
+     );
+  if (!worker->waitForStarted(30000))
+    {
+      _error="Couldn't start worker: "+worker->errorString().toStdString();
+      return false;
+    }
+  return true;
+}
+
+/*! A stop file is from an earlier session.
+  Only the job's own files are cleared out of todo, done and failed: anything else there belongs to other jobs.
+ */
+bool SpoolCoordinator::start()
+{
+  if (!make_spool_directories(_spool,_error)) return false;
+  remove((_spool+"/stop").c_str());
+  static const char*const cleared[]={"todo","done","failed"};
+  for (uint d=0;d<sizeof(cleared)/sizeof(cleared[0]);d++)
+    {
+      const std::string dir(_spool+"/"+cleared[d]+"/");
+      const QStringList entries(spool_entries(dir));
+      for (int i=0;i<entries.size();i++)
+	{
+	  const std::string name(entries[i].toStdString());
+	  uint frame;
+	  uint tile;
+	  if (parse_unit_name(name,_job.id,frame,tile) || name.compare(0,_job.id.size()+1,_job.id+"@")==0)
+	    remove((dir+name).c_str());
+	}
+    }
+
+  std::ostringstream job;
+  _job.write(job);
+  if (!write_spool_file(_spool+"/job",_spool+"/.job",job.str()))
+    {
+      _error="Couldn't write "+_spool+"/job";
+      return false;
+    }
+
+  _local_workers.resize(_local_worker_count);
+  for (uint i=0;i<_local_workers.size();i++)
+    if (!launch(_local_workers[i])) return false;
+
+  _idle.start();
+  return true;
+}
+
+uint SpoolCoordinator::capacity() const
+{
+  return _capacity;
+}
+
+void SpoolCoordinator::submit(uint frame,uint tile)
+{
+  std::ofstream((_spool+"/todo/"+unit_name(frame,tile)).c_str());
+  _outstanding.insert(std::make_pair(frame,tile));
+}
+
+bool SpoolCoordinator::reclaim()
+{
+  for (uint i=0;i<_local_workers.size();i++)
+    if (_local_workers[i]->state()==QProcess::NotRunning || _local_workers[i]->waitForFinished(0))
+      {
+	std::clog << "Local worker exited; restarting it\n";
+	if (++_workers_lost>_max_retries*_local_workers.size())
+	  {
+	    _error="Too many workers lost";
+	    return false;
+	  }
+	if (!launch(_local_workers[i])) return false;
+      }
+
+  // Heartbeats are compared with what was last seen, so workers' clocks don't matter.
+  const QStringList workers(spool_entries(_spool+"/workers"));
+  for (int i=0;i<workers.size();i++)
+    {
+      QFile file(QString::fromLocal8Bit((_spool+"/workers/").c_str())+workers[i]);
+      if (!file.open(QIODevice::ReadOnly)) continue;
+      const QByteArray beat(file.readAll());
+      std::pair<QByteArray,QElapsedTimer>& heartbeat=_heartbeats[workers[i].toStdString()];
+      if (!heartbeat.second.isValid() || heartbeat.first!=beat)
+	{
+	  heartbeat.first=beat;
+	  heartbeat.second.start();
+	}
+    }
+
+  const QStringList claimed(spool_entries(_spool+"/claimed"));
+  for (int i=0;i<claimed.size();i++)
+    {
+      const std::string name(claimed[i].toStdString());
+      const std::string::size_type at=name.find('@');
+      uint frame;
+      uint tile;
+      if (at==std::string::npos || !parse_unit_name(name,_job.id,frame,tile)) continue;
+
+      std::pair<QByteArray,QElapsedTimer>& heartbeat=_heartbeats[name.substr(at+1)];
+      if (!heartbeat.second.isValid()) heartbeat.second.start();
+      if (heartbeat.second.elapsed()<=_heartbeat_timeout_ms) continue;
+
+      // If the worker finishes first its result is still welcome; the rename just fails.
+      if (rename((_spool+"/claimed/"+name).c_str(),(_spool+"/todo/"+name.substr(0,at)).c_str())!=0) continue;
+      std::clog << "Worker " << name.substr(at+1) << " stopped responding; requeueing tile " << tile << " of frame " << frame << "\n";
+      if (++_retries[std::make_pair(frame,tile)]>_max_retries)
+	{
+	  std::ostringstream error;
+	  error << "Tile " << tile << " of frame " << frame << " lost " << _retries[std::make_pair(frame,tile)] << " times";
+	  _error=error.str();
+	  return false;
+	}
+    }
+  return true;
+}
+
+bool SpoolCoordinator::wait(uint& frame,uint& tile,QImage& image)
+{
+  while (true)
+    {
+      if (!_error.empty()) return false;
+
+      // Workers only report failures which would recur (e.g the function not loading), so retrying is pointless.
+      const QStringList failed(spool_entries(_spool+"/failed"));
+      for (int i=0;i<failed.size();i++)
+	{
+	  const std::string name(failed[i].toStdString());
+	  if (name.compare(0,_job.id.size()+1,_job.id+"@")!=0) continue;
+	  std::ifstream file((_spool+"/failed/"+name).c_str());
+	  std::string why;
+	  std::getline(file,why);
+	  _error="Worker "+name.substr(_job.id.size()+1)+" failed: "+why;
+	  return false;
+	}
+
+      const QStringList done(spool_entries(_spool+"/done"));
+      for (int i=0;i<done.size();i++)
+	{
+	  const std::string filename(_spool+"/done/"+done[i].toStdString());
+	  uint f;
+	  uint t;
+	  if (!parse_unit_name(done[i].toStdString(),_job.id,f,t))
+	    {
+	      // Finished after its job was withdrawn.
+	      remove(filename.c_str());
+	      continue;
+	    }
+
+	  std::ifstream file(filename.c_str(),std::ios::in|std::ios::binary);
+	  std::string line;
+	  int width;
+	  int height;
+	  if (!std::getline(file,line) || !parse_tile_header(line,frame,tile,width,height) || frame!=f || tile!=t || width>static_cast<int>(_job.tile_size) || height>static_cast<int>(_job.tile_size))
+	    {
+	      _error="Malformed result "+filename;
+	      return false;
+	    }
+	  std::string data(3*width*height,'\0');
+	  if (!file.read(&data[0],data.size()))
+	    {
+	      _error="Truncated result "+filename;
+	      return false;
+	    }
+	  file.close();
+	  remove(filename.c_str());
+
+	  // Tiles requeued from a slow worker can come back twice.
+	  if (_outstanding.erase(std::make_pair(frame,tile)))
+	    {
+	      image=read_tile(data.data(),width,height);
+	      _idle.restart();
+	      return true;
+	    }
+	}
+
+      if (!reclaim()) return false;
+
+      if (_idle.elapsed()>_heartbeat_timeout_ms)
+	{
+	  std::cerr << "evolvotron_render: Warning: Nothing returned to spool " << _spool << " for " << _idle.elapsed()/1000 << "s; is anything serving it?\n";
+	  _idle.restart();
+	}
+      QThread::msleep(20);
+    }
+}
+
+void SpoolCoordinator::abort()
+{
+  const QStringList todo(spool_entries(_spool+"/todo"));
+  for (int i=0;i<todo.size();i++)
+    {
+      uint frame;
+      uint tile;
+      if (parse_unit_name(todo[i].toStdString(),_job.id,frame,tile))
+	remove((_spool+"/todo/"+todo[i].toStdString()).c_str());
+    }
+  _outstanding.clear();
+}
+
+//! A name for this worker which no other worker serving the spool will have.
+static const std::string spool_worker_name()
+{
+  std::ostringstream name;
+  name << QSysInfo::machineHostName().toStdString() << "-" << QCoreApplication::applicationPid();
+  std::string result(name.str());
+  std::replace(result.begin(),result.end(),'/','-');
+  std::replace(result.begin(),result.end(),'@','-');
+  return result;
+}
+
+/*! Tiles are claimed in name (so frame then raster) order, up to twice the worker's threads at once.
+  A new job is only picked up once the tiles claimed for the last are done.
+ */
+int run_spool_worker(const FunctionRegistry& function_registry,uint threads,const std::string& spool)
+{
+  const std::string name(spool_worker_name());
+  std::string error;
+  if (!make_spool_directories(spool,error))
+    {
+      std::cerr << "evolvotron_render: Error: " << error << "\n";
+      return 1;
+    }
+  std::clog << "Worker " << name << " serving spool " << spool << "\n";
+
+  RenderJob job;
+  boost::shared_ptr<const MutatableImage> fn;
+  boost::shared_ptr<TiledRenderer> renderer;
+  boost::shared_ptr<TiledRenderer::LocalSource> source;
+  uint tiles=0;
+
+  // Tile names claimed, by frame and tile.
+  std::map<std::pair<uint,uint>,std::string> claimed;
+
+  uint beat=0;
+  QElapsedTimer since_beat;
+  while (true)
+    {
+      if (!since_beat.isValid() || since_beat.elapsed()>=1000)
+	{
+	  std::ostringstream content;
+	  content << ++beat << "\n";
+	  write_spool_file(spool+"/workers/"+name,spool+"/workers/."+name,content.str());
+	  since_beat.start();
+	}
+
+      if (claimed.empty())
+	{
+	  if (QFile::exists(QString::fromLocal8Bit((spool+"/stop").c_str())))
+	    {
+	      remove((spool+"/workers/"+name).c_str());
+	      return 0;
+	    }
+
+	  std::ifstream file((spool+"/job").c_str(),std::ios::in|std::ios::binary);
+	  RenderJob next;
+	  if (file && next.read(file,error) && next.id!=job.id)
+	    {
+	      job=next;
+	      source.reset();
+	      fn=load_job_function(function_registry,job,error);
+	      if (fn)
+		{
+		  if (!renderer || renderer->tile_size()!=job.tile_size) renderer.reset(new TiledRenderer(threads,job.tile_size));
+		  source.reset(new TiledRenderer::LocalSource(*renderer,fn,job.size,job.frames,job.jitter,job.multisample));
+		  tiles=renderer->tiles(job.size);
+		  std::clog << "Worker " << name << " starting job " << job.id << "\n";
+		}
+	      else
+		{
+		  // The coordinator would otherwise wait for tiles nobody can compute.
+		  std::cerr << "evolvotron_render: Error: Job " << job.id << ": " << error << "\n";
+		  if (!write_spool_file(spool+"/failed/"+job.id+"@"+name,spool+"/failed/."+job.id+"@"+name,error+"\n"))
+		    std::cerr << "evolvotron_render: Error: Couldn't write " << spool << "/failed/" << job.id << "@" << name << "\n";
+		}
+	    }
+	}
+
+      if (source && claimed.size()<2*renderer->num_threads())
+	{
+	  const QStringList todo(spool_entries(spool+"/todo"));
+	  for (int i=0;i<todo.size() && claimed.size()<2*renderer->num_threads();i++)
+	    {
+	      const std::string unit(todo[i].toStdString());
+	      uint frame;
+	      uint tile;
+	      if (!parse_unit_name(unit,job.id,frame,tile) || frame>=job.frames || tile>=tiles) continue;
+	      // Another worker may get there first.
+	      if (rename((spool+"/todo/"+unit).c_str(),(spool+"/claimed/"+unit+"@"+name).c_str())!=0) continue;
+	      claimed[std::make_pair(frame,tile)]=unit;
+	      source->submit(frame,tile);
+	    }
+	}
+
+      if (claimed.empty())
+	{
+	  QThread::msleep(200);
+	  continue;
+	}
+
+      uint frame;
+      uint tile;
+      QImage image;
+      if (source->wait_for(200,frame,tile,image))
+	{
+	  const std::string unit(claimed[std::make_pair(frame,tile)]);
+	  claimed.erase(std::make_pair(frame,tile));
+	  std::ostringstream result;
+	  write_tile(result,frame,tile,image);
+	  if (!write_spool_file(spool+"/done/"+unit,spool+"/done/."+unit+"@"+name,result.str()))
+	    std::cerr << "evolvotron_render: Error: Couldn't write " << spool << "/done/" << unit << "\n";
+	  remove((spool+"/claimed/"+unit+"@"+name).c_str());
+	}
+    }
+}
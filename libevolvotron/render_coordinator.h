@@ -0,0 +1,287 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+
+/*! \file
+  \brief Interface for classes PipeCoordinator and SpoolCoordinator, which farm tiles out to worker processes.
+*/
+
+#ifndef _render_coordinator_h_
+#define _render_coordinator_h_
+
+#include "common.h"
+
+#include <QElapsedTimer>
+#include <QProcess>
+
+#include "tiled_renderer.h"
+
+class FunctionRegistry;
+
+//! Everything a worker needs to compute tiles of a render.
+struct RenderJob
+{
+  //! Identifies the job (so a spool's workers notice a new one, and stale results are recognised).
+  std::string id;
+
+  //! The function, as saved XML.
+  std::string function;
+
+  //! Size of frames.
+  QSize size;
+
+  //! Frames in the animation.
+  uint frames;
+
+  //! Whether samples are jittered.
+  bool jitter;
+
+  //! Multisampling grid.
+  uint multisample;
+
+  //! Width and height of tiles.
+  uint tile_size;
+
+  //! Write as a header line followed by the function.
+  void write(std::ostream& out) const;
+
+  //! Read back what write() wrote.  Returns false (with a description in error) on failure.
+  bool read(std::istream& in,std::string& error);
+
+  //! A new, probably unique, job id.
+  static const std::string new_id();
+};
+
+//! Computes tiles on worker processes, each started with --worker and fed over its stdin and stdout.
+/*! Workers are sent the job, then batches of tiles; they reply with each tile as it completes,
+  and a heartbeat line every second while they have tiles to compute.
+  A worker which exits or goes quiet for longer than the heartbeat timeout is killed and replaced,
+  and its outstanding tiles go back to the front of the queue.
+  Workers are normally copies of this program, but can be started by any command
+  (e.g "ssh host evolvotron_render") which ends up running one.
+ */
+class PipeCoordinator : public TiledRenderer::Source
+{
+ public:
+
+  //! Constructor.
+  /*! Each command is a program and its arguments, to which --worker and --threads are appended.
+   */
+  PipeCoordinator(const RenderJob& job,const std::vector<QStringList>& commands,uint threads_per_worker,uint heartbeat_timeout_ms,uint max_retries);
+
+  //! Destructor.  Stops the workers.
+  virtual ~PipeCoordinator();
+
+  //! Start the workers.  Returns false (with a description in error()) on failure.
+  bool start();
+
+  //! Threads over all the workers.
+  virtual uint capacity() const;
+
+  //! Queue a tile.
+  virtual void submit(uint frame,uint tile);
+
+  //! Hand out queued tiles and wait for any to complete.
+  virtual bool wait(uint& frame,uint& tile,QImage& image);
+
+  //! Forget queued tiles and stop the workers.
+  virtual void abort();
+
+  //! Why something failed.
+  virtual const std::string error() const
+    {
+      return _error;
+    }
+
+ private:
+
+  //! A worker process and the tiles sent to it.
+  struct Worker
+  {
+    //! Command starting it.
+    QStringList command;
+
+    //! The process.
+    boost::shared_ptr<QProcess> process;
+
+    //! Output not yet parsed.
+    QByteArray buffer;
+
+    //! Tiles sent and not yet returned (as frame,tile).
+    std::deque<std::pair<uint,uint> > assigned;
+
+    //! Time since the worker was last heard from (or last given work when idle).
+    QElapsedTimer heard;
+  };
+
+  //! (Re)start a worker.  Returns false on failure.
+  bool launch(Worker& worker);
+
+  //! Send queued tiles to workers with room for them.
+  void dispatch();
+
+  //! Read whatever workers have written.  Returns false on a fatal error.
+  bool poll();
+
+  //! Parse a worker's output.  Returns false on a fatal error.
+  bool parse(Worker& worker);
+
+  //! Requeue the tiles of a worker which has died or gone quiet, and replace it.  Returns false on a fatal error.
+  bool lost(Worker& worker,const std::string& why);
+
+  //! The job.
+  const RenderJob _job;
+
+  //! The job as sent to workers.
+  QByteArray _job_message;
+
+  //! Compute threads in each worker.
+  const uint _threads_per_worker;
+
+  //! How long a worker with work may be silent.
+  const uint _heartbeat_timeout_ms;
+
+  //! How many times a tile may be lost before giving up.
+  const uint _max_retries;
+
+  //! The workers.
+  std::vector<Worker> _workers;
+
+  //! Tiles waiting to be sent (as frame,tile).
+  std::deque<std::pair<uint,uint> > _queued;
+
+  //! Tiles returned and not yet passed on.
+  std::deque<boost::tuple<uint,uint,QImage> > _completed;
+
+  //! Times each tile has been lost, by frame and tile.
+  std::map<std::pair<uint,uint>,uint> _retries;
+
+  //! Workers lost so far.
+  uint _workers_lost;
+
+  //! Description of a failure.
+  std::string _error;
+};
+
+//! Computes tiles on workers serving a spool directory, which may be shared between machines.
+/*! The job is written to the spool as a file, and each tile as a file in its todo subdirectory.
+  Workers (started with --worker --spool) claim tiles by renaming them into claimed (tagged with the worker's name),
+  write the results into done and remove their claims; they rewrite a heartbeat file in workers every second.
+  A worker which can't serve the job at all (e.g can't load its function) says why in a file in failed, which fails the render.
+  Claims of workers whose heartbeat hasn't changed for longer than the heartbeat timeout are returned to todo.
+  Any local workers are started (and stopped) by the coordinator, but others can join at any time.
+ */
+class SpoolCoordinator : public TiledRenderer::Source
+{
+ public:
+
+  //! Constructor.
+  /*! capacity is the number of threads expected to be serving the spool.
+   */
+  SpoolCoordinator(const RenderJob& job,const std::string& spool,uint local_workers,uint threads_per_worker,uint capacity,uint heartbeat_timeout_ms,uint max_retries);
+
+  //! Destructor.  Withdraws the job and stops any local workers.
+  virtual ~SpoolCoordinator();
+
+  //! Write the job and start any local workers.  Returns false (with a description in error()) on failure.
+  bool start();
+
+  //! As given to the constructor.
+  virtual uint capacity() const;
+
+  //! Spool a tile.
+  virtual void submit(uint frame,uint tile);
+
+  //! Wait for any spooled tile to complete.
+  virtual bool wait(uint& frame,uint& tile,QImage& image);
+
+  //! Withdraw spooled tiles.
+  virtual void abort();
+
+  //! Why something failed.
+  virtual const std::string error() const
+    {
+      return _error;
+    }
+
+ private:
+
+  //! Name of a tile's files.
+  const std::string unit_name(uint frame,uint tile) const;
+
+  //! Start a local worker.  Returns false on failure.
+  bool launch(boost::shared_ptr<QProcess>& worker);
+
+  //! Return claims of workers which have gone quiet to todo, and replace local workers which have exited.  Returns false on a fatal error.
+  bool reclaim();
+
+  //! The job.
+  const RenderJob _job;
+
+  //! Spool directory.
+  const std::string _spool;
+
+  //! Local worker processes.
+  std::vector<boost::shared_ptr<QProcess> > _local_workers;
+
+  //! Number of local workers to start.
+  const uint _local_worker_count;
+
+  //! Compute threads in each local worker.
+  const uint _threads_per_worker;
+
+  //! Threads expected to serve the spool.
+  const uint _capacity;
+
+  //! How long a worker with claims may leave its heartbeat unchanged.
+  const uint _heartbeat_timeout_ms;
+
+  //! How many times a tile may be lost before giving up.
+  const uint _max_retries;
+
+  //! Tiles spooled and not yet returned.
+  std::set<std::pair<uint,uint> > _outstanding;
+
+  //! Times each tile has been lost.
+  std::map<std::pair<uint,uint>,uint> _retries;
+
+  //! Local workers lost so far.
+  uint _workers_lost;
+
+  //! Last heartbeat seen from each worker, and how long since it changed.
+  std::map<std::string,std::pair<QByteArray,QElapsedTimer> > _heartbeats;
+
+  //! Time since anything was last returned (for reporting a spool nobody serves).
+  QElapsedTimer _idle;
+
+  //! Description of a failure.
+  std::string _error;
+};
+
+//! Run as a pipe worker: read a job and batches of tiles from in, writing tiles and heartbeats to out.
+/*! Returns a process exit status.
+ */
+extern int run_pipe_worker(const FunctionRegistry& function_registry,uint threads,std::istream& in,std::ostream& out);
+
+//! Run as a spool worker, serving jobs in the spool until a file named stop appears there.
+/*! Returns a process exit status.
+ */
+extern int run_spool_worker(const FunctionRegistry& function_registry,uint threads,const std::string& spool);
+
+#endif
@@ -0,0 +1,130 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class SpawnLatency.
+*/
+
+#include "spawn_latency.h"
+
+#include "farm_metrics.h"
+
+namespace
+{
+  //! Name of each milestone in summaries.
+  const char*const milestone_names[SpawnLatency::Milestones]={"first preview","full resolution","final"};
+
+  //! The p-th percentile (nearest rank) of some times.
+  float percentile(std::vector<float>& v,float p)
+  {
+    const size_t n=std::min(v.size()-1,static_cast<size_t>(ceil(p*v.size()))-1);
+    std::nth_element(v.begin(),v.begin()+n,v.end());
+    return v[n];
+  }
+}
+
+SpawnLatency::SpawnLatency(uint window)
+  :_window(window)
+  ,_action("other")
+  ,_action_serial(0)
+  ,_outstanding(0)
+  ,_timed(0)
+{}
+
+void SpawnLatency::action(const std::string& name)
+{
+  _action=(name.empty() ? "other" : name);
+  _action_serial++;
+  _outstanding=0;
+  _timed=0;
+}
+
+void SpawnLatency::begin(Spawn& spawn)
+{
+  // Count the new spawn first, so a display replacing its own spawn (e.g when dragged) doesn't end the action.
+  _outstanding++;
+  abandon(spawn);
+
+  spawn.action=_action;
+  spawn.action_serial=_action_serial;
+  spawn.start_ns=FarmMetrics::now_ns();
+  spawn.pending=(1<<Milestones)-1;
+}
+
+/*! Reaching a milestone implies reaching those before it (e.g a display whose first image is already full resolution).
+ */
+void SpawnLatency::reached(Spawn& spawn,Milestone milestone)
+{
+  if (!(spawn.pending&(1<<milestone))) return;
+
+  const float ms=1e-6f*(FarmMetrics::now_ns()-spawn.start_ns);
+  Times& times=_times[spawn.action];
+  for (int m=FirstPreview;m<=milestone;m++)
+    if (spawn.pending&(1<<m))
+      {
+	std::deque<float>& d=times.ms[m];
+	d.push_back(ms);
+	while (d.size()>_window) d.pop_front();
+	spawn.pending&=~(1<<m);
+      }
+
+  if (!spawn.pending) finished(spawn,true);
+}
+
+void SpawnLatency::abandon(Spawn& spawn)
+{
+  if (!spawn.pending) return;
+  const bool timed=!(spawn.pending&(1<<FirstPreview));
+  spawn.pending=0;
+  finished(spawn,timed);
+}
+
+void SpawnLatency::finished(const Spawn& spawn,bool timed)
+{
+  if (spawn.action_serial!=_action_serial || _outstanding==0) return;
+
+  if (timed) _timed++;
+  if (--_outstanding==0 && _timed)
+    {
+      _last_summary=summary(spawn.action);
+      std::clog << "[Latency: " << _last_summary << "]\n";
+    }
+}
+
+const std::string SpawnLatency::summary(const std::string& action) const
+{
+  std::ostringstream out;
+  out << action;
+
+  const std::map<std::string,Times>::const_iterator it=_times.find(action);
+  if (it==_times.end()) return out.str();
+
+  out << std::fixed << std::setprecision(0);
+  for (uint m=0;m<Milestones;m++)
+    {
+      std::vector<float> v((*it).second.ms[m].begin(),(*it).second.ms[m].end());
+      out << (m ? "; " : ": ") << milestone_names[m];
+      if (v.empty())
+	out << " -";
+      else
+	out << " " << percentile(v,0.5f) << "/" << percentile(v,0.9f) << "/" << percentile(v,0.99f) << "ms";
+    }
+  out << " (p50/p90/p99 of last " << (*it).second.ms[FirstPreview].size() << ")";
+  return out.str();
+}
@@ -0,0 +1,130 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class SpawnLatency.
+*/
+
+#ifndef _spawn_latency_h_
+#define _spawn_latency_h_
+
+#include "common.h"
+#include "useful.h"
+
+//! Keeps rolling percentiles of how long displays take to show a newly spawned image.
+/*! Each display given a new image (by a spawn, respawn, undo, mouse adjustment etc) times how long it takes
+  to show its first (coarse) preview, its full resolution image and its final multisampled image.
+  Times are kept for the most recent spawns under the name of the action which caused them
+  (as named to the History), and when every display spawned by the current action has finished
+  (or been given something else) a line of percentiles for that action is logged to std::clog.
+ */
+class SpawnLatency
+{
+ public:
+
+  //! What a display has shown of a spawned image.
+  enum Milestone
+    {
+      FirstPreview,
+      FullResolution,
+      Final,
+      Milestones
+    };
+
+  //! A display's record of its current spawn.
+  struct Spawn
+  {
+    //! Constructor.  Not tracking anything.
+    Spawn()
+      :action_serial(0)
+      ,start_ns(0)
+      ,pending(0)
+    {}
+
+    //! The action which caused the spawn.
+    std::string action;
+
+    //! Which occurrence of the action it was.
+    uint action_serial;
+
+    //! When the display was given the image.
+    unsigned long long start_ns;
+
+    //! Bit per milestone not yet reached (0 when not tracking).
+    uint pending;
+  };
+
+  //! Constructor.  Percentiles are over the last window spawns of each action.
+  SpawnLatency(uint window=512);
+
+  //! Name the action causing subsequent spawns.
+  void action(const std::string& name);
+
+  //! Start timing a display's new image (abandoning any spawn it was still timing).
+  void begin(Spawn& spawn);
+
+  //! Record a milestone, if not already reached.
+  void reached(Spawn& spawn,Milestone milestone);
+
+  //! Stop timing a spawn which won't reach its remaining milestones (replaced or display closed).
+  void abandon(Spawn& spawn);
+
+  //! One line of percentiles for an action.
+  const std::string summary(const std::string& action) const;
+
+  //! The last line logged (empty if none yet).
+  const std::string& last_summary() const
+    {
+      return _last_summary;
+    }
+
+ private:
+
+  //! The most recent times (ms) to each milestone.
+  struct Times
+  {
+    std::deque<float> ms[Milestones];
+  };
+
+  //! Note that one of the current action's spawns is finished with (timed if it showed anything), and log if it was the last.
+  void finished(const Spawn& spawn,bool timed);
+
+  //! Spawns kept for each action's percentiles.
+  const uint _window;
+
+  //! Name of the current action.
+  std::string _action;
+
+  //! Occurrences of actions so far.
+  uint _action_serial;
+
+  //! Spawns of the current action still being timed.
+  uint _outstanding;
+
+  //! Spawns of the current action which reached some milestone.
+  uint _timed;
+
+  //! The most recent times (ms) to each milestone, by action.
+  std::map<std::string,Times> _times;
+
+  //! The last line logged.
+  std::string _last_summary;
+};
+
+#endif
@@ -0,0 +1,318 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class TiledRenderer.
+*/
+
+#include "tiled_renderer.h"
+
+#include "mutatable_image.h"
+
+const std::string frame_filename(const std::string& filename,uint frame,uint frames)
+{
+  if (frames<=1) return filename;
+
+  std::ostringstream frame_component;
+  frame_component << ".f" << std::setw(6) << std::setfill('0') << frame;
+
+  // Only look for a suffix in the last component of the path
+  const std::string::size_type slash=filename.find_last_of("/\\");
+  const std::string::size_type dot=filename.find_last_of('.');
+  if (dot==std::string::npos || (slash!=std::string::npos && dot<slash))
+    return filename+frame_component.str();
+  else
+    return std::string(filename,0,dot)+frame_component.str()+std::string(filename,dot);
+}
+
+TiledRenderer::TiledRenderer(uint n_threads,uint tile_size)
+  :_farm(std::max(1u,n_threads),0)
+  ,_tile_size(tile_size)
+{
+  assert(_tile_size>0);
+}
+
+TiledRenderer::~TiledRenderer()
+{}
+
+uint TiledRenderer::tiles(const QSize& size) const
+{
+  return ((size.width()+_tile_size-1)/_tile_size)*((size.height()+_tile_size-1)/_tile_size);
+}
+
+const QRect TiledRenderer::tile_rect(const QSize& size,uint tile) const
+{
+  const uint columns=(size.width()+_tile_size-1)/_tile_size;
+  const int x=(tile%columns)*_tile_size;
+  const int y=(tile/columns)*_tile_size;
+  return QRect(x,y,std::min(static_cast<int>(_tile_size),size.width()-x),std::min(static_cast<int>(_tile_size),size.height()-y));
+}
+
+TiledRenderer::LocalSource::LocalSource(TiledRenderer& renderer,const boost::shared_ptr<const MutatableImage>& fn,const QSize& size,uint frames,bool jitter,uint multisample)
+  :_renderer(renderer)
+  ,_fn(fn)
+  ,_size(size)
+  ,_frames(frames)
+  ,_jitter(jitter)
+  ,_multisample(multisample)
+  ,_costs(0)
+{}
+
+uint TiledRenderer::LocalSource::capacity() const
+{
+  return _renderer.num_threads();
+}
+
+/*! Tiles are prioritised in frame then raster order.
+ */
+void TiledRenderer::LocalSource::submit(uint frame,uint tile)
+{
+  const uint tiles=_renderer.tiles(_size);
+  const QRect rect(_renderer.tile_rect(_size,tile));
+
+  _renderer._farm.push_todo
+    (
+     boost::shared_ptr<MutatableImageComputerTask>
+     (
+      new MutatableImageComputerTask
+      (
+       0,
+       _fn,
+       frame*tiles+tile,
+       QSize(rect.x(),rect.y()),
+       rect.size(),
+       _size,
+       frame,
+       1,
+       _frames,
+       0,
+       tile,
+       tiles,
+       _jitter,
+       _multisample,
+       false,
+       _costs!=0,
+       frame
+       )
+      )
+     );
+}
+
+bool TiledRenderer::LocalSource::wait(uint& frame,uint& tile,QImage& image)
+{
+  while (!wait_for(ULONG_MAX,frame,tile,image));
+  return true;
+}
+
+bool TiledRenderer::LocalSource::wait_for(unsigned long timeout,uint& frame,uint& tile,QImage& image)
+{
+  boost::shared_ptr<const MutatableImageComputerTask> task;
+  do
+    {
+      task=_renderer._farm.wait_done(timeout);
+      if (!task) return false;
+    }
+  // abort() leaves nothing aborted behind, but an aborted tile has no business in an image regardless.
+  while (task->aborted());
+  frame=task->frame_origin();
+  tile=task->fragment();
+  image=task->images()[0];
+
+  if (_costs)
+    {
+      std::vector<float>& cost=(*_costs)[frame];
+      if (cost.empty()) cost.resize(_size.width()*_size.height());
+      const QSize& tile_size(task->fragment_size());
+      for (int row=0;row<tile_size.height();row++)
+	std::copy
+	  (
+	   task->cost().begin()+row*tile_size.width(),
+	   task->cost().begin()+(row+1)*tile_size.width(),
+	   cost.begin()+(task->fragment_origin().height()+row)*_size.width()+task->fragment_origin().width()
+	   );
+    }
+  return true;
+}
+
+/*! Waits for the threads to finish with their tiles, so none turn up in the renderer's next render.
+ */
+void TiledRenderer::LocalSource::abort()
+{
+  _renderer._farm.abort_all_and_wait();
+}
+
+TiledRenderer::Assembly::Assembly(const QSize& size,uint b)
+  :image(size.isEmpty() ? QImage() : QImage(size,QImage::Format_RGB32))
+  ,tiles_done(0)
+  ,skipped(false)
+  ,bands(b)
+  ,bands_output(0)
+{}
+
+bool TiledRenderer::output_bands(uint frame,Assembly& assembly,const QSize& size,uint columns,uint& tiles_held,Output& output) const
+{
+  while (assembly.bands_output<assembly.bands.size() && assembly.bands[assembly.bands_output].size()==columns)
+    {
+      std::vector<std::pair<int,QImage> >& tiles=assembly.bands[assembly.bands_output];
+
+      const int begin=assembly.bands_output*_tile_size;
+      QImage band(size.width(),tiles.front().second.height(),QImage::Format_RGB32);
+      for (uint i=0;i<tiles.size();i++)
+	{
+	  const QImage& tile=tiles[i].second;
+	  for (int row=0;row<tile.height();row++)
+	    memcpy(band.scanLine(row)+4*tiles[i].first,tile.constScanLine(row),4*tile.width());
+	}
+      tiles_held-=tiles.size();
+      tiles.clear();
+
+      if (!output.rows(frame,band,begin)) return false;
+      assembly.bands_output++;
+    }
+  return true;
+}
+
+bool TiledRenderer::render(const boost::shared_ptr<const MutatableImage>& fn,const QSize& size,uint frames,bool jitter,uint multisample,Output& output)
+{
+  LocalSource source(*this,fn,size,frames,jitter,multisample);
+  return render(source,size,frames,output);
+}
+
+bool TiledRenderer::render(Source& source,const QSize& size,uint frames,Output& output)
+{
+  const Output::Assembly assemble=output.assembly();
+  const uint columns=(size.width()+_tile_size-1)/_tile_size;
+  const uint bands=(size.height()+_tile_size-1)/_tile_size;
+  const uint tiles=columns*bands;
+  assert(tiles>0);
+
+  // Deep enough that a band is always completely queued before its tiles have to be released.
+  const uint window=2*columns+4*source.capacity();
+
+  boost::ptr_map<uint,Assembly> assembling;
+
+  // Tiles queued, being computed or held for assembly.
+  uint tiles_held=0;
+
+  // Tiles queued or being computed.
+  uint tiles_outstanding=0;
+
+  uint next_frame=0;
+  uint next_tile=0;
+  uint next_output=0;
+  while (true)
+    {
+      while (next_frame<frames && tiles_held<window)
+	{
+	  if (next_tile==0)
+	    {
+	      uint frame=next_frame;
+	      if (output.skip_frame(frame))
+		{
+		  Assembly*const assembly=new Assembly(QSize(),0);
+		  assembly->tiles_done=tiles;
+		  assembly->skipped=true;
+		  assembling.insert(frame,assembly);
+		  next_frame++;
+		  continue;
+		}
+	      assembling.insert(frame,new Assembly((assemble==Output::AssembleFrames ? size : QSize()),bands));
+	      if (assemble==Output::AssembleFrames && assembling.at(frame).image.isNull())
+		{
+		  // Out of memory for the frame.
+		  source.abort();
+		  return false;
+		}
+	    }
+	  if (assemble==Output::AssembleNothing && output.skip_tile(next_frame,next_tile))
+	    {
+	      assembling.at(next_frame).tiles_done++;
+	    }
+	  else
+	    {
+	      source.submit(next_frame,next_tile);
+	      tiles_held++;
+	      tiles_outstanding++;
+	    }
+	  if (++next_tile==tiles)
+	    {
+	      next_tile=0;
+	      next_frame++;
+	    }
+	}
+
+      // Frames may complete out of order, but are output in order.
+      boost::ptr_map<uint,Assembly>::iterator it;
+      while ((it=assembling.find(next_output))!=assembling.end())
+	{
+	  Assembly& current=*(*it).second;
+	  if (assemble==Output::AssembleBands && !current.skipped && !output_bands(next_output,current,size,columns,tiles_held,output))
+	    {
+	      source.abort();
+	      return false;
+	    }
+	  if (current.tiles_done<tiles) break;
+	  if (!current.skipped && !output.frame(next_output,current.image))
+	    {
+	      source.abort();
+	      return false;
+	    }
+	  assembling.erase(it);
+	  next_output++;
+	}
+
+      if (next_output==frames) break;
+      if (tiles_outstanding==0) continue;
+
+      uint frame;
+      uint n;
+      QImage tile;
+      if (!source.wait(frame,n,tile))
+	{
+	  source.abort();
+	  return false;
+	}
+      tiles_outstanding--;
+
+      const QPoint origin(tile_rect(size,n).topLeft());
+      Assembly& assembly=assembling.at(frame);
+      assembly.tiles_done++;
+      output.progress(frame,assembly.tiles_done,tiles);
+      if (!output.tile(frame,n,tile,origin))
+	{
+	  source.abort();
+	  return false;
+	}
+
+      if (assemble==Output::AssembleBands)
+	{
+	  assembly.bands[origin.y()/_tile_size].push_back(std::make_pair(origin.x(),tile));
+	}
+      else
+	{
+	  if (assemble==Output::AssembleFrames)
+	    {
+	      for (int row=0;row<tile.height();row++)
+		memcpy(assembly.image.scanLine(origin.y()+row)+4*origin.x(),tile.constScanLine(row),4*tile.width());
+	    }
+	  tiles_held--;
+	}
+    }
+  return true;
+}
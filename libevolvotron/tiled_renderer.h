@@ -0,0 +1,301 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class TiledRenderer.
+*/
+
+#ifndef _tiled_renderer_h_
+#define _tiled_renderer_h_
+
+#include "common.h"
+
+#include "mutatable_image_computer_farm.h"
+
+class MutatableImage;
+
+//! Insert a frame number (.fnnnnnn) before the suffix of a filename, if there's more than one frame.
+extern const std::string frame_filename(const std::string& filename,uint frame,uint frames);
+
+//! Renders images (for batch use) by splitting them into tiles computed by a compute farm.
+/*! Tiles are a fixed size and each carries its own jitter seed,
+  so the result doesn't depend on the number of threads.
+  Tiles are queued in raster order through a window a couple of tile rows deep,
+  which keeps the threads busy across frame boundaries.
+  Unless the output asks for whole frames, that window also bounds the memory used,
+  whatever the size of the image.
+ */
+class TiledRenderer
+{
+ public:
+
+  //! Receives completed tiles, bands of rows or frames, and progress as tiles complete.
+  class Output
+  {
+  public:
+
+    //! What an output needs the renderer to assemble tiles into.
+    enum Assembly
+      {
+	AssembleFrames,  //!< Whole frames, passed to frame().
+	AssembleBands,   //!< Bands of rows, passed to rows() in order.
+	AssembleNothing  //!< Nothing; tiles are only passed to tile().
+      };
+
+    //! Destructor.
+    virtual ~Output()
+      {}
+
+    //! What to assemble.  Anything other than whole frames keeps memory use independent of image size.
+    virtual Assembly assembly() const
+      {
+	return AssembleFrames;
+      }
+
+    //! Whether a frame is already done (e.g when resuming).  Called for each frame in turn.
+    /*! Skipped frames aren't rendered and aren't passed to frame().
+     */
+    virtual bool skip_frame(uint /*frame*/)
+      {
+	return false;
+      }
+
+    //! Whether a tile of a frame is already done.
+    /*! Only consulted for outputs assembling nothing (any others only skip whole frames).
+     */
+    virtual bool skip_tile(uint /*frame*/,uint /*tile*/)
+      {
+	return false;
+      }
+
+    //! Make everything output so far durable (e.g before recording it in a checkpoint).  Return false on failure.
+    virtual bool sync()
+      {
+	return true;
+      }
+
+    //! Called as each tile of a frame completes (in no particular frame order).
+    virtual void progress(uint /*frame*/,uint /*tiles_done*/,uint /*tiles*/)
+      {}
+
+    //! Called with each tile (numbered in raster order) as it completes (in no particular order), whatever is being assembled.
+    /*! Return false to abandon the render.
+     */
+    virtual bool tile(uint /*frame*/,uint /*n*/,const QImage& /*tile*/,const QPoint& /*origin*/)
+      {
+	return true;
+      }
+
+    //! Called with each band of rows of each frame in turn (only when assembling bands).
+    /*! The band holds rows [begin,begin+band.height()) of the frame.
+      Return false to abandon the render.
+     */
+    virtual bool rows(uint /*frame*/,const QImage& /*band*/,int /*begin*/)
+      {
+	return true;
+      }
+
+    //! Called with each frame in turn, once all its tiles are complete.
+    /*! The image is null unless assembling whole frames.
+      Return false to abandon the render.
+     */
+    virtual bool frame(uint frame,const QImage& image)
+      =0;
+  };
+
+  //! Computes the tiles render() assembles, in whatever order they're submitted.
+  /*! Tiles are numbered in raster order within each frame.
+   */
+  class Source
+  {
+  public:
+
+    //! Destructor.
+    virtual ~Source()
+      {}
+
+    //! Number of tiles computed at once (the renderer keeps a few times this many queued).
+    virtual uint capacity() const
+      =0;
+
+    //! Queue a tile of a frame.
+    virtual void submit(uint frame,uint tile)
+      =0;
+
+    //! Wait for any queued tile to complete.
+    /*! Returns false if it can't be computed (with a description in error()).
+     */
+    virtual bool wait(uint& frame,uint& tile,QImage& image)
+      =0;
+
+    //! Abandon all queued tiles.
+    virtual void abort()
+      {}
+
+    //! Why wait() failed.
+    virtual const std::string error() const
+      {
+	return std::string();
+      }
+  };
+
+  //! Computes the tiles of a function on the renderer's own threads.
+  class LocalSource : public Source
+  {
+  public:
+
+    //! Per-sample costs of the pixels of frames (as MutatableImageComputerTask::cost, row major), by frame.
+    typedef std::map<uint,std::vector<float> > Costs;
+
+    //! Constructor.
+    LocalSource(TiledRenderer& renderer,const boost::shared_ptr<const MutatableImage>& fn,const QSize& size,uint frames,bool jitter,uint multisample);
+
+    //! The renderer's threads.
+    virtual uint capacity() const;
+
+    //! Queue a tile of a frame.
+    /*! Safe to call from another thread while one waits (the farm's queues are locked), as pipe workers do.
+     */
+    virtual void submit(uint frame,uint tile);
+
+    //! Wait for any queued tile to complete.
+    virtual bool wait(uint& frame,uint& tile,QImage& image);
+
+    //! As wait(), but returns false if no tile completes within timeout milliseconds.
+    bool wait_for(unsigned long timeout,uint& frame,uint& tile,QImage& image);
+
+    //! Abandon all queued tiles.
+    virtual void abort();
+
+    //! Also copy the cost of each tile's pixels into costs as the tile completes (null to stop).
+    /*! Frames are added as their first tile completes; whatever uses them should remove them when done.
+     */
+    void record_costs(Costs* costs)
+      {
+	_costs=costs;
+      }
+
+  private:
+
+    //! The renderer whose farm computes tiles.
+    TiledRenderer& _renderer;
+
+    //! The function.
+    const boost::shared_ptr<const MutatableImage> _fn;
+
+    //! Size of frames.
+    const QSize _size;
+
+    //! Frames in the animation.
+    const uint _frames;
+
+    //! Whether samples are jittered.
+    const bool _jitter;
+
+    //! Multisampling grid.
+    const uint _multisample;
+
+    //! Where to copy tiles' costs, if anywhere.
+    Costs* _costs;
+  };
+
+  //! Constructor.
+  TiledRenderer(uint n_threads,uint tile_size=64);
+
+  //! Destructor.
+  ~TiledRenderer();
+
+  //! Accessor.
+  uint num_threads() const
+    {
+      return _farm.num_threads();
+    }
+
+  //! Accessor.
+  uint tile_size() const
+    {
+      return _tile_size;
+    }
+
+  //! Add the compute threads' function profiles to totals.
+  void profile(std::vector<FunctionProfile::Totals>& totals) const
+    {
+      _farm.profile(totals);
+    }
+
+  //! Add what the compute threads have done to a metrics snapshot.
+  void metrics(FarmMetrics& m) const
+    {
+      _farm.metrics(m);
+    }
+
+  //! Number of tiles in a frame of the given size.
+  uint tiles(const QSize& size) const;
+
+  //! Position and size of a tile (numbered in raster order) of a frame of the given size.
+  const QRect tile_rect(const QSize& size,uint tile) const;
+
+  //! Render the frames of an image, passing them to the output in order.
+  /*! Returns false if the output abandoned the render, or a whole frame couldn't be allocated.
+   */
+  bool render(const boost::shared_ptr<const MutatableImage>& fn,const QSize& size,uint frames,bool jitter,uint multisample,Output& output);
+
+  //! Render frames from tiles computed elsewhere, passing them to the output in order.
+  /*! Returns false if the output abandoned the render, the source failed, or a whole frame couldn't be allocated.
+   */
+  bool render(Source& source,const QSize& size,uint frames,Output& output);
+
+ private:
+
+  //! A frame being assembled from tiles.
+  class Assembly
+  {
+  public:
+    //! Constructor.  A null size means the frame isn't wanted as a whole.
+    Assembly(const QSize& size,uint bands);
+
+    //! The frame.
+    QImage image;
+
+    //! Tiles completed (or skipped).
+    uint tiles_done;
+
+    //! Whether the whole frame was skipped.
+    bool skipped;
+
+    //! Tiles (with their horizontal positions) held for each band (row of tiles) until the band is complete.
+    std::vector<std::vector<std::pair<int,QImage> > > bands;
+
+    //! Bands already passed to the output.
+    uint bands_output;
+  };
+
+  //! Pass completed bands to the output, releasing their tiles.
+  /*! Returns false if the output abandoned the render.
+   */
+  bool output_bands(uint frame,Assembly& assembly,const QSize& size,uint columns,uint& tiles_held,Output& output) const;
+
+  //! Threads computing tiles.
+  MutatableImageComputerFarm _farm;
+
+  //! Width and height of tiles.
+  const uint _tile_size;
+};
+
+#endif
@@ -0,0 +1,213 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class Trace.
+*/
+
+#include "trace.h"
+
+std::atomic<bool> Trace::_enabled(false);
+
+namespace
+{
+  //! A recorded event.
+  struct Event
+  {
+    //! Category.
+    const char* category;
+
+    //! Name.
+    const char* name;
+
+    //! Chrome trace phase: 'X' for complete events, 'i' for instants.
+    char phase;
+
+    //! Thread recording it.
+    uint thread;
+
+    //! Start, in nanoseconds since recording started.
+    long long begin;
+
+    //! Duration in nanoseconds (complete events only).
+    long long duration;
+
+    //! Arguments, as the members of a JSON object.
+    std::string args;
+  };
+
+  //! Guards everything below.
+  QMutex trace_mutex;
+
+  //! When recording started.
+  std::chrono::steady_clock::time_point trace_epoch(std::chrono::steady_clock::now());
+
+  //! Events recorded.
+  std::vector<Event> trace_events;
+
+  //! Events not recorded for lack of room.
+  unsigned long long trace_dropped=0;
+
+  //! Names given to threads, by thread number.
+  std::map<uint,std::string> trace_thread_names;
+
+  //! Thread numbers are allocated as threads first record something.
+  std::atomic<uint> trace_threads(0);
+
+  //! Number of the calling thread.
+  uint trace_thread()
+  {
+    static thread_local uint thread=++trace_threads;
+    return thread;
+  }
+
+  //! Keep an event.
+  void record(const Event& event)
+  {
+    QMutexLocker lock(&trace_mutex);
+    if (trace_events.size()<Trace::MaxEvents)
+      trace_events.push_back(event);
+    else
+      trace_dropped++;
+  }
+
+  //! Write nanoseconds as the microseconds Chrome traces use.
+  std::ostream& microseconds(std::ostream& out,long long ns)
+  {
+    return out << ns/1000 << "." << std::setw(3) << std::setfill('0') << ns%1000 << std::setfill(' ');
+  }
+}
+
+Trace::Args& Trace::Args::operator()(const char* key,long long value)
+{
+  std::ostringstream arg;
+  arg << (_str.empty() ? "" : ",") << "\"" << key << "\":" << value;
+  _str+=arg.str();
+  return *this;
+}
+
+Trace::Args& Trace::Args::operator()(const char* key,const char* value)
+{
+  _str+=std::string(_str.empty() ? "" : ",")+"\""+key+"\":\""+value+"\"";
+  return *this;
+}
+
+void Trace::start()
+{
+  QMutexLocker lock(&trace_mutex);
+  trace_events.clear();
+  trace_dropped=0;
+  trace_epoch=std::chrono::steady_clock::now();
+  _enabled.store(true,std::memory_order_relaxed);
+}
+
+void Trace::stop()
+{
+  _enabled.store(false,std::memory_order_relaxed);
+}
+
+long long Trace::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-trace_epoch).count();
+}
+
+void Trace::thread_name(const char* name)
+{
+  const uint thread=trace_thread();
+  QMutexLocker lock(&trace_mutex);
+  trace_thread_names[thread]=name;
+}
+
+void Trace::instant(const char* category,const char* name,const Args& args)
+{
+  if (!enabled()) return;
+  const Event event={category,name,'i',trace_thread(),now(),0,args.str()};
+  record(event);
+}
+
+void Trace::complete(const char* category,const char* name,long long begin,const Args& args)
+{
+  complete(category,name,begin,args.str());
+}
+
+void Trace::complete(const char* category,const char* name,long long begin,const std::string& args)
+{
+  if (!enabled()) return;
+  const Event event={category,name,'X',trace_thread(),begin,now()-begin,args};
+  record(event);
+}
+
+/*! Events are written in the order recorded; viewers sort them.
+ */
+bool Trace::write(const std::string& filename,std::string& error)
+{
+  std::ofstream out(filename.c_str());
+  if (!out)
+    {
+      error="Couldn't open "+filename;
+      return false;
+    }
+
+  QMutexLocker lock(&trace_mutex);
+  const long long pid=QCoreApplication::applicationPid();
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first=true;
+  for (std::map<uint,std::string>::const_iterator it=trace_thread_names.begin();it!=trace_thread_names.end();it++)
+    {
+      out
+	<< (first ? "" : ",\n")
+	<< "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+	<< ",\"tid\":" << (*it).first
+	<< ",\"args\":{\"name\":\"" << (*it).second << "\"}}";
+      first=false;
+    }
+  for (std::vector<Event>::const_iterator it=trace_events.begin();it!=trace_events.end();it++)
+    {
+      out
+	<< (first ? "" : ",\n")
+	<< "{\"ph\":\"" << (*it).phase
+	<< "\",\"cat\":\"" << (*it).category
+	<< "\",\"name\":\"" << (*it).name
+	<< "\",\"pid\":" << pid
+	<< ",\"tid\":" << (*it).thread
+	<< ",\"ts\":";
+      microseconds(out,(*it).begin);
+      if ((*it).phase=='X')
+	{
+	  out << ",\"dur\":";
+	  microseconds(out,(*it).duration);
+	}
+      else
+	{
+	  out << ",\"s\":\"t\"";
+	}
+      out << ",\"args\":{" << (*it).args << "}}";
+      first=false;
+    }
+  out << "\n],\"otherData\":{\"dropped_events\":" << trace_dropped << "}}\n";
+
+  out.flush();
+  if (!out)
+    {
+      error="Couldn't write "+filename;
+      return false;
+    }
+  return true;
+}
@@ -0,0 +1,137 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class Trace.
+*/
+
+#ifndef _trace_h_
+#define _trace_h_
+
+#include "common.h"
+#include "useful.h"
+
+//! Records a timeline of what the compute farm and GUI are doing, for writing as a Chrome trace.
+/*! Events are recorded from any thread while tracing is on, and written as Chrome trace event JSON
+  (which chrome://tracing and Perfetto's UI load) by write().
+  Events are per task, not per pixel, so a single lock on recording is no bottleneck;
+  past MaxEvents any more are dropped (and counted).
+ */
+class Trace
+{
+ public:
+
+  //! Most events kept.
+  enum {MaxEvents=1<<21};
+
+  //! Builds the arguments of an event, e.g Trace::Args()("level",2)("outcome","completed").
+  class Args
+  {
+  public:
+    //! Add an integer argument.
+    Args& operator()(const char* key,long long value);
+
+    //! Add a string argument (which shouldn't need escaping).
+    Args& operator()(const char* key,const char* value);
+
+    //! The arguments, as the members of a JSON object.
+    const std::string& str() const
+      {
+	return _str;
+      }
+
+  private:
+    //! The arguments so far.
+    std::string _str;
+  };
+
+  //! Records an event (with category and name) covering its own lifetime, if tracing was on when it was constructed.
+  class Span : boost::noncopyable
+  {
+  public:
+    //! Constructor.  Category and name must be string literals (they're kept, not copied).
+    Span(const char* category,const char* name)
+      :_category(category)
+      ,_name(name)
+      ,_begin(enabled() ? now() : -1)
+      {}
+
+    //! Destructor.
+    ~Span()
+      {
+	if (_begin>=0) complete(_category,_name,_begin,_args);
+      }
+
+    //! Set the event's arguments.
+    void args(const Args& a)
+      {
+	_args=a.str();
+      }
+
+  private:
+    //! Category of the event.
+    const char*const _category;
+
+    //! Name of the event.
+    const char*const _name;
+
+    //! When it began (negative if not tracing).
+    const long long _begin;
+
+    //! Its arguments.
+    std::string _args;
+  };
+
+  //! Whether events are being recorded.
+  static bool enabled()
+    {
+      return _enabled.load(std::memory_order_relaxed);
+    }
+
+  //! Clear anything recorded and start recording.
+  static void start();
+
+  //! Stop recording.
+  static void stop();
+
+  //! Nanoseconds since recording started.
+  static long long now();
+
+  //! Name the calling thread in the timeline (recorded whether or not tracing is on yet).
+  static void thread_name(const char* name);
+
+  //! Record an instant event.  Category and name must be string literals.
+  static void instant(const char* category,const char* name,const Args& args=Args());
+
+  //! Record an event from begin (a value of now()) until now.  Category and name must be string literals.
+  static void complete(const char* category,const char* name,long long begin,const Args& args=Args());
+
+  //! Record an event from begin until now, with arguments already built.
+  static void complete(const char* category,const char* name,long long begin,const std::string& args);
+
+  //! Write everything recorded as Chrome trace JSON.  Returns false (with a description in error) on failure.
+  static bool write(const std::string& filename,std::string& error);
+
+ private:
+
+  //! Whether events are being recorded.
+  static std::atomic<bool> _enabled;
+};
+
+#endif
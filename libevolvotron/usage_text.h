@@ -190,6 +190,22 @@
 "</ul>\n"
 "</p>\n"
 "<p>\n"
+"  <ul><li>--metrics-file <i>file</i><br>\n"
+"  Every few seconds (see --metrics-interval) replaces the file with a\n"
+"  JSON object holding the same compute farm metrics as the status bar's\n"
+"  &quot;Compute metrics&quot; panel (rates over the interval, plus totals),\n"
+"  and the memory accounts shown in the About box,\n"
+"  so that a monitoring script can read it at any time.\n"
+"</li>\n"
+"</ul>\n"
+"</p>\n"
+"<p>\n"
+"  <ul><li>--metrics-interval <i>seconds</i><br>\n"
+"  Seconds between writes of the --metrics-file (default 5).\n"
+"</li>\n"
+"</ul>\n"
+"</p>\n"
+"<p>\n"
 "  <ul><li>-n, --nice <i>niceness</i><br>\n"
 "  Sets additional niceness (relative to the main application thread)\n"
 "  of the compute (rendering) thread(s).\n"
@@ -221,6 +237,15 @@
 "</ul>\n"
 "</p>\n"
 "<p>\n"
+"  <ul><li>--trace <i>file</i><br>\n"
+"  Records a timeline of what the compute threads and the GUI do\n"
+"  (tasks queued and computed, threads idle, waits for the task queue lock,\n"
+"  fragments delivered and displayed) and writes it to the file on exit,\n"
+"  in the Chrome trace JSON format which chrome://tracing and Perfetto load.\n"
+"</li>\n"
+"</ul>\n"
+"</p>\n"
+"<p>\n"
 "  <ul><li>-u, --unwrapped<br>\n"
 "  Modifies -F behaviour so that the specified &quot;favourite&quot; function\n"
 "  is NOT wrapped by space/colour transforms.  NB For functions without leaf nodes\n"
@@ -351,6 +376,10 @@
 "<p>\n"
 "  <ul><li>&quot;Properties&quot; brings up a dialog box containing some information\n"
 "  about the image (e.g the number of function nodes it contains).\n"
+"  Its &quot;Profile&quot; tab times every node of the function over a small\n"
+"  render, and shows the function tree with the share of the time each\n"
+"  subtree (and each node on its own) takes, which shows what makes an\n"
+"  image slow to enlarge, and so what to simplify or replace.\n"
 "</li>\n"
 "</ul>\n"
 "</p>\n"
@@ -505,9 +534,23 @@
 "  function type to always be used as the root node of any new functions.\n"
 "  The function can be wrapped by some other random stuff, or unwrapped.\n"
 "  See also the -X and -x command line options.\n"
+"  &quot;Function profile&quot; brings up a table of how many times each type\n"
+"  of function has been evaluated, and how long was spent in it with and\n"
+"  without its arguments, while profiling is enabled there (or by the\n"
+"  --profile command line option).  Profiling slows computation a little.\n"
+"  &quot;Cost map overlay&quot; shows, instead of each image, what each of its\n"
+"  pixels cost to compute (per sample), false-coloured from black through\n"
+"  blue, magenta, red and yellow to white for the costliest 1%.  The cost\n"
+"  is in time, or in function evaluations while profiling is enabled.\n"
+"  It shows where iterative and branching functions do their work.\n"
+"  Costs are only measured while the overlay is on, so turning it on\n"
+"  recomputes the images.\n"
 "  </li><li>Help menu:\n"
 "  Items to bring up documentation, and the usual &quot;About&quot; box\n"
-"  (which includes the license).\n"
+"  (which includes the license, and a &quot;Memory&quot; tab showing how much\n"
+"  memory is held by function nodes (and how much of that only by the\n"
+"  undo history), compute task buffers, and displays' offscreen images\n"
+"  and pixmaps).\n"
 "</li>\n"
 "</ul>\n"
 "</p>\n"
@@ -525,6 +568,20 @@
 "  lower resolution tasks have completed.\n"
 "</p>\n"
 "<p>\n"
+"  A &quot;Compute metrics&quot; button on the status bar shows or hides a panel\n"
+"  updated every second with the samples computed per second, how busy\n"
+"  each compute thread has been, the tasks running and queued at each\n"
+"  resolution level, how long completed tasks waited from being queued\n"
+"  to finishing, and how much computation was wasted on tasks aborted\n"
+"  before they finished (e.g. because the image was replaced).\n"
+"  Once the images given to the grid by an action (spawn, respawn,\n"
+"  undo, a mouse adjustment...) have all been shown, it also shows how\n"
+"  long they took to show a first preview, the full resolution image\n"
+"  and the final multisampled image (the median, 90th and 99th\n"
+"  percentiles of recent times for that kind of action).  With -v these\n"
+"  are also logged for every action.\n"
+"</p>\n"
+"<p>\n"
 "  The status bar also provides some control over the &quot;autocool&quot;\n"
 "  mechanism which reduces mutation strength with time.\n"
 "  See the advanced usage section below.\n"
@@ -29,6 +29,7 @@
 
 #include "function_node.h"
 #include "function_node_info.h"
+#include "function_profile.h"
 #include "function_registry.h"
 #include "margin.h"
 
@@ -41,15 +42,11 @@ template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint C
   //! Constructor
   /*! \warning Careful to pass an appropriate initial iteration count for iterative functions.
    */
-  FunctionBoilerplate(const std::vector<real>& p,boost::ptr_vector<FunctionNode>& a,uint iter);
+  FunctionBoilerplate(const std::vector<real>& p,const Args& a,uint iter);
   
   //! Destructor.
   virtual ~FunctionBoilerplate();
 
-  //! Accessor providing function name
-  virtual const char* thisname() const
-    =0;
-
   //! Make function meta-information.
   static FunctionRegistration* make_registration(const char* fn_name);
     
@@ -59,6 +56,9 @@ template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint C
   //! Bits give some classification of the function type
   virtual uint self_classification() const;
 
+  //! Index of the function type in a FunctionProfile.
+  virtual uint profile_type() const;
+
   //! Factory method to create a stub node for this type
   static std::unique_ptr<FunctionNode> stubnew(const MutationParameters& mutation_parameters,bool exciting);
 
@@ -67,10 +67,10 @@ template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint C
    */
   static std::unique_ptr<FunctionNode> create(const FunctionRegistry& function_registry,const FunctionNodeInfo& info,std::string& report);
 
-  //! Return a deeploned copy.
+  //! Return a copy (sharing children, which are copied on write).
   virtual std::unique_ptr<FunctionNode> deepclone() const;
 
-  //! Return a deeploned copy with more specific type (but of course this can't be virtual).
+  //! Return a copy with more specific type (but of course this can't be virtual).
   std::unique_ptr<FUNCTION> typed_deepclone() const;
     
   //! Internal self-consistency check.  We can add some extra checks.
@@ -81,7 +81,7 @@ template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint C
 };
 
 template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint CLASSIFICATION> 
-FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,ITERATIVE,CLASSIFICATION>::FunctionBoilerplate(const std::vector<real>& p,boost::ptr_vector<FunctionNode>& a,uint iter)
+FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,ITERATIVE,CLASSIFICATION>::FunctionBoilerplate(const std::vector<real>& p,const Args& a,uint iter)
   :FunctionNode(p,a,iter)
 {
   assert(params().size()==PARAMETERS);
@@ -115,6 +115,13 @@ uint FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,ITERATIVE,CLASSIFICATION>
   return CLASSIFICATION;
 }
 
+template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint CLASSIFICATION>
+uint FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,ITERATIVE,CLASSIFICATION>::profile_type() const
+{
+  static const uint index=FunctionProfile::type_index(FUNCTION::classname());
+  return index;
+}
+
 template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint CLASSIFICATION>
 std::unique_ptr<FunctionNode> FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,ITERATIVE,CLASSIFICATION>::stubnew(const MutationParameters& mutation_parameters,bool exciting)
 {
@@ -124,7 +131,7 @@ std::unique_ptr<FunctionNode> FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,
   std::vector<real> params;
   stubparams(params,mutation_parameters,_PARAMETERS);
   
-  boost::ptr_vector<FunctionNode> args;
+  Args args;
   stubargs(args,mutation_parameters,_ARGUMENTS,exciting);
   
   return std::unique_ptr<FunctionNode>
@@ -143,7 +150,7 @@ std::unique_ptr<FunctionNode> FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,
 {
   if (!verify_info(info,PARAMETERS,ARGUMENTS,ITERATIVE,report)) return std::unique_ptr<FunctionNode>();
   
-  boost::ptr_vector<FunctionNode> args;
+  Args args;
   if (!create_args(function_registry,info,args,report)) return std::unique_ptr<FunctionNode>();
   
   return std::unique_ptr<FunctionNode>(new FUNCTION(info.params(),args,info.iterations()));
@@ -158,7 +165,7 @@ std::unique_ptr<FunctionNode> FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,
 template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint CLASSIFICATION>
 std::unique_ptr<FUNCTION> FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,ITERATIVE,CLASSIFICATION>::typed_deepclone() const
 {
-  return std::unique_ptr<FUNCTION>(new FUNCTION(cloneparams(),*cloneargs(),iterations()));
+  return std::unique_ptr<FUNCTION>(new FUNCTION(cloneparams(),args(),iterations()));
 }
 
 template <typename FUNCTION,uint PARAMETERS,uint ARGUMENTS,bool ITERATIVE,uint CLASSIFICATION>
@@ -181,8 +188,8 @@ std::ostream& FunctionBoilerplate<FUNCTION,PARAMETERS,ARGUMENTS,ITERATIVE,CLASSI
   return Superclass::save_function(out,indent,thisname());
 }
 
-#define FN_CTOR_DCL(FN) FN(const std::vector<real>& p,boost::ptr_vector<FunctionNode>& a,uint iter);
-#define FN_CTOR_IMP(FN) FN::FN(const std::vector<real>& p,boost::ptr_vector<FunctionNode>& a,uint iter) :Superclass(p,a,iter) {}
+#define FN_CTOR_DCL(FN) FN(const std::vector<real>& p,const FunctionNode::Args& a,uint iter);
+#define FN_CTOR_IMP(FN) FN::FN(const std::vector<real>& p,const FunctionNode::Args& a,uint iter) :Superclass(p,a,iter) {}
 
 #define FN_DTOR_DCL(FN) virtual ~FN();
 #define FN_DTOR_IMP(FN) FN::~FN() {}
@@ -29,16 +29,13 @@
 #include "function_node_info.h"
 #include "function_registry.h"
 #include "margin.h"
+#include "memory_account.h"
 #include "mutation_parameters.h"
 
-std::unique_ptr<boost::ptr_vector<FunctionNode> > FunctionNode::cloneargs() const
+namespace
 {
-  std::unique_ptr<boost::ptr_vector<FunctionNode> > ret(new boost::ptr_vector<FunctionNode>());
-  for (boost::ptr_vector<FunctionNode>::const_iterator it=args().begin();it!=args().end();it++)
-    {
-      ret->push_back(it->deepclone().release());
-    }
-  return ret;
+  //! Memory held by function nodes (wherever they are: displayed, in the history, being mutated...).
+  MemoryAccount function_nodes("function nodes");
 }
 
 const std::vector<real> FunctionNode::cloneparams() const
@@ -56,7 +53,7 @@ void FunctionNode::get_stats(uint& total_nodes,uint& total_parameters,uint& dept
   real sub_constants=0.0;
 
   // Traverse child nodes.  Need to reconstruct the actual numbers from the proportions
-  for (boost::ptr_vector<FunctionNode>::const_iterator it=args().begin();it!=args().end();it++)
+  for (Args::const_iterator it=args().begin();it!=args().end();it++)
     {
       uint sub_nodes;
       uint sub_parameters;
@@ -64,7 +61,7 @@ void FunctionNode::get_stats(uint& total_nodes,uint& total_parameters,uint& dept
       uint sub_width;
       real sub_proportion_constant;
 
-      it->get_stats(sub_nodes,sub_parameters,sub_depth,sub_width,sub_proportion_constant);
+      (*it)->get_stats(sub_nodes,sub_parameters,sub_depth,sub_width,sub_proportion_constant);
 
       total_sub_nodes+=sub_nodes;
       total_sub_parameters+=sub_parameters;
@@ -145,15 +142,15 @@ bool FunctionNode::is_constant() const
 bool FunctionNode::ok() const
 {
   bool good=true;
-  for (boost::ptr_vector<FunctionNode>::const_iterator it=args().begin();good && it!=args().end();it++)
+  for (Args::const_iterator it=args().begin();good && it!=args().end();it++)
     {
-      good=(*it).ok();
+      good=(*it)->ok();
     }
   
   return good;
 }
 
-bool FunctionNode::create_args(const FunctionRegistry& function_registry,const FunctionNodeInfo& info,boost::ptr_vector<FunctionNode>& args,std::string& report)
+bool FunctionNode::create_args(const FunctionRegistry& function_registry,const FunctionNodeInfo& info,Args& args,std::string& report)
 {
   for (boost::ptr_vector<FunctionNodeInfo>::const_iterator it=info.args().begin();it!=info.args().end();it++)
     {
@@ -164,7 +161,7 @@ bool FunctionNode::create_args(const FunctionRegistry& function_registry,const F
 	  args.clear();
 	  return false;
 	}
-      args.push_back(fn.release());
+      args.push_back(boost::shared_ptr<FunctionNode>(fn.release()));
     }
   return true;
 }
@@ -176,11 +173,11 @@ std::unique_ptr<FunctionNode> FunctionNode::stub(const MutationParameters& param
 
 /*! This setus up a vector of random bits of stub, used for initialiing nodes with children. 
  */
-void FunctionNode::stubargs(boost::ptr_vector<FunctionNode>& v,const MutationParameters& parameters,uint n,bool exciting)
+void FunctionNode::stubargs(Args& v,const MutationParameters& parameters,uint n,bool exciting)
 {
   assert(v.empty());
   for (uint i=0;i<n;i++)
-    v.push_back(stub(parameters,exciting).release());
+    v.push_back(boost::shared_ptr<FunctionNode>(stub(parameters,exciting).release()));
 }
 
 void FunctionNode::stubparams(std::vector<real>& v,const MutationParameters& parameters,uint n)
@@ -195,11 +192,15 @@ uint FunctionNode::stubiterations(const MutationParameters& parameters)
   return 1+static_cast<uint>(floor(parameters.r01()*parameters.max_initial_iterations()));
 }
 
-FunctionNode::FunctionNode(const std::vector<real>& p,boost::ptr_vector<FunctionNode>& a,uint iter)
-  :_args(a.release())
+FunctionNode::FunctionNode(const std::vector<real>& p,const Args& a,uint iter)
+  :_args(a)
    ,_params(p)
    ,_iterations(iter)
-{}
+   ,_footprint(0)
+{
+  function_nodes.add(1,0);
+  account();
+}
 
 /*! Returns null ptr if there's a problem, in which case there will be an explanation in report.
  */
@@ -217,10 +218,22 @@ std::unique_ptr<FunctionNode> FunctionNode::create(const FunctionRegistry& funct
     }
 }
 
-/*! Deletes all arguments.  No one else should be referencing nodes except the root node of an image.
+/*! Arguments are deleted when no other tree is sharing them.
  */
 FunctionNode::~FunctionNode()
-{}
+{
+  function_nodes.add(-1,-static_cast<long long>(_footprint));
+}
+
+/*! Counts the node's own storage (as a plain FunctionNode; derived types add little) and its params' and args' vectors.
+  Args resized in place (by mutation) aren't recounted until they're next set.
+ */
+void FunctionNode::account()
+{
+  const uint footprint=sizeof(FunctionNode)+_params.capacity()*sizeof(real)+_args.capacity()*sizeof(Args::value_type);
+  function_nodes.add(0,static_cast<long long>(footprint)-_footprint);
+  _footprint=footprint;
+}
 
 /*! There are 2 kinds of mutation:
   - random adjustments to constants 
@@ -233,25 +246,73 @@ FunctionNode::~FunctionNode()
   - inserting new nodes between children and ourself
 
   And of course all children have to be mutated too.
+  Children only this node holds are mutated in place; shared ones are only copied if the mutation changes them (see mutated).
  */
 void FunctionNode::mutate(const MutationParameters& parameters,bool mutate_own_parameters)
 {
   // First mutate all child nodes.
-  for (boost::ptr_vector<FunctionNode>::iterator it=args().begin();it!=args().end();it++)
-    it->mutate(parameters);
-  
+  for (uint i=0;i<args().size();i++)
+    {
+      if (_args[i].unique())
+	{
+	  _args[i]->mutate(parameters);
+	}
+      else
+	{
+	  std::unique_ptr<FunctionNode> m(_args[i]->mutated(parameters));
+	  if (m) arg(i,boost::shared_ptr<FunctionNode>(m.release()));
+	}
+    }
+
+  std::vector<real> p(params());
+  Args a(args());
+  uint iterations=_iterations;
+  mutate_own(parameters,mutate_own_parameters,p,a,iterations);
+  if (p!=params()) params(p);
+  if (a!=args()) args(a);
+  _iterations=iterations;
+}
+
+/*! Draws the same random numbers as mutate would, so which of the two is used doesn't change the result.
+  The node is only copied once it's known to change, and unchanged arguments are shared with the copy.
+  Most nodes' parameters are perturbed whenever they're mutated, so this mainly keeps parameterless subtrees
+  which weren't glitched, substituted, shuffled or had anything inserted shared with the tree they came from.
+ */
+std::unique_ptr<FunctionNode> FunctionNode::mutated(const MutationParameters& parameters) const
+{
+  Args a(args());
+  for (uint i=0;i<a.size();i++)
+    {
+      std::unique_ptr<FunctionNode> m(a[i]->mutated(parameters));
+      if (m) a[i]=boost::shared_ptr<FunctionNode>(m.release());
+    }
+
+  std::vector<real> p(params());
+  uint iterations=_iterations;
+  mutate_own(parameters,true,p,a,iterations);
+  if (p==params() && a==args() && iterations==_iterations) return std::unique_ptr<FunctionNode>();
+
+  std::unique_ptr<FunctionNode> copy(deepclone());
+  copy->params(p);
+  copy->args(a);
+  copy->_iterations=iterations;
+  return copy;
+}
+
+void FunctionNode::mutate_own(const MutationParameters& parameters,bool mutate_own_parameters,std::vector<real>& params,Args& args,uint& iterations)
+{
   // Perturb any parameters we have
   if (mutate_own_parameters)
     {
       if (parameters.r01()<parameters.effective_probability_parameter_reset())
 	{
 	std::vector<real> p;
-	stubparams(p,parameters,params().size());
-	params(p);
+	stubparams(p,parameters,params.size());
+	params=p;
 	}
       else
 	{
-	  for (std::vector<real>::iterator it=params().begin();it!=params().end();it++)
+	  for (std::vector<real>::iterator it=params.begin();it!=params.end();it++)
 	    {
 	      (*it)+=parameters.effective_magnitude_parameter_variation()*(parameters.r01()<0.5 ? -parameters.rnegexp() : parameters.rnegexp());
 	    }
@@ -259,32 +320,32 @@ void FunctionNode::mutate(const MutationParameters& parameters,bool mutate_own_p
     }
 
   // Perturb iteration count if any
-  if (_iterations)
+  if (iterations)
     {
       if (parameters.r01()<parameters.effective_probability_iterations_change_step())
 	{
 	  if (parameters.r01()<0.5)
 	    {
-	      if (_iterations>=2) _iterations--;
+	      if (iterations>=2) iterations--;
 	    }
 	  else
 	    {
-	      _iterations++;
+	      iterations++;
 	    }
 	  if (parameters.r01()<parameters.effective_probability_iterations_change_jump())
 	    {
 	      if (parameters.r01()<0.5)
 		{
-		  if (_iterations>1) _iterations=(_iterations+1)/2;
+		  if (iterations>1) iterations=(iterations+1)/2;
 		}
 	      else
 		{
-		  _iterations*=2;
+		  iterations*=2;
 		}
 	    }
 	  
 	  // For safety but shouldn't happen
-	  if (_iterations==0) _iterations=1;
+	  if (iterations==0) iterations=1;
 	}
     }
       
@@ -292,41 +353,42 @@ void FunctionNode::mutate(const MutationParameters& parameters,bool mutate_own_p
   // Then go to work on the argument structure...
   
   // Think about glitching some nodes.
-  for (uint i=0;i<args().size();i++)
+  for (uint i=0;i<args.size();i++)
     {
       if (parameters.r01()<parameters.effective_probability_glitch())
 	{
-	  args().replace(i,stub(parameters,false).release());
+	  args[i]=boost::shared_ptr<FunctionNode>(stub(parameters,false).release());
 	}
     }
 
   // Think about substituting some nodes.
   //! \todo Substitution might make more sense if it was for a node with the same/similar number of arguments.
-  for (uint i=0;i<args().size();i++)
+  for (uint i=0;i<args.size();i++)
     {
       if (parameters.r01()<parameters.effective_probability_substitute())
 	{
-	  // Take a copy of the nodes parameters and arguments
-	  std::unique_ptr<boost::ptr_vector<FunctionNode> > a(args()[i].deepclone_args());
-	  std::vector<real> p(args()[i].params());
+	  // Take a copy of the nodes parameters and (shared) arguments
+	  Args a(args[i]->args());
+	  std::vector<real> p(args[i]->params());
 	  
 	  // Replace the node with something interesting (maybe this should depend on how complex the original node was)
-	  args().replace(i,stub(parameters,false).release());
+	  args[i]=boost::shared_ptr<FunctionNode>(stub(parameters,false).release());
 
-	  FunctionNode& it=args()[i];
+	  // The new node is held by nothing else, so can be modified in place.
+	  FunctionNode& it=*args[i];
 	  // Do we need some extra arguments ?
-	  if (a->size()<it.args().size())
+	  if (a.size()<it.args().size())
 	    {
-	      boost::ptr_vector<FunctionNode> xa;
-	      stubargs(xa,parameters,it.args().size()-a->size());
-	      a->transfer(a->end(),xa.begin(),xa.end(),xa);
+	      Args xa;
+	      stubargs(xa,parameters,it.args().size()-a.size());
+	      a.insert(a.end(),xa.begin(),xa.end());
 	    }
 	  // Shuffle them
-	  random_shuffle(*a,parameters.rng01());
+	  random_shuffle(a,parameters.rng01());
 	  // Have we got too many arguments ?
-	  while (a->size()>it.args().size())
+	  while (a.size()>it.args().size())
 	    {
-	      a->pop_back();
+	      a.pop_back();
 	    }
 	  
 	  // Do we need some extra parameters ?
@@ -345,62 +407,69 @@ void FunctionNode::mutate(const MutationParameters& parameters,bool mutate_own_p
 	    }
 
 	  // Impose the new parameters and arguments on the new node (iterations not touched)
-	  it.args(*a);
-	  it.params()=p;
+	  it.args(a);
+	  it.params(p);
 	}
     }
   
   // Think about randomising child order
   if (parameters.r01()<parameters.effective_probability_shuffle())
     {
-      random_shuffle(args(),parameters.rng01());
+      random_shuffle(args,parameters.rng01());
     }
 
   // Think about inserting a random stub between us and some subnodes
-  for (uint i=0;i<args().size();i++)
+  for (uint i=0;i<args.size();i++)
     {
       if (parameters.r01()<parameters.effective_probability_insert())
 	{
-	  boost::ptr_vector<FunctionNode> a;
-	  a.transfer(a.begin(),args().begin()+i,args());
-	  a.push_back(stub(parameters,false).release());
+	  Args a;
+	  a.push_back(args[i]);
+	  a.push_back(boost::shared_ptr<FunctionNode>(stub(parameters,false).release()));
 	  
 	  std::vector<real> p;
-	  args().insert(args().begin()+i,new FunctionComposePair(p,a,0));
+	  args[i]=boost::shared_ptr<FunctionNode>(new FunctionComposePair(p,a,0));
 	}
     }
 }
 
+//! Whether simplify_constants would change anything below the node.
+static bool has_constant_descendant(const FunctionNode& fn)
+{
+  for (FunctionNode::Args::const_iterator it=fn.args().begin();it!=fn.args().end();it++)
+    {
+      const FunctionNode& child=**it;
+      // Constant leaves are already as simple as they can be.
+      if (child.is_constant() ? !child.args().empty() : has_constant_descendant(child)) return true;
+    }
+  return false;
+}
+
+/*! Subtrees with nothing to simplify are left alone, so they remain shared with any other trees.
+ */
 void FunctionNode::simplify_constants() 
 {
   for (uint i=0;i<args().size();i++)
     {
-      if (args()[i].is_constant())
+      if (args()[i]->is_constant())
 	{
-	  const XYZ v(args()[i](XYZ(0.0,0.0,0.0)));
+	  if (args()[i]->args().empty()) continue;
+
+	  const XYZ v((*args()[i])(XYZ(0.0,0.0,0.0)));
 	  std::vector<real> vp;
 	  vp.push_back(v.x());
 	  vp.push_back(v.y());
 	  vp.push_back(v.z());
-	  boost::ptr_vector<FunctionNode> va;
-          std::unique_ptr<FunctionConstant> replacement(new FunctionConstant(vp,va,0));
-	  args().replace(i,replacement.release());
+	  Args va;
+	  arg(i,boost::shared_ptr<FunctionNode>(new FunctionConstant(vp,va,0)));
 	}
-      else
+      else if (has_constant_descendant(*args()[i]))
 	{
-	  args()[i].simplify_constants();
+	  arg(i).simplify_constants();
 	}
     }
 }
 
-std::unique_ptr<boost::ptr_vector<FunctionNode> > FunctionNode::deepclone_args() const
-{
-  std::unique_ptr<boost::ptr_vector<FunctionNode> > ret(new boost::ptr_vector<FunctionNode>());
-  for (boost::ptr_vector<FunctionNode>::const_iterator it=args().begin();it!=args().end();it++)
-    ret->push_back(it->deepclone().release());
-  return ret;
-}
-
 const FunctionTop* FunctionNode::is_a_FunctionTop() const
 {
   return 0;
@@ -428,9 +497,9 @@ std::ostream& FunctionNode::save_function(std::ostream& out,uint indent,const st
       out << Margin(indent+1) << "<p>" << (*it) << "</p>\n";
     }
 
-  for (boost::ptr_vector<FunctionNode>::const_iterator it=args().begin();it!=args().end();it++)
+  for (Args::const_iterator it=args().begin();it!=args().end();it++)
     {
-      (*it).save_function(out,indent+1);
+      (*it)->save_function(out,indent+1);
     }
 
   out << Margin(indent) << "</f>\n";  
@@ -59,19 +59,32 @@ class Function : boost::noncopyable
   //! This what distinguishes different types of function.
   virtual const XYZ evaluate(const XYZ&) const
     =0;
+
+  //! Index of the function's type in a FunctionProfile.
+  virtual uint profile_type() const
+    =0;
 };
 
 //! Abstract base class for all kinds of mutatable image node.
 /*! MutatableImage declared a friend to help constification of the public accessors.
+  Child nodes are reference counted and shared between trees (copy-on-write):
+  cloning a node copies only the node itself, and a shared child is only copied
+  when it's about to be modified through the non-const arg accessor.
+  So mutation copies just the paths from the root to the nodes it changes.
  */
 class FunctionNode : public Function
 {
  public:
   friend class MutatableImage;
 
+  //! Type for a node's arguments.
+  typedef std::vector<boost::shared_ptr<FunctionNode> > Args;
+
  private:
   //! The arguments (ie child nodes) for this node.
-  boost::ptr_vector<FunctionNode> _args;
+  /*! These may be shared with other trees, so must only be modified through the non-const arg accessor.
+   */
+  Args _args;
 
   //! The parameters (ie constant values) for this node.
   std::vector<real> _params;
@@ -81,10 +94,16 @@ class FunctionNode : public Function
    */
   uint _iterations;
 
- protected:
+  //! Bytes counted for this node in the function nodes' MemoryAccount.
+  uint _footprint;
+
+  //! Recount this node's memory after its params or args are replaced.
+  void account();
+
+  //! Apply the mutations of a node's own parameters, iteration count and argument structure (not its arguments themselves) to copies of them.
+  static void mutate_own(const MutationParameters& parameters,bool mutate_own_parameters,std::vector<real>& params,Args& args,uint& iterations);
 
-  //! This returns a deep-cloned copy of the node's children.
-  std::unique_ptr<boost::ptr_vector<FunctionNode> > cloneargs() const;
+ protected:
 
   //! This returns a copy of the node's parameters
   const std::vector<real> cloneparams() const;
@@ -102,7 +121,7 @@ class FunctionNode : public Function
   /*! Return true on success, false on fail with reasons in report string.
     Mainly for use by derived FunctionBoilerplate template to avoid duplicate code proliferation.
    */
-  static bool create_args(const FunctionRegistry&,const FunctionNodeInfo& info,boost::ptr_vector<FunctionNode>& args,std::string& report);
+  static bool create_args(const FunctionRegistry&,const FunctionNodeInfo& info,Args& args,std::string& report);
 
  public:
 
@@ -122,6 +141,10 @@ class FunctionNode : public Function
   virtual uint self_classification() const
     =0;
 
+  //! Accessor providing function name
+  virtual const char* thisname() const
+    =0;
+
   //@{
   //! Query the node as to whether it is a FunctionTop (return null if not).
   virtual const FunctionTop* is_a_FunctionTop() const;
@@ -135,15 +158,16 @@ class FunctionNode : public Function
   static void stubparams(std::vector<real>&,const MutationParameters& parameters,uint n);
 
   //! This returns a vector of new random bits of tree.
-  static void stubargs(boost::ptr_vector<FunctionNode>&,const MutationParameters& parameters,uint n,bool exciting=false);
+  static void stubargs(Args&,const MutationParameters& parameters,uint n,bool exciting=false);
 
   //! Return a suitable starting value for a node's iteration count (assuming it's iterative).
   static uint stubiterations(const MutationParameters& parameters);
 
   //! Constructor given an array of params and args and an iteration count.
   /*! These MUST be provided; there are no alterative constructors.
+    The arguments are shared, not copied.
    */
-  FunctionNode(const std::vector<real>& p,boost::ptr_vector<FunctionNode>& a,uint iter);
+  FunctionNode(const std::vector<real>& p,const Args& a,uint iter);
   
   //! Build a FunctionNode given a description
   static std::unique_ptr<FunctionNode> create(const FunctionRegistry& function_registry,const FunctionNodeInfo& info,std::string& report);
@@ -155,6 +179,7 @@ class FunctionNode : public Function
   void params(const std::vector<real>& p)
     {
       _params=p;
+      account();
     }
 
   //! Accessor.
@@ -177,36 +202,45 @@ class FunctionNode : public Function
     }
 
   //! Accessor.
-  const boost::ptr_vector<FunctionNode>& args() const
+  const Args& args() const
     {
       return _args;
     }
   
   //! Accessor.
-  void args(boost::ptr_vector<FunctionNode>& a)
+  void args(const Args& a)
     {
-      _args=a.release();
+      _args=a;
+      account();
+    }
+
+  //! Memory held by this node itself (not its arguments), as of its construction or params or args last being set.
+  uint footprint() const
+    {
+      return _footprint;
     }
 
   //! Accessor. 
   const FunctionNode& arg(uint n) const
     {
       assert(n<args().size());
-      return args()[n];
+      return *args()[n];
     }
 
   //! Scramble this node and its leaves up a bit.
   virtual void mutate(const MutationParameters&,bool mutate_own_parameters=true);
+
+  //! As mutate, but leaving this node alone: returns a mutated copy, or null if the mutation wouldn't change anything.
+  virtual std::unique_ptr<FunctionNode> mutated(const MutationParameters&) const;
   
-  //! Return an clone of this image node and all its children.
+  //! Return a clone of this image node, sharing its children.
+  /*! The clone behaves as an independent deep copy because children are copied on write.
+   */
   virtual std::unique_ptr<FunctionNode> deepclone() const
     =0;
 
   //! Prune any is_constant() nodes and replace them with an actual constant node
   virtual void simplify_constants();
-
-  //! Return a deepcloned copy of the node's arguments
-  virtual std::unique_ptr<boost::ptr_vector<FunctionNode> > deepclone_args() const;
   
   //! Save the function tree.
   virtual std::ostream& save_function(std::ostream& out,uint indent) const
@@ -217,23 +251,28 @@ class FunctionNode : public Function
   //! Save the function tree.  Common code needing a function name.
   std::ostream& save_function(std::ostream& out,uint indent,const std::string& function_name) const;
 
-  //! Accessor (non-const).
-  boost::ptr_vector<FunctionNode>& args()
-    {
-      return _args;
-    }
-
   //! Accessor (non-const).
   std::vector<real>& params()
     {
       return _params;
     }
 
-  //! Accessor. 
+  //! Accessor.  Copies the argument first if it's shared with another tree.
   FunctionNode& arg(uint n)
     {
       assert(n<args().size());
-      return args()[n];
+      if (!_args[n].unique()) _args[n]=boost::shared_ptr<FunctionNode>(_args[n]->deepclone().release());
+      return *_args[n];
+    }
+
+  //! Replace an argument.
+  /*! There's no non-const access to the arguments as a whole,
+    because the nodes they point to may be shared: modify them through the non-const arg.
+   */
+  void arg(uint n,const boost::shared_ptr<FunctionNode>& a)
+    {
+      assert(n<args().size());
+      _args[n]=a;
     }
  protected:
   //! @{
@@ -0,0 +1,150 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class FunctionProfile.
+*/
+
+#include "function_profile.h"
+
+std::atomic<bool> FunctionProfile::_enabled(false);
+
+namespace
+{
+  //! Guards the type names.
+  std::mutex type_names_mutex;
+
+  //! Names of the function types, by index.
+  std::vector<std::string>& type_names_by_index()
+  {
+    static std::vector<std::string> names;
+    return names;
+  }
+}
+
+FunctionProfile::FunctionProfile()
+  :_child_ns(0)
+  ,_evaluations(0)
+  ,_record_nodes(false)
+{}
+
+FunctionProfile::~FunctionProfile()
+{}
+
+/*! Called once per type (function types cache their index), so the lock doesn't matter.
+ */
+uint FunctionProfile::type_index(const char* name)
+{
+  std::lock_guard<std::mutex> lock(type_names_mutex);
+  std::vector<std::string>& names=type_names_by_index();
+  for (uint i=0;i<names.size();i++)
+    if (names[i]==name) return i;
+  if (names.size()==MaxTypes-1) names.push_back("(Others)");
+  if (names.size()==MaxTypes) return MaxTypes-1;
+  names.push_back(name);
+  return names.size()-1;
+}
+
+const std::vector<std::string> FunctionProfile::type_names()
+{
+  std::lock_guard<std::mutex> lock(type_names_mutex);
+  return type_names_by_index();
+}
+
+void FunctionProfile::accumulate(std::vector<Totals>& totals) const
+{
+  const uint types=type_names().size();
+  if (totals.size()<types) totals.resize(types);
+  for (uint i=0;i<types;i++)
+    {
+      totals[i].calls+=_counters[i].calls.load(std::memory_order_relaxed);
+      totals[i].inclusive_ns+=_counters[i].inclusive_ns.load(std::memory_order_relaxed);
+      totals[i].exclusive_ns+=_counters[i].exclusive_ns.load(std::memory_order_relaxed);
+    }
+}
+
+/*! From another thread, an evaluation in progress may still add to the cleared totals as it completes.
+  Node totals aren't cleared.
+ */
+void FunctionProfile::reset()
+{
+  for (uint i=0;i<MaxTypes;i++)
+    {
+      _counters[i].calls.store(0,std::memory_order_relaxed);
+      _counters[i].inclusive_ns.store(0,std::memory_order_relaxed);
+      _counters[i].exclusive_ns.store(0,std::memory_order_relaxed);
+    }
+}
+
+namespace
+{
+  //! Orders type indices by exclusive time, most first.
+  class MoreExclusive
+  {
+  public:
+    MoreExclusive(const std::vector<FunctionProfile::Totals>& totals)
+      :_totals(totals)
+      {}
+    bool operator()(uint a,uint b) const
+      {
+	return _totals[a].exclusive_ns>_totals[b].exclusive_ns;
+      }
+  private:
+    const std::vector<FunctionProfile::Totals>& _totals;
+  };
+}
+
+std::ostream& FunctionProfile::report(std::ostream& out,const std::vector<Totals>& totals)
+{
+  const std::vector<std::string> names(type_names());
+
+  std::vector<uint> order;
+  unsigned long long exclusive_ns=0;
+  for (uint i=0;i<totals.size() && i<names.size();i++)
+    if (totals[i].calls)
+      {
+	order.push_back(i);
+	exclusive_ns+=totals[i].exclusive_ns;
+      }
+  std::stable_sort(order.begin(),order.end(),MoreExclusive(totals));
+
+  std::ostringstream table;
+  table
+    << std::left << std::setw(40) << "function"
+    << std::right << std::setw(14) << "calls"
+    << std::setw(14) << "inclusive ms"
+    << std::setw(14) << "exclusive ms"
+    << std::setw(8) << "excl %"
+    << std::setw(10) << "ns/call"
+    << "\n";
+  table << std::fixed;
+  for (uint o=0;o<order.size();o++)
+    {
+      const Totals& t=totals[order[o]];
+      table
+	<< std::left << std::setw(40) << names[order[o]]
+	<< std::right << std::setw(14) << t.calls
+	<< std::setprecision(1) << std::setw(14) << t.inclusive_ns*1e-6
+	<< std::setw(14) << t.exclusive_ns*1e-6
+	<< std::setw(8) << (exclusive_ns ? (100.0*t.exclusive_ns)/exclusive_ns : 0.0)
+	<< std::setprecision(0) << std::setw(10) << static_cast<double>(t.exclusive_ns)/t.calls
+	<< "\n";
+    }
+  return out << table.str();
+}
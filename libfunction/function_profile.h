@@ -0,0 +1,242 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class FunctionProfile.
+*/
+
+#ifndef _function_profile_h_
+#define _function_profile_h_
+
+#include "useful.h"
+
+//! Counts and times evaluations of each function type on one thread.
+/*! While profiling is enabled, a compute thread renders from a copy of the image's tree built by FunctionProfiled::tree,
+  in which every node evaluated adds a call to the totals for its type,
+  with the time spent in it both including its arguments' evaluation (inclusive) and not (exclusive).
+  Recursion of a type within itself is only counted once in its inclusive time.
+  Totals are only written by the owning thread, and can be read (or reset) from any other without locking.
+  Optionally (and more slowly) totals are also kept for each node, for attributing time to parts of a particular tree.
+ */
+class FunctionProfile : boost::noncopyable
+{
+ private:
+
+  //! Totals for one function type, as written by the owning thread.
+  struct Counters;
+
+ public:
+
+  //! Most function types distinguished.  Any more share the last index.
+  enum {MaxTypes=256};
+
+  //! Totals for one function type.
+  struct Totals
+  {
+    //! Constructor.
+    Totals()
+      :calls(0)
+      ,inclusive_ns(0)
+      ,exclusive_ns(0)
+      {}
+
+    //! Number of evaluations.
+    unsigned long long calls;
+
+    //! Time in evaluations, including that of their arguments.
+    unsigned long long inclusive_ns;
+
+    //! Time in evaluations, excluding that of their arguments.
+    unsigned long long exclusive_ns;
+
+    //! Accumulate.
+    Totals& operator+=(const Totals& t)
+      {
+	calls+=t.calls;
+	inclusive_ns+=t.inclusive_ns;
+	exclusive_ns+=t.exclusive_ns;
+	return *this;
+      }
+  };
+
+  //! Constructor.
+  FunctionProfile();
+
+  //! Destructor.
+  ~FunctionProfile();
+
+  //! Whether compute threads should profile their renders.
+  static bool enabled()
+    {
+      return _enabled.load(std::memory_order_relaxed);
+    }
+
+  //! Enable or disable profiling (taking effect as compute threads start their next task).
+  static void enabled(bool v)
+    {
+      _enabled.store(v,std::memory_order_relaxed);
+    }
+
+  //! Index of a function type, allocated on first use.
+  static uint type_index(const char* name);
+
+  //! Names of the function types allocated indices so far.
+  static const std::vector<std::string> type_names();
+
+  //! Add this profile's totals for each type (indexed by type_index) to totals, extending it as necessary.
+  void accumulate(std::vector<Totals>& totals) const;
+
+  //! Clear the totals.
+  void reset();
+
+  //! Write a table of totals, most exclusive time first.
+  static std::ostream& report(std::ostream& out,const std::vector<Totals>& totals);
+
+  //! Whether totals are kept for each node as well as each type.
+  bool record_nodes() const
+    {
+      return _record_nodes;
+    }
+
+  //! Keep (or stop keeping) totals for each node as well as each type.
+  void record_nodes(bool v)
+    {
+      _record_nodes=v;
+    }
+
+  //! Totals for each node evaluated while recording nodes.
+  /*! Only for use by the owning thread (or once it has finished with the profile).
+   */
+  const std::map<const void*,Totals>& node_totals() const
+    {
+      return _node_totals;
+    }
+
+  //! Evaluations counted since the profile was constructed (not cleared by reset).
+  /*! Only for use by the owning thread, which can take differences to count the evaluations of some piece of work.
+   */
+  unsigned long long evaluations() const
+    {
+      return _evaluations;
+    }
+
+  //! Times an evaluation for the lifetime of the object.
+  class Call : boost::noncopyable
+  {
+  public:
+    //! Constructor.  The node is only used to identify it when recording nodes.
+    Call(FunctionProfile& profile,uint type,const void* node)
+      :_profile(profile)
+      ,_counters(profile._counters[type])
+      ,_node(node)
+      ,_outer_child_ns(profile._child_ns)
+      {
+	_profile._child_ns=0;
+	_profile._evaluations++;
+	_counters.depth++;
+	_start=std::chrono::steady_clock::now();
+      }
+
+    //! Destructor.
+    ~Call()
+      {
+	const unsigned long long ns=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_start).count();
+	const unsigned long long exclusive_ns=(ns>_profile._child_ns ? ns-_profile._child_ns : 0);
+	add(_counters.calls,1);
+	add(_counters.exclusive_ns,exclusive_ns);
+	if (--_counters.depth==0) add(_counters.inclusive_ns,ns);
+	if (_profile._record_nodes)
+	  {
+	    Totals& node=_profile._node_totals[_node];
+	    node.calls++;
+	    node.inclusive_ns+=ns;
+	    node.exclusive_ns+=exclusive_ns;
+	  }
+	_profile._child_ns=_outer_child_ns+ns;
+      }
+
+  private:
+    //! Add to a counter only ever written by this thread.
+    static void add(std::atomic<unsigned long long>& counter,unsigned long long n)
+      {
+	counter.store(counter.load(std::memory_order_relaxed)+n,std::memory_order_relaxed);
+      }
+
+    //! The profile added to.
+    FunctionProfile& _profile;
+
+    //! The counters for the function type.
+    Counters& _counters;
+
+    //! The node evaluated.
+    const void*const _node;
+
+    //! Time in the arguments of the enclosing evaluation before this one started.
+    const unsigned long long _outer_child_ns;
+
+    //! When the evaluation started.
+    std::chrono::steady_clock::time_point _start;
+  };
+
+ private:
+
+  //! Totals for one function type, as written by the owning thread.
+  struct Counters : boost::noncopyable
+  {
+    //! Constructor.
+    Counters()
+      :calls(0)
+      ,inclusive_ns(0)
+      ,exclusive_ns(0)
+      ,depth(0)
+      {}
+
+    //! Number of evaluations.
+    std::atomic<unsigned long long> calls;
+
+    //! Time in evaluations, including their arguments.
+    std::atomic<unsigned long long> inclusive_ns;
+
+    //! Time in evaluations, excluding their arguments.
+    std::atomic<unsigned long long> exclusive_ns;
+
+    //! Evaluations of the type in progress (only used by the owning thread).
+    uint depth;
+  };
+
+  //! Counters for each function type.
+  boost::array<Counters,MaxTypes> _counters;
+
+  //! Time spent so far in arguments of the evaluation in progress.
+  unsigned long long _child_ns;
+
+  //! Evaluations counted by the owning thread.
+  unsigned long long _evaluations;
+
+  //! Whether totals are kept for each node.
+  bool _record_nodes;
+
+  //! Totals for each node.
+  std::map<const void*,Totals> _node_totals;
+
+  //! Whether profiling is enabled.
+  static std::atomic<bool> _enabled;
+};
+
+#endif
@@ -0,0 +1,80 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class FunctionProfiled.
+*/
+
+#include "function_profiled.h"
+
+/*! Nodes appearing more than once in the tree are copied (and counted) separately.
+ */
+boost::shared_ptr<FunctionNode> FunctionProfiled::tree(const boost::shared_ptr<const FunctionNode>& node,FunctionProfile& profile)
+{
+  std::unique_ptr<FunctionNode> copy(node->deepclone());
+  if (!node->args().empty())
+    {
+      Args args;
+      for (Args::const_iterator it=node->args().begin();it!=node->args().end();it++)
+	args.push_back(tree(*it,profile));
+      copy->args(args);
+    }
+  return boost::shared_ptr<FunctionNode>(new FunctionProfiled(profile,node,boost::shared_ptr<const FunctionNode>(copy.release())));
+}
+
+FunctionProfiled::FunctionProfiled(FunctionProfile& profile,const boost::shared_ptr<const FunctionNode>& original,const boost::shared_ptr<const FunctionNode>& copy)
+  :FunctionNode(std::vector<real>(),Args(),0)
+  ,_profile(profile)
+  ,_original(original)
+  ,_copy(copy)
+  ,_type(copy->profile_type())
+{}
+
+FunctionProfiled::~FunctionProfiled()
+{}
+
+uint FunctionProfiled::profile_type() const
+{
+  return _type;
+}
+
+uint FunctionProfiled::self_classification() const
+{
+  return _copy->self_classification();
+}
+
+const char* FunctionProfiled::thisname() const
+{
+  return _copy->thisname();
+}
+
+bool FunctionProfiled::is_constant() const
+{
+  return _copy->is_constant();
+}
+
+std::unique_ptr<FunctionNode> FunctionProfiled::deepclone() const
+{
+  return std::unique_ptr<FunctionNode>(new FunctionProfiled(_profile,_original,_copy));
+}
+
+std::ostream& FunctionProfiled::save_function(std::ostream& out,uint indent) const
+{
+  return _copy->save_function(out,indent);
+}
@@ -0,0 +1,91 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class FunctionProfiled.
+*/
+
+#ifndef _function_profiled_h_
+#define _function_profiled_h_
+
+#include "useful.h"
+
+#include "function_node.h"
+#include "function_profile.h"
+
+//! Node timing the evaluation of another through a FunctionProfile.
+/*! Profiling is kept off the normal evaluation path: rather than every node checking for a profile,
+  a profiled render evaluates a copy of the tree (built by tree) in which each node is wrapped by one of these.
+  The copies' arguments are the wrapped copies of the original's arguments, so every evaluation below is counted too.
+  Evaluations are recorded against the original node (for per-node totals), which is kept alive by the wrapper.
+ */
+class FunctionProfiled : public FunctionNode
+{
+ public:
+
+  //! Return a profiled copy of a node and everything below it.
+  static boost::shared_ptr<FunctionNode> tree(const boost::shared_ptr<const FunctionNode>& node,FunctionProfile& profile);
+
+  //! Constructor.
+  FunctionProfiled(FunctionProfile& profile,const boost::shared_ptr<const FunctionNode>& original,const boost::shared_ptr<const FunctionNode>& copy);
+
+  //! Destructor.
+  virtual ~FunctionProfiled();
+
+  //! Evaluate the copy, timing it.
+  virtual const XYZ evaluate(const XYZ& p) const
+    {
+      const FunctionProfile::Call call(_profile,_type,static_cast<const Function*>(_original.get()));
+      return (*_copy)(p);
+    }
+
+  //! The wrapped node's type.
+  virtual uint profile_type() const;
+
+  //! The wrapped node's classification.
+  virtual uint self_classification() const;
+
+  //! The wrapped node's name.
+  virtual const char* thisname() const;
+
+  //! Whether the wrapped node is constant.
+  virtual bool is_constant() const;
+
+  //! Another wrapper for the same copy.
+  virtual std::unique_ptr<FunctionNode> deepclone() const;
+
+  //! Save the wrapped node.
+  virtual std::ostream& save_function(std::ostream& out,uint indent) const;
+
+ private:
+
+  //! The profile evaluations are added to.
+  FunctionProfile& _profile;
+
+  //! The node in the original tree, which identifies it in per-node totals.
+  const boost::shared_ptr<const FunctionNode> _original;
+
+  //! Copy of the original node evaluated, with profiled arguments.
+  const boost::shared_ptr<const FunctionNode> _copy;
+
+  //! Cached profile_type() of the wrapped node.
+  const uint _type;
+};
+
+#endif
@@ -29,10 +29,23 @@
 
 const XYZ FunctionTop::evaluate(const XYZ& p) const
 {
-  const Transform space_transform(params(),0);
+  return colour(precolour(p));
+}
+
+const XYZ FunctionTop::precolour(const XYZ& p) const
+{
+  return precolour(p,pretransform());
+}
+
+const XYZ FunctionTop::precolour(const XYZ& p,const Transform& space_transform) const
+{
   const XYZ sp(space_transform.transformed(p)); 
   const XYZ v(arg(0)(sp));
-  const XYZ tv(tanh(0.5*v.x()),tanh(0.5*v.y()),tanh(0.5*v.z()));
+  return XYZ(tanh(0.5*v.x()),tanh(0.5*v.y()),tanh(0.5*v.z()));
+}
+
+const XYZ FunctionTop::colour(const XYZ& tv) const
+{
   // ...each component of tv is in [-1,1] so the transform parameters define a rhomboid in colour space.
   const Transform colour_transform(params(),12);
   return colour_transform.transformed(tv);
@@ -65,8 +78,8 @@ std::unique_ptr<FunctionTop> FunctionTop::initial(const MutationParameters& para
   
   assert(fn->ok());
   
-  boost::ptr_vector<FunctionNode> a;
-  a.push_back(fn.release());
+  Args a;
+  a.push_back(boost::shared_ptr<FunctionNode>(fn.release()));
 
   const TransformIdentity ti;
   std::vector<real> tiv=ti.get_columns();
@@ -116,12 +129,33 @@ void FunctionTop::mutate(const MutationParameters& parameters,bool mutate_own_pa
     }
 }
 
+/*! The transforms are perturbed (or reset) by every mutation, so there's nothing to gain by checking for changes before copying.
+  The copy's children are still shared, so they're only copied if they change.
+ */
+std::unique_ptr<FunctionNode> FunctionTop::mutated(const MutationParameters& parameters) const
+{
+  std::unique_ptr<FunctionNode> copy(deepclone());
+  copy->mutate(parameters);
+  return copy;
+}
+
 void FunctionTop::concatenate_pretransform_on_right(const Transform& transform)
 {
   Transform current_transform(params(),0);
   current_transform.concatenate_on_right(transform);
+  pretransform(current_transform);
+}
+
+const Transform FunctionTop::pretransform() const
+{
+  return Transform(params(),0);
+}
+
+void FunctionTop::pretransform(const Transform& transform)
+{
+  const std::vector<real> columns(transform.get_columns());
   for (uint i=0;i<12;i++)
-    params()[i]=current_transform.get_columns()[i];
+    params()[i]=columns[i];
 }
 
 const Transform FunctionTop::interesting_pretransform(const MutationParameters& parameters,const real k)
@@ -44,6 +44,17 @@ public:
 
   virtual const XYZ evaluate(const XYZ& p) const;
 
+  //! The value at p before the colour transform is applied (each component in [-1,1]).
+  const XYZ precolour(const XYZ& p) const;
+
+  //! As precolour, but using the given space transform in place of the node's own pre-transform parameters.
+  const XYZ precolour(const XYZ& p,const Transform& space_transform) const;
+
+  //! Apply the colour transform to a precolour value.
+  /*! This is affine, so it commutes with averaging of multiple samples.
+   */
+  const XYZ colour(const XYZ& tv) const;
+
   virtual FunctionTop* is_a_FunctionTop()
   {
       return this;
@@ -57,8 +68,17 @@ public:
   //! Overridden so transform and colours don't keep changing
   virtual void mutate(const MutationParameters& parameters,bool mutate_own_parameters=true);
 
+  //! Overridden to go through our mutate.
+  virtual std::unique_ptr<FunctionNode> mutated(const MutationParameters& parameters) const;
+
   virtual void concatenate_pretransform_on_right(const Transform& transform);
 
+  //! The pre-transform defined by the first 12 parameters.
+  const Transform pretransform() const;
+
+  //! Replace the pre-transform parameters.
+  void pretransform(const Transform& transform);
+
   virtual void mutate_pretransform_parameters(const MutationParameters& parameters);
   virtual void reset_pretransform_parameters(const MutationParameters& parameters);
   virtual void mutate_posttransform_parameters(const MutationParameters& parameters);
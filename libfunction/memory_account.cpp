@@ -0,0 +1,104 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Implementation of class MemoryAccount.
+*/
+
+#include "memory_account.h"
+
+const MemoryAccount* MemoryAccount::_first=0;
+
+/*! Accounts are constructed during static initialisation, before any threads could be updating the list.
+ */
+MemoryAccount::MemoryAccount(const char* name,const char* part_of)
+  :_name(name)
+  ,_part_of(part_of)
+  ,_objects(0)
+  ,_bytes(0)
+  ,_next(_first)
+{
+  _first=this;
+}
+
+/*! In order of construction (i.e of linking, which is arbitrary but at least stable).
+ */
+const std::vector<const MemoryAccount*> MemoryAccount::accounts()
+{
+  std::vector<const MemoryAccount*> ret;
+  for (const MemoryAccount* it=_first;it;it=it->_next)
+    ret.push_back(it);
+  std::reverse(ret.begin(),ret.end());
+  return ret;
+}
+
+/*! Parts of accounts aren't added to the total again.
+ */
+std::ostream& MemoryAccount::report(std::ostream& out)
+{
+  const std::vector<const MemoryAccount*> all(accounts());
+
+  std::vector<const MemoryAccount*> ordered;
+  size_t width=5;
+  for (uint i=0;i<all.size();i++)
+    if (!all[i]->part_of())
+      {
+	ordered.push_back(all[i]);
+	width=std::max(width,strlen(all[i]->name()));
+	for (uint j=0;j<all.size();j++)
+	  if (all[j]->part_of() && strcmp(all[j]->part_of(),all[i]->name())==0)
+	    {
+	      ordered.push_back(all[j]);
+	      width=std::max(width,strlen(all[j]->name())+2);
+	    }
+      }
+
+  long long total=0;
+  out << std::setw(width) << "" << std::setw(10) << "Objects" << std::setw(14) << "Memory" << "\n";
+  out << std::fixed << std::setprecision(1);
+  for (uint i=0;i<ordered.size();i++)
+    {
+      const MemoryAccount& account=*ordered[i];
+      const std::string name(account.part_of() ? std::string("  ")+account.name() : std::string(account.name()));
+      out
+	<< std::left << std::setw(width) << name << std::right
+	<< std::setw(10) << account.objects() << " "
+	<< std::setw(10) << account.bytes()/1048576.0 << " MB\n";
+      if (!account.part_of()) total+=account.bytes();
+    }
+  out
+    << std::left << std::setw(width) << "Total" << std::right
+    << std::setw(11) << " "
+    << std::setw(10) << total/1048576.0 << " MB\n";
+  return out;
+}
+
+std::ostream& MemoryAccount::json(std::ostream& out)
+{
+  const std::vector<const MemoryAccount*> all(accounts());
+
+  out << "{";
+  for (uint i=0;i<all.size();i++)
+    out
+      << (i ? "," : "")
+      << "\"" << all[i]->name() << "\":{\"objects\":" << all[i]->objects() << ",\"bytes\":" << all[i]->bytes()
+      << (all[i]->part_of() ? std::string(",\"part_of\":\"")+all[i]->part_of()+"\"" : std::string())
+      << "}";
+  return out << "}";
+}
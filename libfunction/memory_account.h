@@ -0,0 +1,158 @@
+/**************************************************************************/
+/*  Copyright 2012 Tim Day                                                */
+/*                                                                        */
+/*  This file is part of Evolvotron                                       */
+/*                                                                        */
+/*  Evolvotron is free software: you can redistribute it and/or modify    */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation, either version 3 of the License, or     */
+/*  (at your option) any later version.                                   */
+/*                                                                        */
+/*  Evolvotron is distributed in the hope that it will be useful,         */
+/*  but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/*  GNU General Public License for more details.                          */
+/*                                                                        */
+/*  You should have received a copy of the GNU General Public License     */
+/*  along with Evolvotron.  If not, see <http://www.gnu.org/licenses/>.   */
+/**************************************************************************/
+
+/*! \file
+  \brief Interface for class MemoryAccount.
+*/
+
+#ifndef _memory_account_h_
+#define _memory_account_h_
+
+#include "useful.h"
+
+//! Counts the objects of one kind alive in the process, and the memory they hold.
+/*! Accounts are static objects, one for each kind of object accounted for (function nodes, task buffers...),
+  which link themselves into a list on construction so that all of them can be reported.
+  Counts are updated atomically so objects can come and go on any thread.
+  Bytes are those of the objects' main allocations (not allocator overheads or anything shared),
+  so totals are an attribution of where memory has gone rather than an exact process size.
+  Some accounts are set from time to time (by whatever knows what to count) rather than kept up to date.
+ */
+class MemoryAccount : boost::noncopyable
+{
+ public:
+
+  //! Constructor.  Only for static accounts, as they're never unlinked.
+  /*! An account may count some of the objects (or memory) already counted by another, named by part_of.
+   */
+  MemoryAccount(const char* name,const char* part_of=0);
+
+  //! Name of the kind of object.
+  const char* name() const
+    {
+      return _name;
+    }
+
+  //! Name of the account this is part of (null if none).
+  const char* part_of() const
+    {
+      return _part_of;
+    }
+
+  //! Count objects (negative to uncount them).
+  void add(long long objects,long long bytes)
+    {
+      _objects.fetch_add(objects,std::memory_order_relaxed);
+      _bytes.fetch_add(bytes,std::memory_order_relaxed);
+    }
+
+  //! Replace the counts.
+  void set(long long objects,long long bytes)
+    {
+      _objects.store(objects,std::memory_order_relaxed);
+      _bytes.store(bytes,std::memory_order_relaxed);
+    }
+
+  //! Objects counted.
+  long long objects() const
+    {
+      return _objects.load(std::memory_order_relaxed);
+    }
+
+  //! Bytes counted.
+  long long bytes() const
+    {
+      return _bytes.load(std::memory_order_relaxed);
+    }
+
+  //! The part of an account due to one object, withdrawn when the object is destroyed.
+  class Holding : boost::noncopyable
+  {
+  public:
+    //! Constructor.  Holds nothing yet.
+    Holding(MemoryAccount& account)
+      :_account(account)
+      ,_objects(0)
+      ,_bytes(0)
+      {}
+
+    //! Destructor.
+    ~Holding()
+      {
+	_account.add(-_objects,-_bytes);
+      }
+
+    //! Count more (or, if negative, fewer) objects.
+    void add(long long objects,long long bytes)
+      {
+	_account.add(objects,bytes);
+	_objects+=objects;
+	_bytes+=bytes;
+      }
+
+    //! Replace what's held.
+    void set(long long objects,long long bytes)
+      {
+	add(objects-_objects,bytes-_bytes);
+      }
+
+  private:
+    //! The account.
+    MemoryAccount& _account;
+
+    //! Objects held.
+    long long _objects;
+
+    //! Bytes held.
+    long long _bytes;
+  };
+
+  //! All the accounts in the process.
+  static const std::vector<const MemoryAccount*> accounts();
+
+  //! Write a table of the accounts (each followed by any parts of it) and their total.
+  static std::ostream& report(std::ostream& out);
+
+  //! Write the accounts as a JSON object, keyed by name.
+  static std::ostream& json(std::ostream& out);
+
+ private:
+
+  //! Name of the kind of object.
+  const char*const _name;
+
+  //! Name of the account this is part of (null if none).
+  const char*const _part_of;
+
+  //! Objects counted.
+  std::atomic<long long> _objects;
+
+  //! Bytes counted.
+  std::atomic<long long> _bytes;
+
+  //! Next account in the list.
+  const MemoryAccount* _next;
+
+  //! Most recently constructed account.
+  /*! A pointer is zero-initialised before any account's constructor runs, whatever the order of static initialisation.
+   */
+  static const MemoryAccount* _first;
+};
+
+#endif
@@ -44,6 +44,12 @@ MutationParameters::MutationParameters(uint seed,bool ac,bool debug_mode)
 MutationParameters::~MutationParameters()
 {}
 
+void MutationParameters::seed(uint s)
+{
+  _r01.seed(s);
+  _r_negexp.seed(s);
+}
+
 void MutationParameters::reset()
 {
   _autocool_enable=_autocool_reset_state;
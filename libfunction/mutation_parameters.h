@@ -133,6 +133,11 @@ class MutationParameters
   //! Reset to initial values.
   void reset();
 
+  //! Restart the random number generators from a new seed (other parameters are unchanged).
+  /*! The results of a mutation then depend only on the seed, whatever was done before.
+   */
+  void seed(uint s);
+
   //! Multiply most parameters by the given factor
   void general_cool(real f);
 
@@ -39,3 +39,11 @@ double Random01::operator()()
 {
   return _gen();
 }
+
+/*! The generator holds its own copy of the engine, so that's the one reseeded.
+ */
+void Random01::seed(uint s)
+{
+  _gen.engine().seed(s);
+  _gen.distribution().reset();
+}
@@ -58,6 +58,9 @@ public:
   
   //! Return next number in sequence.
   virtual double operator()();
+
+  //! Restart the sequence from a new seed.
+  void seed(uint s);
 private:
 
   //! Base generator
@@ -98,6 +101,12 @@ public:
     {
       return -_mean*log(1.0-_generator());
     }  
+
+  //! Restart the sequence from a new seed.
+  void seed(uint s)
+    {
+      _generator.seed(s);
+    }
 };
 
 template <typename T> void random_shuffle(boost::ptr_vector<T>& v,Random01& r01)
@@ -111,6 +120,19 @@ template <typename T> void random_shuffle(boost::ptr_vector<T>& v,Random01& r01)
   v.transfer(v.end(),nv.begin(),nv.end(),nv);
 }
 
+//! Shuffle shared pointers the same way as a ptr_vector (so random sequences are unchanged).
+template <typename T> void random_shuffle(std::vector<boost::shared_ptr<T> >& v,Random01& r01)
+{
+  std::vector<boost::shared_ptr<T> > nv;
+  while (!v.empty())
+    {
+      const uint n=static_cast<uint>(r01()*v.size());
+      nv.push_back(v[n]);
+      v.erase(v.begin()+n);
+    }
+  v.swap(nv);
+}
+
 //! Adapter to use our random number generator to feed std::random_shuffle
 class RandomInt
 {
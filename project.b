@@ -7,8 +7,8 @@ sources_cpp: func [path /local it] [
 application: does [
     include_from [%libfunction %libevolvotron]
     libs_from %. [%evolvotron %function]
-    unix  [libs %boost_program_options]
-    win32 [libs %boost_program_options-x64]
+    unix  [libs [%boost_program_options %z]]
+    win32 [libs [%boost_program_options-x64 %zlib]]
     qt [widgets]
 ]
 
@@ -35,7 +35,23 @@ exe %evolv_mutate [
     sources_cpp %evolvotron_mutate
 ]
 
+exe %evolv_evolve [
+    application
+    sources_cpp %evolvotron_evolve
+]
+
+exe %evolv_serve [
+    application
+    qt [network]
+    sources_cpp %evolvotron_serve
+]
+
 exe %evolv_render [
     application
     sources_cpp %evolvotron_render
 ]
+
+exe %evolv_bench [
+    application
+    sources_cpp %evolvotron_bench
+]